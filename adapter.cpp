@@ -28,12 +28,24 @@
 #include <Python.h>
 #include <inttypes.h>
 #include <libcec/cec.h>
+#include <algorithm>
+#include <condition_variable>
 #include <list>
+#include <map>
 #include <stdlib.h>
+#include <system_error>
+#include <thread>
 
 #include "cec.h"
 #include "adapter.h"
+#include "broker.h"
+#include "detect.h"
 #include "device.h"
+#include "module.h"
+#include "opcodes.h"
+#include "pool.h"
+#include "probes.h"
+#include "volume.h"
 
 using namespace CEC;
 
@@ -61,33 +73,176 @@ static PyObject * make_bound_method_args(PyObject * self, PyObject * args) {
     return result;
 }
 
-static PyObject * trigger_event(void * param, long int event, PyObject * args) {
-    Adapter * self = (Adapter *)param;
+// Callback registry
+
+void CallbackStats::record(double elapsed, bool failed, bool overrun) {
+    uint64_t ns = elapsed > 0 ? (uint64_t)(elapsed * 1e9) : 0;
+    calls.fetch_add(1, std::memory_order_relaxed);
+    total_ns.fetch_add(ns, std::memory_order_relaxed);
+    uint64_t max = max_ns.load(std::memory_order_relaxed);
+    while (ns > max && !max_ns.compare_exchange_weak(max, ns,
+                std::memory_order_relaxed)) {
+    }
+    if (failed) {
+        exceptions.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (overrun) {
+        overruns.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void CallbackStats::reset() {
+    calls.store(0);
+    exceptions.store(0);
+    overruns.store(0);
+    total_ns.store(0);
+    max_ns.store(0);
+}
+
+void CallbackList::add(long int events, PyObject * cb) {
+    std::lock_guard<std::mutex> guard(lock);
+    callbacks.push_back(Callback(events, cb));
+}
+
+void CallbackList::remove(PyObject * cb, long int events) {
+    std::vector<PyObject *> removed;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for (std::list<Callback>::iterator itr = callbacks.begin(); itr != callbacks.end(); ) {
+            if (itr->cb == cb) {
+                // clear out the given events for this callback
+                itr->event &= ~(events);
+                if (itr->event == 0) {
+                    // if this callback has no events, remove it
+                    removed.push_back(itr->cb);
+                    itr = callbacks.erase(itr);
+                    continue;
+                }
+            }
+            ++itr;
+        }
+    }
+    // outside the lock, releasing a callback may run arbitrary code
+    for (size_t i=0; i<removed.size(); i++) {
+        Py_DECREF(removed[i]);
+    }
+}
+
+void CallbackList::clear() {
+    std::list<Callback> removed;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        removed.swap(callbacks);
+    }
+    for (std::list<Callback>::iterator itr = removed.begin(); itr != removed.end(); ++itr) {
+        Py_DECREF(itr->cb);
+    }
+}
+
+bool CallbackList::wants(long int event) {
+    std::lock_guard<std::mutex> guard(lock);
+    for (std::list<Callback>::const_iterator itr = callbacks.begin();
+            itr != callbacks.end(); ++itr) {
+        if (itr->event & event) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void CallbackList::matching(long int event, std::vector<Callback> & out) {
+    std::lock_guard<std::mutex> guard(lock);
+    for (std::list<Callback>::const_iterator itr = callbacks.begin();
+            itr != callbacks.end(); ++itr) {
+        if (itr->event & event) {
+            Py_INCREF(itr->cb);
+            out.push_back(*itr);
+        }
+    }
+}
+
+void CallbackList::snapshot(std::vector<Callback> & out) {
+    matching(EVENT_ALL, out);
+}
+
+// module.qualname of a callback, or its repr
+static PyObject * callback_name(PyObject * cb) {
+    PyObject * qualname = PyObject_GetAttrString(cb, "__qualname__");
+    if (!qualname || !PyUnicode_Check(qualname)) {
+        Py_XDECREF(qualname);
+        PyErr_Clear();
+        return PyObject_Repr(cb);
+    }
+    PyObject * module = PyObject_GetAttrString(cb, "__module__");
+    PyObject * name;
+    if (module && PyUnicode_Check(module)) {
+        name = PyUnicode_FromFormat("%U.%U", module, qualname);
+    } else {
+        PyErr_Clear();
+        Py_INCREF(qualname);
+        name = qualname;
+    }
+    Py_XDECREF(module);
+    Py_DECREF(qualname);
+    return name;
+}
+
+// warn that cb ran over budget, keeping any exception it raised
+static void report_overrun(PyObject * cb, double elapsed, double budget) {
+    PyObject * type, * value, * traceback;
+    PyErr_Fetch(&type, &value, &traceback);
+    PyObject * name = callback_name(cb);
+    if (name) {
+        char times[64];
+        snprintf(times, sizeof(times), "%.3fs, over the %.3fs budget",
+                elapsed, budget);
+        if (PyErr_WarnFormat(PyExc_RuntimeWarning, 1,
+                "cec callback %U took %s", name, times) < 0) {
+            PyErr_WriteUnraisable(cb);
+        }
+        Py_DECREF(name);
+    } else {
+        PyErr_WriteUnraisable(cb);
+    }
+    PyErr_Restore(type, value, traceback);
+}
+
+PyObject * trigger_callbacks(CallbackList & callbacks, long int event, PyObject * args) {
     assert(event & EVENT_ALL);
     Py_INCREF(Py_None);
     PyObject * result = Py_None;
 
     //debug("Triggering event %ld\n", event);
 
-    int i=0;
-    for (cb_list::const_iterator itr = self->callbacks.begin();
-            itr != self->callbacks.end();
-            ++itr) {
-        //debug("Checking callback %d with events %ld\n", i, itr->event);
-        if (itr->event & event) {
+    double budget = callbacks.budget();
+    std::vector<Callback> matched;
+    callbacks.matching(event, matched);
+    for (size_t i=0; i<matched.size(); i++) {
+        PyObject * cb = matched[i].cb;
+        if (result) {
             //debug("Calling callback %d\n", i);
-            PyObject * callback = itr->cb;
+            PyObject * callback = cb;
             PyObject * arguments = args;
-            if ( PyMethod_Check(itr->cb)) {
-                callback = PyMethod_Function(itr->cb);
-                PyObject * self = PyMethod_Self(itr->cb);
+            if ( PyMethod_Check(cb)) {
+                callback = PyMethod_Function(cb);
+                PyObject * self = PyMethod_Self(cb);
                 if( self ) {
                 // bound method, prepend self/cls to argument tuple
                 arguments = make_bound_method_args(self, args);
                 }
             }
             // see also: PyObject_CallFunction(...) which can take C args
+            CEC_PROBE2(handler__entry, event, cb);
+            double start = monotonic_time();
             PyObject * temp = PyObject_CallObject(callback, arguments);
+            double elapsed = monotonic_time() - start;
+            CEC_PROBE4(handler__return, event, cb, (uint64_t)(elapsed * 1e9),
+                    temp == NULL);
+            bool overrun = budget > 0 && elapsed > budget;
+            matched[i].stats->record(elapsed, !temp, overrun);
+            if (overrun) {
+                report_overrun(cb, elapsed, budget);
+            }
             if (arguments != args) {
                 Py_XDECREF(arguments);
             }
@@ -97,15 +252,166 @@ static PyObject * trigger_event(void * param, long int event, PyObject * args) {
             } else {
                 debug("Callback failed\n");
                 Py_DECREF(Py_None);
-                return NULL;
+                result = NULL;
             }
         }
-        i++;
+        Py_DECREF(cb);
     }
 
     return result;
 }
 
+static PyObject * trigger_event(void * param, long int event, PyObject * args) {
+    Adapter * self = (Adapter *)param;
+    return trigger_callbacks(self->callbacks, event, args);
+}
+
+// Event delivery
+
+static PyObject * convert_cmd(const cec_command* cmd) {
+#if PY_MAJOR_VERSION >= 3
+    return Py_BuildValue("{sBsBsOsOsBsy#sOsi}",
+#else
+    return Py_BuildValue("{sBsBsOsOsBss#sOsi}",
+#endif
+            "initiator", cmd->initiator,
+            "destination", cmd->destination,
+            "ack", cmd->ack ? Py_True : Py_False,
+            "eom", cmd->eom ? Py_True : Py_False,
+            "opcode", cmd->opcode,
+            "parameters", cmd->parameters.data, cmd->parameters.size,
+            "opcode_set", cmd->opcode_set ? Py_True : Py_False,
+            "transmit_timeout", cmd->transmit_timeout);
+    }
+
+PyObject * event_args(const Event & event) {
+    switch (event.type) {
+        case EVENT_LOG: {
+            // decode message ignoring invalid characters
+            PyObject * umsg = PyUnicode_DecodeASCII(event.message.data(),
+                    event.message.size(), "ignore");
+            if (!umsg) {
+                return NULL;
+            }
+            return Py_BuildValue("(iilN)", EVENT_LOG,
+                    event.level,
+                    event.time,
+                    umsg);
+        }
+        case EVENT_KEYPRESS:
+            return Py_BuildValue("(iBI)", EVENT_KEYPRESS,
+                    event.keycode,
+                    event.duration);
+        case EVENT_COMMAND:
+            return Py_BuildValue("(iO&)", EVENT_COMMAND, convert_cmd, &event.command);
+        case EVENT_ALERT: {
+            PyObject * param = Py_None;
+            if (event.has_param) {
+                param = Py_BuildValue("s", event.param.c_str());
+            } else {
+                Py_INCREF(param);
+            }
+            return Py_BuildValue("(iiN)", EVENT_ALERT, event.alert, param);
+        }
+        case EVENT_MENU_CHANGED:
+            return Py_BuildValue("(ii)", EVENT_MENU_CHANGED, event.menu);
+        case EVENT_ACTIVATED:
+            return Py_BuildValue("(iOi)", EVENT_ACTIVATED,
+                    event.active ? Py_True : Py_False,
+                    event.address);
+        case EVENT_POWER_CHANGE:
+            return Py_BuildValue("(iiii)", EVENT_POWER_CHANGE, event.address,
+                    event.old_status, event.status);
+        case EVENT_DEVICE_ADDED:
+        case EVENT_DEVICE_REMOVED:
+            return Py_BuildValue("(li)", event.type, event.address);
+        case EVENT_CONFIG_CHANGE: {
+            PyObject * fields = convert_config(*event.config, event.changed);
+            if (!fields) {
+                return NULL;
+            }
+            return Py_BuildValue("(iN)", EVENT_CONFIG_CHANGE, fields);
+        }
+    }
+    PyErr_SetString(PyExc_ValueError, "Unknown event");
+    return NULL;
+}
+
+void deliver_event(Adapter * self, const Event & event) {
+    bool trace = self->latency.enabled();
+    PyObject * args = event_args(event);
+    if (args && trace && self->latency.attach()) {
+        PyObject * times = Py_BuildValue("((ddd))", event.received,
+                event.acquired, monotonic_time());
+        PyObject * traced = times ? PySequence_Concat(args, times) : NULL;
+        Py_XDECREF(times);
+        Py_DECREF(args);
+        args = traced;
+    }
+    if (args) {
+        double dispatched = trace ? monotonic_time() : 0;
+        trigger_event(self, event.type, args);
+        Py_DECREF(args);
+        if (trace) {
+            self->latency.record(event.type, event.received, event.acquired,
+                    dispatched, monotonic_time());
+        }
+    }
+}
+
+static bool is_monitor(Adapter * self) {
+#if HAVE_CEC_MONITOR_ONLY
+    return self->config.bMonitorOnly;
+#else
+    return false;
+#endif
+}
+
+// Called from libcec and native threads without the GIL. Native handlers run
+// first, here; pooled adapters then hand the event to the pool's dispatcher
+// instead of taking the GIL here.
+static void emit_event(Adapter * self, Event & event) {
+    std::shared_ptr<Broker> broker = std::atomic_load(&self->broker);
+    if (broker) {
+        broker->publish(event);
+    }
+    if (self->handlers.dispatch(self, event)) {
+        return;
+    }
+    if (self->sink) {
+        self->sink->push(self, event);
+        return;
+    }
+    uint64_t waited = probe_time();
+    uint64_t acquired;
+    {
+        InterpreterLock gil(self->interp);
+        event.acquired = monotonic_time();
+        acquired = probe_time();
+        CEC_PROBE2(gil__acquire, event.type, acquired - waited);
+        deliver_event(self, event);
+        if (PyErr_Occurred()) {
+            PyErr_Print();
+        }
+    }
+    CEC_PROBE2(gil__release, event.type, probe_time() - acquired);
+}
+
+// fires callback__entry, and callback__return when it goes out of scope
+class CallbackProbe {
+    public:
+        CallbackProbe(long int type) : type(type), start(probe_time()) {
+            CEC_PROBE1(callback__entry, type);
+        }
+        ~CallbackProbe() {
+            CEC_PROBE2(callback__return, type, probe_time() - start);
+        }
+
+    private:
+        long int type;
+        uint64_t start;
+};
+
 // CEC callback implementations
 
 #if CEC_LIB_VERSION_MAJOR >= 4
@@ -113,30 +419,19 @@ static void log_cb(void * self, const cec_log_message* message) {
 #else
 static int log_cb(void * self, const cec_log_message message) {
 #endif
+    CallbackProbe probe(EVENT_LOG);
     debug("got log callback\n");
-    PyGILState_STATE gstate;
-    gstate = PyGILState_Ensure();
+    Event event(EVENT_LOG);
 #if CEC_LIB_VERSION_MAJOR >= 4
-    int level = message->level;
-    long int time = message->time;
-    const char * msg = message->message;
+    event.level = message->level;
+    event.time = message->time;
+    event.message = message->message;
 #else
-    int level = message.level;
-    long int time = message.time;
-    const char* msg = message.message;
+    event.level = message.level;
+    event.time = message.time;
+    event.message = message.message;
 #endif
-    // decode message ignoring invalid characters
-    PyObject * umsg = PyUnicode_DecodeASCII(msg, strlen(msg), "ignore");
-    PyObject * args = Py_BuildValue("(iilO)", EVENT_LOG,
-            level,
-            time,
-            umsg);
-    if (args) {
-        trigger_event(self, EVENT_LOG, args);
-        Py_DECREF(args);
-    }
-    Py_XDECREF(umsg);
-    PyGILState_Release(gstate);
+    emit_event((Adapter *)self, event);
 #if CEC_LIB_VERSION_MAJOR >= 4
     return;
 #else
@@ -150,24 +445,17 @@ static int log_cb(void * self, const cec_log_message message) {
 #else
     static int keypress_cb(void * self, const cec_keypress key) {
 #endif
+    CallbackProbe probe(EVENT_KEYPRESS);
     debug("got keypress callback\n");
-    PyGILState_STATE gstate;
-    gstate = PyGILState_Ensure();
+    Event event(EVENT_KEYPRESS);
 #if CEC_LIB_VERSION_MAJOR >= 4
-    cec_user_control_code keycode = key->keycode;
-    unsigned int duration = key->duration;
+    event.keycode = key->keycode;
+    event.duration = key->duration;
 #else
-    cec_user_control_code keycode = key.keycode;
-    unsigned int duration = key.duration;
+    event.keycode = key.keycode;
+    event.duration = key.duration;
 #endif
-    PyObject * args = Py_BuildValue("(iBI)", EVENT_KEYPRESS,
-            keycode,
-            duration);
-    if( args ) {
-        trigger_event(self, EVENT_KEYPRESS, args);
-        Py_DECREF(args);
-    }
-    PyGILState_Release(gstate);
+    emit_event((Adapter *)self, event);
 #if CEC_LIB_VERSION_MAJOR >= 4
     return;
 #else
@@ -175,41 +463,54 @@ static int log_cb(void * self, const cec_log_message message) {
 #endif
 }
 
-static PyObject * convert_cmd(const cec_command* cmd) {
-#if PY_MAJOR_VERSION >= 3
-    return Py_BuildValue("{sBsBsOsOsBsy#sOsi}",
-#else
-    return Py_BuildValue("{sBsBsOsOsBss#sOsi}",
-#endif
-            "initiator", cmd->initiator,
-            "destination", cmd->destination,
-            "ack", cmd->ack ? Py_True : Py_False,
-            "eom", cmd->eom ? Py_True : Py_False,
-            "opcode", cmd->opcode,
-            "parameters", cmd->parameters.data, cmd->parameters.size,
-            "opcode_set", cmd->opcode_set ? Py_True : Py_False,
-            "transmit_timeout", cmd->transmit_timeout);
-    }
-
 #if CEC_LIB_VERSION_MAJOR >= 4
 static void command_cb(void * self, const cec_command* command) {
 #else
 static int command_cb(void * self, const cec_command command) {
 #endif
+    CallbackProbe probe(EVENT_COMMAND);
     debug("got command callback\n");
-    PyGILState_STATE gstate;
-    gstate = PyGILState_Ensure();
 #if CEC_LIB_VERSION_MAJOR >= 4
     const cec_command * cmd = command;
 #else
     const cec_command * cmd = &command;
 #endif
-    PyObject * args = Py_BuildValue("(iO&)", EVENT_COMMAND, convert_cmd, cmd);
-    if( args ) {
-        trigger_event(self, EVENT_COMMAND, args);
-        Py_DECREF(args);
+    CEC_PROBE3(command__receive, cmd->initiator, cmd->destination, cmd->opcode);
+    if (((Adapter *)self)->state.observe(*cmd) && ((Adapter *)self)->poller) {
+        ((Adapter *)self)->poller->notify();
+    }
+    ((Adapter *)self)->topology.observe(*cmd);
+    if (((Adapter *)self)->presence) {
+        ((Adapter *)self)->presence->observe(*cmd);
+    }
+    std::shared_ptr<MetadataCache> metadata = std::atomic_load(&((Adapter *)self)->metadata);
+    if (metadata) {
+        metadata->observe(*cmd);
+    }
+    std::shared_ptr<HistoryStore> history = std::atomic_load(&((Adapter *)self)->history);
+    if (history) {
+        history->add(*cmd, HISTORY_RECEIVED);
+    }
+    if (((Adapter *)self)->capture) {
+        ((Adapter *)self)->capture->add(*cmd, HISTORY_RECEIVED);
+    }
+    cec_command reply;
+    bool send = false;
+    bool consumed = false;
+    // a monitor stays passive, rules would answer on its behalf
+    if (!is_monitor((Adapter *)self)) {
+        consumed = ((Adapter *)self)->rules.process(*cmd, reply, send);
+    }
+    if (send) {
+        // a single attempt, backing off here would hold up every event
+        RetryPolicy once;
+        adapter_transmit((Adapter *)self, reply, &once);
+    }
+    if (!consumed) {
+        Event event(EVENT_COMMAND);
+        event.command = *cmd;
+        emit_event((Adapter *)self, event);
     }
-    PyGILState_Release(gstate);
 #if CEC_LIB_VERSION_MAJOR >= 4
     return;
 #else
@@ -218,26 +519,21 @@ static int command_cb(void * self, const cec_command command) {
 }
 
 #if CEC_LIB_VERSION_MAJOR >= 4
-static void config_cb(void * self, const libcec_configuration*) {
+static void config_cb(void * self, const libcec_configuration* config) {
 #else
-static int config_cb(void * self, const libcec_configuration) {
+static int config_cb(void * self, const libcec_configuration config_arg) {
+    const libcec_configuration * config = &config_arg;
 #endif
+    CallbackProbe probe(EVENT_CONFIG_CHANGE);
     debug("got config callback\n");
-    PyGILState_STATE gstate;
-    gstate = PyGILState_Ensure();
-    // TODO: figure out how to pass these as parameters
-    // yeah... right.
-    //  we'll probably have to come up with some functions for converting the
-    //  libcec_configuration class into a python Object
-    //  this will probably be _lots_ of work and should probably wait until
-    //  a later release, or when it becomes necessary.
-    PyObject * args = Py_BuildValue("(i)", EVENT_CONFIG_CHANGE);
-    if (args) {
-        // don't bother triggering an event until we can actually pass arguments
-        //trigger_event(self, EVENT_CONFIG_CHANGE, args);
-        Py_DECREF(args);
+    uint32_t changed = ((Adapter *)self)->reported.update(*config);
+    ((Adapter *)self)->state.set_own_addresses(config->logicalAddresses);
+    if (changed) {
+        Event event(EVENT_CONFIG_CHANGE);
+        event.config = std::make_shared<const libcec_configuration>(*config);
+        event.changed = changed;
+        emit_event((Adapter *)self, event);
     }
-    PyGILState_Release(gstate);
 #if CEC_LIB_VERSION_MAJOR >= 4
     return;
 #else
@@ -250,21 +546,18 @@ static void alert_cb(void * self, const libcec_alert alert, const libcec_paramet
 #else
 static int alert_cb(void * self, const libcec_alert alert, const libcec_parameter p) {
 #endif
+    CallbackProbe probe(EVENT_ALERT);
     debug("got alert callback\n");
-    PyGILState_STATE gstate;
-    gstate = PyGILState_Ensure();
-    PyObject * param = Py_None;
-    if ( p.paramType == CEC_PARAMETER_TYPE_STRING) {
-        param = Py_BuildValue("s", p.paramData);
-    } else {
-        Py_INCREF(param);
+    if (alert == CEC_ALERT_CONNECTION_LOST && ((Adapter *)self)->reconnector) {
+        ((Adapter *)self)->reconnector->connection_lost();
     }
-    PyObject * args = Py_BuildValue("(iiN)", EVENT_ALERT, alert, param);
-    if (args) {
-        trigger_event(self, EVENT_ALERT, args);
-        Py_DECREF(args);
+    Event event(EVENT_ALERT);
+    event.alert = alert;
+    if ( p.paramType == CEC_PARAMETER_TYPE_STRING) {
+        event.has_param = true;
+        event.param = (const char *)p.paramData;
     }
-    PyGILState_Release(gstate);
+    emit_event((Adapter *)self, event);
 #if CEC_LIB_VERSION_MAJOR >= 4
     return;
 #else
@@ -273,63 +566,105 @@ static int alert_cb(void * self, const libcec_alert alert, const libcec_paramete
 }
 
 static int menu_cb(void * self, const cec_menu_state menu) {
+    CallbackProbe probe(EVENT_MENU_CHANGED);
     debug("got menu callback\n");
-    PyGILState_STATE gstate;
-    gstate = PyGILState_Ensure();
-    PyObject * args = Py_BuildValue("(ii)", EVENT_MENU_CHANGED, menu);
-    if (args) {
-        trigger_event(self, EVENT_MENU_CHANGED, args);
-        Py_DECREF(args);
-    }
-    PyGILState_Release(gstate);
+    Event event(EVENT_MENU_CHANGED);
+    event.menu = menu;
+    emit_event((Adapter *)self, event);
     return 1;
 }
 
 static void activated_cb(void * self, const cec_logical_address logical_address,
         const uint8_t state) {
+    CallbackProbe probe(EVENT_ACTIVATED);
     debug("got activated callback\n");
-    PyGILState_STATE gstate;
-    gstate = PyGILState_Ensure();
-    PyObject * active = (state == 1) ? Py_True : Py_False;
-    PyObject * args = Py_BuildValue("(iOi)", EVENT_ACTIVATED, active,
-        logical_address);
-    if (args) {
-        trigger_event(self, EVENT_ACTIVATED, args);
-        Py_DECREF(args);
-    }
-    PyGILState_Release(gstate);
+    ((Adapter *)self)->state.observe_activated(logical_address, state == 1);
+    Event event(EVENT_ACTIVATED);
+    event.address = logical_address;
+    event.active = state == 1;
+    emit_event((Adapter *)self, event);
     return;
 }
 
+void trigger_power_change(Adapter * self, cec_logical_address addr,
+        cec_power_status old, cec_power_status status) {
+    debug("power change %d: %d -> %d\n", addr, old, status);
+    Event event(EVENT_POWER_CHANGE);
+    event.address = addr;
+    event.old_status = old;
+    event.status = status;
+    emit_event(self, event);
+}
+
+void trigger_presence_change(Adapter * self, cec_logical_address addr,
+        bool present) {
+    debug("device %d %s\n", addr, present ? "added" : "removed");
+    if (!present) {
+        // a device that comes back announces its physical address again
+        self->topology.remove(addr);
+    }
+    Event event(present ? EVENT_DEVICE_ADDED : EVENT_DEVICE_REMOVED);
+    event.address = addr;
+    emit_event(self, event);
+}
+
+uint16_t active_devices(Adapter * self) {
+    // the presence tracker already knows, without scanning the bus
+    if (self->presence && self->presence->tracking()) {
+        return self->presence->present();
+    }
+    ICECAdapter * cec = self->adapter;
+    if (!cec) {
+        return 0;
+    }
+    uint16_t present = 0;
+    cec_logical_addresses devices = cec->GetActiveDevices();
+    for (uint8_t i=0; i<16; i++) {
+        if (devices[i]) {
+            present |= (uint16_t)(1 << i);
+        }
+    }
+    return present;
+}
+
 // Python methods
 
 static PyObject * list_devices(Adapter * self, PyObject * args) {
-    PyObject * result = NULL;
-
     if (!PyArg_ParseTuple(args, ":list_devices")) {
         return NULL;
     }
+    ModuleState * module = type_state(Py_TYPE(self));
+    if (!module) {
+        return NULL;
+    }
 
-    cec_logical_addresses devices;
+    uint16_t present;
     Py_BEGIN_ALLOW_THREADS
-    devices = self->adapter->GetActiveDevices();
+    present = active_devices(self);
     Py_END_ALLOW_THREADS
 
-    result = PyDict_New();
-    for (uint8_t i=0; i<32; i++) {
-        if (devices[i]) {
-            PyObject * ii = Py_BuildValue("Ob", self, i);
-            PyObject * dev = PyObject_CallObject((PyObject *)DeviceType(), ii);
-
-            Py_DECREF(ii);
-            if (dev) {
-                PyDict_SetItem(result, Py_BuildValue("b", i), dev);
-            } else {
-                Py_DECREF(result);
-                PyErr_SetString(PyExc_ValueError, "Failed to create Device object");
-                result = NULL;
-                break;
-            }
+    PyObject * result = PyDict_New();
+    if (!result) {
+        return NULL;
+    }
+    for (uint8_t i=0; i<16; i++) {
+        if (!(present & (1 << i))) {
+            continue;
+        }
+        PyObject * dev = PyObject_CallFunction((PyObject *)module->device_type,
+                "Ob", self, i);
+        if (!dev) {
+            Py_DECREF(result);
+            PyErr_SetString(PyExc_ValueError, "Failed to create Device object");
+            return NULL;
+        }
+        PyObject * key = PyLong_FromLong(i);
+        int failed = !key || PyDict_SetItem(result, key, dev) < 0;
+        Py_XDECREF(key);
+        Py_DECREF(dev);
+        if (failed) {
+            Py_DECREF(result);
+            return NULL;
         }
     }
 
@@ -339,8 +674,27 @@ static PyObject * list_devices(Adapter * self, PyObject * args) {
 static PyObject * adapter_close(Adapter * self, PyObject * args) {
     if (self->adapter != NULL) {
         Py_BEGIN_ALLOW_THREADS
+        {
+            std::lock_guard<std::mutex> guard(self->lock);
+            if (self->reconnector) {
+                self->reconnector->stop();
+            }
+            if (self->poller) {
+                self->poller->stop();
+            }
+            if (self->presence) {
+                self->presence->stop();
+            }
+            // refreshes query the bus through self->adapter
+            std::shared_ptr<MetadataCache> metadata = std::atomic_exchange(
+                    &self->metadata, std::shared_ptr<MetadataCache>());
+            if (metadata) {
+                metadata->stop();
+            }
+        }
         self->adapter->Close();
         self->adapter = NULL;
+        self->topology.clear();
         Py_END_ALLOW_THREADS
     }
 
@@ -348,11 +702,11 @@ static PyObject * adapter_close(Adapter * self, PyObject * args) {
     return Py_None;
 }
 
-static PyObject * add_callback(Adapter * self, PyObject * args) {
+PyObject * add_callback_to(CallbackList & callbacks, PyObject * args) {
     PyObject * callback;
     long int events = EVENT_ALL; // default to all events
 
-    if (!PyArg_ParseTuple(args, "O|i:add_callback", &callback, &events)) {
+    if (!PyArg_ParseTuple(args, "O|l:add_callback", &callback, &events)) {
         return NULL;
     }
     // check that event is one of the allowed events
@@ -366,102 +720,767 @@ static PyObject * add_callback(Adapter * self, PyObject * args) {
     }
 
     Py_INCREF(callback);
-    Callback new_cb(events, callback);
-
     debug("Adding callback for event %ld\n", events);
-    self->callbacks.push_back(new_cb);
+    callbacks.add(events, callback);
 
     Py_INCREF(Py_None);
     return Py_None;
 }
 
-static PyObject * remove_callback(Adapter * self, PyObject * args) {
+PyObject * remove_callback_from(CallbackList & callbacks, PyObject * args) {
     PyObject * callback;
     Py_ssize_t events = EVENT_ALL; // default to all events
 
-    if (PyArg_ParseTuple(args, "O|i:remove_callback", &callback, &events)) {
-        for (cb_list::iterator itr = self->callbacks.begin(); itr != self->callbacks.end(); ++itr ) {
-            if (itr->cb == callback) {
-                // clear out the given events for this callback
-                itr->event &= ~(events);
-                if (itr->event == 0) {
-                    // if this callback has no events, remove it
-                    itr = self->callbacks.erase(itr);
-                    Py_DECREF(callback);
-                }
-            }
-        }
+    if (PyArg_ParseTuple(args, "O|n:remove_callback", &callback, &events)) {
+        callbacks.remove(callback, events);
     }
     Py_INCREF(Py_None);
     return Py_None;
 }
 
-static PyObject * transmit(Adapter * self, PyObject * args) {
-    unsigned char initiator = 'g';
-    unsigned char destination;
-    unsigned char opcode;
-    const char * params = NULL;
-    Py_ssize_t param_count = 0;
+static PyObject * add_callback(Adapter * self, PyObject * args) {
+    return add_callback_to(self->callbacks, args);
+}
 
-    if (PyArg_ParseTuple(args, "bb|s#b:transmit", &destination, &opcode,
-            &params, &param_count, &initiator)) {
-        if (destination < 0 || destination > 15) {
-            PyErr_SetString(PyExc_ValueError, "Logical address must be between 0 and 15");
-            return NULL;
-        }
-        if (initiator != 'g') {
-            if( initiator < 0 || initiator > 15 ) {
-                PyErr_SetString(PyExc_ValueError, "Logical address must be between 0 and 15");
-                return NULL;
+static PyObject * remove_callback(Adapter * self, PyObject * args) {
+    return remove_callback_from(self->callbacks, args);
+}
+
+PyObject * callback_stats_from(CallbackList & callbacks, bool reset) {
+    std::vector<Callback> registered;
+    callbacks.snapshot(registered);
+    PyObject * result = PyList_New(0);
+    for (size_t i=0; i<registered.size(); i++) {
+        PyObject * cb = registered[i].cb;
+        if (result) {
+            CallbackStats & stats = *registered[i].stats;
+            uint64_t calls = stats.calls.load();
+            double total = stats.total_ns.load() / 1e9;
+            PyObject * entry = Py_BuildValue("{sOsNslsKsKsKsdsdsd}",
+                    "callback", cb,
+                    "name", callback_name(cb),
+                    "events", registered[i].event,
+                    "calls", (unsigned long long)calls,
+                    "exceptions", (unsigned long long)stats.exceptions.load(),
+                    "overruns", (unsigned long long)stats.overruns.load(),
+                    "total", total,
+                    "mean", calls ? total / calls : 0.0,
+                    "max", stats.max_ns.load() / 1e9);
+            if (!entry || PyList_Append(result, entry) < 0) {
+                Py_CLEAR(result);
             }
-        } else {
-            initiator = self->adapter->GetLogicalAddresses().primary;
-        }
-        if (param_count > CEC_MAX_DATA_PACKET_SIZE) {
-            char errstr[1024];
-            snprintf(errstr, 1024, "Too many parameters, maximum is %d",
-                CEC_MAX_DATA_PACKET_SIZE);
-            PyErr_SetString(PyExc_ValueError, errstr);
-            return NULL;
-        }
-        cec_command data;
-        bool success;
-        Py_BEGIN_ALLOW_THREADS
-        data.initiator = (cec_logical_address)initiator;
-        data.destination = (cec_logical_address)destination;
-        data.opcode = (cec_opcode)opcode;
-        data.opcode_set = 1;
-        if (params) {
-            for (Py_ssize_t i=0; i<param_count; i++) {
-                data.PushBack(((uint8_t *)params)[i]);
+            Py_XDECREF(entry);
+            if (result && reset) {
+                stats.reset();
             }
         }
-        success = self->adapter->Transmit(data);
-        Py_END_ALLOW_THREADS
-        RETURN_BOOL(success);
+        Py_DECREF(cb);
     }
+    return result;
+}
 
-    return NULL;
+static PyObject * callback_stats(Adapter * self, PyObject * args, PyObject * kwargs) {
+    int reset = 0;
+    static const char * keywords[] = { "reset", NULL };
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|p:callback_stats",
+            (char **)keywords, &reset)) {
+        return NULL;
+    }
+    return callback_stats_from(self->callbacks, reset);
 }
 
-static PyObject * is_active_source(Adapter * self, PyObject * args) {
-    unsigned char addr;
+static PyObject * set_callback_budget(Adapter * self, PyObject * args) {
+    PyObject * arg;
 
-    if (PyArg_ParseTuple(args, "b:is_active_source", &addr)) {
-        if (addr < 0 || addr > 15) {
-            PyErr_SetString(PyExc_ValueError, "Logical address must be between 0 and 15");
+    if (!PyArg_ParseTuple(args, "O:set_callback_budget", &arg)) {
+        return NULL;
+    }
+    double budget = 0;
+    if (arg != Py_None) {
+        budget = PyFloat_AsDouble(arg);
+        if (budget == -1 && PyErr_Occurred()) {
+            return NULL;
+        }
+        if (budget < 0) {
+            PyErr_SetString(PyExc_ValueError, "Budget must not be negative");
             return NULL;
-        } else {
-            RETURN_BOOL(self->adapter->IsActiveSource((cec_logical_address)addr));
         }
     }
-    return NULL;
+    self->callbacks.set_budget(budget);
+    Py_RETURN_NONE;
 }
 
-static PyObject * set_active_source(Adapter * self, PyObject * args) {
-    unsigned char devtype = (unsigned char)CEC_DEVICE_TYPE_RESERVED;
+static PyObject * trace_latency(Adapter * self, PyObject * args, PyObject * kwargs) {
+    int enable = 1;
+    int attach = 0;
+    static const char * keywords[] = { "enable", "attach", NULL };
 
-    if (PyArg_ParseTuple(args, "|b:set_active_source", &devtype)) {
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|pp:trace_latency",
+            (char **)keywords, &enable, &attach)) {
+        return NULL;
+    }
+    self->latency.enable(enable, attach);
+    Py_RETURN_NONE;
+}
+
+static PyObject * latency_stats(Adapter * self, PyObject * args, PyObject * kwargs) {
+    int reset = 0;
+    static const char * keywords[] = { "reset", NULL };
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|p:latency_stats",
+            (char **)keywords, &reset)) {
+        return NULL;
+    }
+    return self->latency.convert(reset);
+}
+
+static PyObject * add_handler(Adapter * self, PyObject * args) {
+    PyObject * capsule;
+
+    if (!PyArg_ParseTuple(args, "O:add_handler", &capsule)) {
+        return NULL;
+    }
+    if (self->handlers.add(capsule) < 0) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject * remove_handler(Adapter * self, PyObject * args) {
+    PyObject * capsule;
+
+    if (!PyArg_ParseTuple(args, "O:remove_handler", &capsule)) {
+        return NULL;
+    }
+    self->handlers.remove(capsule);
+    Py_RETURN_NONE;
+}
+
+static PyObject * add_rule(Adapter * self, PyObject * args, PyObject * kwargs) {
+    PyObject * match;
+    Rule rule;
+    int mirror = 0;
+    int reply_to_sender = 0;
+    static const char * keywords[] = { "match", "reply", "rate_limit", "mirror",
+        "reply_to_sender", NULL };
+
+    rule.rate_limit = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO&|dpp:add_rule",
+            (char **)keywords, &match, convert_command_arg, &rule.reply,
+            &rule.rate_limit, &mirror, &reply_to_sender)) {
+        return NULL;
+    }
+    if (rule.rate_limit < 0) {
+        PyErr_SetString(PyExc_ValueError, "rate_limit must not be negative");
+        return NULL;
+    }
+    if (convert_rule_match(match, rule) < 0) {
+        return NULL;
+    }
+    rule.mirror = mirror;
+    rule.reply_to_sender = reply_to_sender;
+
+    long id;
+    Py_BEGIN_ALLOW_THREADS
+    id = self->rules.add(rule);
+    Py_END_ALLOW_THREADS
+    return PyLong_FromLong(id);
+}
+
+static PyObject * remove_rule(Adapter * self, PyObject * args) {
+    long id;
+
+    if (!PyArg_ParseTuple(args, "l:remove_rule", &id)) {
+        return NULL;
+    }
+    RETURN_BOOL(self->rules.remove(id));
+}
+
+static PyObject * rules(Adapter * self, PyObject * args) {
+    if (!PyArg_ParseTuple(args, ":rules")) {
+        return NULL;
+    }
+    std::vector<Rule> snapshot;
+    Py_BEGIN_ALLOW_THREADS
+    snapshot = self->rules.snapshot();
+    Py_END_ALLOW_THREADS
+    return convert_rules(snapshot);
+}
+
+static PyObject * transmit(Adapter * self, PyObject * args, PyObject * kwargs) {
+    unsigned char initiator = 'g';
+    unsigned char destination;
+    unsigned char opcode;
+    const char * params = NULL;
+    Py_ssize_t param_count = 0;
+    PyObject * attempts = NULL;
+    PyObject * backoff = NULL;
+    PyObject * retry_on = NULL;
+    static const char * keywords[] = { "destination", "opcode", "parameters",
+        "initiator", "attempts", "backoff", "retry_on", NULL };
+
+    if (PyArg_ParseTupleAndKeywords(args, kwargs, "bb|s#bOOO:transmit",
+            (char **)keywords, &destination, &opcode, &params, &param_count,
+            &initiator, &attempts, &backoff, &retry_on)) {
+        if (destination < 0 || destination > 15) {
+            PyErr_SetString(PyExc_ValueError, "Logical address must be between 0 and 15");
+            return NULL;
+        }
+        if (initiator != 'g') {
+            if( initiator < 0 || initiator > 15 ) {
+                PyErr_SetString(PyExc_ValueError, "Logical address must be between 0 and 15");
+                return NULL;
+            }
+        } else {
+            initiator = self->adapter->GetLogicalAddresses().primary;
+        }
+        if (param_count > CEC_MAX_DATA_PACKET_SIZE) {
+            char errstr[1024];
+            snprintf(errstr, 1024, "Too many parameters, maximum is %d",
+                CEC_MAX_DATA_PACKET_SIZE);
+            PyErr_SetString(PyExc_ValueError, errstr);
+            return NULL;
+        }
+        RetryPolicy policy;
+        Py_BEGIN_ALLOW_THREADS
+        policy = self->retry.policy();
+        Py_END_ALLOW_THREADS
+        if (retry_policy_args(policy, attempts, backoff, NULL, NULL, retry_on) < 0) {
+            return NULL;
+        }
+        cec_command data;
+        TransmitResult result;
+        Py_BEGIN_ALLOW_THREADS
+        data.initiator = (cec_logical_address)initiator;
+        data.destination = (cec_logical_address)destination;
+        data.opcode = (cec_opcode)opcode;
+        data.opcode_set = 1;
+        if (params) {
+            for (Py_ssize_t i=0; i<param_count; i++) {
+                data.PushBack(((uint8_t *)params)[i]);
+            }
+        }
+        adapter_transmit(self, data, &policy, &result);
+        Py_END_ALLOW_THREADS
+        return transmit_result((PyObject *)self, self->spare_result, result);
+    }
+
+    return NULL;
+}
+
+static PyObject * set_retry_policy(Adapter * self, PyObject * args, PyObject * kwargs) {
+    PyObject * attempts = NULL;
+    PyObject * backoff = NULL;
+    PyObject * max_backoff = NULL;
+    PyObject * jitter = NULL;
+    PyObject * retry_on = NULL;
+    static const char * keywords[] = { "attempts", "backoff", "max_backoff",
+        "jitter", "retry_on", NULL };
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|OOOOO:set_retry_policy",
+            (char **)keywords, &attempts, &backoff, &max_backoff, &jitter, &retry_on)) {
+        return NULL;
+    }
+    RetryPolicy policy;
+    Py_BEGIN_ALLOW_THREADS
+    policy = self->retry.policy();
+    Py_END_ALLOW_THREADS
+    if (retry_policy_args(policy, attempts, backoff, max_backoff, jitter, retry_on) < 0) {
+        return NULL;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    self->retry.set_policy(policy);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+static PyObject * retry_policy(Adapter * self, PyObject * args) {
+    if (!PyArg_ParseTuple(args, ":retry_policy")) {
+        return NULL;
+    }
+    RetryPolicy policy;
+    Py_BEGIN_ALLOW_THREADS
+    policy = self->retry.policy();
+    Py_END_ALLOW_THREADS
+    return convert_retry_policy(policy);
+}
+
+static PyObject * transmit_stats(Adapter * self, PyObject * args, PyObject * kwargs) {
+    int reset = 0;
+    static const char * keywords[] = { "reset", NULL };
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|p:transmit_stats",
+            (char **)keywords, &reset)) {
+        return NULL;
+    }
+    TransmitStats stats;
+    Py_BEGIN_ALLOW_THREADS
+    stats = self->retry.stats(reset);
+    Py_END_ALLOW_THREADS
+    return convert_transmit_stats(stats);
+}
+
+// one attempt, recorded in the frame history and capture
+static bool send_frame(Adapter * self, cec_command & cmd) {
+    std::shared_ptr<HistoryStore> history = std::atomic_load(&self->history);
+    if (history) {
+        history->add(cmd, HISTORY_TRANSMITTED);
+    }
+    if (self->capture) {
+        self->capture->add(cmd, HISTORY_TRANSMITTED);
+    }
+    return self->adapter->Transmit(cmd);
+}
+
+bool adapter_transmit(Adapter * self, cec_command & cmd,
+        const RetryPolicy * policy, TransmitResult * result) {
+    TransmitResult outcome;
+    outcome.status = TRANSMIT_FAILED;
+    outcome.attempts = 0;
+    outcome.elapsed = 0;
+    ICECAdapter * adapter = self->adapter;
+    if (adapter && !is_monitor(self)) {
+        RetryPolicy adapter_policy;
+        if (!policy) {
+            adapter_policy = self->retry.policy();
+            policy = &adapter_policy;
+        }
+        if (cmd.initiator == CECDEVICE_UNREGISTERED) {
+            cmd.initiator = adapter->GetLogicalAddresses().primary;
+        }
+        double start = monotonic_time();
+        while (true) {
+            double sent = monotonic_time();
+            outcome.attempts++;
+            CEC_PROBE4(transmit__begin, cmd.initiator, cmd.destination,
+                    cmd.opcode, outcome.attempts);
+            bool acked = send_frame(self, cmd);
+            double took = monotonic_time() - sent;
+            outcome.status = acked ? TRANSMIT_ACKED : classify_failure(cmd, took);
+            CEC_PROBE5(transmit__end, cmd.initiator, cmd.destination,
+                    cmd.opcode, outcome.status, (uint64_t)(took * 1e9));
+            if (acked || !should_retry(*policy, outcome.status, outcome.attempts)) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::duration<double>(
+                    retry_delay(*policy, outcome.attempts)));
+        }
+        outcome.elapsed = monotonic_time() - start;
+        if (self->presence) {
+            self->presence->transmitted(cmd.destination,
+                    outcome.status == TRANSMIT_ACKED);
+        }
+    }
+    self->retry.record(outcome);
+    if (result) {
+        *result = outcome;
+    }
+    return outcome.status == TRANSMIT_ACKED;
+}
+
+static PyObject * record_history(Adapter * self, PyObject * args, PyObject * kwargs) {
+    Py_ssize_t capacity = 65536;
+    static const char * keywords[] = { "capacity", NULL };
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|n:record_history",
+            (char **)keywords, &capacity)) {
+        return NULL;
+    }
+    if (capacity < 0) {
+        PyErr_SetString(PyExc_ValueError, "capacity must not be negative");
+        return NULL;
+    }
+    std::shared_ptr<HistoryStore> history;
+    if (capacity > 0) {
+        try {
+            history = std::make_shared<HistoryStore>(capacity);
+        } catch (std::bad_alloc &) {
+            return PyErr_NoMemory();
+        }
+    }
+    std::atomic_store(&self->history, history);
+    Py_RETURN_NONE;
+}
+
+static PyObject * cache_metadata(Adapter * self, PyObject * args, PyObject * kwargs) {
+    PyObject * path;
+    double max_age = 7 * 24 * 3600;
+    static const char * keywords[] = { "path", "max_age", NULL };
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|d:cache_metadata",
+            (char **)keywords, &path, &max_age)) {
+        return NULL;
+    }
+    std::shared_ptr<MetadataCache> metadata;
+    if (path != Py_None) {
+#if HAVE_METADATA_CACHE
+        PyObject * bytes;
+        if (!PyUnicode_FSConverter(path, &bytes)) {
+            return NULL;
+        }
+        MetadataCache * cache;
+        Py_BEGIN_ALLOW_THREADS
+        cache = MetadataCache::open(self, PyBytes_AS_STRING(bytes), max_age);
+        Py_END_ALLOW_THREADS
+        if (!cache) {
+            PyErr_SetFromErrnoWithFilename(PyExc_OSError, PyBytes_AS_STRING(bytes));
+            Py_DECREF(bytes);
+            return NULL;
+        }
+        Py_DECREF(bytes);
+        metadata.reset(cache);
+#else
+        PyErr_SetString(PyExc_NotImplementedError,
+                "The metadata cache is not supported on this platform");
+        return NULL;
+#endif
+    }
+    std::shared_ptr<MetadataCache> old = std::atomic_exchange(&self->metadata, metadata);
+    if (old) {
+        Py_BEGIN_ALLOW_THREADS
+        old->stop();
+        Py_END_ALLOW_THREADS
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject * metadata_stats(Adapter * self, PyObject * args) {
+    if (!PyArg_ParseTuple(args, ":metadata_stats")) {
+        return NULL;
+    }
+    std::shared_ptr<MetadataCache> metadata = std::atomic_load(&self->metadata);
+    if (!metadata) {
+        Py_RETURN_NONE;
+    }
+    MetadataStats stats = metadata->stats();
+    return Py_BuildValue("{sksksksk}",
+            "hits", stats.hits,
+            "misses", stats.misses,
+            "refreshes", stats.refreshes,
+            "invalidations", stats.invalidations);
+}
+
+static PyObject * serve_broker(Adapter * self, PyObject * args, PyObject * kwargs) {
+    PyObject * path;
+    unsigned int capacity = 4096;
+    static const char * keywords[] = { "path", "capacity", NULL };
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|I:serve_broker",
+            (char **)keywords, &path, &capacity)) {
+        return NULL;
+    }
+    std::shared_ptr<Broker> broker;
+    if (path != Py_None) {
+#if HAVE_BROKER
+        if (capacity < 1 || capacity > (1U << 20)) {
+            PyErr_SetString(PyExc_ValueError, "capacity must be between 1 and 1048576");
+            return NULL;
+        }
+        PyObject * bytes;
+        if (!PyUnicode_FSConverter(path, &bytes)) {
+            return NULL;
+        }
+        // stop a running broker first, it may own the same path
+        std::shared_ptr<Broker> old = std::atomic_exchange(&self->broker, broker);
+        Broker * started;
+        Py_BEGIN_ALLOW_THREADS
+        if (old) {
+            old->stop();
+        }
+        started = Broker::start(self, PyBytes_AS_STRING(bytes), capacity);
+        Py_END_ALLOW_THREADS
+        if (!started) {
+            PyErr_SetFromErrnoWithFilename(PyExc_OSError, PyBytes_AS_STRING(bytes));
+            Py_DECREF(bytes);
+            return NULL;
+        }
+        Py_DECREF(bytes);
+        broker.reset(started);
+#else
+        PyErr_SetString(PyExc_NotImplementedError,
+                "The broker is not supported on this platform");
+        return NULL;
+#endif
+    }
+    std::shared_ptr<Broker> old = std::atomic_exchange(&self->broker, broker);
+    if (old) {
+        Py_BEGIN_ALLOW_THREADS
+        old->stop();
+        Py_END_ALLOW_THREADS
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject * broker_stats(Adapter * self, PyObject * args) {
+    if (!PyArg_ParseTuple(args, ":broker_stats")) {
+        return NULL;
+    }
+    std::shared_ptr<Broker> broker = std::atomic_load(&self->broker);
+    if (!broker) {
+        Py_RETURN_NONE;
+    }
+    BrokerStats stats;
+    Py_BEGIN_ALLOW_THREADS
+    stats = broker->stats();
+    Py_END_ALLOW_THREADS
+    return Py_BuildValue("{sksksksksksk}",
+            "clients", stats.clients,
+            "connections", stats.connections,
+            "published", stats.published,
+            "transmits", stats.transmits,
+            "calls", stats.calls,
+            "wakeups", stats.wakeups);
+}
+
+static PyObject * is_active_source(Adapter * self, PyObject * args) {
+    unsigned char addr;
+
+    if (PyArg_ParseTuple(args, "b:is_active_source", &addr)) {
+        if (addr < 0 || addr > 15) {
+            PyErr_SetString(PyExc_ValueError, "Logical address must be between 0 and 15");
+            return NULL;
+        } else {
+            bool active;
+            Py_BEGIN_ALLOW_THREADS
+            active = self->adapter->IsActiveSource((cec_logical_address)addr);
+            self->state.set_active_source((cec_logical_address)addr, active);
+            Py_END_ALLOW_THREADS
+            RETURN_BOOL(active);
+        }
+    }
+    return NULL;
+}
+
+static PyObject * state(Adapter * self, PyObject * args) {
+    if (!PyArg_ParseTuple(args, ":state")) {
+        return NULL;
+    }
+    BusStateData snapshot;
+    Py_BEGIN_ALLOW_THREADS
+    snapshot = self->state.snapshot();
+    Py_END_ALLOW_THREADS
+    return convert_state(snapshot);
+}
+
+static PyObject * watch_power(Adapter * self, PyObject * args, PyObject * kwargs) {
+    PyObject * addrs;
+    double fast_interval = 1.0;
+    double slow_interval = 60.0;
+    static const char * keywords[] = { "addresses", "fast_interval", "slow_interval", NULL };
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|dd:watch_power",
+            (char **)keywords, &addrs, &fast_interval, &slow_interval)) {
+        return NULL;
+    }
+    if (fast_interval <= 0 || slow_interval < fast_interval) {
+        PyErr_SetString(PyExc_ValueError,
+            "Intervals must satisfy 0 < fast_interval <= slow_interval");
+        return NULL;
+    }
+    if (!self->adapter) {
+        PyErr_SetString(PyExc_IOError, "Adapter is closed");
+        return NULL;
+    }
+
+    PyObject * iter = PyObject_GetIter(addrs);
+    if (!iter) {
+        return NULL;
+    }
+    uint16_t mask = 0;
+    PyObject * item;
+    while ((item = PyIter_Next(iter))) {
+        long addr = PyLong_AsLong(item);
+        Py_DECREF(item);
+        if (addr == -1 && PyErr_Occurred()) {
+            Py_DECREF(iter);
+            return NULL;
+        }
+        if (addr < 0 || addr > 14) {
+            Py_DECREF(iter);
+            PyErr_SetString(PyExc_ValueError, "Logical address must be between 0 and 14");
+            return NULL;
+        }
+        mask |= (uint16_t)(1 << addr);
+    }
+    Py_DECREF(iter);
+    if (PyErr_Occurred()) {
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    {
+        std::lock_guard<std::mutex> guard(self->lock);
+        if (!self->poller && mask) {
+            self->poller = new PowerPoller(self);
+        }
+        if (self->poller) {
+            self->poller->watch(mask, fast_interval, slow_interval);
+        }
+    }
+    Py_END_ALLOW_THREADS
+
+    Py_RETURN_NONE;
+}
+
+static PyObject * track_presence(Adapter * self, PyObject * args, PyObject * kwargs) {
+    int enable = 1;
+    double interval = 5.0;
+    double scan_interval = 60.0;
+    static const char * keywords[] = { "enable", "interval", "scan_interval", NULL };
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|idd:track_presence",
+            (char **)keywords, &enable, &interval, &scan_interval)) {
+        return NULL;
+    }
+    if (interval <= 0 || scan_interval < interval) {
+        PyErr_SetString(PyExc_ValueError,
+            "Intervals must satisfy 0 < interval <= scan_interval");
+        return NULL;
+    }
+    if (!self->adapter) {
+        PyErr_SetString(PyExc_IOError, "Adapter is closed");
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    {
+        std::lock_guard<std::mutex> guard(self->lock);
+        if (!self->presence && enable) {
+            self->presence = new PresenceTracker(self);
+        }
+        if (self->presence) {
+            if (enable) {
+                self->presence->start(interval, scan_interval);
+            } else {
+                self->presence->stop();
+            }
+        }
+    }
+    Py_END_ALLOW_THREADS
+
+    Py_RETURN_NONE;
+}
+
+static PyObject * present_devices(Adapter * self, PyObject * args) {
+    if (!PyArg_ParseTuple(args, ":present_devices")) {
+        return NULL;
+    }
+    bool tracking = false;
+    uint16_t present = 0;
+    Py_BEGIN_ALLOW_THREADS
+    if (self->presence && self->presence->tracking()) {
+        tracking = true;
+        present = self->presence->present();
+    }
+    Py_END_ALLOW_THREADS
+    if (!tracking) {
+        Py_RETURN_NONE;
+    }
+    PyObject * result = PyList_New(0);
+    for (int i=0; result && i<16; i++) {
+        if (present & (1 << i)) {
+            PyObject * addr = PyLong_FromLong(i);
+            if (!addr || PyList_Append(result, addr) < 0) {
+                Py_CLEAR(result);
+            }
+            Py_XDECREF(addr);
+        }
+    }
+    return result;
+}
+
+static PyObject * auto_reconnect(Adapter * self, PyObject * args, PyObject * kwargs) {
+    int enable = 1;
+    double initial_delay = 1.0;
+    double max_delay = 60.0;
+    static const char * keywords[] = { "enable", "initial_delay", "max_delay", NULL };
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|idd:auto_reconnect",
+            (char **)keywords, &enable, &initial_delay, &max_delay)) {
+        return NULL;
+    }
+    if (initial_delay <= 0 || max_delay < initial_delay) {
+        PyErr_SetString(PyExc_ValueError,
+            "Delays must satisfy 0 < initial_delay <= max_delay");
+        return NULL;
+    }
+    if (!self->adapter) {
+        PyErr_SetString(PyExc_IOError, "Adapter is closed");
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    {
+        std::lock_guard<std::mutex> guard(self->lock);
+        if (enable) {
+            if (!self->reconnector) {
+                self->reconnector = new Reconnector(self);
+            }
+            self->reconnector->start(initial_delay, max_delay);
+        } else if (self->reconnector) {
+            self->reconnector->stop();
+        }
+    }
+    Py_END_ALLOW_THREADS
+
+    Py_RETURN_NONE;
+}
+
+static PyObject * reconnect_stats(Adapter * self, PyObject * args) {
+    if (!PyArg_ParseTuple(args, ":reconnect_stats")) {
+        return NULL;
+    }
+    ReconnectStats stats;
+    Py_BEGIN_ALLOW_THREADS
+    {
+        std::lock_guard<std::mutex> guard(self->lock);
+        if (self->reconnector) {
+            stats = self->reconnector->stats();
+        } else {
+            memset(&stats, 0, sizeof(stats));
+            stats.connected = self->adapter != NULL;
+        }
+    }
+    Py_END_ALLOW_THREADS
+    PyObject * down_since = Py_None;
+    if (stats.down_since > 0) {
+        down_since = PyFloat_FromDouble(stats.down_since);
+    } else {
+        Py_INCREF(down_since);
+    }
+    return Py_BuildValue("{sOsksksksdsN}",
+            "connected", stats.connected ? Py_True : Py_False,
+            "lost", stats.lost,
+            "reconnects", stats.reconnects,
+            "attempts", stats.attempts,
+            "downtime", stats.downtime,
+            "down_since", down_since);
+}
+
+static PyObject * capture_stats(Adapter * self, PyObject * args) {
+    if (!PyArg_ParseTuple(args, ":capture_stats")) {
+        return NULL;
+    }
+    if (!self->capture) {
+        Py_RETURN_NONE;
+    }
+    uint64_t written;
+    uint64_t dropped;
+    bool failed;
+    Py_BEGIN_ALLOW_THREADS
+    self->capture->stats(written, dropped, failed);
+    Py_END_ALLOW_THREADS
+    return Py_BuildValue("{sKsKsO}",
+            "written", (unsigned long long)written,
+            "dropped", (unsigned long long)dropped,
+            "failed", failed ? Py_True : Py_False);
+}
+
+static PyObject * set_active_source(Adapter * self, PyObject * args) {
+    unsigned char devtype = (unsigned char)CEC_DEVICE_TYPE_RESERVED;
+
+    if (PyArg_ParseTuple(args, "|b:set_active_source", &devtype)) {
         if (devtype < 0 || devtype > 5) {
             PyErr_SetString(PyExc_ValueError, "Device type must be between 0 and 5");
             return NULL;
@@ -491,69 +1510,311 @@ static PyObject * toggle_mute(Adapter * self, PyObject * args) {
     if (PyArg_ParseTuple(args, ":toggle_mute")) {
         RETURN_BOOL(self->adapter->AudioToggleMute());
     }
-    return NULL;
+    return NULL;
+}
+
+
+static PyObject * convert_audio_status(uint8_t status) {
+    if ((status & AUDIO_VOLUME_MASK) > 100) {
+        Py_RETURN_NONE;
+    }
+    return Py_BuildValue("{sisO}",
+            "volume", status & AUDIO_VOLUME_MASK,
+            "muted", (status & AUDIO_MUTE_MASK) ? Py_True : Py_False);
+}
+
+static PyObject * audio_status(Adapter * self, PyObject * args) {
+    if (!PyArg_ParseTuple(args, ":audio_status")) {
+        return NULL;
+    }
+    if (!self->adapter) {
+        PyErr_SetString(PyExc_IOError, "Adapter is closed");
+        return NULL;
+    }
+    uint8_t status;
+    Py_BEGIN_ALLOW_THREADS
+    status = self->adapter->AudioStatus();
+    Py_END_ALLOW_THREADS
+    return convert_audio_status(status);
+}
+
+static PyObject * set_volume(Adapter * self, PyObject * args, PyObject * kwargs) {
+    int level;
+    double timeout = 2.0;
+    int unmute = 1;
+    static const char * keywords[] = { "level", "timeout", "unmute", NULL };
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i|dp:set_volume",
+            (char **)keywords, &level, &timeout, &unmute)) {
+        return NULL;
+    }
+    if (level < 0 || level > 100) {
+        PyErr_SetString(PyExc_ValueError, "level must be between 0 and 100");
+        return NULL;
+    }
+    if (!self->adapter) {
+        PyErr_SetString(PyExc_IOError, "Adapter is closed");
+        return NULL;
+    }
+    VolumeResult result;
+    bool ok;
+    Py_BEGIN_ALLOW_THREADS
+    ok = drive_volume(self, level, unmute, timeout, result);
+    Py_END_ALLOW_THREADS
+    if (!ok) {
+        PyErr_SetString(PyExc_IOError, "The audio system did not report its status");
+        return NULL;
+    }
+    return Py_BuildValue("{sOsisOsIsd}",
+            "reached", result.reached ? Py_True : Py_False,
+            "volume", result.status & AUDIO_VOLUME_MASK,
+            "muted", (result.status & AUDIO_MUTE_MASK) ? Py_True : Py_False,
+            "steps", result.steps,
+            "elapsed", result.elapsed);
+}
+#endif
+
+static PyObject * set_stream_path(Adapter * self, PyObject * args) {
+    PyObject * arg;
+    const char * arg_s = NULL;
+
+    if (PyArg_ParseTuple(args, "O:set_stream_path", &arg)) {
+        Py_INCREF(arg);
+
+#if PY_MAJOR_VERSION >= 3
+        if (PyLong_Check(arg)) {
+            long arg_l = PyLong_AsLong(arg);
+#else
+        if (PyInt_Check(arg)) {
+            long arg_l = PyInt_AsLong(arg);
+#endif
+            Py_DECREF(arg);
+            if (arg_l < 0 || arg_l > 15) {
+                PyErr_SetString(PyExc_ValueError, "Logical address must be between 0 and 15");
+                return NULL;
+            } else {
+                // use the known physical address to avoid a bus query
+                uint16_t pa;
+                if (self->topology.physical_address((cec_logical_address)arg_l, &pa)) {
+                    RETURN_BOOL(self->adapter->SetStreamPath(pa));
+                }
+                RETURN_BOOL(self->adapter->SetStreamPath((cec_logical_address)arg_l));
+            }
+
+#if PY_MAJOR_VERSION >= 3
+        } else if (PyUnicode_Check(arg)) {
+            arg_s = PyUnicode_AsUTF8(arg);
+#else
+        } else if (PyString_Check(arg)) {
+            arg_s = PyString_AsString(arg);
+#endif
+        } else if (PyUnicode_Check(arg)) {
+            // Convert from Unicode to ASCII
+            PyObject * ascii_arg = PyUnicode_AsASCIIString(arg);
+            if (NULL == ascii_arg) {
+                // Means the string can't be converted to ASCII, the codec failed
+                PyErr_SetString(PyExc_ValueError, "Could not convert address to ASCII");
+                return NULL;
+            }
+
+            // Get the actual bytes as a C string
+            arg_s = PyByteArray_AsString(ascii_arg);
+        }
+
+        if (arg_s) {
+            int pa = parse_physical_addr(arg_s);
+            Py_DECREF(arg);
+            if (pa < 0) {
+                PyErr_SetString(PyExc_ValueError, "Invalid physical address");
+                return NULL;
+            } else {
+                RETURN_BOOL(self->adapter->SetStreamPath((uint16_t)pa));
+            }
+        } else {
+            Py_DECREF(arg);
+            PyErr_SetString(PyExc_TypeError, "parameter must be string or int");
+            return NULL;
+        }
+    }
+
+    return NULL;
+}
+
+// Convert a physical address given as an "a.b.c.d" string or as an int
+// Returns -1 and sets an exception on failure
+int physical_addr_arg(PyObject * arg) {
+    if (PyLong_Check(arg)) {
+        long pa = PyLong_AsLong(arg);
+        if (pa == -1 && PyErr_Occurred()) {
+            return -1;
+        }
+        if (pa < 0 || pa > 0xFFFF || !Topology::valid((uint16_t)pa)) {
+            PyErr_SetString(PyExc_ValueError, "Invalid physical address");
+            return -1;
+        }
+        return (int)pa;
+    }
+    if (PyUnicode_Check(arg)) {
+        const char * arg_s = PyUnicode_AsUTF8(arg);
+        if (!arg_s) {
+            return -1;
+        }
+        int pa = parse_physical_addr(arg_s);
+        if (pa < 0 || !Topology::valid((uint16_t)pa)) {
+            PyErr_SetString(PyExc_ValueError, "Invalid physical address");
+            return -1;
+        }
+        return pa;
+    }
+    PyErr_SetString(PyExc_TypeError, "physical address must be string or int");
+    return -1;
+}
+
+static PyObject * physical_addr_str(uint16_t pa) {
+    char str[8];
+    format_physical_addr(pa, str);
+    return Py_BuildValue("s", str);
+}
+
+static PyObject * topology(Adapter * self, PyObject * args) {
+    if (!PyArg_ParseTuple(args, ":topology")) {
+        return NULL;
+    }
+    uint16_t phys[16];
+    self->topology.snapshot(phys);
+    PyObject * result = PyDict_New();
+    if (!result) {
+        return NULL;
+    }
+    for (int i=CECDEVICE_TV; i<CECDEVICE_BROADCAST; i++) {
+        if (phys[i] == PHYSICAL_ADDR_INVALID) {
+            continue;
+        }
+        PyObject * key = PyLong_FromLong(i);
+        PyObject * value = physical_addr_str(phys[i]);
+        int err = (key && value) ? PyDict_SetItem(result, key, value) : -1;
+        Py_XDECREF(key);
+        Py_XDECREF(value);
+        if (err) {
+            Py_DECREF(result);
+            return NULL;
+        }
+    }
+    return result;
+}
+
+static PyObject * device_at(Adapter * self, PyObject * args) {
+    PyObject * arg;
+    if (!PyArg_ParseTuple(args, "O:device_at", &arg)) {
+        return NULL;
+    }
+    int pa = physical_addr_arg(arg);
+    if (pa < 0) {
+        return NULL;
+    }
+    cec_logical_address addr = self->topology.device_at((uint16_t)pa);
+    if (addr == CECDEVICE_UNKNOWN) {
+        Py_RETURN_NONE;
+    }
+    return Py_BuildValue("i", addr);
+}
+
+static PyObject * devices_behind(Adapter * self, PyObject * args) {
+    PyObject * arg;
+    if (!PyArg_ParseTuple(args, "O:devices_behind", &arg)) {
+        return NULL;
+    }
+    int pa = physical_addr_arg(arg);
+    if (pa < 0) {
+        return NULL;
+    }
+    uint16_t mask = self->topology.devices_behind((uint16_t)pa);
+    uint16_t phys[16];
+    self->topology.snapshot(phys);
+
+    // nearest to the given node first
+    int order[16];
+    int count = 0;
+    for (int i=CECDEVICE_TV; i<CECDEVICE_BROADCAST; i++) {
+        if (mask & (1 << i)) {
+            order[count++] = i;
+        }
+    }
+    std::stable_sort(order, order + count, [&phys](int a, int b) {
+        return Topology::depth(phys[a]) < Topology::depth(phys[b]);
+    });
+
+    PyObject * result = PyList_New(count);
+    if (!result) {
+        return NULL;
+    }
+    for (int i=0; i<count; i++) {
+        PyList_SET_ITEM(result, i, PyLong_FromLong(order[i]));
+    }
+    return result;
+}
+
+static PyObject * parent_address(Adapter * self, PyObject * args) {
+    PyObject * arg;
+    if (!PyArg_ParseTuple(args, "O:parent_address", &arg)) {
+        return NULL;
+    }
+    int pa = physical_addr_arg(arg);
+    if (pa < 0) {
+        return NULL;
+    }
+    uint16_t parent;
+    if (!Topology::parent((uint16_t)pa, &parent)) {
+        Py_RETURN_NONE;
+    }
+    return physical_addr_str(parent);
 }
-#endif
 
-static PyObject * set_stream_path(Adapter * self, PyObject * args) {
+static PyObject * child_addresses(Adapter * self, PyObject * args) {
     PyObject * arg;
-    const char * arg_s = NULL;
-
-    if (PyArg_ParseTuple(args, "O:set_stream_path", &arg)) {
-        Py_INCREF(arg);
-
-#if PY_MAJOR_VERSION >= 3
-        if (PyLong_Check(arg)) {
-            long arg_l = PyLong_AsLong(arg);
-#else
-        if (PyInt_Check(arg)) {
-            long arg_l = PyInt_AsLong(arg);
-#endif
-            Py_DECREF(arg);
-            if (arg_l < 0 || arg_l > 15) {
-                PyErr_SetString(PyExc_ValueError, "Logical address must be between 0 and 15");
-                return NULL;
-            } else {
-                RETURN_BOOL(self->adapter->SetStreamPath((cec_logical_address)arg_l));
-            }
-
-#if PY_MAJOR_VERSION >= 3
-        } else if (PyUnicode_Check(arg)) {
-            arg_s = PyUnicode_AsUTF8(arg);
-#else
-        } else if (PyString_Check(arg)) {
-            arg_s = PyString_AsString(arg);
-#endif
-        } else if (PyUnicode_Check(arg)) {
-            // Convert from Unicode to ASCII
-            PyObject * ascii_arg = PyUnicode_AsASCIIString(arg);
-            if (NULL == ascii_arg) {
-                // Means the string can't be converted to ASCII, the codec failed
-                PyErr_SetString(PyExc_ValueError, "Could not convert address to ASCII");
-                return NULL;
-            }
-
-            // Get the actual bytes as a C string
-            arg_s = PyByteArray_AsString(ascii_arg);
-        }
-
-        if (arg_s) {
-            int pa = parse_physical_addr(arg_s);
-            Py_DECREF(arg);
-            if (pa < 0) {
-                PyErr_SetString(PyExc_ValueError, "Invalid physical address");
-                return NULL;
-            } else {
-                RETURN_BOOL(self->adapter->SetStreamPath((uint16_t)pa));
-            }
-        } else {
-            Py_DECREF(arg);
-            PyErr_SetString(PyExc_TypeError, "parameter must be string or int");
+    if (!PyArg_ParseTuple(args, "O:child_addresses", &arg)) {
+        return NULL;
+    }
+    int pa = physical_addr_arg(arg);
+    if (pa < 0) {
+        return NULL;
+    }
+    uint16_t children[15];
+    int count = self->topology.children((uint16_t)pa, children);
+    PyObject * result = PyList_New(count);
+    if (!result) {
+        return NULL;
+    }
+    for (int i=0; i<count; i++) {
+        PyObject * child = physical_addr_str(children[i]);
+        if (!child) {
+            Py_DECREF(result);
             return NULL;
         }
+        PyList_SET_ITEM(result, i, child);
     }
+    return result;
+}
 
-    return NULL;
+static PyObject * port_path(Adapter * self, PyObject * args) {
+    PyObject * arg;
+    if (!PyArg_ParseTuple(args, "O:port_path", &arg)) {
+        return NULL;
+    }
+    int pa = physical_addr_arg(arg);
+    if (pa < 0) {
+        return NULL;
+    }
+    uint8_t ports[4];
+    int count = Topology::port_path((uint16_t)pa, ports);
+    PyObject * result = PyTuple_New(count);
+    if (!result) {
+        return NULL;
+    }
+    for (int i=0; i<count; i++) {
+        PyTuple_SET_ITEM(result, i, PyLong_FromLong(ports[i]));
+    }
+    return result;
 }
 
 static PyObject * set_physical_addr(Adapter * self, PyObject * args) {
@@ -644,13 +1905,10 @@ static PyObject * Adapter_getPhysicalAddress(Adapter * self, void * closure) {
     Py_BEGIN_ALLOW_THREADS
     logicalAddress = self->adapter->GetLogicalAddresses().primary;
     physicalAddress = self->adapter->GetDevicePhysicalAddress(logicalAddress);
+    self->topology.set_physical_address(logicalAddress, physicalAddress);
     Py_END_ALLOW_THREADS
     char strAddr[8];
-    snprintf(strAddr, 8, "%x.%x.%x.%x",
-        (physicalAddress >> 12) & 0xF,
-        (physicalAddress >> 8) & 0xF,
-        (physicalAddress >> 4) & 0xF,
-        physicalAddress & 0xF);
+    format_physical_addr(physicalAddress, strAddr);
 
     return Py_BuildValue("s", strAddr);
 }
@@ -668,6 +1926,16 @@ static PyObject * Adapter_getVendor(Adapter * self, void * closure) {
     return Py_BuildValue("s", vendor_str);
 }
 
+static PyObject * Adapter_getVendorId(Adapter * self, void * closure) {
+    cec_logical_address logicalAddress;
+    uint32_t vendorId;
+    Py_BEGIN_ALLOW_THREADS
+    logicalAddress = self->adapter->GetLogicalAddresses().primary;
+    vendorId = self->adapter->GetDeviceVendorId(logicalAddress);
+    Py_END_ALLOW_THREADS
+    return Py_BuildValue("k", (unsigned long)vendorId);
+}
+
 static PyObject * Adapter_getOsdString(Adapter * self, void * closure) {
     return Py_BuildValue("s", self->config.strDeviceName);
 }
@@ -676,79 +1944,123 @@ static PyObject * Adapter_getCECVersion(Adapter * self, void * closure) {
     return Py_BuildValue("s", "1.4");
 }
 
-static PyObject * Adapter_getLanguage(Adapter * self, void * closure) {
-    return Py_BuildValue("s", self->config.strDeviceLanguage);
+static PyObject * Adapter_getHistory(Adapter * self, void * closure) {
+    std::shared_ptr<HistoryStore> history = std::atomic_load(&self->history);
+    if (!history) {
+        Py_RETURN_NONE;
+    }
+    ModuleState * module = type_state(Py_TYPE(self));
+    if (!module) {
+        return NULL;
+    }
+    return history_new(module->history_type, history);
 }
 
+static PyObject * Adapter_getConfig(Adapter * self, void * closure) {
+    ModuleState * module = type_state(Py_TYPE(self));
+    if (!module) {
+        return NULL;
+    }
+    return config_new(module->config_type, self);
+}
 
+static PyObject * Adapter_getMonitor(Adapter * self, void * closure) {
+    return PyBool_FromLong(is_monitor(self));
+}
 
-// Alloc/dealloc
-
-std::list<CEC_ADAPTER_TYPE> get_adapters(ICECAdapter * adapter) {
-    std::list<CEC_ADAPTER_TYPE> res;
-    // release the Global Interpreter lock
-    Py_BEGIN_ALLOW_THREADS
-    // get adapters
-    int cec_count = 10;
-    CEC_ADAPTER_TYPE * dev_list = (CEC_ADAPTER_TYPE*)malloc(
-            cec_count * sizeof(CEC_ADAPTER_TYPE));
-    int count = adapter->CEC_FIND_ADAPTERS(dev_list, cec_count);
-    if (count > cec_count) {
-        cec_count = count;
-        dev_list = (CEC_ADAPTER_TYPE*)realloc(dev_list,
-            cec_count * sizeof(CEC_ADAPTER_TYPE));
-        count = adapter->CEC_FIND_ADAPTERS(dev_list, cec_count);
-        count = (std::min)(count, cec_count);
+static PyObject * Adapter_getStartup(Adapter * self, void * closure) {
+    const StartupTimes & t = self->startup;
+    PyObject * result = PyDict_New();
+    if (!result) {
+        return NULL;
     }
-
-    for (int i=0; i<count; i++) {
-        res.push_back(dev_list[i]);
+    const char * names[] = { "initialise", "detect", "open", "total" };
+    double values[] = { t.initialise, t.detect, t.open, t.total };
+    for (size_t i=0; i<sizeof(values)/sizeof(values[0]); i++) {
+        if (values[i] < 0) {
+            continue;
+        }
+        PyObject * value = PyFloat_FromDouble(values[i]);
+        if (!value || PyDict_SetItemString(result, names[i], value) < 0) {
+            Py_XDECREF(value);
+            Py_DECREF(result);
+            return NULL;
+        }
+        Py_DECREF(value);
     }
+    return result;
+}
 
-    free(dev_list);
-    // acquire the GIL before returning to code that uses python objects
-    Py_END_ALLOW_THREADS
-    return res;
+static PyObject * Adapter_getLanguage(Adapter * self, void * closure) {
+    return Py_BuildValue("s", self->config.strDeviceLanguage);
 }
 
+
+
+// Alloc/dealloc
+
 static void Adapter_dealloc(Adapter * self) {
+    self->callbacks.clear();
+    if (self->reconnector) {
+        Py_BEGIN_ALLOW_THREADS
+        delete self->reconnector;
+        Py_END_ALLOW_THREADS
+        self->reconnector = NULL;
+    }
+    if (self->poller) {
+        Py_BEGIN_ALLOW_THREADS
+        delete self->poller;
+        Py_END_ALLOW_THREADS
+        self->poller = NULL;
+    }
+    if (self->presence) {
+        Py_BEGIN_ALLOW_THREADS
+        delete self->presence;
+        Py_END_ALLOW_THREADS
+        self->presence = NULL;
+    }
+    std::shared_ptr<MetadataCache> metadata = std::atomic_exchange(&self->metadata,
+            std::shared_ptr<MetadataCache>());
+    if (metadata) {
+        Py_BEGIN_ALLOW_THREADS
+        metadata->stop();
+        Py_END_ALLOW_THREADS
+    }
+    std::shared_ptr<Broker> broker = std::atomic_exchange(&self->broker,
+            std::shared_ptr<Broker>());
+    if (broker) {
+        Py_BEGIN_ALLOW_THREADS
+        broker->stop();
+        Py_END_ALLOW_THREADS
+    }
     if (self->adapter) {
         CECDestroy(self->adapter);
         self->adapter = NULL;
     }
+    // libcec has stopped, no handler can be running
+    self->handlers.clear();
+    if (self->capture) {
+        Py_BEGIN_ALLOW_THREADS
+        delete self->capture;
+        Py_END_ALLOW_THREADS
+        self->capture = NULL;
+    }
+    Py_XDECREF(self->spare_result.exchange(NULL));
     self->~Adapter();
-    Py_TYPE(self)->tp_free((PyObject *)self);
+    free_instance((PyObject *)self);
 }
 
-#pragma GCC diagnostic ignored "-Wwrite-strings"
-static PyObject * Adapter_new(PyTypeObject * type, PyObject * args, PyObject * kwargs) {
-    bool success = false;
-    Adapter * self;
-    const char * dev = NULL;
-    char * device_name = "python-cec";
-    cec_device_type device_type = CEC_DEVICE_TYPE_RECORDING_DEVICE;
-    char * keywords[] = { "dev", "name", "type", NULL};
-
-
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|$ssi", keywords,
-            &dev, &device_name, &device_type)) {
-        return NULL;
-    }
-
-    if (device_type < CEC_DEVICE_TYPE_TV ||
-            device_type > CEC_DEVICE_TYPE_AUDIO_SYSTEM) {
-        PyErr_SetString(PyExc_Exception, "Invalid CEC device type");
-        return NULL;
-    }
-
+Adapter * adapter_create(PyTypeObject * type, const char * device_name,
+        cec_device_type device_type, bool monitor) {
     void * mem = type->tp_alloc(type, 0);
     if (!mem) {
         return NULL;
     }
 
-    self = new (mem) Adapter();
+    Adapter * self = new (mem) Adapter();
 
     self->adapter = NULL;
+    self->interp = current_interpreter();
 
     self->config.Clear();
 
@@ -767,6 +2079,9 @@ static PyObject * Adapter_new(PyTypeObject * type, PyObject * args, PyObject * k
 #endif
     self->config.bActivateSource = 0;
     self->config.deviceTypes.Add(device_type);
+#if HAVE_CEC_MONITOR_ONLY
+    self->config.bMonitorOnly = monitor;
+#endif
 
    // libcec callbacks
 #if CEC_LIB_VERSION_MAJOR > 1 || ( CEC_LIB_VERSION_MAJOR == 1 && CEC_LIB_VERSION_MINOR >= 7 )
@@ -792,61 +2107,347 @@ static PyObject * Adapter_new(PyTypeObject * type, PyObject * args, PyObject * k
     self->config.callbackParam = self;
     self->config.callbacks = &self->cec_callbacks;
 
-    Py_BEGIN_ALLOW_THREADS
+    return self;
+}
+
+PyObject * adapter_open(Adapter * self, const char * dev, char * error,
+        size_t size, OpenProgress progress, void * param) {
+    double started = monotonic_time();
+    double phase = started;
+    self->startup = StartupTimes();
+
     self->adapter = CECInitialise(&self->config);
-    Py_END_ALLOW_THREADS
 
     if (!self->adapter) {
-        PyErr_SetString(PyExc_IOError, "Failed to initialize adapter");
-        goto fail;
+        snprintf(error, size, "Failed to initialize adapter");
+        return PyExc_IOError;
     }
 
     // The description of InitVideoStandalone() implies that it can only be called once.
     // However, libcec internally ensures that it is applied only once. So we can call it
     // multiple times.
+    // A monitor leaves the video system alone, like any other passive
+    // listener.
 #if CEC_LIB_VERSION_MAJOR > 1 || ( CEC_LIB_VERSION_MAJOR == 1 && CEC_LIB_VERSION_MINOR >= 8 )
-    Py_BEGIN_ALLOW_THREADS
-    self->adapter->InitVideoStandalone();
-    Py_END_ALLOW_THREADS
+    if (!is_monitor(self)) {
+        self->adapter->InitVideoStandalone();
+    }
 #endif
+    double now = monotonic_time();
+    self->startup.initialise = now - phase;
+    phase = now;
+    if (progress) {
+        progress(self, OPEN_INITIALISED, now - started, param);
+    }
 
     if (!dev) {
-        std::list<CEC_ADAPTER_TYPE> devs = get_adapters(self->adapter);
-        if (devs.size() > 0) {
-#if HAVE_CEC_ADAPTER_DESCRIPTOR
-        dev = devs.front().strComName;
-#else
-        dev = devs.front().comm;
+        std::vector<CEC_ADAPTER_TYPE> devs;
+        find_adapters(self->adapter, false, devs);
+        now = monotonic_time();
+        self->startup.detect = now - phase;
+        phase = now;
+        if (devs.size() == 0) {
+            snprintf(error, size, "No default adapter found");
+            return PyExc_Exception;
+        }
+        snprintf(self->dev, sizeof(self->dev), "%s", CEC_ADAPTER_NAME(devs.front()));
+    } else if (dev != self->dev) {
+        snprintf(self->dev, sizeof(self->dev), "%s", dev);
+    }
+
+    if (!self->adapter->Open(self->dev)) {
+        snprintf(error, size, "CEC failed to open %s", self->dev);
+        return PyExc_IOError;
+    }
+    // changes are reported relative to the configuration negotiated by Open()
+    libcec_configuration config;
+    if (self->adapter->GetCurrentConfiguration(&config)) {
+        self->reported.reset(config);
+    }
+    self->state.set_own_addresses(self->adapter->GetLogicalAddresses());
+    now = monotonic_time();
+    self->startup.open = now - phase;
+    self->startup.total = now - started;
+    if (progress) {
+        progress(self, OPEN_OPENED, now - started, param);
+        // Open() returns once libcec has negotiated the logical addresses
+        if (self->adapter->GetLogicalAddresses().primary != CECDEVICE_UNREGISTERED) {
+            progress(self, OPEN_ADDRESS_CLAIMED, now - started, param);
+        }
+    }
+    return NULL;
+}
+
+// Allocate an adapter from the Adapter() arguments, with its capture file
+// open. Steals the reference to capture.
+static Adapter * adapter_setup(PyTypeObject * type, const char * device_name,
+        cec_device_type device_type, int monitor, PyObject * capture) {
+    if (device_type < CEC_DEVICE_TYPE_TV ||
+            device_type > CEC_DEVICE_TYPE_AUDIO_SYSTEM) {
+        PyErr_SetString(PyExc_Exception, "Invalid CEC device type");
+        Py_XDECREF(capture);
+        return NULL;
+    }
+#if !HAVE_CEC_MONITOR_ONLY
+    if (monitor) {
+        PyErr_SetString(PyExc_NotImplementedError,
+                "Monitor mode requires libcec 2.0.0 or later");
+        Py_XDECREF(capture);
+        return NULL;
+    }
 #endif
-        } else {
-            PyErr_SetString(PyExc_Exception, "No default adapter found");
+
+    Adapter * self = adapter_create(type, device_name, device_type, monitor);
+    if (!self) {
+        Py_XDECREF(capture);
+        return NULL;
+    }
+
+    // the capture must be in place before libcec starts delivering frames
+    if (capture) {
+        FILE * file = fopen(PyBytes_AS_STRING(capture), "wb");
+        if (!file) {
+            PyErr_SetFromErrnoWithFilename(PyExc_OSError, PyBytes_AS_STRING(capture));
+            Py_DECREF(capture);
+            Py_DECREF(self);
+            return NULL;
         }
+        Py_DECREF(capture);
+        self->capture = new CaptureWriter(file);
     }
+    return self;
+}
 
-    if (!dev) {
-        Adapter_dealloc(self);
+#pragma GCC diagnostic ignored "-Wwrite-strings"
+static PyObject * Adapter_new(PyTypeObject * type, PyObject * args, PyObject * kwargs) {
+    Adapter * self;
+    const char * dev = NULL;
+    char * device_name = "python-cec";
+    cec_device_type device_type = CEC_DEVICE_TYPE_RECORDING_DEVICE;
+    int monitor = 0;
+    PyObject * capture = NULL;
+    char * keywords[] = { "dev", "name", "type", "monitor", "capture", NULL};
+    char errstr[1024];
+    PyObject * error;
+
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|$ssipO&", keywords,
+            &dev, &device_name, &device_type, &monitor,
+            PyUnicode_FSConverter, &capture)) {
         return NULL;
     }
 
-    strncpy(self->dev, dev, sizeof(self->dev) - 1);
+    self = adapter_setup(type, device_name, device_type, monitor, capture);
+    if (!self) {
+        return NULL;
+    }
 
     Py_BEGIN_ALLOW_THREADS
-    success = self->adapter->Open(dev);
+    error = adapter_open(self, dev, errstr, sizeof(errstr));
     Py_END_ALLOW_THREADS
-    if (!success) {
-        char errstr[1024];
-        snprintf(errstr, 1023, "CEC failed to open %s", dev);
-        errstr[1023] = '\0';
-        PyErr_SetString(PyExc_IOError, errstr);
-        goto fail;
+
+    if (error) {
+        PyErr_SetString(error, errstr);
+        Py_DECREF(self);
+        return NULL;
     }
 
     return (PyObject *)self;
+}
+
+// An adapter being opened on a thread of its own by open_async()
+struct OpenTask {
+    Adapter * adapter;
+    PyObject * future;
+    PyObject * progress; // may be NULL
+    std::string dev;
+    bool has_dev;
+};
 
-fail:
+// Opens still running, per interpreter. An interpreter that has used
+// open_async() waits for them at exit, before it starts finalizing, so that an
+// opener thread never takes the GIL of an interpreter that is going away.
+static std::mutex opens_lock;
+static std::condition_variable opens_done;
+static std::map<PyInterpreterState *, int> opens_pending;
 
-    Adapter_dealloc(self);
-    return NULL;
+static PyObject * wait_for_opens(PyObject * unused, PyObject * unused2) {
+    PyInterpreterState * interp = current_interpreter();
+    Py_BEGIN_ALLOW_THREADS
+    {
+        std::unique_lock<std::mutex> guard(opens_lock);
+        opens_done.wait(guard, [interp] { return opens_pending[interp] == 0; });
+        opens_pending.erase(interp);
+    }
+    Py_END_ALLOW_THREADS
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyMethodDef wait_for_opens_def = {
+    "wait_for_opens", wait_for_opens, METH_NOARGS, NULL
+};
+
+// Count an open about to start, registering the exit hook for the first one
+static bool open_started(PyInterpreterState * interp) {
+    bool first;
+    {
+        std::lock_guard<std::mutex> guard(opens_lock);
+        first = opens_pending.find(interp) == opens_pending.end();
+    }
+    if (first) {
+        PyObject * atexit = PyImport_ImportModule("atexit");
+        PyObject * hook = atexit ? PyCFunction_New(&wait_for_opens_def, NULL) : NULL;
+        PyObject * result = hook ?
+            PyObject_CallMethod(atexit, "register", "O", hook) : NULL;
+        Py_XDECREF(hook);
+        Py_XDECREF(atexit);
+        if (!result) {
+            return false;
+        }
+        Py_DECREF(result);
+    }
+    std::lock_guard<std::mutex> guard(opens_lock);
+    opens_pending[interp]++;
+    return true;
+}
+
+static void open_finished(PyInterpreterState * interp) {
+    {
+        std::lock_guard<std::mutex> guard(opens_lock);
+        opens_pending[interp]--;
+    }
+    opens_done.notify_all();
+}
+
+static const char * open_phase_names[] = { "initialised", "opened", "address_claimed" };
+
+static void open_task_progress(Adapter * adapter, int phase, double elapsed,
+        void * param) {
+    OpenTask * task = (OpenTask *)param;
+    if (!task->progress) {
+        return;
+    }
+    InterpreterLock gil(adapter->interp);
+    PyObject * result = PyObject_CallFunction(task->progress, "Osd",
+            (PyObject *)adapter, open_phase_names[phase], elapsed);
+    if (result) {
+        Py_DECREF(result);
+    } else {
+        PyErr_WriteUnraisable(task->progress);
+    }
+}
+
+static void open_task_run(OpenTask * task) {
+    char errstr[1024];
+    Adapter * adapter = task->adapter;
+    PyInterpreterState * interp = adapter->interp;
+    PyObject * error = adapter_open(adapter, task->has_dev ? task->dev.c_str() : NULL,
+            errstr, sizeof(errstr), open_task_progress, task);
+
+    {
+        InterpreterLock gil(interp);
+        PyObject * result;
+        if (error) {
+            PyObject * exc = PyObject_CallFunction(error, "s", errstr);
+            result = exc ? PyObject_CallMethod(task->future, "set_exception", "O", exc) : NULL;
+            Py_XDECREF(exc);
+        } else {
+            result = PyObject_CallMethod(task->future, "set_result", "O", (PyObject *)adapter);
+        }
+        if (result) {
+            Py_DECREF(result);
+        } else {
+            PyErr_WriteUnraisable(task->future);
+        }
+        Py_DECREF(adapter);
+        Py_DECREF(task->future);
+        Py_XDECREF(task->progress);
+        delete task;
+    }
+    // only once the GIL is released, as the interpreter may finalize next
+    open_finished(interp);
+}
+
+static PyObject * Adapter_open_async(PyTypeObject * type, PyObject * args, PyObject * kwargs) {
+    const char * dev = NULL;
+    char * device_name = "python-cec";
+    cec_device_type device_type = CEC_DEVICE_TYPE_RECORDING_DEVICE;
+    int monitor = 0;
+    PyObject * capture = NULL;
+    PyObject * progress = Py_None;
+    char * keywords[] = { "dev", "name", "type", "monitor", "capture", "progress", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|$ssipO&O:open_async", keywords,
+            &dev, &device_name, &device_type, &monitor,
+            PyUnicode_FSConverter, &capture, &progress)) {
+        return NULL;
+    }
+    if (progress != Py_None && !PyCallable_Check(progress)) {
+        PyErr_SetString(PyExc_TypeError, "progress must be callable");
+        Py_XDECREF(capture);
+        return NULL;
+    }
+
+    PyObject * futures = PyImport_ImportModule("concurrent.futures");
+    if (!futures) {
+        Py_XDECREF(capture);
+        return NULL;
+    }
+    PyObject * future = PyObject_CallMethod(futures, "Future", NULL);
+    Py_DECREF(futures);
+    if (!future) {
+        Py_XDECREF(capture);
+        return NULL;
+    }
+    // the open can't be cancelled once started
+    PyObject * running = PyObject_CallMethod(future, "set_running_or_notify_cancel", NULL);
+    if (!running) {
+        Py_DECREF(future);
+        Py_XDECREF(capture);
+        return NULL;
+    }
+    Py_DECREF(running);
+
+    Adapter * self = adapter_setup(type, device_name, device_type, monitor, capture);
+    if (!self) {
+        Py_DECREF(future);
+        return NULL;
+    }
+
+    // the task owns the references to the adapter and the future until the
+    // open is done
+    OpenTask * task = new OpenTask();
+    task->adapter = self;
+    task->future = future;
+    Py_INCREF(future);
+    task->progress = progress == Py_None ? NULL : progress;
+    Py_XINCREF(task->progress);
+    task->has_dev = dev != NULL;
+    if (dev) {
+        task->dev = dev;
+    }
+    if (!open_started(self->interp)) {
+        Py_DECREF(self);
+        Py_DECREF(future);
+        Py_XDECREF(task->progress);
+        delete task;
+        Py_DECREF(future);
+        return NULL;
+    }
+    try {
+        std::thread(open_task_run, task).detach();
+    } catch (std::system_error &) {
+        open_finished(self->interp);
+        Py_DECREF(self);
+        Py_DECREF(future);
+        Py_XDECREF(task->progress);
+        delete task;
+        Py_DECREF(future);
+        PyErr_SetString(PyExc_RuntimeError, "Failed to start the open thread");
+        return NULL;
+    }
+    return future;
 }
 
 static PyObject * Adapter_str(Adapter * self) {
@@ -869,20 +2470,84 @@ static PyObject * Adapter_repr(Adapter * self) {
 
 
 static PyMethodDef Adapter_methods[] = {
+    {"open_async", (PyCFunction)Adapter_open_async, METH_VARARGS | METH_KEYWORDS | METH_CLASS,
+        "Open an adapter on a thread of its own, returning a concurrent.futures.Future"},
     {"list_devices", (PyCFunction)list_devices, METH_VARARGS, "List devices"},
     {"close", (PyCFunction)adapter_close, METH_NOARGS, "Close the adapter"},
     {"add_callback", (PyCFunction)add_callback, METH_VARARGS, "Add a callback"},
     {"remove_callback", (PyCFunction)remove_callback, METH_VARARGS, "Remove a callback"},
-    {"transmit", (PyCFunction)transmit, METH_VARARGS, "Transmit a raw CEC command"},
+    {"trace_latency", (PyCFunction)trace_latency, METH_VARARGS | METH_KEYWORDS,
+        "Record how long each stage of delivering events to callbacks takes"},
+    {"latency_stats", (PyCFunction)latency_stats, METH_VARARGS | METH_KEYWORDS,
+        "Get latency histograms per event type and stage"},
+    {"callback_stats", (PyCFunction)callback_stats, METH_VARARGS | METH_KEYWORDS,
+        "Get call counts and execution times of each registered callback"},
+    {"set_callback_budget", (PyCFunction)set_callback_budget, METH_VARARGS,
+        "Warn about callbacks running longer than a number of seconds"},
+    {"add_handler", (PyCFunction)add_handler, METH_VARARGS,
+        "Add a native handler, a capsule from an extension module using cec_handler.h"},
+    {"remove_handler", (PyCFunction)remove_handler, METH_VARARGS, "Remove a native handler"},
+    {"add_rule", (PyCFunction)add_rule, METH_VARARGS | METH_KEYWORDS,
+        "Reply to matching commands natively, without calling into Python"},
+    {"remove_rule", (PyCFunction)remove_rule, METH_VARARGS, "Remove a rule by id"},
+    {"rules", (PyCFunction)rules, METH_VARARGS, "List rules and their counters"},
+    {"transmit", (PyCFunction)transmit, METH_VARARGS | METH_KEYWORDS,
+        "Transmit a raw CEC command, retrying failures, and get the outcome"},
+    {"set_retry_policy", (PyCFunction)set_retry_policy, METH_VARARGS | METH_KEYWORDS,
+        "Set how failed transmissions are retried"},
+    {"retry_policy", (PyCFunction)retry_policy, METH_VARARGS,
+        "Get how failed transmissions are retried"},
+    {"transmit_stats", (PyCFunction)transmit_stats, METH_VARARGS | METH_KEYWORDS,
+        "Get transmission outcome counters"},
+    {"record_history", (PyCFunction)record_history, METH_VARARGS | METH_KEYWORDS,
+        "Keep the last capacity frames sent and received, 0 to stop"},
     {"is_active_source", (PyCFunction)is_active_source, METH_VARARGS, "Check active source"},
+    {"state", (PyCFunction)state, METH_VARARGS,
+        "Get the bus state observed from traffic, without querying the bus"},
+    {"watch_power", (PyCFunction)watch_power, METH_VARARGS | METH_KEYWORDS,
+        "Poll the power status of devices in the background, delivering EVENT_POWER_CHANGE"},
+    {"track_presence", (PyCFunction)track_presence, METH_VARARGS | METH_KEYWORDS,
+        "Track which logical addresses have a device, with change events"},
+    {"present_devices", (PyCFunction)present_devices, METH_VARARGS,
+        "Logical addresses with a device, or None when not tracking"},
+    {"auto_reconnect", (PyCFunction)auto_reconnect, METH_VARARGS | METH_KEYWORDS,
+        "Reopen the adapter with backoff when the connection is lost"},
+    {"reconnect_stats", (PyCFunction)reconnect_stats, METH_VARARGS,
+        "Get connection loss, reconnect and downtime counters"},
+    {"cache_metadata", (PyCFunction)cache_metadata, METH_VARARGS | METH_KEYWORDS,
+        "Build devices from a persistent metadata cache file"},
+    {"metadata_stats", (PyCFunction)metadata_stats, METH_VARARGS,
+        "Get metadata cache hit, miss, refresh and invalidation counters, or None"},
+    {"serve_broker", (PyCFunction)serve_broker, METH_VARARGS | METH_KEYWORDS,
+        "Share the adapter with other processes through a local socket"},
+    {"broker_stats", (PyCFunction)broker_stats, METH_VARARGS,
+        "Get broker client, event and transmit counters, or None"},
+    {"capture_stats", (PyCFunction)capture_stats, METH_VARARGS,
+        "Get frames written to and dropped from the capture file, or None"},
     {"set_active_source", (PyCFunction)set_active_source, METH_VARARGS, "Set active source"},
     {"volume_up", (PyCFunction)volume_up, METH_VARARGS, "Volume Up"},
     {"volume_down", (PyCFunction)volume_down, METH_VARARGS, "Volume Down"},
 #if CEC_LIB_VERSION_MAJOR > 1
     {"toggle_mute", (PyCFunction)toggle_mute, METH_VARARGS, "Toggle Mute"},
+    {"audio_status", (PyCFunction)audio_status, METH_VARARGS,
+        "Query the audio system's volume and mute state"},
+    {"set_volume", (PyCFunction)set_volume, METH_VARARGS | METH_KEYWORDS,
+        "Drive the audio system's volume to a level using its reported status"},
 #endif
     {"set_stream_path", (PyCFunction)set_stream_path, METH_VARARGS, "Set HDMI stream path"},
     {"set_physical_addr", (PyCFunction)set_physical_addr, METH_VARARGS, "Set HDMI physical address"},
+    {"topology", (PyCFunction)topology, METH_VARARGS,
+        "Get the known physical address of each logical address"},
+    {"device_at", (PyCFunction)device_at, METH_VARARGS,
+        "Get the logical address at a physical address, or None"},
+    {"devices_behind", (PyCFunction)devices_behind, METH_VARARGS,
+        "List the logical addresses at or below a physical address, nearest first"},
+    {"parent_address", (PyCFunction)parent_address, METH_VARARGS,
+        "Get the physical address upstream of a physical address, or None"},
+    {"child_addresses", (PyCFunction)child_addresses, METH_VARARGS,
+        "List the known physical addresses directly below a physical address"},
+    {"port_path", (PyCFunction)port_path, METH_VARARGS,
+        "Get the input ports leading from the TV to a physical address"},
     {"set_port", (PyCFunction)set_port, METH_VARARGS, "Set upstream HDMI port"},
     {"can_persist_config", (PyCFunction)can_persist_config, METH_VARARGS,
         "return true if the current adapter can persist the CEC configuration"},
@@ -895,43 +2560,36 @@ static PyGetSetDef Adapter_getset[] = {
    {"address", (getter)Adapter_getAddr, (setter)NULL, "Logical Address"},
    {"physical_address", (getter)Adapter_getPhysicalAddress, (setter)NULL, "Physical Addresss"},
    {"vendor", (getter)Adapter_getVendor, (setter)NULL, "Vendor ID"},
+   {"vendor_id", (getter)Adapter_getVendorId, (setter)NULL, "Vendor ID as an int"},
    {"osd_string", (getter)Adapter_getOsdString, (setter)NULL, "OSD String"},
    {"cec_version", (getter)Adapter_getCECVersion, (setter)NULL, "CEC Version"},
    {"language", (getter)Adapter_getLanguage, (setter)NULL, "Language"},
+   {"history", (getter)Adapter_getHistory, (setter)NULL, "Frame history, or None"},
+   {"monitor", (getter)Adapter_getMonitor, (setter)NULL, "Monitor only, without a logical address"},
+   {"config", (getter)Adapter_getConfig, (setter)NULL, "libcec configuration"},
+   {"startup", (getter)Adapter_getStartup, (setter)NULL, "Seconds spent in each phase of opening"},
    {NULL}
 };
 
-static PyTypeObject _AdapterType = {
-   PyVarObject_HEAD_INIT(NULL, 0)
-   "cec.Adapter",              /*tp_name*/
-   sizeof(Adapter),            /*tp_basicsize*/
-   0,                         /*tp_itemsize*/
-   (destructor)Adapter_dealloc, /*tp_dealloc*/
-   0,                         /*tp_print*/
-   0,                         /*tp_getattr*/
-   0,                         /*tp_setattr*/
-   0,                         /*tp_compare*/
-   (reprfunc)Adapter_repr,     /*tp_repr*/
-   0,                         /*tp_as_number*/
-   0,                         /*tp_as_sequence*/
-   0,                         /*tp_as_mapping*/
-   0,                         /*tp_hash */
-   0,                         /*tp_call*/
-   (reprfunc)Adapter_str,      /*tp_str*/
-   0,                         /*tp_getattro*/
-   0,                         /*tp_setattro*/
-   0,                         /*tp_as_buffer*/
-   Py_TPFLAGS_DEFAULT,        /*tp_flags*/
-   "CEC Adapter objects",      /* tp_doc */
+static PyType_Slot Adapter_slots[] = {
+   {Py_tp_dealloc, (void *)Adapter_dealloc},
+   {Py_tp_repr, (void *)Adapter_repr},
+   {Py_tp_str, (void *)Adapter_str},
+   {Py_tp_doc, (void *)"CEC Adapter objects"},
+   {Py_tp_methods, Adapter_methods},
+   {Py_tp_getset, Adapter_getset},
+   {Py_tp_new, (void *)Adapter_new},
+   {0, NULL}
 };
 
-PyTypeObject * AdapterTypeInit() {
-   _AdapterType.tp_new = Adapter_new;
-   _AdapterType.tp_methods = Adapter_methods;
-   _AdapterType.tp_getset = Adapter_getset;
-   return &_AdapterType;
-}
+static PyType_Spec Adapter_spec = {
+   "cec.Adapter",
+   sizeof(Adapter),
+   0,
+   CEC_TYPE_FLAGS,
+   Adapter_slots
+};
 
-PyTypeObject * AdapterType() {
-    return &_AdapterType;
+PyTypeObject * AdapterTypeInit(PyObject * module) {
+   return new_type(module, &Adapter_spec);
 }
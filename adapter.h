@@ -22,22 +22,148 @@
  * Author: retsyx <retsyx@gmail.com>
  */
 
+#ifndef CEC_ADAPTER_H
+#define CEC_ADAPTER_H
+
 #define PY_SSIZE_T_CLEAN
 #include <Python.h>
 
+#include <atomic>
 #include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 
 #include <libcec/cec.h>
 
+#include "capture.h"
+#include "config.h"
+#include "handlers.h"
+#include "history.h"
+#include "latency.h"
+#include "metadata.h"
+#include "state.h"
+#include "topology.h"
+#include "poller.h"
+#include "presence.h"
+#include "reconnect.h"
+#include "retry.h"
+#include "rules.h"
+
+// Profile of one registered callback, updated without a lock since handlers
+// may run in parallel on free-threaded builds
+struct CallbackStats {
+    std::atomic<uint64_t> calls;
+    std::atomic<uint64_t> exceptions;
+    std::atomic<uint64_t> overruns; // calls over the time budget
+    std::atomic<uint64_t> total_ns;
+    std::atomic<uint64_t> max_ns;
+
+    CallbackStats() : calls(0), exceptions(0), overruns(0), total_ns(0),
+        max_ns(0) {}
+    void record(double elapsed, bool failed, bool overrun);
+    void reset();
+};
+
 struct Callback {
    public:
       long int event;
       PyObject * cb;
+      std::shared_ptr<CallbackStats> stats;
+
+      Callback(long int e, PyObject * c) : event(e), cb(c),
+         stats(std::make_shared<CallbackStats>()) {}
+};
 
-      Callback(long int e, PyObject * c) : event(e), cb(c) {}
+// Registered Python callbacks. Handlers are called outside the lock, from a
+// snapshot, so they may add and remove callbacks, and so that events from
+// different threads can run handlers in parallel on free-threaded builds.
+class CallbackList {
+    public:
+        // the list takes over the reference to cb
+        void add(long int events, PyObject * cb);
+        void remove(PyObject * cb, long int events);
+        void clear();
+        bool wants(long int event);
+        // new references to the callbacks registered for event, in order
+        void matching(long int event, std::vector<Callback> & out);
+        // every registration, with new references
+        void snapshot(std::vector<Callback> & out);
+
+        // callbacks that run longer than budget seconds are reported with a
+        // RuntimeWarning; 0 disables the check
+        void set_budget(double budget) { time_budget.store(budget); }
+        double budget() { return time_budget.load(); }
+
+        CallbackList() : time_budget(0) {}
+
+    private:
+        std::mutex lock;
+        std::list<Callback> callbacks;
+        std::atomic<double> time_budget;
 };
 
-typedef std::list<Callback> cb_list;
+// An event as received from libcec, before conversion to Python objects.
+// Only the fields of the event's type are set.
+struct Event {
+    long int type;
+    double received;  // monotonic_time() of the libcec callback
+    double acquired;  // when the GIL was taken to deliver it
+    // EVENT_LOG
+    int level;
+    long int time;
+    std::string message;
+    // EVENT_KEYPRESS
+    CEC::cec_user_control_code keycode;
+    unsigned int duration;
+    // EVENT_COMMAND
+    CEC::cec_command command;
+    // EVENT_ALERT
+    CEC::libcec_alert alert;
+    bool has_param;
+    std::string param;
+    // EVENT_MENU_CHANGED
+    CEC::cec_menu_state menu;
+    // EVENT_ACTIVATED, EVENT_POWER_CHANGE and EVENT_DEVICE_*
+    CEC::cec_logical_address address;
+    bool active;
+    CEC::cec_power_status old_status;
+    CEC::cec_power_status status;
+    // EVENT_CONFIG_CHANGE
+    std::shared_ptr<const CEC::libcec_configuration> config;
+    uint32_t changed; // mask of the config fields that changed
+
+    Event(long int type) : type(type), received(monotonic_time()), acquired(0),
+        level(0), time(0),
+        keycode(CEC::CEC_USER_CONTROL_CODE_UNKNOWN), duration(0),
+        alert(CEC::CEC_ALERT_SERVICE_DEVICE), has_param(false),
+        menu(CEC::CEC_MENU_STATE_ACTIVATED), address(CEC::CECDEVICE_UNKNOWN),
+        active(false), old_status(CEC::CEC_POWER_STATUS_UNKNOWN),
+        status(CEC::CEC_POWER_STATUS_UNKNOWN), changed(0) {}
+};
+
+class Broker;
+class EventQueue;
+
+// Seconds spent in each phase of opening an adapter, -1 for phases not run
+struct StartupTimes {
+    double initialise; // CECInitialise() and InitVideoStandalone()
+    double detect;     // looking for the default adapter
+    double open;       // Open(), which negotiates the logical addresses
+    double total;
+
+    StartupTimes() : initialise(-1), detect(-1), open(-1), total(-1) {}
+};
+
+// phases reported while opening
+#define OPEN_INITIALISED     0
+#define OPEN_OPENED          1
+#define OPEN_ADDRESS_CLAIMED 2
+
+struct Adapter;
+typedef void (*OpenProgress)(Adapter * adapter, int phase, double elapsed,
+        void * param);
 
 struct Adapter {
     PyObject_HEAD
@@ -45,16 +171,83 @@ struct Adapter {
     CEC::libcec_configuration config;
     CEC::ICECCallbacks cec_callbacks;
     CEC::ICECAdapter * adapter;
-    cb_list callbacks;
+    CallbackList callbacks;
+    HandlerList handlers;
+    RuleSet rules;
+    LatencyStats latency;
+    RetryState retry;
+    std::atomic<PyObject *> spare_result; // the last cec.TransmitResult
+    std::shared_ptr<HistoryStore> history; // accessed atomically
+    CaptureWriter * capture; // set before the adapter is opened
+    std::shared_ptr<MetadataCache> metadata; // accessed atomically
+    std::shared_ptr<Broker> broker; // accessed atomically
+    std::mutex lock; // guards creating and stopping the helpers below
+    BusState state;
+    Topology topology;
+    PowerPoller * poller;
+    PresenceTracker * presence;
+    Reconnector * reconnector;
+    EventQueue * sink; // set while the adapter belongs to an AdapterPool
+    StartupTimes startup;
+    ConfigTracker reported; // the configuration libcec last reported
+    PyInterpreterState * interp; // the interpreter callbacks run in
 
-    Adapter() : adapter(NULL) {}
+    Adapter() : adapter(NULL), spare_result(NULL), capture(NULL), poller(NULL),
+        presence(NULL), reconnector(NULL), sink(NULL), interp(NULL) {}
     ~Adapter() {}
 };
 
-PyTypeObject * AdapterTypeInit();
-PyTypeObject * AdapterType();
+PyTypeObject * AdapterTypeInit(PyObject * module);
+
+// Allocate an adapter of type configured with an OSD name and device type,
+// ready to be opened. A monitor only adapter claims no logical address and
+// never transmits. Requires the GIL.
+Adapter * adapter_create(PyTypeObject * type, const char * device_name,
+        CEC::cec_device_type device_type, bool monitor);
+
+// Initialise libcec and open dev, or the first adapter found if dev is NULL.
+// Called without the GIL. Returns NULL, or the exception type to raise with
+// the message written to error. progress, if set, is called without the GIL
+// as each OPEN_* phase completes.
+PyObject * adapter_open(Adapter * self, const char * dev, char * error,
+        size_t size, OpenProgress progress = NULL, void * param = NULL);
+
+// Transmit cmd and record each attempt in the frame history and capture. An
+// initiator of CECDEVICE_UNREGISTERED is replaced by the primary logical
+// address. Failed attempts are retried following policy, or the adapter's
+// policy if NULL, and the outcome is stored in result if set. Fails on
+// monitor only adapters. Called without the GIL.
+bool adapter_transmit(Adapter * self, CEC::cec_command & cmd,
+        const RetryPolicy * policy = NULL, TransmitResult * result = NULL);
 
-std::list<CEC::CEC_ADAPTER_TYPE> get_adapters(CEC::ICECAdapter * adapter);
+// Mask of the logical addresses with a device, from the presence tracker
+// when it is running or else from a bus scan. 0 if the adapter is closed.
+// Called without the GIL.
+uint16_t active_devices(Adapter * self);
+
+// parse a physical address given as 'a.b.c.d' or int; -1 with an exception
+// set if it is invalid
+int physical_addr_arg(PyObject * arg);
+
+// callback list management shared by Adapter and AdapterPool; require the GIL
+PyObject * add_callback_to(CallbackList & callbacks, PyObject * args);
+PyObject * remove_callback_from(CallbackList & callbacks, PyObject * args);
+PyObject * trigger_callbacks(CallbackList & callbacks, long int event,
+        PyObject * args);
+// a list of dicts profiling each registered callback, in order
+PyObject * callback_stats_from(CallbackList & callbacks, bool reset);
+
+// the Python arguments of an event, as passed to callbacks
+PyObject * event_args(const Event & event);
+// call the adapter's callbacks for an event; requires the GIL
+void deliver_event(Adapter * self, const Event & event);
+
+// deliver EVENT_POWER_CHANGE from a native thread; acquires the GIL
+void trigger_power_change(Adapter * self, CEC::cec_logical_address addr,
+        CEC::cec_power_status old, CEC::cec_power_status status);
+// deliver EVENT_DEVICE_ADDED or EVENT_DEVICE_REMOVED from a native thread
+void trigger_presence_change(Adapter * self, CEC::cec_logical_address addr,
+        bool present);
 
 /*
  * Compat for libcec 3.x
@@ -62,3 +255,5 @@ std::list<CEC::CEC_ADAPTER_TYPE> get_adapters(CEC::ICECAdapter * adapter);
 #if CEC_LIB_VERSION_MAJOR < 4
   #define CEC_MAX_DATA_PACKET_SIZE (16 * 4)
 #endif
+
+#endif
@@ -0,0 +1,1477 @@
+/* broker.cpp
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Implementation of the adapter broker and its client
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#include "broker.h"
+
+#if HAVE_BROKER
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+
+#include "cec.h"
+#include "adapter.h"
+#include "device.h"
+#include "metadata.h"
+#include "module.h"
+#include "retry.h"
+#include "volume.h"
+
+using namespace CEC;
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static_assert(sizeof(BrokerRequest) % 8 == 0 && sizeof(BrokerMessage) == 24 &&
+        sizeof(BrokerVolume) == 16 && sizeof(BrokerDevice) == 28 &&
+        sizeof(BrokerDeviceState) == 120,
+        "socket messages must not depend on the compiler");
+
+// the largest reply a client accepts
+#define BROKER_MAX_REPLY (sizeof(BrokerState) > 16 * sizeof(BrokerDevice) ? \
+        sizeof(BrokerState) : 16 * sizeof(BrokerDevice))
+
+namespace {
+
+size_t ring_size(unsigned capacity) {
+    return sizeof(BrokerHeader) + capacity * sizeof(BrokerSlot);
+}
+
+void encode_event(const Event & event, BrokerRecord & record) {
+    record.received = event.received;
+    record.type = (int32_t)event.type;
+    record.length = 0;
+    switch (event.type) {
+        case EVENT_LOG:
+            record.level = event.level;
+            record.time = event.time;
+            record.length = (uint16_t)std::min(event.message.size(),
+                    (size_t)BROKER_TEXT_SIZE);
+            memcpy(record.data, event.message.data(), record.length);
+            break;
+        case EVENT_KEYPRESS:
+            record.keycode = event.keycode;
+            record.duration = event.duration;
+            break;
+        case EVENT_COMMAND: {
+            const cec_command & cmd = event.command;
+            record.initiator = cmd.initiator;
+            record.destination = cmd.destination;
+            record.ack = cmd.ack;
+            record.eom = cmd.eom;
+            record.opcode = cmd.opcode;
+            record.opcode_set = cmd.opcode_set;
+            record.size = cmd.parameters.size;
+            memcpy(record.parameters, cmd.parameters.data, cmd.parameters.size);
+            break;
+        }
+        case EVENT_ALERT:
+            record.alert = event.alert;
+            record.has_param = event.has_param;
+            record.length = (uint16_t)std::min(event.param.size(),
+                    (size_t)BROKER_TEXT_SIZE);
+            memcpy(record.data, event.param.data(), record.length);
+            break;
+        case EVENT_MENU_CHANGED:
+            record.menu = event.menu;
+            break;
+        case EVENT_ACTIVATED:
+            record.address = event.address;
+            record.active = event.active;
+            break;
+        case EVENT_POWER_CHANGE:
+            record.address = event.address;
+            record.old_status = event.old_status;
+            record.status = event.status;
+            break;
+        case EVENT_DEVICE_ADDED:
+        case EVENT_DEVICE_REMOVED:
+            record.address = event.address;
+            break;
+        case EVENT_CONFIG_CHANGE:
+            // the library is the same on both ends, so is the layout
+            record.changed = event.changed;
+            record.length = sizeof(libcec_configuration);
+            memcpy(record.data, (const void *)event.config.get(), sizeof(libcec_configuration));
+            break;
+    }
+}
+
+void decode_event(const BrokerRecord & record, Event & event) {
+    // every client can write the ring, don't trust the length
+    size_t length = std::min((size_t)record.length, sizeof(record.data));
+    event.received = record.received;
+    switch (event.type) {
+        case EVENT_LOG:
+            event.level = record.level;
+            event.time = (long int)record.time;
+            event.message.assign((const char *)record.data, length);
+            break;
+        case EVENT_KEYPRESS:
+            event.keycode = (cec_user_control_code)record.keycode;
+            event.duration = record.duration;
+            break;
+        case EVENT_COMMAND: {
+            cec_command & cmd = event.command;
+            cmd.Clear();
+            cmd.initiator = (cec_logical_address)record.initiator;
+            cmd.destination = (cec_logical_address)record.destination;
+            cmd.ack = record.ack;
+            cmd.eom = record.eom;
+            cmd.opcode = (cec_opcode)record.opcode;
+            cmd.opcode_set = record.opcode_set;
+            for (uint8_t i=0; i<record.size && i<CEC_MAX_DATA_PACKET_SIZE; i++) {
+                cmd.parameters.PushBack(record.parameters[i]);
+            }
+            break;
+        }
+        case EVENT_ALERT:
+            event.alert = (libcec_alert)record.alert;
+            event.has_param = record.has_param;
+            event.param.assign((const char *)record.data, length);
+            break;
+        case EVENT_MENU_CHANGED:
+            event.menu = (cec_menu_state)record.menu;
+            break;
+        case EVENT_ACTIVATED:
+            event.address = (cec_logical_address)record.address;
+            event.active = record.active;
+            break;
+        case EVENT_POWER_CHANGE:
+            event.address = (cec_logical_address)record.address;
+            event.old_status = (cec_power_status)record.old_status;
+            event.status = (cec_power_status)record.status;
+            break;
+        case EVENT_DEVICE_ADDED:
+        case EVENT_DEVICE_REMOVED:
+            event.address = (cec_logical_address)record.address;
+            break;
+        case EVENT_CONFIG_CHANGE: {
+            std::shared_ptr<libcec_configuration> config =
+                std::make_shared<libcec_configuration>();
+            memcpy((void *)config.get(), record.data, sizeof(libcec_configuration));
+            event.config = config;
+            event.changed = record.changed;
+            break;
+        }
+    }
+}
+
+template <typename T>
+void encode_value(const Observed<T> & observed, BrokerValue & value) {
+    value.time = observed.time;
+    value.value = (int32_t)observed.value;
+}
+
+template <typename T>
+void decode_value(const BrokerValue & value, Observed<T> & observed) {
+    observed.set((T)value.value, value.time);
+}
+
+void encode_text(const Observed<std::string> & observed, double & time,
+        char * text, size_t size) {
+    time = observed.time;
+    memcpy(text, observed.value.data(), std::min(observed.value.size(), size - 1));
+}
+
+void decode_text(double time, const char * text, size_t size,
+        Observed<std::string> & observed) {
+    observed.set(std::string(text, strnlen(text, size)), time);
+}
+
+void encode_state(const BusStateData & data, BrokerState & state) {
+    memset(&state, 0, sizeof(state));
+    for (int i=0; i<16; i++) {
+        const DeviceState & dev = data.devices[i];
+        BrokerDeviceState & out = state.devices[i];
+        encode_value(dev.power_status, out.power_status);
+        encode_value(dev.physical_address, out.physical_address);
+        encode_value(dev.device_type, out.device_type);
+        encode_value(dev.vendor_id, out.vendor_id);
+        encode_value(dev.cec_version, out.cec_version);
+        encode_text(dev.osd_name, out.osd_name_time, out.osd_name, sizeof(out.osd_name));
+        encode_text(dev.language, out.language_time, out.language, sizeof(out.language));
+    }
+    encode_value(data.active_source, state.active_source);
+    encode_value(data.stream_path, state.stream_path);
+    encode_value(data.system_audio_mode, state.system_audio_mode);
+    encode_value(data.volume, state.volume);
+    encode_value(data.mute, state.mute);
+}
+
+void decode_state(const BrokerState & state, BusStateData & data) {
+    for (int i=0; i<16; i++) {
+        const BrokerDeviceState & in = state.devices[i];
+        DeviceState & dev = data.devices[i];
+        decode_value(in.power_status, dev.power_status);
+        decode_value(in.physical_address, dev.physical_address);
+        decode_value(in.device_type, dev.device_type);
+        decode_value(in.vendor_id, dev.vendor_id);
+        decode_value(in.cec_version, dev.cec_version);
+        decode_text(in.osd_name_time, in.osd_name, sizeof(in.osd_name), dev.osd_name);
+        decode_text(in.language_time, in.language, sizeof(in.language), dev.language);
+    }
+    decode_value(state.active_source, data.active_source);
+    decode_value(state.stream_path, data.stream_path);
+    decode_value(state.system_audio_mode, data.system_audio_mode);
+    decode_value(state.volume, data.volume);
+    decode_value(state.mute, data.mute);
+}
+
+// send or receive all of a message, retrying after signals
+bool send_all(int fd, const void * data, size_t size) {
+    const char * p = (const char *)data;
+    while (size > 0) {
+        ssize_t sent = ::send(fd, p, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        p += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+// false on disconnection, or if block is false and nothing is waiting
+bool receive_all(int fd, void * data, size_t size, bool block) {
+    char * p = (char *)data;
+    while (size > 0) {
+        ssize_t got = recv(fd, p, size, block ? MSG_WAITALL : MSG_DONTWAIT);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return false;
+        }
+        // the rest of a message that has started is on its way
+        block = true;
+        p += got;
+        size -= got;
+    }
+    return true;
+}
+
+void set_cloexec(int fd) {
+    fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+}
+
+bool socket_address(const char * path, sockaddr_un & addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+    return true;
+}
+
+// an unlinked file next to the socket, of size bytes
+int create_ring_file(const char * path, size_t size) {
+    std::vector<char> name(path, path + strlen(path));
+    const char suffix[] = ".ringXXXXXX";
+    name.insert(name.end(), suffix, suffix + sizeof(suffix));
+    int fd = mkstemp(name.data());
+    if (fd < 0) {
+        return -1;
+    }
+    unlink(name.data());
+    set_cloexec(fd);
+    if (ftruncate(fd, size) < 0) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    return fd;
+}
+
+}
+
+/*
+ * Broker
+ */
+
+Broker * Broker::start(Adapter * adapter, const char * path, unsigned capacity) {
+    sockaddr_un addr;
+    if (!socket_address(path, addr)) {
+        return NULL;
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        return NULL;
+    }
+    set_cloexec(listener);
+    // a socket left by a broker that died is replaced, a live one is not
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe >= 0) {
+        if (connect(probe, (sockaddr *)&addr, sizeof(addr)) == 0) {
+            close(probe);
+            close(listener);
+            errno = EADDRINUSE;
+            return NULL;
+        }
+        if (errno == ECONNREFUSED) {
+            unlink(path);
+        }
+        close(probe);
+    }
+    int ring_fd = -1;
+    void * map = MAP_FAILED;
+    int wake[2] = { -1, -1 };
+    size_t size = ring_size(capacity);
+    if (bind(listener, (sockaddr *)&addr, sizeof(addr)) < 0 ||
+            listen(listener, BROKER_MAX_CLIENTS) < 0 ||
+            (ring_fd = create_ring_file(path, size)) < 0 ||
+            (map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                ring_fd, 0)) == MAP_FAILED ||
+            pipe(wake) < 0) {
+        int error = errno;
+        if (map != MAP_FAILED) {
+            munmap(map, size);
+        }
+        if (ring_fd >= 0) {
+            close(ring_fd);
+        }
+        close(listener);
+        unlink(path);
+        errno = error;
+        return NULL;
+    }
+    set_cloexec(wake[0]);
+    set_cloexec(wake[1]);
+
+    BrokerHeader * header = (BrokerHeader *)map;
+    memcpy(header->magic, BROKER_MAGIC, sizeof(header->magic));
+    header->slot_size = sizeof(BrokerSlot);
+    header->capacity = capacity;
+
+    Broker * broker = new Broker(adapter, path, listener, ring_fd, map, size,
+            wake[0], wake[1]);
+    broker->thread = std::thread(&Broker::run, broker);
+    return broker;
+}
+
+Broker::Broker(Adapter * adapter, const char * path, int listener, int ring_fd,
+        void * map, size_t size, int wake_read, int wake_write) :
+    adapter(adapter), path(path, path + strlen(path) + 1), listener(listener),
+    ring_fd(ring_fd), map(map), size(size), header((BrokerHeader *)map),
+    slots((BrokerSlot *)((char *)map + sizeof(BrokerHeader))),
+    wake_read(wake_read), wake_write(wake_write), running(true),
+    connections(0), published(0), transmits(0), calls(0), wakeups(0) {}
+
+Broker::~Broker() {
+    stop();
+    munmap(map, size);
+    close(ring_fd);
+    close(wake_read);
+    close(wake_write);
+}
+
+void Broker::publish(const Event & event) {
+    {
+        std::lock_guard<std::mutex> guard(write_lock);
+        uint64_t n = header->head;
+        BrokerSlot & slot = slots[n % header->capacity];
+        __atomic_store_n(&slot.sequence, 0, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        encode_event(event, slot.record);
+        __atomic_store_n(&slot.sequence, n + 1, __ATOMIC_RELEASE);
+        // pairs with the client setting its waiting flag and then checking
+        // the head
+        __atomic_store_n(&header->head, n + 1, __ATOMIC_SEQ_CST);
+    }
+    published++;
+
+    std::lock_guard<std::mutex> guard(lock);
+    for (size_t i=0; i<clients.size(); i++) {
+        Client * client = clients[i];
+        if (__atomic_exchange_n(&header->waiting[client->reader], 0, __ATOMIC_SEQ_CST)) {
+            BrokerMessage message;
+            memset(&message, 0, sizeof(message));
+            message.type = BROKER_WAKE;
+            std::lock_guard<std::mutex> send_guard(client->send_lock);
+            // a waiting client has read everything, there is room
+            ::send(client->fd, &message, sizeof(message), MSG_DONTWAIT | MSG_NOSIGNAL);
+            wakeups++;
+        }
+    }
+}
+
+void Broker::send(Client * client, const BrokerMessage & message,
+        const void * data, size_t length) {
+    std::lock_guard<std::mutex> guard(client->send_lock);
+    if (send_all(client->fd, &message, sizeof(message)) && length) {
+        send_all(client->fd, data, length);
+    }
+}
+
+void Broker::accept_client() {
+    int fd = accept(listener, NULL, NULL);
+    if (fd < 0) {
+        return;
+    }
+    set_cloexec(fd);
+    uint64_t used = 0;
+    for (size_t i=0; i<clients.size(); i++) {
+        used |= 1ULL << clients[i]->reader;
+    }
+    unsigned reader = 0;
+    while (reader < BROKER_MAX_CLIENTS && (used & (1ULL << reader))) {
+        reader++;
+    }
+    if (reader == BROKER_MAX_CLIENTS) {
+        close(fd);
+        return;
+    }
+    __atomic_store_n(&header->waiting[reader], 0, __ATOMIC_RELAXED);
+
+    // registered before the greeting, so that a client that has read the ring
+    // and is waiting is woken by the next event
+    Client * client = new Client();
+    client->fd = fd;
+    client->reader = reader;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        clients.push_back(client);
+    }
+
+    BrokerMessage hello;
+    memset(&hello, 0, sizeof(hello));
+    hello.type = BROKER_HELLO;
+    hello.reader = reader;
+    hello.logical_address = CECDEVICE_UNKNOWN;
+    ICECAdapter * cec = adapter->adapter;
+    if (cec) {
+        libcec_configuration config;
+        hello.logical_address = cec->GetLogicalAddresses().primary;
+        if (cec->GetCurrentConfiguration(&config)) {
+            hello.physical_address = config.iPhysicalAddress;
+        }
+    }
+    // the ring's descriptor goes along with the greeting
+    iovec iov = { &hello, sizeof(hello) };
+    union {
+        cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &ring_fd, sizeof(int));
+    if (sendmsg(fd, &msg, MSG_NOSIGNAL) != (ssize_t)sizeof(hello)) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            clients.pop_back();
+        }
+        delete client;
+        close(fd);
+        return;
+    }
+    client->worker = std::thread(&Broker::work, this, client);
+    connections++;
+}
+
+bool Broker::serve(Client * client) {
+    BrokerRequest request;
+    if (!receive_all(client->fd, &request, sizeof(request), true) ||
+            (request.type != BROKER_TRANSMIT && request.type != BROKER_CALL)) {
+        return false;
+    }
+    std::lock_guard<std::mutex> guard(client->work_lock);
+    client->request = request;
+    client->pending = true;
+    client->work_cond.notify_one();
+    return true;
+}
+
+void Broker::work(Client * client) {
+    std::unique_lock<std::mutex> guard(client->work_lock);
+    while (true) {
+        client->work_cond.wait(guard, [client] {
+            return client->pending || client->closing;
+        });
+        if (client->closing) {
+            break;
+        }
+        BrokerRequest request = client->request;
+        guard.unlock();
+        if (request.type == BROKER_CALL) {
+            call(client, request);
+        } else {
+            transmit(client, request);
+        }
+        guard.lock();
+        client->pending = false;
+        // the poll thread goes back to reading this client's requests
+        char c = 1;
+        while (write(wake_write, &c, 1) < 0 && errno == EINTR) {
+        }
+    }
+    client->done = true;
+}
+
+void Broker::transmit(Client * client, const BrokerRequest & request) {
+    // a client can lower the broker's policy, but only raise it so far
+    RetryPolicy policy = adapter->retry.policy();
+    if (request.attempts > 0) {
+        policy.attempts = std::min((unsigned)request.attempts,
+                std::max(policy.attempts, (unsigned)BROKER_MAX_ATTEMPTS));
+    }
+    if (request.retry_on >= 0) {
+        policy.retry_on = request.retry_on & RETRY_ALL;
+    }
+    if (request.backoff >= 0) {
+        policy.backoff = std::min(request.backoff, policy.max_backoff);
+    }
+    cec_command cmd;
+    cmd.Clear();
+    cmd.initiator = (cec_logical_address)(request.initiator & 0xF);
+    cmd.destination = (cec_logical_address)(request.destination & 0xF);
+    cmd.opcode = (cec_opcode)request.opcode;
+    cmd.opcode_set = 1;
+    for (uint8_t i=0; i<request.size && i<CEC_MAX_DATA_PACKET_SIZE; i++) {
+        cmd.PushBack(request.parameters[i]);
+    }
+    TransmitResult result;
+    adapter_transmit(adapter, cmd, &policy, &result);
+    transmits++;
+
+    BrokerMessage reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.type = BROKER_RESULT;
+    reply.status = result.status;
+    reply.attempts = result.attempts;
+    reply.elapsed = result.elapsed;
+    send(client, reply);
+}
+
+void Broker::call(Client * client, const BrokerRequest & request) {
+    ICECAdapter * cec = adapter->adapter;
+    cec_logical_address addr = (cec_logical_address)(request.destination & 0xF);
+    std::vector<char> data;
+    bool ok = false;
+    switch (request.method) {
+        case BROKER_POWER_ON:
+            ok = cec && cec->PowerOnDevices(addr);
+            break;
+        case BROKER_STANDBY:
+            ok = cec && cec->StandbyDevices(addr);
+            break;
+        case BROKER_SET_ACTIVE_SOURCE:
+            ok = cec && request.parameters[0] <= CEC_DEVICE_TYPE_AUDIO_SYSTEM &&
+                cec->SetActiveSource((cec_device_type)request.parameters[0]);
+            break;
+        case BROKER_VOLUME_UP:
+            ok = cec && cec->VolumeUp();
+            break;
+        case BROKER_VOLUME_DOWN:
+            ok = cec && cec->VolumeDown();
+            break;
+#if CEC_LIB_VERSION_MAJOR > 1
+        case BROKER_TOGGLE_MUTE:
+            ok = cec && cec->AudioToggleMute();
+            break;
+        case BROKER_SET_VOLUME: {
+            // like a transmit's backoff, the broker bounds how long a
+            // client's call may hold up stop()
+            double timeout = std::max(0.0, std::min(request.backoff,
+                        BROKER_MAX_VOLUME_TIMEOUT));
+            VolumeResult result;
+            ok = cec && request.parameters[0] <= 100 &&
+                drive_volume(adapter, request.parameters[0], request.parameters[1],
+                        timeout, result);
+            if (ok) {
+                BrokerVolume volume;
+                memset(&volume, 0, sizeof(volume));
+                volume.status = result.status;
+                volume.reached = result.reached;
+                volume.steps = result.steps;
+                volume.elapsed = result.elapsed;
+                data.assign((const char *)&volume, (const char *)(&volume + 1));
+            }
+            break;
+        }
+#endif
+        case BROKER_LIST_DEVICES: {
+            uint16_t present = active_devices(adapter);
+            for (uint8_t i=0; i<16; i++) {
+                if (!(present & (1 << i))) {
+                    continue;
+                }
+                DeviceMetadata metadata;
+                device_metadata(adapter, (cec_logical_address)i, metadata);
+                BrokerDevice device;
+                memset(&device, 0, sizeof(device));
+                device.address = i;
+                device.cec_version = metadata.cec_version;
+                device.physical_address = metadata.physical_address;
+                device.vendor_id = metadata.vendor_id;
+                memcpy(device.osd_name, metadata.osd_name.data(),
+                        std::min(metadata.osd_name.size(), sizeof(device.osd_name) - 1));
+                memcpy(device.language, metadata.language.data(),
+                        std::min(metadata.language.size(), sizeof(device.language) - 1));
+                data.insert(data.end(), (const char *)&device,
+                        (const char *)(&device + 1));
+            }
+            ok = true;
+            break;
+        }
+        case BROKER_STATE: {
+            BrokerState state;
+            encode_state(adapter->state.snapshot(), state);
+            data.assign((const char *)&state, (const char *)(&state + 1));
+            ok = true;
+            break;
+        }
+    }
+    calls++;
+
+    BrokerMessage reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.type = BROKER_REPLY;
+    reply.status = ok;
+    reply.length = (uint32_t)data.size();
+    send(client, reply, data.data(), data.size());
+}
+
+void Broker::retire(Client * client) {
+    // wake anything blocked on the socket, the fd is closed once the worker
+    // is done with it
+    shutdown(client->fd, SHUT_RDWR);
+    {
+        std::lock_guard<std::mutex> guard(client->work_lock);
+        client->closing = true;
+        client->work_cond.notify_one();
+    }
+    retired.push_back(client);
+}
+
+void Broker::reap(bool wait) {
+    for (size_t i=retired.size(); i-- > 0; ) {
+        Client * client = retired[i];
+        if (!wait) {
+            std::lock_guard<std::mutex> guard(client->work_lock);
+            if (!client->done) {
+                continue;
+            }
+        }
+        client->worker.join();
+        close(client->fd);
+        delete client;
+        retired.erase(retired.begin() + i);
+    }
+}
+
+void Broker::run() {
+    std::vector<pollfd> fds;
+    while (true) {
+        // only this thread changes the client list
+        fds.resize(2 + clients.size());
+        fds[0].fd = wake_read;
+        fds[1].fd = listener;
+        for (size_t i=0; i<fds.size(); i++) {
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+        }
+        for (size_t i=0; i<clients.size(); i++) {
+            fds[2 + i].fd = clients[i]->fd;
+            // a client's next request waits until its worker is free, but
+            // a hangup is still seen
+            std::lock_guard<std::mutex> guard(clients[i]->work_lock);
+            if (clients[i]->pending) {
+                fds[2 + i].events = 0;
+            }
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[0].revents) {
+            // a worker finished, or stop() was called
+            char buf[64];
+            while (read(wake_read, buf, sizeof(buf)) < 0 && errno == EINTR) {
+            }
+            std::lock_guard<std::mutex> guard(lock);
+            if (!running) {
+                break;
+            }
+        }
+        reap(false);
+        // clients first, the indices change once one is accepted or dropped
+        for (size_t i=fds.size(); i-- > 2; ) {
+            if (!fds[i].revents) {
+                continue;
+            }
+            Client * client = clients[i - 2];
+            if (fds[i].revents & (POLLERR | POLLNVAL) || !serve(client)) {
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    clients.erase(clients.begin() + (i - 2));
+                }
+                retire(client);
+            }
+        }
+        if (fds[1].revents & POLLIN) {
+            accept_client();
+        }
+    }
+}
+
+void Broker::stop() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!running) {
+            return;
+        }
+        running = false;
+    }
+    char c = 0;
+    while (write(wake_write, &c, 1) < 0 && errno == EINTR) {
+    }
+    thread.join();
+    std::vector<Client *> remaining;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        remaining.swap(clients);
+    }
+    // workers finish the transmit they are running, which the clamped
+    // policy keeps short
+    for (size_t i=0; i<remaining.size(); i++) {
+        retire(remaining[i]);
+    }
+    reap(true);
+    close(listener);
+    unlink(path.data());
+}
+
+BrokerStats Broker::stats() {
+    BrokerStats stats;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stats.clients = clients.size();
+    }
+    stats.connections = connections;
+    stats.published = published;
+    stats.transmits = transmits;
+    stats.calls = calls;
+    stats.wakeups = wakeups;
+    return stats;
+}
+
+/*
+ * cec.BrokerClient
+ */
+
+struct BrokerClient {
+    PyObject_HEAD
+    int fd;
+    void * map;
+    size_t size;
+    BrokerHeader * header;
+    BrokerSlot * slots;
+    unsigned reader;
+    uint8_t logical_address;
+    uint16_t physical_address;
+    CallbackList callbacks;
+    std::thread thread;
+    std::mutex request_lock; // one transmit at a time
+    std::mutex lock;         // guards the reply and connected
+    std::condition_variable cond;
+    bool replied;
+    BrokerMessage reply;
+    std::vector<char> reply_data;
+    bool connected;
+    std::atomic<unsigned long> received;
+    std::atomic<unsigned long> dropped;
+    std::atomic<PyObject *> spare_result;
+    PyInterpreterState * interp;
+
+    BrokerClient() : fd(-1), map(NULL), size(0), header(NULL), slots(NULL),
+        reader(0), logical_address(CECDEVICE_UNKNOWN), physical_address(0),
+        replied(false), connected(true), received(0), dropped(0),
+        spare_result(NULL), interp(NULL) {}
+};
+
+// events delivered per GIL acquisition
+#define CLIENT_BATCH 64
+
+// the next event at cursor, skipping those overwritten before they were read
+static bool read_event(BrokerClient * self, uint64_t & cursor, Event & event) {
+    uint32_t capacity = self->header->capacity;
+    while (true) {
+        uint64_t head = __atomic_load_n(&self->header->head, __ATOMIC_ACQUIRE);
+        if (cursor >= head) {
+            return false;
+        }
+        if (head - cursor > capacity) {
+            self->dropped += head - capacity - cursor;
+            cursor = head - capacity;
+        }
+        BrokerSlot & slot = self->slots[cursor % capacity];
+        uint64_t sequence = __atomic_load_n(&slot.sequence, __ATOMIC_ACQUIRE);
+        BrokerRecord record;
+        if (sequence == cursor + 1) {
+            memcpy(&record, &slot.record, sizeof(record));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        }
+        if (sequence != cursor + 1 ||
+                __atomic_load_n(&slot.sequence, __ATOMIC_RELAXED) != sequence) {
+            // the broker lapped us while we read
+            self->dropped++;
+            cursor++;
+            continue;
+        }
+        cursor++;
+        event = Event(record.type);
+        decode_event(record, event);
+        return true;
+    }
+}
+
+static void deliver_events(BrokerClient * self, std::vector<Event> & events) {
+    InterpreterLock gil(self->interp);
+    for (size_t i=0; i<events.size(); i++) {
+        events[i].acquired = monotonic_time();
+        PyObject * args = event_args(events[i]);
+        if (args) {
+            PyObject * result = trigger_callbacks(self->callbacks, events[i].type, args);
+            Py_XDECREF(result);
+            Py_DECREF(args);
+        }
+        if (PyErr_Occurred()) {
+            PyErr_Print();
+        }
+    }
+    events.clear();
+}
+
+// false if the broker went away, or sent more than any reply holds
+static bool handle_message(BrokerClient * self, const BrokerMessage & message) {
+    std::vector<char> data;
+    if (message.type == BROKER_REPLY) {
+        if (message.length > BROKER_MAX_REPLY) {
+            return false;
+        }
+        data.resize(message.length);
+        if (message.length && !receive_all(self->fd, data.data(), data.size(), true)) {
+            return false;
+        }
+    }
+    if (message.type == BROKER_RESULT || message.type == BROKER_REPLY) {
+        std::lock_guard<std::mutex> guard(self->lock);
+        self->reply = message;
+        self->reply_data.swap(data);
+        self->replied = true;
+        self->cond.notify_all();
+    }
+    return true;
+}
+
+// reads the ring from cursor and the socket until the broker or close()
+// disconnects
+static void client_run(BrokerClient * self, uint64_t cursor) {
+    std::vector<Event> events;
+    BrokerMessage message;
+    while (true) {
+        Event event(EVENT_LOG);
+        while (read_event(self, cursor, event)) {
+            self->received++;
+            if (self->callbacks.wants(event.type)) {
+                events.push_back(event);
+                if (events.size() >= CLIENT_BATCH) {
+                    deliver_events(self, events);
+                }
+            }
+        }
+        if (!events.empty()) {
+            deliver_events(self, events);
+        }
+        // results are picked up between events, not only when idle
+        bool alive = true;
+        while (alive && receive_all(self->fd, &message, sizeof(message), false)) {
+            alive = handle_message(self, message);
+        }
+        if (!alive) {
+            break;
+        }
+        __atomic_store_n(&self->header->waiting[self->reader], 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&self->header->head, __ATOMIC_SEQ_CST) != cursor) {
+            __atomic_store_n(&self->header->waiting[self->reader], 0, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (!receive_all(self->fd, &message, sizeof(message), true) ||
+                !handle_message(self, message)) {
+            break;
+        }
+    }
+    std::lock_guard<std::mutex> guard(self->lock);
+    self->connected = false;
+    self->cond.notify_all();
+}
+
+PyObject * broker_connect(PyObject * module, PyObject * args) {
+    PyObject * bytes;
+    if (!PyArg_ParseTuple(args, "O&:connect_broker", PyUnicode_FSConverter, &bytes)) {
+        return NULL;
+    }
+    const char * path = PyBytes_AS_STRING(bytes);
+    sockaddr_un addr;
+    int fd = -1;
+    int ring_fd = -1;
+    void * map = MAP_FAILED;
+    size_t size = 0;
+    BrokerMessage hello;
+    bool valid = false;
+    int error = 0;
+    Py_BEGIN_ALLOW_THREADS
+    if (socket_address(path, addr) && (fd = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0) {
+        set_cloexec(fd);
+        iovec iov = { &hello, sizeof(hello) };
+        union {
+            cmsghdr align;
+            char buf[CMSG_SPACE(sizeof(int))];
+        } control;
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        struct stat st;
+        if (connect(fd, (sockaddr *)&addr, sizeof(addr)) == 0 &&
+                recvmsg(fd, &msg, MSG_WAITALL) == (ssize_t)sizeof(hello)) {
+            cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+            if (hello.type == BROKER_HELLO && cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+                    cmsg->cmsg_type == SCM_RIGHTS) {
+                memcpy(&ring_fd, CMSG_DATA(cmsg), sizeof(int));
+                set_cloexec(ring_fd);
+            }
+        }
+        if (ring_fd >= 0 && fstat(ring_fd, &st) == 0 &&
+                (size_t)st.st_size >= sizeof(BrokerHeader)) {
+            size = st.st_size;
+            map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, ring_fd, 0);
+        }
+        if (map != MAP_FAILED) {
+            BrokerHeader * header = (BrokerHeader *)map;
+            valid = memcmp(header->magic, BROKER_MAGIC, sizeof(header->magic)) == 0 &&
+                header->slot_size == sizeof(BrokerSlot) && header->capacity > 0 &&
+                ring_size(header->capacity) <= size &&
+                hello.reader < BROKER_MAX_CLIENTS;
+        }
+    }
+    error = errno;
+    if (ring_fd >= 0) {
+        // the mapping stays valid
+        close(ring_fd);
+    }
+    if (!valid) {
+        if (map != MAP_FAILED) {
+            munmap(map, size);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    Py_END_ALLOW_THREADS
+    if (!valid) {
+        if (map != MAP_FAILED) {
+            PyErr_Format(PyExc_OSError, "%s is not a compatible python-cec broker", path);
+        } else {
+            errno = error ? error : ECONNREFUSED;
+            PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        }
+        Py_DECREF(bytes);
+        return NULL;
+    }
+    Py_DECREF(bytes);
+
+    PyTypeObject * type = module_state(module)->broker_client_type;
+    BrokerClient * self = (BrokerClient *)type->tp_alloc(type, 0);
+    if (!self) {
+        munmap(map, size);
+        close(fd);
+        return NULL;
+    }
+    new (self) BrokerClient();
+    self->fd = fd;
+    self->map = map;
+    self->size = size;
+    self->header = (BrokerHeader *)map;
+    self->slots = (BrokerSlot *)((char *)map + sizeof(BrokerHeader));
+    self->reader = hello.reader;
+    self->logical_address = hello.logical_address;
+    self->physical_address = hello.physical_address;
+    self->interp = current_interpreter();
+    // events are delivered from the first one published after connecting,
+    // not from whenever the thread gets to run
+    uint64_t cursor = __atomic_load_n(&self->header->head, __ATOMIC_ACQUIRE);
+    self->thread = std::thread(client_run, self, cursor);
+    return (PyObject *)self;
+}
+
+// stop reading; the thread is joined unless this is a callback running on it
+static void client_close(BrokerClient * self) {
+    if (self->fd >= 0) {
+        shutdown(self->fd, SHUT_RDWR);
+    }
+    if (self->thread.joinable() && self->thread.get_id() != std::this_thread::get_id()) {
+        self->thread.join();
+    }
+}
+
+static void BrokerClient_dealloc(BrokerClient * self) {
+    Py_BEGIN_ALLOW_THREADS
+    client_close(self);
+    Py_END_ALLOW_THREADS
+    if (self->thread.joinable()) {
+        // dropped by its own callback, the thread finishes on its own
+        self->thread.detach();
+    }
+    self->callbacks.clear();
+    Py_XDECREF(self->spare_result.exchange(NULL));
+    if (self->fd >= 0) {
+        close(self->fd);
+    }
+    if (self->map) {
+        munmap(self->map, self->size);
+    }
+    self->~BrokerClient();
+    free_instance((PyObject *)self);
+}
+
+static PyObject * BrokerClient_close(BrokerClient * self, PyObject * args) {
+    Py_BEGIN_ALLOW_THREADS
+    client_close(self);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+// Send a request and wait for the broker's answer, taking the data of a
+// reply. False once disconnected. Called without the GIL.
+static bool client_request(BrokerClient * self, const BrokerRequest & request,
+        BrokerMessage & reply, std::vector<char> & data) {
+    std::lock_guard<std::mutex> request_guard(self->request_lock);
+    {
+        std::lock_guard<std::mutex> guard(self->lock);
+        self->replied = false;
+    }
+    if (!self->connected || !send_all(self->fd, &request, sizeof(request))) {
+        return false;
+    }
+    std::unique_lock<std::mutex> guard(self->lock);
+    while (!self->replied && self->connected) {
+        self->cond.wait(guard);
+    }
+    if (!self->replied) {
+        return false;
+    }
+    reply = self->reply;
+    data.swap(self->reply_data);
+    return true;
+}
+
+// Call an Adapter method through the broker, expecting size bytes of data
+// back if it succeeds. Returns whether it succeeded, or -1 with IOError set.
+static int client_call(BrokerClient * self, uint8_t method, BrokerRequest & request,
+        std::vector<char> & data, size_t size = 0) {
+    request.type = BROKER_CALL;
+    request.method = method;
+    BrokerMessage reply;
+    bool answered;
+    Py_BEGIN_ALLOW_THREADS
+    answered = client_request(self, request, reply, data);
+    Py_END_ALLOW_THREADS
+    if (!answered) {
+        PyErr_SetString(PyExc_IOError, "Not connected to the broker");
+        return -1;
+    }
+    if (reply.status && size && data.size() % size != 0) {
+        PyErr_SetString(PyExc_IOError, "Invalid reply from the broker");
+        return -1;
+    }
+    return reply.status ? 1 : 0;
+}
+
+static PyObject * BrokerClient_transmit(BrokerClient * self, PyObject * args,
+        PyObject * kwargs) {
+    unsigned char initiator = CECDEVICE_UNREGISTERED;
+    unsigned char destination;
+    unsigned char opcode;
+    const char * params = NULL;
+    Py_ssize_t param_count = 0;
+    PyObject * attempts = NULL;
+    PyObject * backoff = NULL;
+    PyObject * retry_on = NULL;
+    static const char * keywords[] = { "destination", "opcode", "parameters",
+        "initiator", "attempts", "backoff", "retry_on", NULL };
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "bb|s#bOOO:transmit",
+            (char **)keywords, &destination, &opcode, &params, &param_count,
+            &initiator, &attempts, &backoff, &retry_on)) {
+        return NULL;
+    }
+    if (destination > 15 || initiator > 15) {
+        PyErr_SetString(PyExc_ValueError, "Logical address must be between 0 and 15");
+        return NULL;
+    }
+    if (param_count > CEC_MAX_DATA_PACKET_SIZE) {
+        PyErr_Format(PyExc_ValueError, "Too many parameters, maximum is %d",
+                CEC_MAX_DATA_PACKET_SIZE);
+        return NULL;
+    }
+    // validated here, applied by the broker to its own policy
+    RetryPolicy policy;
+    if (retry_policy_args(policy, attempts, backoff, NULL, NULL, retry_on) < 0) {
+        return NULL;
+    }
+    BrokerRequest request;
+    memset(&request, 0, sizeof(request));
+    request.type = BROKER_TRANSMIT;
+    request.initiator = initiator;
+    request.destination = destination;
+    request.opcode = opcode;
+    request.size = (uint8_t)param_count;
+    memcpy(request.parameters, params, param_count);
+    request.attempts = attempts && attempts != Py_None ? policy.attempts : 0;
+    request.retry_on = retry_on && retry_on != Py_None ? policy.retry_on : -1;
+    request.backoff = backoff && backoff != Py_None ? policy.backoff : -1;
+
+    TransmitResult result;
+    result.status = TRANSMIT_FAILED;
+    result.attempts = 0;
+    result.elapsed = 0;
+    BrokerMessage reply;
+    std::vector<char> data;
+    Py_BEGIN_ALLOW_THREADS
+    if (client_request(self, request, reply, data)) {
+        result.status = reply.status;
+        result.attempts = reply.attempts;
+        result.elapsed = reply.elapsed;
+    }
+    Py_END_ALLOW_THREADS
+    return transmit_result((PyObject *)self, self->spare_result, result);
+}
+
+static PyObject * client_power(BrokerClient * self, PyObject * args,
+        const char * format, uint8_t method) {
+    unsigned char addr;
+    if (!PyArg_ParseTuple(args, format, &addr)) {
+        return NULL;
+    }
+    if (addr > 15) {
+        PyErr_SetString(PyExc_ValueError, "Logical address must be between 0 and 15");
+        return NULL;
+    }
+    BrokerRequest request;
+    memset(&request, 0, sizeof(request));
+    request.destination = addr;
+    std::vector<char> data;
+    int ok = client_call(self, method, request, data);
+    return ok < 0 ? NULL : PyBool_FromLong(ok);
+}
+
+static PyObject * BrokerClient_power_on(BrokerClient * self, PyObject * args) {
+    return client_power(self, args, "b:power_on", BROKER_POWER_ON);
+}
+
+static PyObject * BrokerClient_standby(BrokerClient * self, PyObject * args) {
+    return client_power(self, args, "b:standby", BROKER_STANDBY);
+}
+
+static PyObject * BrokerClient_set_active_source(BrokerClient * self, PyObject * args) {
+    unsigned char devtype = (unsigned char)CEC_DEVICE_TYPE_RESERVED;
+    if (!PyArg_ParseTuple(args, "|b:set_active_source", &devtype)) {
+        return NULL;
+    }
+    if (devtype > 5) {
+        PyErr_SetString(PyExc_ValueError, "Device type must be between 0 and 5");
+        return NULL;
+    }
+    BrokerRequest request;
+    memset(&request, 0, sizeof(request));
+    request.parameters[0] = devtype;
+    std::vector<char> data;
+    int ok = client_call(self, BROKER_SET_ACTIVE_SOURCE, request, data);
+    return ok < 0 ? NULL : PyBool_FromLong(ok);
+}
+
+static PyObject * client_key(BrokerClient * self, uint8_t method) {
+    BrokerRequest request;
+    memset(&request, 0, sizeof(request));
+    std::vector<char> data;
+    int ok = client_call(self, method, request, data);
+    return ok < 0 ? NULL : PyBool_FromLong(ok);
+}
+
+static PyObject * BrokerClient_volume_up(BrokerClient * self, PyObject * args) {
+    return client_key(self, BROKER_VOLUME_UP);
+}
+
+static PyObject * BrokerClient_volume_down(BrokerClient * self, PyObject * args) {
+    return client_key(self, BROKER_VOLUME_DOWN);
+}
+
+static PyObject * BrokerClient_toggle_mute(BrokerClient * self, PyObject * args) {
+    return client_key(self, BROKER_TOGGLE_MUTE);
+}
+
+static PyObject * BrokerClient_set_volume(BrokerClient * self, PyObject * args,
+        PyObject * kwargs) {
+    int level;
+    double timeout = 2.0;
+    int unmute = 1;
+    static const char * keywords[] = { "level", "timeout", "unmute", NULL };
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i|dp:set_volume",
+            (char **)keywords, &level, &timeout, &unmute)) {
+        return NULL;
+    }
+    if (level < 0 || level > 100) {
+        PyErr_SetString(PyExc_ValueError, "level must be between 0 and 100");
+        return NULL;
+    }
+    BrokerRequest request;
+    memset(&request, 0, sizeof(request));
+    request.parameters[0] = (uint8_t)level;
+    request.parameters[1] = (uint8_t)unmute;
+    request.backoff = timeout;
+    std::vector<char> data;
+    int ok = client_call(self, BROKER_SET_VOLUME, request, data, sizeof(BrokerVolume));
+    if (ok < 0) {
+        return NULL;
+    }
+    if (!ok || data.size() != sizeof(BrokerVolume)) {
+        PyErr_SetString(PyExc_IOError, "The audio system did not report its status");
+        return NULL;
+    }
+    BrokerVolume volume;
+    memcpy(&volume, data.data(), sizeof(volume));
+    return Py_BuildValue("{sOsisOsIsd}",
+            "reached", volume.reached ? Py_True : Py_False,
+            "volume", volume.status & AUDIO_VOLUME_MASK,
+            "muted", (volume.status & AUDIO_MUTE_MASK) ? Py_True : Py_False,
+            "steps", volume.steps,
+            "elapsed", volume.elapsed);
+}
+
+static PyObject * BrokerClient_list_devices(BrokerClient * self, PyObject * args) {
+    BrokerRequest request;
+    memset(&request, 0, sizeof(request));
+    std::vector<char> data;
+    if (client_call(self, BROKER_LIST_DEVICES, request, data, sizeof(BrokerDevice)) < 0) {
+        return NULL;
+    }
+    PyObject * result = PyDict_New();
+    if (!result) {
+        return NULL;
+    }
+    for (size_t i=0; i + sizeof(BrokerDevice) <= data.size(); i += sizeof(BrokerDevice)) {
+        BrokerDevice device;
+        memcpy(&device, &data[i], sizeof(device));
+        device.osd_name[sizeof(device.osd_name) - 1] = '\0';
+        device.language[sizeof(device.language) - 1] = '\0';
+        // the attributes of the Device object the broker would build
+        char vendor[7];
+        snprintf(vendor, sizeof(vendor), "%06" PRIX32, device.vendor_id & 0xFFFFFF);
+        char addr[8];
+        format_physical_addr(device.physical_address, addr);
+        PyObject * dev = Py_BuildValue("{ssssskssssss}",
+                "physical_address", addr,
+                "vendor", vendor,
+                "vendor_id", (unsigned long)device.vendor_id,
+                "cec_version", cec_version_str((cec_version)device.cec_version),
+                "osd_string", device.osd_name,
+                "language", device.language);
+        PyObject * key = dev ? PyLong_FromLong(device.address) : NULL;
+        int failed = !key || PyDict_SetItem(result, key, dev) < 0;
+        Py_XDECREF(key);
+        Py_XDECREF(dev);
+        if (failed) {
+            Py_DECREF(result);
+            return NULL;
+        }
+    }
+    return result;
+}
+
+static PyObject * BrokerClient_state(BrokerClient * self, PyObject * args) {
+    BrokerRequest request;
+    memset(&request, 0, sizeof(request));
+    std::vector<char> data;
+    int ok = client_call(self, BROKER_STATE, request, data, sizeof(BrokerState));
+    if (ok < 0) {
+        return NULL;
+    }
+    if (!ok || data.size() != sizeof(BrokerState)) {
+        PyErr_SetString(PyExc_IOError, "Invalid reply from the broker");
+        return NULL;
+    }
+    BrokerState state;
+    memcpy(&state, data.data(), sizeof(state));
+    BusStateData snapshot;
+    decode_state(state, snapshot);
+    return convert_state(snapshot);
+}
+
+static PyObject * BrokerClient_add_callback(BrokerClient * self, PyObject * args) {
+    return add_callback_to(self->callbacks, args);
+}
+
+static PyObject * BrokerClient_remove_callback(BrokerClient * self, PyObject * args) {
+    return remove_callback_from(self->callbacks, args);
+}
+
+static PyObject * BrokerClient_stats(BrokerClient * self, PyObject * args) {
+    return Py_BuildValue("{sksk}",
+            "received", self->received.load(),
+            "dropped", self->dropped.load());
+}
+
+static PyObject * BrokerClient_getAddr(BrokerClient * self, void * closure) {
+    return Py_BuildValue("b", self->logical_address);
+}
+
+static PyObject * BrokerClient_getPhysicalAddress(BrokerClient * self, void * closure) {
+    char addr[8];
+    format_physical_addr(self->physical_address, addr);
+    return PyUnicode_FromString(addr);
+}
+
+static PyObject * BrokerClient_getConnected(BrokerClient * self, void * closure) {
+    bool connected;
+    Py_BEGIN_ALLOW_THREADS
+    {
+        std::lock_guard<std::mutex> guard(self->lock);
+        connected = self->connected;
+    }
+    Py_END_ALLOW_THREADS
+    return PyBool_FromLong(connected);
+}
+
+static PyMethodDef BrokerClient_methods[] = {
+   {"transmit", (PyCFunction)BrokerClient_transmit, METH_VARARGS | METH_KEYWORDS,
+      "Transmit a raw CEC command through the broker's adapter"},
+   {"power_on", (PyCFunction)BrokerClient_power_on, METH_VARARGS,
+      "Power on a device"},
+   {"standby", (PyCFunction)BrokerClient_standby, METH_VARARGS,
+      "Put a device in standby"},
+   {"set_active_source", (PyCFunction)BrokerClient_set_active_source, METH_VARARGS,
+      "Set active source"},
+   {"volume_up", (PyCFunction)BrokerClient_volume_up, METH_NOARGS, "Volume Up"},
+   {"volume_down", (PyCFunction)BrokerClient_volume_down, METH_NOARGS, "Volume Down"},
+   {"toggle_mute", (PyCFunction)BrokerClient_toggle_mute, METH_NOARGS, "Toggle Mute"},
+   {"set_volume", (PyCFunction)BrokerClient_set_volume, METH_VARARGS | METH_KEYWORDS,
+      "Drive the audio system's volume to a level using its reported status"},
+   {"list_devices", (PyCFunction)BrokerClient_list_devices, METH_NOARGS,
+      "Get the attributes of each device on the bus"},
+   {"state", (PyCFunction)BrokerClient_state, METH_NOARGS,
+      "Get the bus state observed by the broker's adapter"},
+   {"add_callback", (PyCFunction)BrokerClient_add_callback, METH_VARARGS,
+      "Add a callback"},
+   {"remove_callback", (PyCFunction)BrokerClient_remove_callback, METH_VARARGS,
+      "Remove a callback"},
+   {"stats", (PyCFunction)BrokerClient_stats, METH_NOARGS,
+      "Get counters of events received and lost to a full ring"},
+   {"close", (PyCFunction)BrokerClient_close, METH_NOARGS, "Disconnect from the broker"},
+   {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef BrokerClient_getset[] = {
+   {"address", (getter)BrokerClient_getAddr, (setter)NULL,
+      "Logical address of the broker's adapter"},
+   {"physical_address", (getter)BrokerClient_getPhysicalAddress, (setter)NULL,
+      "Physical address of the broker's adapter"},
+   {"connected", (getter)BrokerClient_getConnected, (setter)NULL,
+      "Still connected to the broker"},
+   {NULL}
+};
+
+static PyType_Slot BrokerClient_slots[] = {
+   {Py_tp_dealloc, (void *)BrokerClient_dealloc},
+   {Py_tp_doc, (void *)"Connection to an adapter served by another process"},
+   {Py_tp_methods, BrokerClient_methods},
+   {Py_tp_getset, BrokerClient_getset},
+   {0, NULL}
+};
+
+// only created by connect_broker
+static PyType_Spec BrokerClient_spec = {
+   "cec.BrokerClient",
+   sizeof(BrokerClient),
+   0,
+#if PY_VERSION_HEX >= 0x030A0000
+   CEC_TYPE_FLAGS | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+#else
+   CEC_TYPE_FLAGS,
+#endif
+   BrokerClient_slots
+};
+
+PyTypeObject * BrokerClientTypeInit(PyObject * module) {
+   PyTypeObject * type = new_type(module, &BrokerClient_spec);
+#if PY_VERSION_HEX < 0x030A0000
+   if (type) {
+      type->tp_new = NULL;
+   }
+#endif
+   return type;
+}
+
+#else
+
+PyObject * broker_connect(PyObject * module, PyObject * args) {
+    PyErr_SetString(PyExc_NotImplementedError,
+            "The broker is not supported on this platform");
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,307 @@
+/* broker.h
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Local broker sharing one adapter between processes
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#ifndef CEC_BROKER_H
+#define CEC_BROKER_H
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <libcec/cec.h>
+
+#include "adapter.h"
+
+// the broker uses Unix domain sockets, passing the ring with SCM_RIGHTS
+#ifndef _WIN32
+#define HAVE_BROKER 1
+#else
+#define HAVE_BROKER 0
+#endif
+
+#define BROKER_MAGIC       "PYCECBR2"
+#define BROKER_MAX_CLIENTS 32
+// the longest log message or alert parameter carried, longer ones are cut
+#define BROKER_TEXT_SIZE   256
+// the most attempts a client may ask for, unless the broker's policy allows
+// more; a client's backoff is limited by the policy's max_backoff
+#define BROKER_MAX_ATTEMPTS 5
+// the longest a client's set_volume() may keep driving the volume
+#define BROKER_MAX_VOLUME_TIMEOUT 10.0
+
+// An event in the ring. Text and configurations are stored in data.
+struct BrokerRecord {
+    double received;
+    int32_t type;
+    int32_t level;            // EVENT_LOG
+    int64_t time;
+    int32_t keycode;          // EVENT_KEYPRESS
+    uint32_t duration;
+    int32_t alert;            // EVENT_ALERT
+    int32_t menu;             // EVENT_MENU_CHANGED
+    int32_t address;          // EVENT_ACTIVATED, EVENT_POWER_CHANGE and EVENT_DEVICE_*
+    int32_t old_status;
+    int32_t status;
+    uint32_t changed;         // EVENT_CONFIG_CHANGE
+    uint8_t active;
+    uint8_t has_param;
+    uint8_t initiator;        // EVENT_COMMAND
+    uint8_t destination;
+    uint8_t ack;
+    uint8_t eom;
+    uint8_t opcode;
+    uint8_t opcode_set;
+    uint8_t size;
+    uint8_t parameters[CEC_MAX_DATA_PACKET_SIZE];
+    uint16_t length;          // bytes used in data
+    uint8_t data[sizeof(CEC::libcec_configuration) > BROKER_TEXT_SIZE ?
+        sizeof(CEC::libcec_configuration) : BROKER_TEXT_SIZE];
+};
+
+struct BrokerSlot {
+    uint64_t sequence;        // event number plus one, 0 while written
+    BrokerRecord record;
+};
+
+// The start of the ring, shared by the broker and its clients
+struct BrokerHeader {
+    char magic[8];
+    uint32_t slot_size;
+    uint32_t capacity;
+    uint64_t head;            // events published
+    // set by a client about to wait for events, cleared by the broker when
+    // it sends the client a wakeup
+    uint32_t waiting[BROKER_MAX_CLIENTS];
+};
+
+// socket messages, of fixed size unless noted
+#define BROKER_TRANSMIT 1 // client to broker
+#define BROKER_CALL     2 // client to broker, an Adapter method
+
+#define BROKER_HELLO    1 // broker to client, with the ring's fd
+#define BROKER_WAKE     2
+#define BROKER_RESULT   3
+#define BROKER_REPLY    4 // followed by length bytes of the call's result
+
+// methods a client can call, with their arguments
+#define BROKER_POWER_ON          1 // destination
+#define BROKER_STANDBY           2 // destination
+#define BROKER_SET_ACTIVE_SOURCE 3 // parameters[0]: device type
+#define BROKER_VOLUME_UP         4
+#define BROKER_VOLUME_DOWN       5
+#define BROKER_TOGGLE_MUTE       6
+#define BROKER_SET_VOLUME        7 // parameters[0]: level, [1]: unmute; backoff: timeout
+#define BROKER_LIST_DEVICES      8 // replies with a BrokerDevice per device
+#define BROKER_STATE             9 // replies with a BrokerState
+
+struct BrokerRequest {
+    uint8_t type;
+    uint8_t initiator;
+    uint8_t destination;
+    uint8_t opcode;
+    uint8_t size;
+    uint8_t attempts;         // 0 for the broker's policy
+    int8_t retry_on;          // -1 for the broker's policy
+    uint8_t method;           // CALL: BROKER_* method
+    double backoff;           // negative for the broker's policy
+    uint8_t parameters[CEC_MAX_DATA_PACKET_SIZE];
+};
+
+struct BrokerMessage {
+    uint8_t type;
+    uint8_t reader;           // HELLO: index of the client's waiting flag
+    uint8_t logical_address;  // HELLO: the broker adapter's primary address
+    uint8_t status;           // RESULT: TRANSMIT_*, REPLY: 1 if the call succeeded
+    uint16_t physical_address;// HELLO
+    uint16_t attempts;        // RESULT
+    uint32_t length;          // REPLY
+    uint32_t reserved;
+    double elapsed;           // RESULT
+};
+
+// BROKER_SET_VOLUME's reply
+struct BrokerVolume {
+    uint8_t status;           // the last audio status reported
+    uint8_t reached;
+    uint16_t reserved;
+    uint32_t steps;
+    double elapsed;
+};
+
+// BROKER_LIST_DEVICES' reply, the metadata Device objects are built from
+struct BrokerDevice {
+    uint8_t address;
+    uint8_t cec_version;
+    uint16_t physical_address;
+    uint32_t vendor_id;
+    char osd_name[16];
+    char language[4];
+};
+
+// BROKER_STATE's reply, the adapter's BusStateData. A time of 0 means the
+// value was never observed.
+struct BrokerValue {
+    double time;
+    int32_t value;
+    uint32_t reserved;
+};
+
+struct BrokerDeviceState {
+    BrokerValue power_status;
+    BrokerValue physical_address;
+    BrokerValue device_type;
+    BrokerValue vendor_id;
+    BrokerValue cec_version;
+    double osd_name_time;
+    double language_time;
+    char osd_name[16];
+    char language[8];
+};
+
+struct BrokerState {
+    BrokerDeviceState devices[16];
+    BrokerValue active_source;
+    BrokerValue stream_path;
+    BrokerValue system_audio_mode;
+    BrokerValue volume;
+    BrokerValue mute;
+};
+
+struct BrokerStats {
+    unsigned long clients;    // connected now
+    unsigned long connections;
+    unsigned long published;
+    unsigned long transmits;
+    unsigned long calls;
+    unsigned long wakeups;
+};
+
+// Serves the events of an adapter to other processes, and transmits for
+// them.
+//
+// Every event the adapter emits is published, before native handlers and
+// Python callbacks run, into a ring of fixed size slots in shared memory.
+// Each client reads the ring from its own cursor, so publishing never waits
+// for a client; a client that falls a whole ring behind loses the oldest
+// events. Slots are guarded by sequence numbers like the metadata cache.
+//
+// Clients connect to a Unix domain socket, which passes them the ring's file
+// descriptor and carries their transmit requests and Adapter method calls.
+// Each client's requests run on a thread of its own, one at a time, so a
+// client retrying a transmit holds up neither the other clients nor new
+// connections. A client that has read
+// everything marks itself waiting in the ring before blocking on the socket,
+// and only then does the broker write it a wakeup, so a busy client costs
+// the broker no system calls.
+class Broker {
+    public:
+        // listen on path, replacing a stale socket; NULL with errno set on
+        // failure
+        static Broker * start(Adapter * adapter, const char * path,
+                unsigned capacity);
+        ~Broker();
+
+        // safe from any thread, without the GIL
+        void publish(const Event & event);
+        // close the socket and disconnect the clients; must not be called
+        // with the GIL held
+        void stop();
+
+        BrokerStats stats();
+
+    private:
+        struct Client {
+            int fd;
+            unsigned reader;
+            std::mutex send_lock; // wakeups and results come from different threads
+            std::thread worker;   // runs the client's requests
+            std::mutex work_lock; // guards the fields below
+            std::condition_variable work_cond;
+            BrokerRequest request;
+            bool pending;         // request is waiting for or in the worker
+            bool closing;
+            bool done;            // the worker has exited
+
+            Client() : fd(-1), reader(0), pending(false), closing(false),
+                done(false) {}
+        };
+
+        Broker(Adapter * adapter, const char * path, int listener, int ring_fd,
+                void * map, size_t size, int wake_read, int wake_write);
+
+        void run();
+        void accept_client();
+        // hand the client's next request to its worker; false once the
+        // client has disconnected
+        bool serve(Client * client);
+        void work(Client * client);
+        void transmit(Client * client, const BrokerRequest & request);
+        void call(Client * client, const BrokerRequest & request);
+        // disconnect a client whose worker may still be transmitting
+        void retire(Client * client);
+        // free retired clients, waiting for their workers if wait is set
+        void reap(bool wait);
+        // a message, followed by length bytes of data
+        void send(Client * client, const BrokerMessage & message,
+                const void * data = NULL, size_t length = 0);
+
+        Adapter * adapter;
+        std::vector<char> path;
+        int listener;
+        int ring_fd;
+        void * map;
+        size_t size;
+        BrokerHeader * header;
+        BrokerSlot * slots;
+        int wake_read;        // a pipe to interrupt poll() when stopping
+        int wake_write;
+
+        std::mutex write_lock; // serialises publishers
+        std::mutex lock;       // guards clients
+        std::vector<Client *> clients;
+        std::vector<Client *> retired; // only used by the poll thread and stop()
+        std::thread thread;
+        bool running;
+
+        std::atomic<unsigned long> connections;
+        std::atomic<unsigned long> published;
+        std::atomic<unsigned long> transmits;
+        std::atomic<unsigned long> calls;
+        std::atomic<unsigned long> wakeups;
+};
+
+// cec.connect_broker(path)
+PyObject * broker_connect(PyObject * module, PyObject * args);
+#if HAVE_BROKER
+PyTypeObject * BrokerClientTypeInit(PyObject * module);
+#endif
+
+#endif
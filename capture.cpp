@@ -0,0 +1,91 @@
+/* capture.cpp
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Binary capture of CEC frames to a file
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#include "capture.h"
+
+using namespace CEC;
+
+CaptureWriter::CaptureWriter(FILE * file) : file(file), running(true),
+        failed(false), written(0), dropped(0) {
+    thread = std::thread(&CaptureWriter::run, this);
+}
+
+CaptureWriter::~CaptureWriter() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        running = false;
+    }
+    cond.notify_one();
+    thread.join();
+    fclose(file);
+}
+
+void CaptureWriter::add(const cec_command & cmd, int direction) {
+    bool wake;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (failed || queue.size() >= CAPTURE_QUEUE_LIMIT) {
+            dropped++;
+            return;
+        }
+        wake = queue.empty();
+        queue.emplace_back();
+        frame_record(cmd, direction, queue.back());
+    }
+    if (wake) {
+        cond.notify_one();
+    }
+}
+
+void CaptureWriter::stats(uint64_t & written, uint64_t & dropped, bool & failed) {
+    std::lock_guard<std::mutex> guard(lock);
+    written = this->written;
+    dropped = this->dropped;
+    failed = this->failed;
+}
+
+void CaptureWriter::run() {
+    std::vector<FrameRecord> batch;
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        cond.wait(guard, [this] { return !running || !queue.empty(); });
+        if (queue.empty()) {
+            break;
+        }
+        // write outside the lock, swapping buffers so neither side allocates
+        // once both have grown
+        batch.swap(queue);
+        guard.unlock();
+        size_t count = fwrite(batch.data(), sizeof(FrameRecord), batch.size(), file);
+        bool ok = count == batch.size() && fflush(file) == 0;
+        guard.lock();
+        written += count;
+        if (!ok) {
+            failed = true;
+            dropped += batch.size() - count + queue.size();
+            queue.clear();
+        }
+        batch.clear();
+    }
+}
@@ -0,0 +1,74 @@
+/* capture.h
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Binary capture of CEC frames to a file
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#ifndef CEC_CAPTURE_H
+#define CEC_CAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <libcec/cec.h>
+
+#include "history.h"
+
+// Appends frames to a file as FrameRecord structs, the same records
+// Adapter.history exports, so a capture loads with numpy.fromfile().
+//
+// Frames are queued by the libcec thread and written by a thread of the
+// writer's own, so a slow disk never delays the bus. Frames are dropped, and
+// counted, while more than CAPTURE_QUEUE_LIMIT are waiting to be written.
+#define CAPTURE_QUEUE_LIMIT 65536
+
+class CaptureWriter {
+    public:
+        // takes over file
+        CaptureWriter(FILE * file);
+        // writes the queued frames and closes the file; must not be called
+        // with the GIL held
+        ~CaptureWriter();
+
+        // safe from any thread, without the GIL
+        void add(const CEC::cec_command & cmd, int direction);
+        void stats(uint64_t & written, uint64_t & dropped, bool & failed);
+
+    private:
+        void run();
+
+        FILE * file;
+        std::mutex lock;
+        std::condition_variable cond;
+        std::thread thread;
+        std::vector<FrameRecord> queue;
+        bool running;
+        bool failed;   // a write failed, nothing more is written
+        uint64_t written;
+        uint64_t dropped;
+};
+
+#endif
@@ -30,12 +30,23 @@
 #include <Python.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <errno.h>
 #include <libcec/cec.h>
 #include <algorithm>
 
 #include "cec.h"
 #include "adapter.h"
+#include "broker.h"
+#include "config.h"
+#include "constants.h"
+#include "detect.h"
 #include "device.h"
+#include "history.h"
+#include "module.h"
+#include "opcodes.h"
+#include "pool.h"
+#include "retry.h"
+#include "vendor.h"
 
 using namespace CEC;
 
@@ -87,6 +98,14 @@ int parse_physical_addr(const char * addr) {
    }
 }
 
+void format_physical_addr(uint16_t addr, char * buf) {
+   snprintf(buf, 8, "%x.%x.%x.%x",
+         (addr >> 12) & 0xF,
+         (addr >> 8) & 0xF,
+         (addr >> 4) & 0xF,
+         addr & 0xF);
+}
+
 void parse_test() {
    assert(parse_physical_addr("0.0.0.0") == 0);
    assert(parse_physical_addr("F.0.0.0") == 0xF000);
@@ -102,78 +121,241 @@ void parse_test() {
    assert(parse_physical_addr("f.f.f.f") == 0xFFFF);
 }
 
-static PyObject * list_adapters(PyObject * self, PyObject * args) {
-   PyObject * result = NULL;
-
-   if( PyArg_ParseTuple(args, ":list_adapters") ) {
-
-      libcec_configuration config;
-      ICECAdapter * adapter;
+static PyObject * list_adapters(PyObject * self, PyObject * args,
+      PyObject * kwds) {
+   static const char * kwlist[] = {"details", "refresh", NULL};
+   int details = 0;
+   int refresh = 0;
+   if( !PyArg_ParseTupleAndKeywords(args, kwds, "|ii:list_adapters",
+            const_cast<char**>(kwlist), &details, &refresh) ) {
+      return NULL;
+   }
 
-      config.Clear();
-      config.deviceTypes.Add(CEC_DEVICE_TYPE_RECORDING_DEVICE);
+   std::vector<CEC_ADAPTER_TYPE> dev_list;
+   bool found;
+   Py_BEGIN_ALLOW_THREADS
+   found = find_adapters(NULL, refresh, dev_list);
+   Py_END_ALLOW_THREADS
 
-      Py_BEGIN_ALLOW_THREADS
-      adapter = CECInitialise(&config);
-      Py_END_ALLOW_THREADS
+   if (!found) {
+     PyErr_SetString(PyExc_IOError, "Failed to initialize adapter");
+     return NULL;
+   }
 
-      if (!adapter) {
-        PyErr_SetString(PyExc_IOError, "Failed to initialize adapter");
-        return NULL;
-      }
+   // set up our result list
+   PyObject * result = PyList_New(dev_list.size());
+   if( !result ) {
+      return NULL;
+   }
 
-      std::list<CEC_ADAPTER_TYPE> dev_list = get_adapters(adapter);
-
-      CECDestroy(adapter);
-
-      // set up our result list
-      result = PyList_New(0);
-
-      // populate our result list
-      std::list<CEC_ADAPTER_TYPE>::const_iterator itr;
-      for( itr = dev_list.begin(); itr != dev_list.end(); itr++ ) {
-#if HAVE_CEC_ADAPTER_DESCRIPTOR
-         PyList_Append(result, Py_BuildValue("s", itr->strComName));
-         /* Convert all of the fields
-         PyList_Append(result, Py_BuildValue("sshhhhii",
-                  itr->strComName,
-                  itr->strComPath,
-                  itr->iVendorId,
-                  itr->iProductId,
-                  itr->iFirmwareVersion,
-                  itr->iPhysicalAddress,
-                  itr->iFirmwareBuildDate,
-                  itr->adapterType
-                  ));
-                  */
-#else
-         PyList_Append(result, Py_BuildValue("s", itr->comm));
-         /* Convert all of the fields
-         PyList_Append(result, Py_BuildValue("sshhhhii",
-                  itr->comm,
-                  itr->strComPath,
-                  itr->iVendorId,
-                  itr->iProductId,
-                  itr->iFirmwareVersion,
-                  itr->iPhysicalAddress,
-                  itr->iFirmwareBuildDate,
-                  itr->adapterType
-                  ));
-                  */
-#endif
+   // populate our result list
+   for( size_t i=0; i<dev_list.size(); i++ ) {
+      PyObject * dev = convert_adapter(dev_list[i], details);
+      if( !dev ) {
+         Py_DECREF(result);
+         return NULL;
       }
+      PyList_SET_ITEM(result, i, dev);
    }
 
    return result;
 }
 
+static PyObject * watch_adapter_nodes(PyObject * self, PyObject * args,
+      PyObject * kwds) {
+   static const char * kwlist[] = {"callback", "path", NULL};
+   PyObject * callback = Py_None;
+   const char * path = NULL;
+   if( !PyArg_ParseTupleAndKeywords(args, kwds, "|Oz:watch_adapters",
+            const_cast<char**>(kwlist), &callback, &path) ) {
+      return NULL;
+   }
+   if( callback != Py_None && !PyCallable_Check(callback) ) {
+      PyErr_SetString(PyExc_TypeError, "callback must be callable");
+      return NULL;
+   }
+
+   int err;
+   Py_BEGIN_ALLOW_THREADS
+   err = watch_adapters(path);
+   Py_END_ALLOW_THREADS
+
+   if( err ) {
+      errno = err;
+      return PyErr_SetFromErrnoWithFilename(PyExc_OSError,
+            path ? path : ADAPTER_WATCH_PATH);
+   }
+
+   set_hotplug_callback(callback == Py_None ? NULL : callback);
+   Py_RETURN_NONE;
+}
+
+static PyObject * get_vendor_name(PyObject * self, PyObject * args) {
+   unsigned long id;
+   if( !PyArg_ParseTuple(args, "k:vendor_name", &id) ) {
+      return NULL;
+   }
+   const char * name = vendor_name((uint32_t)id);
+   if( !name || id > 0xFFFFFF ) {
+      Py_RETURN_NONE;
+   }
+   return Py_BuildValue("s", name);
+}
+
+static PyObject * decode(PyObject * self, PyObject * args) {
+   cec_command cmd;
+   if( !PyArg_ParseTuple(args, "O&:decode", convert_command_arg, &cmd) ) {
+      return NULL;
+   }
+   return decode_command(cmd);
+}
+
+static PyObject * format(PyObject * self, PyObject * args) {
+   cec_command cmd;
+   if( !PyArg_ParseTuple(args, "O&:format", convert_command_arg, &cmd) ) {
+      return NULL;
+   }
+   char buf[512];
+   size_t len = format_command(cmd, buf, sizeof(buf));
+   return PyUnicode_DecodeASCII(buf, len, "replace");
+}
+
 static PyMethodDef CecMethods[] = {
-   {"list_adapters", list_adapters, METH_VARARGS, "List available adapters"},
+   {"list_adapters", (PyCFunction)list_adapters, METH_VARARGS | METH_KEYWORDS,
+      "List available adapters"},
+   {"watch_adapters", (PyCFunction)watch_adapter_nodes, METH_VARARGS | METH_KEYWORDS,
+      "Watch for adapters being plugged in or removed"},
+   {"vendor_name", get_vendor_name, METH_VARARGS,
+      "Get the manufacturer name of a vendor ID, or None if unknown"},
+   {"decode", decode, METH_VARARGS,
+      "Decode a command dict or raw frame into typed fields"},
+   {"format", format, METH_VARARGS,
+      "Format a command dict or raw frame as a line of text"},
+   {"connect_broker", broker_connect, METH_VARARGS,
+      "Connect to an adapter served by another process with serve_broker()"},
+#if PY_VERSION_HEX >= 0x03070000
+   {"__getattr__", constants_getattr, METH_O, NULL},
+   {"__dir__", constants_dir, METH_NOARGS, NULL},
+#endif
    {NULL, NULL, 0, NULL}
 };
 
-#if PY_MAJOR_VERSION >= 3
-static struct PyModuleDef moduledef = {
+static int cec_exec(PyObject * m) {
+   ModuleState * state = module_state(m);
+
+   // set up python module
+   state->adapter_type = AdapterTypeInit(m);
+   if (!state->adapter_type) return -1;
+   state->device_type = DeviceTypeInit(m);
+   if (!state->device_type) return -1;
+   state->pool_type = AdapterPoolTypeInit(m);
+   if (!state->pool_type) return -1;
+   state->history_type = HistoryTypeInit(m);
+   if (!state->history_type) return -1;
+   state->config_type = ConfigTypeInit(m);
+   if (!state->config_type) return -1;
+   state->transmit_result_type = TransmitResultTypeInit(m);
+   if (!state->transmit_result_type) return -1;
+#if HAVE_BROKER
+   state->broker_client_type = BrokerClientTypeInit(m);
+   if (!state->broker_client_type) return -1;
+#endif
+
+   Py_INCREF(state->device_type);
+   PyModule_AddObject(m, "Device", (PyObject *)state->device_type);
+   Py_INCREF(state->adapter_type);
+   PyModule_AddObject(m, "Adapter", (PyObject *)state->adapter_type);
+   Py_INCREF(state->pool_type);
+   PyModule_AddObject(m, "AdapterPool", (PyObject *)state->pool_type);
+   Py_INCREF(state->history_type);
+   PyModule_AddObject(m, "History", (PyObject *)state->history_type);
+   Py_INCREF(state->config_type);
+   PyModule_AddObject(m, "Config", (PyObject *)state->config_type);
+   Py_INCREF(state->transmit_result_type);
+   PyModule_AddObject(m, "TransmitResult", (PyObject *)state->transmit_result_type);
+#if HAVE_BROKER
+   Py_INCREF(state->broker_client_type);
+   PyModule_AddObject(m, "BrokerClient", (PyObject *)state->broker_client_type);
+#endif
+
+   // constants for events, alerts, device types, logical addresses and
+   // opcodes are created on first use by __getattr__, along with their
+   // IntEnum namespaces
+#if PY_VERSION_HEX < 0x03070000
+   if( add_constants(m) < 0 ) return -1;
+#endif
+
+   // expose whether or not we're using the new cec_adapter_descriptor API
+   // this should help debugging by exposing which version was detected and
+   // which adapter detection API was used at compile time
+   PyModule_AddIntMacro(m, HAVE_CEC_ADAPTER_DESCRIPTOR);
+
+   return 0;
+}
+
+#if CEC_MODULE_STATE
+static int cec_traverse(PyObject * m, visitproc visit, void * arg) {
+   ModuleState * state = module_state(m);
+   Py_VISIT(state->adapter_type);
+   Py_VISIT(state->device_type);
+   Py_VISIT(state->pool_type);
+   Py_VISIT(state->history_type);
+   Py_VISIT(state->config_type);
+   Py_VISIT(state->transmit_result_type);
+   Py_VISIT(state->broker_client_type);
+   return 0;
+}
+
+static int cec_clear(PyObject * m) {
+   ModuleState * state = module_state(m);
+   Py_CLEAR(state->adapter_type);
+   Py_CLEAR(state->device_type);
+   Py_CLEAR(state->pool_type);
+   Py_CLEAR(state->history_type);
+   Py_CLEAR(state->config_type);
+   Py_CLEAR(state->transmit_result_type);
+   Py_CLEAR(state->broker_client_type);
+   return 0;
+}
+
+static void cec_free(void * m) {
+   cec_clear((PyObject *)m);
+   // drop this interpreter's hotplug callback
+   set_hotplug_callback(NULL);
+}
+
+// Each interpreter imports its own instance of the module, with its own
+// types, so interpreters with their own GIL can each drive an adapter
+static PyModuleDef_Slot cec_slots[] = {
+   {Py_mod_exec, (void *)cec_exec},
+#if CEC_SUBINTERPRETERS
+   {Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED},
+#endif
+#ifdef Py_GIL_DISABLED
+   // callback lists, helper threads and detection state are guarded by
+   // their own locks, so don't re-enable the GIL on free-threaded builds
+   {Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+   {0, NULL}
+};
+
+PyModuleDef cec_module = {
+   PyModuleDef_HEAD_INIT,
+   "cec",
+   NULL,
+   sizeof(ModuleState),
+   CecMethods,
+   cec_slots,
+   cec_traverse,
+   cec_clear,
+   cec_free
+};
+
+PyMODINIT_FUNC PyInit_cec(void) {
+   return PyModuleDef_Init(&cec_module);
+}
+#else
+PyModuleDef cec_module = {
    PyModuleDef_HEAD_INIT,
    "cec",
    NULL,
@@ -184,272 +366,21 @@ static struct PyModuleDef moduledef = {
    NULL,
    NULL
 };
-#endif
-
-#if PY_MAJOR_VERSION >= 3
-#define INITERROR return NULL
-#else
-#define INITERROR return
-#endif
 
-#if PY_MAJOR_VERSION >= 3
 PyMODINIT_FUNC PyInit_cec(void) {
-#else
-PyMODINIT_FUNC initcec(void) {
-#endif
+#if PY_VERSION_HEX < 0x03070000
    // Make sure threads are enabled in the python interpreter
    // this also acquires the global interpreter lock
    PyEval_InitThreads();
-
-   // set up python module
-   PyTypeObject * adapter = AdapterTypeInit();
-   if (PyType_Ready(adapter) < 0) INITERROR;
-   PyTypeObject * dev = DeviceTypeInit();
-   if (PyType_Ready(dev) < 0) INITERROR;
-
-#if PY_MAJOR_VERSION >= 3
-   PyObject * m = PyModule_Create(&moduledef);
-#else
-   PyObject * m = Py_InitModule("cec", CecMethods);
 #endif
 
-   if( m == NULL ) INITERROR;
-
-   Py_INCREF(dev);
-   PyModule_AddObject(m, "Device", (PyObject *)dev);
-   Py_INCREF(adapter);
-   PyModule_AddObject(m, "Adapter", (PyObject *)adapter);
-
-   // constants for event types
-   PyModule_AddIntMacro(m, EVENT_LOG);
-   PyModule_AddIntMacro(m, EVENT_KEYPRESS);
-   PyModule_AddIntMacro(m, EVENT_COMMAND);
-   PyModule_AddIntMacro(m, EVENT_CONFIG_CHANGE);
-   PyModule_AddIntMacro(m, EVENT_ALERT);
-   PyModule_AddIntMacro(m, EVENT_MENU_CHANGED);
-   PyModule_AddIntMacro(m, EVENT_ACTIVATED);
-   PyModule_AddIntMacro(m, EVENT_ALL);
-
-   // constants for alert types
-   PyModule_AddIntConstant(m, "CEC_ALERT_SERVICE_DEVICE",
-         CEC_ALERT_SERVICE_DEVICE);
-   PyModule_AddIntConstant(m, "CEC_ALERT_CONNECTION_LOST",
-         CEC_ALERT_CONNECTION_LOST);
-   PyModule_AddIntConstant(m, "CEC_ALERT_PERMISSION_ERROR",
-         CEC_ALERT_PERMISSION_ERROR);
-   PyModule_AddIntConstant(m, "CEC_ALERT_PORT_BUSY",
-         CEC_ALERT_PORT_BUSY);
-   PyModule_AddIntConstant(m, "CEC_ALERT_PHYSICAL_ADDRESS_ERROR",
-         CEC_ALERT_PHYSICAL_ADDRESS_ERROR);
-   PyModule_AddIntConstant(m, "CEC_ALERT_TV_POLL_FAILED",
-         CEC_ALERT_TV_POLL_FAILED);
-
-   // constants for menu events
-   PyModule_AddIntConstant(m, "CEC_MENU_STATE_ACTIVATED",
-         CEC_MENU_STATE_ACTIVATED);
-   PyModule_AddIntConstant(m, "CEC_MENU_STATE_DEACTIVATED",
-         CEC_MENU_STATE_DEACTIVATED);
-
-   // constants for device types
-   PyModule_AddIntConstant(m, "CEC_DEVICE_TYPE_TV",
-         CEC_DEVICE_TYPE_TV);
-   PyModule_AddIntConstant(m, "CEC_DEVICE_TYPE_RECORDING_DEVICE",
-         CEC_DEVICE_TYPE_RECORDING_DEVICE);
-   PyModule_AddIntConstant(m, "CEC_DEVICE_TYPE_RESERVED",
-         CEC_DEVICE_TYPE_RESERVED);
-   PyModule_AddIntConstant(m, "CEC_DEVICE_TYPE_TUNER",
-         CEC_DEVICE_TYPE_TUNER);
-   PyModule_AddIntConstant(m, "CEC_DEVICE_TYPE_PLAYBACK_DEVICE",
-         CEC_DEVICE_TYPE_PLAYBACK_DEVICE);
-   PyModule_AddIntConstant(m, "CEC_DEVICE_TYPE_AUDIO_SYSTEM",
-         CEC_DEVICE_TYPE_AUDIO_SYSTEM);
-
-   // constants for logical addresses
-   PyModule_AddIntConstant(m, "CECDEVICE_UNKNOWN",
-         CECDEVICE_UNKNOWN);
-   PyModule_AddIntConstant(m, "CECDEVICE_TV",
-         CECDEVICE_TV);
-   PyModule_AddIntConstant(m, "CECDEVICE_RECORDINGDEVICE1",
-         CECDEVICE_RECORDINGDEVICE1);
-   PyModule_AddIntConstant(m, "CECDEVICE_RECORDINGDEVICE2",
-         CECDEVICE_RECORDINGDEVICE2);
-   PyModule_AddIntConstant(m, "CECDEVICE_TUNER1",
-         CECDEVICE_TUNER1);
-   PyModule_AddIntConstant(m, "CECDEVICE_PLAYBACKDEVICE1",
-         CECDEVICE_PLAYBACKDEVICE1);
-   PyModule_AddIntConstant(m, "CECDEVICE_AUDIOSYSTEM",
-         CECDEVICE_AUDIOSYSTEM);
-   PyModule_AddIntConstant(m, "CECDEVICE_TUNER2",
-         CECDEVICE_TUNER2);
-   PyModule_AddIntConstant(m, "CECDEVICE_TUNER3",
-         CECDEVICE_TUNER3);
-   PyModule_AddIntConstant(m, "CECDEVICE_PLAYBACKDEVICE2",
-         CECDEVICE_PLAYBACKDEVICE2);
-   PyModule_AddIntConstant(m, "CECDEVICE_RECORDINGDEVICE3",
-         CECDEVICE_RECORDINGDEVICE3);
-   PyModule_AddIntConstant(m, "CECDEVICE_TUNER4",
-         CECDEVICE_TUNER4);
-   PyModule_AddIntConstant(m, "CECDEVICE_PLAYBACKDEVICE3",
-         CECDEVICE_PLAYBACKDEVICE3);
-   PyModule_AddIntConstant(m, "CECDEVICE_RESERVED1",
-         CECDEVICE_RESERVED1);
-   PyModule_AddIntConstant(m, "CECDEVICE_RESERVED2",
-         CECDEVICE_RESERVED2);
-   PyModule_AddIntConstant(m, "CECDEVICE_FREEUSE",
-         CECDEVICE_FREEUSE);
-   PyModule_AddIntConstant(m, "CECDEVICE_UNREGISTERED",
-         CECDEVICE_UNREGISTERED);
-   PyModule_AddIntConstant(m, "CECDEVICE_BROADCAST",
-         CECDEVICE_BROADCAST);
-
-   // constants for opcodes
-   PyModule_AddIntConstant(m, "CEC_OPCODE_ACTIVE_SOURCE",
-         CEC_OPCODE_ACTIVE_SOURCE);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_IMAGE_VIEW_ON",
-         CEC_OPCODE_IMAGE_VIEW_ON);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_TEXT_VIEW_ON",
-         CEC_OPCODE_TEXT_VIEW_ON);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_INACTIVE_SOURCE",
-         CEC_OPCODE_INACTIVE_SOURCE);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_REQUEST_ACTIVE_SOURCE",
-         CEC_OPCODE_REQUEST_ACTIVE_SOURCE);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_ROUTING_CHANGE",
-         CEC_OPCODE_ROUTING_CHANGE);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_ROUTING_INFORMATION",
-         CEC_OPCODE_ROUTING_INFORMATION);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_SET_STREAM_PATH",
-         CEC_OPCODE_SET_STREAM_PATH);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_STANDBY",
-         CEC_OPCODE_STANDBY);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_RECORD_OFF",
-         CEC_OPCODE_RECORD_OFF);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_RECORD_ON",
-         CEC_OPCODE_RECORD_ON);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_RECORD_STATUS",
-         CEC_OPCODE_RECORD_STATUS);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_RECORD_TV_SCREEN",
-         CEC_OPCODE_RECORD_TV_SCREEN);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_CLEAR_ANALOGUE_TIMER",
-         CEC_OPCODE_CLEAR_ANALOGUE_TIMER);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_CLEAR_DIGITAL_TIMER",
-         CEC_OPCODE_CLEAR_DIGITAL_TIMER);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_CLEAR_EXTERNAL_TIMER",
-         CEC_OPCODE_CLEAR_EXTERNAL_TIMER);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_SET_ANALOGUE_TIMER",
-         CEC_OPCODE_SET_ANALOGUE_TIMER);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_SET_DIGITAL_TIMER",
-         CEC_OPCODE_SET_DIGITAL_TIMER);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_SET_EXTERNAL_TIMER",
-         CEC_OPCODE_SET_EXTERNAL_TIMER);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_SET_TIMER_PROGRAM_TITLE",
-         CEC_OPCODE_SET_TIMER_PROGRAM_TITLE);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_TIMER_CLEARED_STATUS",
-         CEC_OPCODE_TIMER_CLEARED_STATUS);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_TIMER_STATUS",
-         CEC_OPCODE_TIMER_STATUS);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_CEC_VERSION",
-         CEC_OPCODE_CEC_VERSION);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_GET_CEC_VERSION",
-         CEC_OPCODE_GET_CEC_VERSION);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_GIVE_PHYSICAL_ADDRESS",
-         CEC_OPCODE_GIVE_PHYSICAL_ADDRESS);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_GET_MENU_LANGUAGE",
-         CEC_OPCODE_GET_MENU_LANGUAGE);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_REPORT_PHYSICAL_ADDRESS",
-         CEC_OPCODE_REPORT_PHYSICAL_ADDRESS);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_SET_MENU_LANGUAGE",
-         CEC_OPCODE_SET_MENU_LANGUAGE);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_DECK_CONTROL",
-         CEC_OPCODE_DECK_CONTROL);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_DECK_STATUS",
-         CEC_OPCODE_DECK_STATUS);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_GIVE_DECK_STATUS",
-         CEC_OPCODE_GIVE_DECK_STATUS);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_PLAY",
-         CEC_OPCODE_PLAY);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_GIVE_TUNER_DEVICE_STATUS",
-         CEC_OPCODE_GIVE_TUNER_DEVICE_STATUS);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_SELECT_ANALOGUE_SERVICE",
-         CEC_OPCODE_SELECT_ANALOGUE_SERVICE);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_SELECT_DIGITAL_SERVICE",
-         CEC_OPCODE_SELECT_DIGITAL_SERVICE);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_TUNER_DEVICE_STATUS",
-         CEC_OPCODE_TUNER_DEVICE_STATUS);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_TUNER_STEP_DECREMENT",
-         CEC_OPCODE_TUNER_STEP_DECREMENT);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_TUNER_STEP_INCREMENT",
-         CEC_OPCODE_TUNER_STEP_INCREMENT);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_DEVICE_VENDOR_ID",
-         CEC_OPCODE_DEVICE_VENDOR_ID);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_GIVE_DEVICE_VENDOR_ID",
-         CEC_OPCODE_GIVE_DEVICE_VENDOR_ID);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_VENDOR_COMMAND",
-         CEC_OPCODE_VENDOR_COMMAND);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_VENDOR_COMMAND_WITH_ID",
-         CEC_OPCODE_VENDOR_COMMAND_WITH_ID);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_VENDOR_REMOTE_BUTTON_DOWN",
-         CEC_OPCODE_VENDOR_REMOTE_BUTTON_DOWN);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_VENDOR_REMOTE_BUTTON_UP",
-         CEC_OPCODE_VENDOR_REMOTE_BUTTON_UP);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_SET_OSD_STRING",
-         CEC_OPCODE_SET_OSD_STRING);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_GIVE_OSD_NAME",
-         CEC_OPCODE_GIVE_OSD_NAME);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_SET_OSD_NAME",
-         CEC_OPCODE_SET_OSD_NAME);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_MENU_REQUEST",
-         CEC_OPCODE_MENU_REQUEST);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_MENU_STATUS",
-         CEC_OPCODE_MENU_STATUS);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_USER_CONTROL_PRESSED",
-         CEC_OPCODE_USER_CONTROL_PRESSED);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_USER_CONTROL_RELEASE",
-         CEC_OPCODE_USER_CONTROL_RELEASE);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_GIVE_DEVICE_POWER_STATUS",
-         CEC_OPCODE_GIVE_DEVICE_POWER_STATUS);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_REPORT_POWER_STATUS",
-         CEC_OPCODE_REPORT_POWER_STATUS);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_FEATURE_ABORT",
-         CEC_OPCODE_FEATURE_ABORT);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_ABORT",
-         CEC_OPCODE_ABORT);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_GIVE_AUDIO_STATUS",
-         CEC_OPCODE_GIVE_AUDIO_STATUS);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_GIVE_SYSTEM_AUDIO_MODE_STATUS",
-         CEC_OPCODE_GIVE_SYSTEM_AUDIO_MODE_STATUS);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_REPORT_AUDIO_STATUS",
-         CEC_OPCODE_REPORT_AUDIO_STATUS);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_SET_SYSTEM_AUDIO_MODE",
-         CEC_OPCODE_SET_SYSTEM_AUDIO_MODE);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_SYSTEM_AUDIO_MODE_REQUEST",
-         CEC_OPCODE_SYSTEM_AUDIO_MODE_REQUEST);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_SYSTEM_AUDIO_MODE_STATUS",
-         CEC_OPCODE_SYSTEM_AUDIO_MODE_STATUS);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_SET_AUDIO_RATE",
-         CEC_OPCODE_SET_AUDIO_RATE);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_START_ARC",
-         CEC_OPCODE_START_ARC);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_REPORT_ARC_STARTED",
-         CEC_OPCODE_REPORT_ARC_STARTED);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_REPORT_ARC_ENDED",
-         CEC_OPCODE_REPORT_ARC_ENDED);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_REQUEST_ARC_START",
-         CEC_OPCODE_REQUEST_ARC_START);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_REQUEST_ARC_END",
-         CEC_OPCODE_REQUEST_ARC_END);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_END_ARC",
-         CEC_OPCODE_END_ARC);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_CDC",
-         CEC_OPCODE_CDC);
-   PyModule_AddIntConstant(m, "CEC_OPCODE_NONE",
-         CEC_OPCODE_NONE);
-
-   // expose whether or not we're using the new cec_adapter_descriptor API
-   // this should help debugging by exposing which version was detected and
-   // which adapter detection API was used at compile time
-   PyModule_AddIntMacro(m, HAVE_CEC_ADAPTER_DESCRIPTOR);
+   PyObject * m = PyModule_Create(&cec_module);
+   if( m == NULL ) return NULL;
 
-#if PY_MAJOR_VERSION >= 3
+   if( cec_exec(m) < 0 ) {
+      Py_DECREF(m);
+      return NULL;
+   }
    return m;
-#endif
 }
+#endif
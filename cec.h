@@ -1,20 +1,28 @@
 //#define DEBUG 1
 
+#ifndef CEC_CEC_H
+#define CEC_CEC_H
+
+#include <stdint.h>
+
 #ifdef DEBUG
 # define debug(...) printf("CEC DEBUG: " __VA_ARGS__)
 #else
 # define debug(...)
 #endif
 
-#define EVENT_LOG           0x0001
-#define EVENT_KEYPRESS      0x0002
-#define EVENT_COMMAND       0x0004
-#define EVENT_CONFIG_CHANGE 0x0008
-#define EVENT_ALERT         0x0010
-#define EVENT_MENU_CHANGED  0x0020
-#define EVENT_ACTIVATED     0x0040
-#define EVENT_VALID         0x007F
-#define EVENT_ALL           0x007F
+#define EVENT_LOG            0x0001
+#define EVENT_KEYPRESS       0x0002
+#define EVENT_COMMAND        0x0004
+#define EVENT_CONFIG_CHANGE  0x0008
+#define EVENT_ALERT          0x0010
+#define EVENT_MENU_CHANGED   0x0020
+#define EVENT_ACTIVATED      0x0040
+#define EVENT_POWER_CHANGE   0x0080
+#define EVENT_DEVICE_ADDED   0x0100
+#define EVENT_DEVICE_REMOVED 0x0200
+#define EVENT_VALID          0x03FF
+#define EVENT_ALL            0x03FF
 
 #define RETURN_BOOL(arg) do { \
   bool result; \
@@ -30,11 +38,24 @@
 #if CEC_LIB_VERSION_MAJOR >= 3 || (CEC_LIB_VERSION_MAJOR >= 2 && CEC_LIB_VERSION_MINOR >= 1)
 #define CEC_ADAPTER_TYPE cec_adapter_descriptor
 #define CEC_FIND_ADAPTERS DetectAdapters
+#define CEC_ADAPTER_NAME(a) ((a).strComName)
 #define HAVE_CEC_ADAPTER_DESCRIPTOR 1
 #else
 #define CEC_ADAPTER_TYPE cec_adapter
 #define CEC_FIND_ADAPTERS FindAdapters
+#define CEC_ADAPTER_NAME(a) ((a).comm)
 #define HAVE_CEC_ADAPTER_DESCRIPTOR 0
 #endif
 
+// libcec_configuration.bMonitorOnly was introduced in 2.0.0
+#if CEC_LIB_VERSION_MAJOR >= 2
+#define HAVE_CEC_MONITOR_ONLY 1
+#else
+#define HAVE_CEC_MONITOR_ONLY 0
+#endif
+
 int parse_physical_addr(const char * addr);
+// format a physical address as a.b.c.d; buf must hold at least 8 characters
+void format_physical_addr(uint16_t addr, char * buf);
+
+#endif
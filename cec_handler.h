@@ -0,0 +1,132 @@
+/* cec_handler.h
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Stable C ABI for native event handlers
+ *
+ * Extension modules can react to adapter events without the GIL by handing
+ * an Adapter a PyCapsule named CEC_HANDLER_CAPSULE that points to a
+ * cec_handler:
+ *
+ *   static int on_event(void * context, const cec_handler_api * api,
+ *           void * adapter, const cec_handler_event * event) {
+ *       ...
+ *       return CEC_HANDLER_CONTINUE;
+ *   }
+ *   static cec_handler handler = { CEC_HANDLER_ABI_VERSION,
+ *       CEC_HANDLER_EVENT_COMMAND, on_event, NULL };
+ *   capsule = PyCapsule_New(&handler, CEC_HANDLER_CAPSULE, NULL);
+ *
+ *   adapter.add_handler(capsule)
+ *
+ * Handlers run on the thread the event arrives on, usually libcec's, before
+ * the Python callbacks. They must not call into Python, and they must return
+ * quickly, as they hold up every later event of the adapter. The adapter
+ * keeps a reference to the capsule until the handler is removed, and no call
+ * is in progress once remove_handler() returns.
+ *
+ * Only plain C types are used, so this header doesn't need libcec or Python.
+ * Later versions only append fields and bump CEC_HANDLER_ABI_VERSION.
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#ifndef CEC_HANDLER_H
+#define CEC_HANDLER_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CEC_HANDLER_ABI_VERSION 1
+#define CEC_HANDLER_CAPSULE "cec.handler"
+
+/* Event types, the same values as the module's EVENT_* constants */
+#define CEC_HANDLER_EVENT_LOG          0x0001
+#define CEC_HANDLER_EVENT_KEYPRESS     0x0002
+#define CEC_HANDLER_EVENT_COMMAND      0x0004
+#define CEC_HANDLER_EVENT_ALERT        0x0010
+#define CEC_HANDLER_EVENT_MENU_CHANGED 0x0020
+#define CEC_HANDLER_EVENT_ACTIVATED    0x0040
+#define CEC_HANDLER_EVENT_POWER_CHANGE 0x0080
+#define CEC_HANDLER_EVENT_DEVICE_ADDED   0x0100
+#define CEC_HANDLER_EVENT_DEVICE_REMOVED 0x0200
+
+/* Returned by a handler */
+#define CEC_HANDLER_CONTINUE 0 /* pass the event on */
+#define CEC_HANDLER_CONSUMED 1 /* don't deliver the event to Python */
+
+#define CEC_HANDLER_MAX_PARAMETERS 64
+
+typedef struct cec_handler_command {
+    uint8_t initiator;      /* logical address */
+    uint8_t destination;    /* logical address, 15 for broadcast */
+    uint8_t opcode_set;     /* 0 for a poll without an opcode */
+    uint8_t opcode;
+    uint8_t size;           /* number of parameters */
+    uint8_t parameters[CEC_HANDLER_MAX_PARAMETERS];
+} cec_handler_command;
+
+/* Only the fields of the event's type are set */
+typedef struct cec_handler_event {
+    uint32_t type;               /* one of CEC_HANDLER_EVENT_* */
+    /* CEC_HANDLER_EVENT_LOG */
+    int32_t log_level;
+    int64_t log_time;
+    const char * log_message;    /* valid for the duration of the call */
+    /* CEC_HANDLER_EVENT_KEYPRESS */
+    int32_t keycode;
+    uint32_t duration;
+    /* CEC_HANDLER_EVENT_COMMAND */
+    cec_handler_command command;
+    /* CEC_HANDLER_EVENT_ALERT */
+    int32_t alert;
+    const char * alert_param;    /* NULL if the alert has none */
+    /* CEC_HANDLER_EVENT_MENU_CHANGED */
+    int32_t menu_state;
+    /* CEC_HANDLER_EVENT_ACTIVATED, CEC_HANDLER_EVENT_POWER_CHANGE and
+       CEC_HANDLER_EVENT_DEVICE_* */
+    int32_t logical_address;
+    int32_t activated;
+    int32_t old_power_status;
+    int32_t power_status;
+} cec_handler_event;
+
+/* Functions a handler may call on the adapter it was given */
+typedef struct cec_handler_api {
+    uint32_t abi_version;
+    /* Send a command, 1 if it was acknowledged. An initiator of 0xF is
+       replaced by the adapter's primary logical address. */
+    int (*transmit)(void * adapter, const cec_handler_command * command);
+} cec_handler_api;
+
+typedef struct cec_handler {
+    uint32_t abi_version;        /* CEC_HANDLER_ABI_VERSION */
+    uint32_t events;             /* mask of CEC_HANDLER_EVENT_* to handle */
+    int (*handle)(void * context, const cec_handler_api * api,
+            void * adapter, const cec_handler_event * event);
+    void * context;
+} cec_handler;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
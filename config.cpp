@@ -0,0 +1,414 @@
+/* config.cpp
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Python view of the libcec configuration
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#include <string.h>
+
+#include "cec.h"
+#include "adapter.h"
+#include "config.h"
+#include "module.h"
+
+using namespace CEC;
+
+// A field of libcec_configuration as seen from Python
+struct ConfigField {
+    const char * name;
+    const char * doc;
+    PyObject * (*get)(const libcec_configuration & config);
+    // parse value into config; NULL for read only fields
+    int (*set)(libcec_configuration & config, PyObject * value);
+    bool (*same)(const libcec_configuration & a, const libcec_configuration & b);
+    void (*copy)(libcec_configuration & dst, const libcec_configuration & src);
+};
+
+template <typename T, T libcec_configuration::*F>
+static PyObject * get_int(const libcec_configuration & config) {
+    return PyLong_FromLong((long)(config.*F));
+}
+
+template <typename T, T libcec_configuration::*F>
+static PyObject * get_bool(const libcec_configuration & config) {
+    return PyBool_FromLong(config.*F);
+}
+
+template <typename T, T libcec_configuration::*F, unsigned long MAX>
+static int set_int(libcec_configuration & config, PyObject * value) {
+    unsigned long v = PyLong_AsUnsignedLong(value);
+    if (v == (unsigned long)-1 && PyErr_Occurred()) {
+        return -1;
+    }
+    if (v > MAX) {
+        PyErr_Format(PyExc_OverflowError, "value must be at most %lu", MAX);
+        return -1;
+    }
+    config.*F = (T)v;
+    return 0;
+}
+
+template <typename T, T libcec_configuration::*F>
+static int set_bool(libcec_configuration & config, PyObject * value) {
+    int v = PyObject_IsTrue(value);
+    if (v < 0) {
+        return -1;
+    }
+    config.*F = (T)v;
+    return 0;
+}
+
+template <typename T, T libcec_configuration::*F>
+static bool same(const libcec_configuration & a, const libcec_configuration & b) {
+    return a.*F == b.*F;
+}
+
+template <typename T, T libcec_configuration::*F>
+static void copy(libcec_configuration & dst, const libcec_configuration & src) {
+    dst.*F = src.*F;
+}
+
+static PyObject * get_osd_name(const libcec_configuration & config) {
+    return PyUnicode_DecodeASCII(config.strDeviceName,
+            strnlen(config.strDeviceName, sizeof(config.strDeviceName)), "replace");
+}
+
+static bool same_osd_name(const libcec_configuration & a, const libcec_configuration & b) {
+    return strncmp(a.strDeviceName, b.strDeviceName, sizeof(a.strDeviceName)) == 0;
+}
+
+// the language is 3 characters, without a terminator
+static PyObject * get_language(const libcec_configuration & config) {
+    return PyUnicode_DecodeASCII(config.strDeviceLanguage,
+            strnlen(config.strDeviceLanguage, 3), "replace");
+}
+
+static bool same_language(const libcec_configuration & a, const libcec_configuration & b) {
+    return strncmp(a.strDeviceLanguage, b.strDeviceLanguage, 3) == 0;
+}
+
+static PyObject * get_physical_address(const libcec_configuration & config) {
+    char str[8];
+    format_physical_addr(config.iPhysicalAddress, str);
+    return PyUnicode_FromString(str);
+}
+
+static PyObject * get_logical_address(const libcec_configuration & config) {
+    return PyLong_FromLong(config.logicalAddresses.primary);
+}
+
+static bool same_logical_address(const libcec_configuration & a,
+        const libcec_configuration & b) {
+    return a.logicalAddresses.primary == b.logicalAddresses.primary;
+}
+
+#define FIELD(type, member) type, &libcec_configuration::member
+#define READ_ONLY(name, doc, type, member) \
+    { name, doc, get_int<FIELD(type, member)>, NULL, \
+      same<FIELD(type, member)>, copy<FIELD(type, member)> }
+#define MILLISECONDS(name, doc, member) \
+    { name, doc, get_int<FIELD(uint32_t, member)>, \
+      set_int<FIELD(uint32_t, member), 0xFFFFFFFFUL>, \
+      same<FIELD(uint32_t, member)>, copy<FIELD(uint32_t, member)> }
+
+static const ConfigField config_fields[] = {
+    { "osd_name", "OSD name", get_osd_name, NULL, same_osd_name, NULL },
+    { "physical_address", "Physical address", get_physical_address, NULL,
+      same<FIELD(uint16_t, iPhysicalAddress)>, NULL },
+    { "logical_address", "Primary logical address", get_logical_address, NULL,
+      same_logical_address, NULL },
+    READ_ONLY("hdmi_port", "HDMI port of the base device", uint8_t, iHDMIPort),
+    READ_ONLY("base_device", "Logical address of the device the adapter is connected to",
+            cec_logical_address, baseDevice),
+    READ_ONLY("tv_vendor", "Vendor ID of the TV", uint32_t, tvVendor),
+    { "language", "Menu language", get_language, NULL, same_language, NULL },
+    { "activate_source", "Make the adapter the active source when opened",
+      get_bool<FIELD(uint8_t, bActivateSource)>, set_bool<FIELD(uint8_t, bActivateSource)>,
+      same<FIELD(uint8_t, bActivateSource)>, copy<FIELD(uint8_t, bActivateSource)> },
+#if CEC_LIB_VERSION_MAJOR >= 4
+    { "combo_key", "Key that starts a combination, CEC_USER_CONTROL_CODE_UNKNOWN for none",
+      get_int<FIELD(cec_user_control_code, comboKey)>,
+      set_int<FIELD(cec_user_control_code, comboKey), 0xFF>,
+      same<FIELD(cec_user_control_code, comboKey)>, copy<FIELD(cec_user_control_code, comboKey)> },
+    MILLISECONDS("combo_key_timeout",
+            "Milliseconds a press of the combo key is held back waiting for the next key",
+            iComboKeyTimeoutMs),
+    MILLISECONDS("button_repeat_rate",
+            "Milliseconds between repeated keypresses, 0 to use the remote's rate",
+            iButtonRepeatRateMs),
+    MILLISECONDS("button_release_delay",
+            "Milliseconds without a repeat before a held key is released",
+            iButtonReleaseDelayMs),
+    MILLISECONDS("double_tap_timeout",
+            "Milliseconds within which a second press counts as a repeat",
+            iDoubleTapTimeoutMs),
+#endif
+};
+
+#define CONFIG_FIELD_COUNT (sizeof(config_fields) / sizeof(config_fields[0]))
+#define CONFIG_ALL ((uint32_t)((1ULL << CONFIG_FIELD_COUNT) - 1))
+
+static_assert(CONFIG_FIELD_COUNT <= 32, "a change mask holds 32 fields");
+
+void ConfigTracker::reset(const libcec_configuration & config) {
+    std::lock_guard<std::mutex> guard(lock);
+    last = config;
+    known = true;
+}
+
+uint32_t ConfigTracker::update(const libcec_configuration & config) {
+    std::lock_guard<std::mutex> guard(lock);
+    uint32_t changed = 0;
+    if (known) {
+        for (size_t i=0; i<CONFIG_FIELD_COUNT; i++) {
+            if (!config_fields[i].same(last, config)) {
+                changed |= 1U << i;
+            }
+        }
+    }
+    last = config;
+    known = true;
+    return changed;
+}
+
+PyObject * convert_config(const libcec_configuration & config, uint32_t mask) {
+    PyObject * result = PyDict_New();
+    if (!result) {
+        return NULL;
+    }
+    for (size_t i=0; i<CONFIG_FIELD_COUNT; i++) {
+        if (!(mask & (1U << i))) {
+            continue;
+        }
+        PyObject * value = config_fields[i].get(config);
+        if (!value || PyDict_SetItemString(result, config_fields[i].name, value) < 0) {
+            Py_XDECREF(value);
+            Py_DECREF(result);
+            return NULL;
+        }
+        Py_DECREF(value);
+    }
+    return result;
+}
+
+// Python Config objects
+
+struct Config {
+    PyObject_HEAD
+    Adapter * adapter;
+};
+
+PyObject * config_new(PyTypeObject * type, Adapter * adapter) {
+    Config * self = (Config *)type->tp_alloc(type, 0);
+    if (!self) {
+        return NULL;
+    }
+    Py_INCREF(adapter);
+    self->adapter = adapter;
+    return (PyObject *)self;
+}
+
+static void Config_dealloc(Config * self) {
+    Py_DECREF(self->adapter);
+    free_instance((PyObject *)self);
+}
+
+// the current configuration, -1 with an exception set on failure
+static int current_config(Config * self, libcec_configuration & config) {
+    bool ok = false;
+    Py_BEGIN_ALLOW_THREADS
+    ICECAdapter * adapter = self->adapter->adapter;
+    ok = adapter && adapter->GetCurrentConfiguration(&config);
+    Py_END_ALLOW_THREADS
+    if (!ok) {
+        PyErr_SetString(PyExc_IOError, "Could not get configuration");
+        return -1;
+    }
+    return 0;
+}
+
+// Write the fields in mask of values to libcec. The configuration is read
+// and written back under the adapter's lock, so concurrent updates of
+// different fields don't undo each other.
+static int apply_config(Config * self, const libcec_configuration & values,
+        uint32_t mask) {
+    bool ok = false;
+    Py_BEGIN_ALLOW_THREADS
+    {
+        std::lock_guard<std::mutex> guard(self->adapter->lock);
+        ICECAdapter * adapter = self->adapter->adapter;
+        libcec_configuration config;
+        if (adapter && adapter->GetCurrentConfiguration(&config)) {
+            for (size_t i=0; i<CONFIG_FIELD_COUNT; i++) {
+                if (mask & (1U << i)) {
+                    config_fields[i].copy(config, values);
+                }
+            }
+            ok = adapter->SetConfiguration(&config);
+        }
+    }
+    Py_END_ALLOW_THREADS
+    if (!ok) {
+        PyErr_SetString(PyExc_IOError, "Could not set configuration");
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject * Config_get(Config * self, void * closure) {
+    const ConfigField * field = (const ConfigField *)closure;
+    libcec_configuration config;
+    if (current_config(self, config) < 0) {
+        return NULL;
+    }
+    return field->get(config);
+}
+
+static int Config_set(Config * self, PyObject * value, void * closure) {
+    const ConfigField * field = (const ConfigField *)closure;
+    if (!value) {
+        PyErr_Format(PyExc_AttributeError, "cannot delete %s", field->name);
+        return -1;
+    }
+    if (!field->set) {
+        PyErr_Format(PyExc_AttributeError, "%s is read only", field->name);
+        return -1;
+    }
+    libcec_configuration values;
+    if (field->set(values, value) < 0) {
+        return -1;
+    }
+    return apply_config(self, values, 1U << (field - config_fields));
+}
+
+static PyObject * Config_update(Config * self, PyObject * args, PyObject * kwargs) {
+    if (PyTuple_GET_SIZE(args) > 0) {
+        PyErr_SetString(PyExc_TypeError, "update() takes only keyword arguments");
+        return NULL;
+    }
+    libcec_configuration values;
+    uint32_t mask = 0;
+    PyObject * key;
+    PyObject * value;
+    Py_ssize_t pos = 0;
+    while (kwargs && PyDict_Next(kwargs, &pos, &key, &value)) {
+        const char * name = PyUnicode_AsUTF8(key);
+        if (!name) {
+            return NULL;
+        }
+        size_t i;
+        for (i=0; i<CONFIG_FIELD_COUNT; i++) {
+            if (strcmp(config_fields[i].name, name) == 0) {
+                break;
+            }
+        }
+        if (i == CONFIG_FIELD_COUNT) {
+            PyErr_Format(PyExc_TypeError, "unknown configuration field '%s'", name);
+            return NULL;
+        }
+        if (!config_fields[i].set) {
+            PyErr_Format(PyExc_AttributeError, "%s is read only", name);
+            return NULL;
+        }
+        if (config_fields[i].set(values, value) < 0) {
+            return NULL;
+        }
+        mask |= 1U << i;
+    }
+    if (mask && apply_config(self, values, mask) < 0) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject * Config_as_dict(Config * self, PyObject * args) {
+    libcec_configuration config;
+    if (current_config(self, config) < 0) {
+        return NULL;
+    }
+    return convert_config(config, CONFIG_ALL);
+}
+
+static PyObject * Config_repr(Config * self) {
+    PyObject * fields = Config_as_dict(self, NULL);
+    if (!fields) {
+        return NULL;
+    }
+    PyObject * repr = PyUnicode_FromFormat("<cec.Config %R>", fields);
+    Py_DECREF(fields);
+    return repr;
+}
+
+static PyMethodDef Config_methods[] = {
+    {"update", (PyCFunction)Config_update, METH_VARARGS | METH_KEYWORDS,
+        "Set several writable fields at once"},
+    {"as_dict", (PyCFunction)Config_as_dict, METH_NOARGS, "Get every field as a dict"},
+    {NULL, NULL, 0, NULL}
+};
+
+// one attribute per field, filled in by ConfigTypeInit
+static PyGetSetDef Config_getset[CONFIG_FIELD_COUNT + 1];
+
+static PyType_Slot Config_slots[] = {
+   {Py_tp_dealloc, (void *)Config_dealloc},
+   {Py_tp_repr, (void *)Config_repr},
+   {Py_tp_doc, (void *)"Live view of an adapter's libcec configuration"},
+   {Py_tp_methods, Config_methods},
+   {Py_tp_getset, Config_getset},
+   {0, NULL}
+};
+
+// only created by Adapter.config
+static PyType_Spec Config_spec = {
+   "cec.Config",
+   sizeof(Config),
+   0,
+#if PY_VERSION_HEX >= 0x030A0000
+   CEC_TYPE_FLAGS | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+#else
+   CEC_TYPE_FLAGS,
+#endif
+   Config_slots
+};
+
+static bool fill_getset() {
+   for (size_t i=0; i<CONFIG_FIELD_COUNT; i++) {
+      Config_getset[i].name = (char *)config_fields[i].name;
+      Config_getset[i].get = (getter)Config_get;
+      Config_getset[i].set = (setter)Config_set;
+      Config_getset[i].doc = (char *)config_fields[i].doc;
+      Config_getset[i].closure = (void *)&config_fields[i];
+   }
+   return true;
+}
+
+PyTypeObject * ConfigTypeInit(PyObject * module) {
+   // once, even with interpreters importing the module in parallel
+   static bool filled = fill_getset();
+   (void)filled;
+   PyTypeObject * type = new_type(module, &Config_spec);
+#if PY_VERSION_HEX < 0x030A0000
+   if (type) {
+      type->tp_new = NULL;
+   }
+#endif
+   return type;
+}
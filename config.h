@@ -0,0 +1,64 @@
+/* config.h
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Python view of the libcec configuration
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#ifndef CEC_CONFIG_H
+#define CEC_CONFIG_H
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <stdint.h>
+
+#include <mutex>
+
+#include <libcec/cec.h>
+
+struct Adapter;
+
+// Remembers the last configuration libcec reported, to tell which of the
+// fields exposed to Python changed. Bit i of a change mask is the field at
+// index i of the field table.
+class ConfigTracker {
+    public:
+        ConfigTracker() : known(false) {}
+
+        void reset(const CEC::libcec_configuration & config);
+        // the fields of config that differ from the last configuration, which
+        // config replaces; 0 for the first configuration seen
+        uint32_t update(const CEC::libcec_configuration & config);
+
+    private:
+        std::mutex lock;
+        CEC::libcec_configuration last;
+        bool known;
+};
+
+// dict of the fields of config in mask
+PyObject * convert_config(const CEC::libcec_configuration & config, uint32_t mask);
+
+// A live view of the configuration of adapter, which it keeps alive
+PyObject * config_new(PyTypeObject * type, Adapter * adapter);
+PyTypeObject * ConfigTypeInit(PyObject * module);
+
+#endif
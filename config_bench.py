@@ -0,0 +1,109 @@
+#!/usr/bin/env python
+
+# Measure how libcec's key handling settings affect remote control latency.
+# The sender adapter plays the remote: it transmits key presses and releases
+# to the receiver, which reports them as EVENT_KEYPRESS. For each value of
+# each setting the delay from a transmitted press to the keypress event, and
+# from a release to the release event, is reported. Both adapters must be on
+# the same bus.
+#
+# usage: config_bench.py [--setting name] [--values v,...] [--presses n]
+#                        sender_dev receiver_dev
+
+import argparse
+import threading
+import time
+
+import cec
+
+SWEEPS = {
+   "combo_key_timeout": [0, 100, 250, 500, 1000],
+   "button_repeat_rate": [0, 50, 100, 200],
+   "button_release_delay": [100, 250, 500],
+   "double_tap_timeout": [0, 100, 200, 400],
+}
+
+parser = argparse.ArgumentParser()
+parser.add_argument("--setting", choices=sorted(SWEEPS), action="append")
+parser.add_argument("--values")
+parser.add_argument("--presses", type=int, default=20)
+parser.add_argument("--hold", type=float, default=0.1)
+parser.add_argument("sender")
+parser.add_argument("receiver")
+args = parser.parse_args()
+
+sender = cec.Adapter(dev=args.sender, name="remote")
+receiver = cec.Adapter(dev=args.receiver, name="bench")
+
+events = []
+cond = threading.Condition()
+
+def on_key(event, key, duration):
+   with cond:
+      events.append((time.monotonic(), key, duration))
+      cond.notify()
+
+receiver.add_callback(on_key, cec.EVENT_KEYPRESS)
+
+def wait_event(since, timeout=5.0):
+   deadline = time.monotonic() + timeout
+   with cond:
+      while True:
+         for t, key, duration in events:
+            if t >= since:
+               events.remove((t, key, duration))
+               return t, duration
+         left = deadline - time.monotonic()
+         if left <= 0:
+            return None, None
+         cond.wait(left)
+
+def percentile(values, p):
+   values = sorted(values)
+   return values[min(len(values) - 1, int(p * len(values)))]
+
+def measure(key):
+   press = []
+   release = []
+   for i in range(args.presses):
+      with cond:
+         del events[:]
+      sent = time.monotonic()
+      sender.transmit(receiver.address, cec.CEC_OPCODE_USER_CONTROL_PRESSED,
+                      bytes([key]))
+      t, duration = wait_event(sent)
+      if t is not None:
+         press.append(t - sent)
+      time.sleep(args.hold)
+      sent = time.monotonic()
+      sender.transmit(receiver.address, cec.CEC_OPCODE_USER_CONTROL_RELEASE)
+      t, duration = wait_event(sent)
+      if t is not None:
+         release.append(t - sent)
+      time.sleep(0.2)
+   return press, release
+
+def report(name, value, samples):
+   if not samples:
+      return "%-22s %6s  no events" % (name, value)
+   return "%-22s %6s  mean %6.1f ms  p50 %6.1f ms  p99 %6.1f ms" % (name, value,
+      1000 * sum(samples) / len(samples), 1000 * percentile(samples, 0.5),
+      1000 * percentile(samples, 0.99))
+
+config = receiver.config
+defaults = config.as_dict()
+for setting in args.setting or sorted(SWEEPS):
+   values = SWEEPS[setting]
+   if args.values:
+      values = [int(v) for v in args.values.split(",")]
+   # the combo key timeout only delays the combo key
+   key = defaults["combo_key"] if setting == "combo_key_timeout" else 0x00
+   for value in values:
+      config.update(**{setting: value})
+      press, release = measure(key)
+      print(report(setting + " press", value, press))
+      print(report(setting + " release", value, release))
+   config.update(**{setting: defaults[setting]})
+
+sender.close()
+receiver.close()
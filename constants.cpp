@@ -0,0 +1,395 @@
+/* constants.cpp
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Compile time constant tables, resolved lazily on attribute access
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "cec.h"
+#include "constants.h"
+#include "opcodes.h"
+#include "retry.h"
+
+using namespace CEC;
+
+namespace {
+
+struct Constant {
+    const char * name;
+    int value;
+};
+
+#define C(prefix, name) { #name, prefix##name }
+
+constexpr Constant events[] = {
+    C(EVENT_, LOG),
+    C(EVENT_, KEYPRESS),
+    C(EVENT_, COMMAND),
+    C(EVENT_, CONFIG_CHANGE),
+    C(EVENT_, ALERT),
+    C(EVENT_, MENU_CHANGED),
+    C(EVENT_, ACTIVATED),
+    C(EVENT_, POWER_CHANGE),
+    C(EVENT_, DEVICE_ADDED),
+    C(EVENT_, DEVICE_REMOVED),
+    C(EVENT_, ALL),
+};
+
+constexpr Constant alerts[] = {
+    C(CEC_ALERT_, SERVICE_DEVICE),
+    C(CEC_ALERT_, CONNECTION_LOST),
+    C(CEC_ALERT_, PERMISSION_ERROR),
+    C(CEC_ALERT_, PORT_BUSY),
+    C(CEC_ALERT_, PHYSICAL_ADDRESS_ERROR),
+    C(CEC_ALERT_, TV_POLL_FAILED),
+};
+
+constexpr Constant menu_states[] = {
+    C(CEC_MENU_STATE_, ACTIVATED),
+    C(CEC_MENU_STATE_, DEACTIVATED),
+};
+
+constexpr Constant power_states[] = {
+    C(CEC_POWER_STATUS_, ON),
+    C(CEC_POWER_STATUS_, STANDBY),
+    C(CEC_POWER_STATUS_, IN_TRANSITION_STANDBY_TO_ON),
+    C(CEC_POWER_STATUS_, IN_TRANSITION_ON_TO_STANDBY),
+    C(CEC_POWER_STATUS_, UNKNOWN),
+};
+
+constexpr Constant device_types[] = {
+    C(CEC_DEVICE_TYPE_, TV),
+    C(CEC_DEVICE_TYPE_, RECORDING_DEVICE),
+    C(CEC_DEVICE_TYPE_, RESERVED),
+    C(CEC_DEVICE_TYPE_, TUNER),
+    C(CEC_DEVICE_TYPE_, PLAYBACK_DEVICE),
+    C(CEC_DEVICE_TYPE_, AUDIO_SYSTEM),
+};
+
+constexpr Constant logical_addresses[] = {
+    C(CECDEVICE_, UNKNOWN),
+    C(CECDEVICE_, TV),
+    C(CECDEVICE_, RECORDINGDEVICE1),
+    C(CECDEVICE_, RECORDINGDEVICE2),
+    C(CECDEVICE_, TUNER1),
+    C(CECDEVICE_, PLAYBACKDEVICE1),
+    C(CECDEVICE_, AUDIOSYSTEM),
+    C(CECDEVICE_, TUNER2),
+    C(CECDEVICE_, TUNER3),
+    C(CECDEVICE_, PLAYBACKDEVICE2),
+    C(CECDEVICE_, RECORDINGDEVICE3),
+    C(CECDEVICE_, TUNER4),
+    C(CECDEVICE_, PLAYBACKDEVICE3),
+    C(CECDEVICE_, RESERVED1),
+    C(CECDEVICE_, RESERVED2),
+    C(CECDEVICE_, FREEUSE),
+    C(CECDEVICE_, UNREGISTERED),
+    C(CECDEVICE_, BROADCAST),
+};
+
+constexpr Constant transmit_statuses[] = {
+    C(TRANSMIT_, ACKED),
+    C(TRANSMIT_, NACKED),
+    C(TRANSMIT_, TIMED_OUT),
+    C(TRANSMIT_, FAILED),
+};
+
+constexpr Constant retry_conditions[] = {
+    C(RETRY_, NACK),
+    C(RETRY_, TIMEOUT),
+    C(RETRY_, ALL),
+};
+
+#undef C
+
+// A family of constants sharing a prefix. The flat module names are the
+// prefix followed by the member name, the IntEnum namespace (if any) uses
+// the bare member names. Opcodes have no table here, they are read from
+// opcode_table so the decoder and the constants can't drift apart.
+struct Group {
+    const char * prefix;
+    const char * enum_name;
+    const Constant * items;
+    int count;
+};
+
+template<int N>
+constexpr Group group(const char * prefix, const char * enum_name,
+        const Constant (&items)[N]) {
+    return Group { prefix, enum_name, items, N };
+}
+
+constexpr Group groups[] = {
+    group("EVENT_", "Event", events),
+    group("CEC_ALERT_", "Alert", alerts),
+    group("CEC_MENU_STATE_", NULL, menu_states),
+    group("CEC_POWER_STATUS_", NULL, power_states),
+    group("CEC_DEVICE_TYPE_", "DeviceType", device_types),
+    group("CECDEVICE_", "LogicalAddress", logical_addresses),
+    group("TRANSMIT_", "TransmitStatus", transmit_statuses),
+    group("RETRY_", NULL, retry_conditions),
+    { "CEC_OPCODE_", "Opcode", NULL, 0 },
+};
+
+constexpr int group_count = sizeof(groups) / sizeof(groups[0]);
+
+constexpr bool same(const char * a, const char * b) {
+    return *a == *b && (*a == '\0' || same(a + 1, b + 1));
+}
+
+template<int N>
+constexpr bool unique(const Constant (&items)[N]) {
+    for (int i=0; i<N; i++) {
+        for (int j=i+1; j<N; j++) {
+            if (same(items[i].name, items[j].name)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static_assert(unique(events) && unique(alerts) && unique(menu_states) &&
+        unique(power_states) && unique(device_types) && unique(logical_addresses) &&
+        unique(transmit_statuses) && unique(retry_conditions),
+        "duplicate constant name");
+
+int size(const Group & g) {
+    return g.items ? g.count : opcode_table_size;
+}
+
+Constant item(const Group & g, int i) {
+    if (g.items) {
+        return g.items[i];
+    }
+    return Constant { opcode_table[i].name, opcode_table[i].opcode };
+}
+
+#if PY_VERSION_HEX >= 0x03070000
+
+// Look up a flat name such as CEC_OPCODE_STANDBY
+bool find_flat(const char * name, int * value) {
+    for (int i=0; i<group_count; i++) {
+        const Group & g = groups[i];
+        size_t len = strlen(g.prefix);
+        if (strncmp(name, g.prefix, len) != 0) {
+            continue;
+        }
+        for (int j=0; j<size(g); j++) {
+            Constant c = item(g, j);
+            if (strcmp(name + len, c.name) == 0) {
+                *value = c.value;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+PyObject * make_enum(PyObject * module, const Group & g) {
+    PyObject * members = PyList_New(size(g));
+    if (!members) {
+        return NULL;
+    }
+    for (int i=0; i<size(g); i++) {
+        Constant c = item(g, i);
+        PyObject * member = Py_BuildValue("(si)", c.name, c.value);
+        if (!member) {
+            Py_DECREF(members);
+            return NULL;
+        }
+        PyList_SET_ITEM(members, i, member);
+    }
+
+    PyObject * result = NULL;
+    PyObject * int_enum = NULL;
+    PyObject * args = NULL;
+    PyObject * kwargs = NULL;
+    PyObject * enum_module = PyImport_ImportModule("enum");
+    if (enum_module) {
+        int_enum = PyObject_GetAttrString(enum_module, "IntEnum");
+        Py_DECREF(enum_module);
+    }
+    if (int_enum) {
+        args = Py_BuildValue("(sO)", g.enum_name, members);
+        kwargs = Py_BuildValue("{sN}", "module", PyModule_GetNameObject(module));
+    }
+    if (args && kwargs) {
+        result = PyObject_Call(int_enum, args, kwargs);
+    }
+    Py_XDECREF(kwargs);
+    Py_XDECREF(args);
+    Py_XDECREF(int_enum);
+    Py_DECREF(members);
+    return result;
+}
+
+bool is_enum_name(const char * name) {
+    for (int i=0; i<group_count; i++) {
+        if (groups[i].enum_name && name && strcmp(name, groups[i].enum_name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The module's public attributes plus every flat CEC_* and EVENT_* name, so
+// that star imports export the constants resolved lazily. The IntEnum
+// namespaces are left out so that star imports don't build them.
+PyObject * make_all(PyObject * module) {
+    PyObject * names = PySet_New(NULL);
+    if (!names) {
+        return NULL;
+    }
+    PyObject * dict = PyModule_GetDict(module);
+    PyObject * key;
+    PyObject * value;
+    Py_ssize_t pos = 0;
+    while (PyDict_Next(dict, &pos, &key, &value)) {
+        if (!PyUnicode_Check(key) || PyUnicode_READ_CHAR(key, 0) == '_' ||
+                is_enum_name(PyUnicode_AsUTF8(key))) {
+            continue;
+        }
+        if (PySet_Add(names, key) < 0) {
+            Py_DECREF(names);
+            return NULL;
+        }
+    }
+    for (int i=0; i<group_count; i++) {
+        const Group & g = groups[i];
+        for (int j=0; j<size(g); j++) {
+            PyObject * name = PyUnicode_FromFormat("%s%s", g.prefix, item(g, j).name);
+            if (!name || PySet_Add(names, name) < 0) {
+                Py_XDECREF(name);
+                Py_DECREF(names);
+                return NULL;
+            }
+            Py_DECREF(name);
+        }
+    }
+
+    PyObject * result = PySequence_List(names);
+    Py_DECREF(names);
+    if (result && PyList_Sort(result) < 0) {
+        Py_CLEAR(result);
+    }
+    return result;
+}
+
+#endif
+
+}
+
+int add_constants(PyObject * module) {
+    for (int i=0; i<group_count; i++) {
+        const Group & g = groups[i];
+        for (int j=0; j<size(g); j++) {
+            Constant c = item(g, j);
+            char name[64];
+            snprintf(name, sizeof(name), "%s%s", g.prefix, c.name);
+            if (PyModule_AddIntConstant(module, name, c.value) < 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+#if PY_VERSION_HEX >= 0x03070000
+
+PyObject * constants_getattr(PyObject * module, PyObject * name) {
+    const char * str = PyUnicode_AsUTF8(name);
+    if (!str) {
+        return NULL;
+    }
+
+    PyObject * value = NULL;
+    int flat;
+    if (strcmp(str, "__all__") == 0) {
+        // built on the first star import rather than on every import
+        value = make_all(module);
+    } else if (find_flat(str, &flat)) {
+        value = PyLong_FromLong(flat);
+    } else {
+        for (int i=0; i<group_count; i++) {
+            if (groups[i].enum_name && strcmp(str, groups[i].enum_name) == 0) {
+                value = make_enum(module, groups[i]);
+                break;
+            }
+        }
+        if (!value && !PyErr_Occurred()) {
+            PyErr_Format(PyExc_AttributeError, "module '%s' has no attribute '%U'",
+                    PyModule_GetName(module), name);
+            return NULL;
+        }
+    }
+
+    // later lookups find the value in the module dict and skip __getattr__
+    if (value && PyObject_SetAttr(module, name, value) < 0) {
+        Py_CLEAR(value);
+    }
+    return value;
+}
+
+PyObject * constants_dir(PyObject * module, PyObject * unused) {
+    PyObject * dict = PyModule_GetDict(module);
+    PyObject * names = PyDict_Keys(dict);
+    if (!names) {
+        return NULL;
+    }
+
+    for (int i=0; i<group_count; i++) {
+        const Group & g = groups[i];
+        for (int j=-1; j<size(g); j++) {
+            PyObject * name;
+            if (j < 0) {
+                if (!g.enum_name) {
+                    continue;
+                }
+                name = PyUnicode_FromString(g.enum_name);
+            } else {
+                name = PyUnicode_FromFormat("%s%s", g.prefix, item(g, j).name);
+            }
+            if (!name) {
+                Py_DECREF(names);
+                return NULL;
+            }
+            int present = PyDict_Contains(dict, name);
+            if (present < 0 || (!present && PyList_Append(names, name) < 0)) {
+                Py_DECREF(name);
+                Py_DECREF(names);
+                return NULL;
+            }
+            Py_DECREF(name);
+        }
+    }
+
+    if (PyList_Sort(names) < 0) {
+        Py_DECREF(names);
+        return NULL;
+    }
+    return names;
+}
+
+#endif
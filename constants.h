@@ -0,0 +1,47 @@
+/* constants.h
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Module constants and their IntEnum namespaces
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+
+#ifndef CEC_CONSTANTS_H
+#define CEC_CONSTANTS_H
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+// Register every constant on the module right away, for interpreters without
+// module __getattr__ (PEP 562)
+int add_constants(PyObject * module);
+
+#if PY_VERSION_HEX >= 0x03070000
+
+// Module __getattr__: resolves the flat CEC_* and EVENT_* names, __all__ and
+// the IntEnum namespaces on first use, caching the result on the module
+PyObject * constants_getattr(PyObject * module, PyObject * name);
+
+// Module __dir__: the module's attributes plus the not yet resolved constants
+PyObject * constants_dir(PyObject * module, PyObject * unused);
+
+#endif
+
+#endif
@@ -0,0 +1,338 @@
+/* detect.cpp
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Implementation of the adapter detection cache and hotplug watch
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "detect.h"
+#include "module.h"
+
+using namespace CEC;
+
+namespace {
+
+// a hotplug callback and the interpreter it was set from
+struct Hotplug {
+    PyInterpreterState * interp;
+    PyObject * callback;
+};
+
+struct Detector {
+    std::mutex lock;
+    std::vector<CEC_ADAPTER_TYPE> adapters;
+    bool cached;          // adapters is the current set
+    unsigned generation;  // bumped for every change seen by the watch
+    bool started;         // a watch has been requested
+    int fd;               // inotify instance
+    int wd;               // current watch, -1 if none
+    std::string path;
+    std::vector<Hotplug> callbacks; // one per interpreter
+
+    Detector() : cached(false), generation(0), started(false), fd(-1), wd(-1) {}
+};
+
+// Never destroyed, the watch thread may outlive static destructors
+Detector & detector() {
+    static Detector * d = new Detector();
+    return *d;
+}
+
+int detect(ICECAdapter * adapter, std::vector<CEC_ADAPTER_TYPE> & out) {
+    out.resize(10);
+    int count = adapter->CEC_FIND_ADAPTERS(out.data(), out.size());
+    if (count > (int)out.size()) {
+        out.resize(count);
+        count = adapter->CEC_FIND_ADAPTERS(out.data(), out.size());
+    }
+    out.resize((std::max)(0, (std::min)(count, (int)out.size())));
+    return count;
+}
+
+#ifdef __linux__
+
+// Device nodes adapters appear as: Pulse-Eight USB adapters (ttyACM), USB
+// serial adapters (ttyUSB), the Linux CEC framework (cec) and the Raspberry
+// Pi firmware (vchiq)
+constexpr const char * node_prefixes[] = { "ttyACM", "ttyUSB", "cec", "vchiq" };
+
+bool is_adapter_node(const char * name) {
+    for (const char * prefix : node_prefixes) {
+        if (strncmp(name, prefix, strlen(prefix)) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+struct Change {
+    std::string path;
+    bool present;
+};
+
+PyObject * find_callback(Detector & d, PyInterpreterState * interp) {
+    for (size_t i=0; i<d.callbacks.size(); i++) {
+        if (d.callbacks[i].interp == interp) {
+            return d.callbacks[i].callback;
+        }
+    }
+    return NULL;
+}
+
+void call_hotplug(const std::vector<Change> & changes) {
+    Detector & d = detector();
+    std::vector<PyInterpreterState *> interps;
+    {
+        std::lock_guard<std::mutex> guard(d.lock);
+        for (size_t i=0; i<d.callbacks.size(); i++) {
+            interps.push_back(d.callbacks[i].interp);
+        }
+    }
+    for (size_t i=0; i<interps.size(); i++) {
+        InterpreterLock gil(interps[i]);
+        PyObject * callback;
+        {
+            // the callback may have been replaced while waiting for the GIL
+            std::lock_guard<std::mutex> guard(d.lock);
+            callback = find_callback(d, interps[i]);
+            Py_XINCREF(callback);
+        }
+        for (size_t j=0; callback && j<changes.size(); j++) {
+            PyObject * result = PyObject_CallFunction(callback, "(sO)",
+                    changes[j].path.c_str(), changes[j].present ? Py_True : Py_False);
+            if (result) {
+                Py_DECREF(result);
+            } else {
+                PyErr_Print();
+            }
+        }
+        Py_XDECREF(callback);
+    }
+}
+
+void run_watch(int fd) {
+    Detector & d = detector();
+    // aligned for struct inotify_event, as inotify(7) recommends
+    alignas(struct inotify_event) char buf[4096];
+    std::vector<Change> changes;
+
+    for (;;) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        ssize_t len = read(fd, buf, sizeof(buf));
+        if (len <= 0) {
+            if (len < 0 && (errno == EAGAIN || errno == EINTR)) {
+                continue;
+            }
+            break;
+        }
+
+        changes.clear();
+        {
+            std::lock_guard<std::mutex> guard(d.lock);
+            for (char * ptr = buf; ptr < buf + len; ) {
+                const struct inotify_event * event = (const struct inotify_event *)ptr;
+                ptr += sizeof(struct inotify_event) + event->len;
+
+                if (event->mask & IN_Q_OVERFLOW) {
+                    // events were lost, detect again next time
+                    d.generation++;
+                    d.cached = false;
+                    continue;
+                }
+                if (event->wd != d.wd) {
+                    continue;
+                }
+                if (event->mask & IN_IGNORED) {
+                    // the watched directory is gone, the cache can't be trusted
+                    d.wd = -1;
+                    d.generation++;
+                    d.cached = false;
+                    continue;
+                }
+                if (!event->len || !is_adapter_node(event->name)) {
+                    continue;
+                }
+                d.generation++;
+                d.cached = false;
+                changes.push_back(Change {
+                    d.path + "/" + event->name,
+                    (event->mask & (IN_CREATE | IN_MOVED_TO)) != 0 });
+            }
+        }
+
+        if (!changes.empty()) {
+            call_hotplug(changes);
+        }
+    }
+}
+
+#endif
+
+// Called with the lock held
+int start_watch(Detector & d, const char * path) {
+    d.started = true;
+#ifdef __linux__
+    if (d.fd < 0) {
+        d.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (d.fd < 0) {
+            return errno;
+        }
+        std::thread(run_watch, d.fd).detach();
+    }
+    if (d.wd >= 0) {
+        inotify_rm_watch(d.fd, d.wd);
+        d.wd = -1;
+    }
+    d.generation++;
+    d.cached = false;
+    int wd = inotify_add_watch(d.fd, path,
+            IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR);
+    if (wd < 0) {
+        return errno;
+    }
+    d.wd = wd;
+    d.path = path;
+    return 0;
+#else
+    return ENOSYS;
+#endif
+}
+
+}
+
+bool find_adapters(ICECAdapter * adapter, bool refresh,
+        std::vector<CEC_ADAPTER_TYPE> & out) {
+    Detector & d = detector();
+    unsigned generation;
+    {
+        std::lock_guard<std::mutex> guard(d.lock);
+        if (!d.started) {
+            start_watch(d, ADAPTER_WATCH_PATH);
+        }
+        if (d.cached && !refresh) {
+            out = d.adapters;
+            return true;
+        }
+        generation = d.generation;
+    }
+
+    if (adapter) {
+        detect(adapter, out);
+    } else {
+        libcec_configuration config;
+        config.Clear();
+        config.deviceTypes.Add(CEC_DEVICE_TYPE_RECORDING_DEVICE);
+        adapter = CECInitialise(&config);
+        if (!adapter) {
+            return false;
+        }
+        detect(adapter, out);
+        CECDestroy(adapter);
+    }
+
+    std::lock_guard<std::mutex> guard(d.lock);
+    // only cache a result nothing has changed under
+    if (d.wd >= 0 && generation == d.generation) {
+        d.adapters = out;
+        d.cached = true;
+    }
+    return true;
+}
+
+int watch_adapters(const char * path) {
+    Detector & d = detector();
+    std::lock_guard<std::mutex> guard(d.lock);
+    if (!path) {
+        if (d.wd >= 0) {
+            return 0;
+        }
+        path = ADAPTER_WATCH_PATH;
+    }
+    return start_watch(d, path);
+}
+
+void set_hotplug_callback(PyObject * callback) {
+    Detector & d = detector();
+    PyInterpreterState * interp = current_interpreter();
+    PyObject * old = NULL;
+    Py_XINCREF(callback);
+    {
+        std::lock_guard<std::mutex> guard(d.lock);
+        std::vector<Hotplug>::iterator itr = d.callbacks.begin();
+        while (itr != d.callbacks.end() && itr->interp != interp) {
+            ++itr;
+        }
+        if (itr != d.callbacks.end()) {
+            old = itr->callback;
+            if (callback) {
+                itr->callback = callback;
+            } else {
+                d.callbacks.erase(itr);
+            }
+        } else if (callback) {
+            d.callbacks.push_back(Hotplug { interp, callback });
+        }
+    }
+    Py_XDECREF(old);
+}
+
+PyObject * convert_adapter(const CEC_ADAPTER_TYPE & adapter, bool details) {
+    if (!details) {
+        return Py_BuildValue("s", CEC_ADAPTER_NAME(adapter));
+    }
+#if HAVE_CEC_ADAPTER_DESCRIPTOR
+    char addr[8];
+    format_physical_addr(adapter.iPhysicalAddress, addr);
+    return Py_BuildValue("{sssssisisisssksi}",
+            "name", adapter.strComName,
+            "path", adapter.strComPath,
+            "vendor_id", (int)adapter.iVendorId,
+            "product_id", (int)adapter.iProductId,
+            "firmware_version", (int)adapter.iFirmwareVersion,
+            "physical_address", addr,
+            "firmware_build_date", (unsigned long)adapter.iFirmwareBuildDate,
+            "type", (int)adapter.adapterType);
+#else
+    return Py_BuildValue("{ssss}",
+            "name", adapter.comm,
+            "path", adapter.path);
+#endif
+}
@@ -0,0 +1,64 @@
+/* detect.h
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Process wide adapter detection cache and hotplug watch
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+
+#ifndef CEC_DETECT_H
+#define CEC_DETECT_H
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <vector>
+
+#include <libcec/cec.h>
+
+#include "cec.h"
+
+// Directory watched for adapter device nodes unless told otherwise
+#define ADAPTER_WATCH_PATH "/dev"
+
+// Fill out with the adapters libcec can see. Unless refresh is set, the result
+// of the last detection is reused while the hotplug watch is running and has
+// seen no change since. The watch on ADAPTER_WATCH_PATH is started on first
+// use. adapter may be NULL, in which case a temporary libcec instance is
+// created if detection has to run. Must be called without the GIL. Returns
+// false if libcec could not be initialised.
+bool find_adapters(CEC::ICECAdapter * adapter, bool refresh,
+        std::vector<CEC::CEC_ADAPTER_TYPE> & out);
+
+// Watch path for adapter device nodes appearing or disappearing, replacing
+// any earlier watch. NULL keeps a running watch, or starts one on
+// ADAPTER_WATCH_PATH. Returns 0 or an errno value, ENOSYS where hotplug
+// watching isn't supported. Must be called without the GIL.
+int watch_adapters(const char * path);
+
+// Set the callable receiving (path, present) for each adapter device node
+// that appears or disappears, or clear it with NULL. Each interpreter has its
+// own callback, called in that interpreter. Requires the GIL.
+void set_hotplug_callback(PyObject * callback);
+
+// Convert an adapter to its name, or to a dict of every descriptor field
+PyObject * convert_adapter(const CEC::CEC_ADAPTER_TYPE & adapter, bool details);
+
+#endif
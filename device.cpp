@@ -28,6 +28,8 @@
 #include "cec.h"
 #include "adapter.h"
 #include "device.h"
+#include "module.h"
+#include "probes.h"
 
 #include <inttypes.h>
 
@@ -52,6 +54,10 @@ static PyObject * Device_getVendor(Device * self, void * closure) {
    return self->vendorId;
 }
 
+static PyObject * Device_getVendorId(Device * self, void * closure) {
+   return Py_BuildValue("k", (unsigned long)self->vendor);
+}
+
 static PyObject * Device_getOsdString(Device * self, void * closure) {
    Py_INCREF(self->osdName);
    return self->osdName;
@@ -74,6 +80,7 @@ static PyGetSetDef Device_getset[] = {
    {"address", (getter)Device_getAddr, (setter)NULL, "Logical Address"},
    {"physical_address", (getter)Device_getPhysicalAddress, (setter)NULL, "Physical Addresss"},
    {"vendor", (getter)Device_getVendor, (setter)NULL, "Vendor ID"},
+   {"vendor_id", (getter)Device_getVendorId, (setter)NULL, "Vendor ID as an int"},
    {"osd_string", (getter)Device_getOsdString, (setter)NULL, "OSD String"},
    {"cec_version", (getter)Device_getCECVersion, (setter)NULL, "CEC Version"},
    {"language", (getter)Device_getLanguage, (setter)NULL, "Language"},
@@ -83,7 +90,11 @@ static PyGetSetDef Device_getset[] = {
 static PyObject * Device_is_on(Device * self) {
    cec_power_status power;
    Py_BEGIN_ALLOW_THREADS
-   power = self->adapter->adapter->GetDevicePowerStatus(self->addr);
+   {
+      QueryProbe probe(self->addr, "power_status");
+      power = self->adapter->adapter->GetDevicePowerStatus(self->addr);
+   }
+   self->adapter->state.set_power_status(self->addr, power);
    Py_END_ALLOW_THREADS
    PyObject * ret;
    switch(power) {
@@ -104,10 +115,39 @@ static PyObject * Device_is_on(Device * self) {
    return ret;
 }
 
+static PyObject * Device_cached_power_status(Device * self, PyObject * args,
+      PyObject * kwds) {
+   PyObject * max_age_obj = Py_None;
+   double max_age = -1;
+   static const char * keywords[] = { "max_age", NULL };
+   if( !PyArg_ParseTupleAndKeywords(args, kwds, "|O:cached_power_status",
+         (char **)keywords, &max_age_obj) ) {
+      return NULL;
+   }
+   if( max_age_obj != Py_None ) {
+      max_age = PyFloat_AsDouble(max_age_obj);
+      if( max_age == -1 && PyErr_Occurred() ) {
+         return NULL;
+      }
+      if( max_age < 0 ) {
+         PyErr_SetString(PyExc_ValueError, "max_age should be >= 0");
+         return NULL;
+      }
+   }
+   cec_power_status power;
+   if( !self->adapter->state.power_status(self->addr, max_age, &power) ) {
+      Py_RETURN_NONE;
+   }
+   return Py_BuildValue("i", power);
+}
+
 static PyObject * Device_power_on(Device * self) {
    bool success;
    Py_BEGIN_ALLOW_THREADS
-   success = self->adapter->adapter->PowerOnDevices(self->addr);
+   {
+      QueryProbe probe(self->addr, "power_on");
+      success = self->adapter->adapter->PowerOnDevices(self->addr);
+   }
    Py_END_ALLOW_THREADS
    if( success ) {
       Py_RETURN_TRUE;
@@ -119,7 +159,10 @@ static PyObject * Device_power_on(Device * self) {
 static PyObject * Device_standby(Device * self) {
    bool success;
    Py_BEGIN_ALLOW_THREADS
-   success = self->adapter->adapter->StandbyDevices(self->addr);
+   {
+      QueryProbe probe(self->addr, "standby");
+      success = self->adapter->adapter->StandbyDevices(self->addr);
+   }
    Py_END_ALLOW_THREADS
    if( success ) {
       Py_RETURN_TRUE;
@@ -131,7 +174,11 @@ static PyObject * Device_standby(Device * self) {
 static PyObject * Device_is_active(Device * self) {
    bool success;
    Py_BEGIN_ALLOW_THREADS
-   success = self->adapter->adapter->IsActiveSource(self->addr);
+   {
+      QueryProbe probe(self->addr, "active_source");
+      success = self->adapter->adapter->IsActiveSource(self->addr);
+   }
+   self->adapter->state.set_active_source(self->addr, success);
    Py_END_ALLOW_THREADS
    if( success ) {
       Py_RETURN_TRUE;
@@ -152,7 +199,7 @@ static PyObject * Device_av_input(Device * self, PyObject * args) {
       data.opcode_set = 1;
       data.PushBack(0x69);
       data.PushBack(input);
-      success = self->adapter->adapter->Transmit(data);
+      success = adapter_transmit(self->adapter, data);
       Py_END_ALLOW_THREADS
       if( success ) {
          Py_RETURN_TRUE;
@@ -176,7 +223,7 @@ static PyObject * Device_audio_input(Device * self, PyObject * args) {
       data.opcode_set = 1;
       data.PushBack(0x6a);
       data.PushBack(input);
-      success = self->adapter->adapter->Transmit(data);
+      success = adapter_transmit(self->adapter, data);
       Py_END_ALLOW_THREADS
       if( success ) {
          Py_RETURN_TRUE;
@@ -188,12 +235,18 @@ static PyObject * Device_audio_input(Device * self, PyObject * args) {
    }
 }
 
-static PyObject * Device_transmit(Device * self, PyObject * args) {
+static PyObject * Device_transmit(Device * self, PyObject * args, PyObject * kwargs) {
    unsigned char opcode;
    const char * params = NULL;
    Py_ssize_t param_count = 0;
-   if( PyArg_ParseTuple(args, "b|s#:transmit", &opcode,
-         &params, &param_count) ) {
+   PyObject * attempts = NULL;
+   PyObject * backoff = NULL;
+   PyObject * retry_on = NULL;
+   static const char * keywords[] = { "opcode", "parameters", "attempts",
+      "backoff", "retry_on", NULL };
+   if( PyArg_ParseTupleAndKeywords(args, kwargs, "b|s#OOO:transmit",
+         (char **)keywords, &opcode, &params, &param_count, &attempts,
+         &backoff, &retry_on) ) {
       if( param_count > CEC_MAX_DATA_PACKET_SIZE ) {
          char errstr[1024];
          snprintf(errstr, 1024, "Too many parameters, maximum is %d",
@@ -201,8 +254,15 @@ static PyObject * Device_transmit(Device * self, PyObject * args) {
          PyErr_SetString(PyExc_ValueError, errstr);
          return NULL;
       }
+      RetryPolicy policy;
+      Py_BEGIN_ALLOW_THREADS
+      policy = self->adapter->retry.policy();
+      Py_END_ALLOW_THREADS
+      if( retry_policy_args(policy, attempts, backoff, NULL, NULL, retry_on) < 0 ) {
+         return NULL;
+      }
       cec_command data;
-      bool success;
+      TransmitResult result;
       Py_BEGIN_ALLOW_THREADS
       data.initiator = self->adapter->adapter->GetLogicalAddresses().primary;
       data.destination = self->addr;
@@ -213,35 +273,106 @@ static PyObject * Device_transmit(Device * self, PyObject * args) {
             data.PushBack(((uint8_t *)params)[i]);
          }
       }
-      success = self->adapter->adapter->Transmit(data);
+      adapter_transmit(self->adapter, data, &policy, &result);
       Py_END_ALLOW_THREADS
-      if( success ) {
-         Py_RETURN_TRUE;
-      } else {
-         Py_RETURN_FALSE;
-      }
+      return transmit_result((PyObject *)self->adapter, self->adapter->spare_result,
+            result);
    } else {
       return NULL;
    }
 }
 
-static PyObject * Device_new(PyTypeObject * type, PyObject * args, PyObject * kwds) {
-   Device * self;
-   Adapter * adapter;
-   unsigned char addr;
+bool query_device_metadata(Adapter * adapter, cec_logical_address addr,
+      DeviceMetadata & metadata) {
+   ICECAdapter * cec = adapter->adapter;
+   if (!cec) {
+      metadata.vendor_id = 0;
+      metadata.physical_address = PHYSICAL_ADDR_INVALID;
+      metadata.cec_version = CEC_VERSION_UNKNOWN;
+      metadata.osd_name.clear();
+      metadata.language.clear();
+      return false;
+   }
+
+   {
+      QueryProbe probe(addr, "vendor_id");
+      metadata.vendor_id = (uint32_t)cec->GetDeviceVendorId(addr);
+   }
+   adapter->state.set_vendor_id(addr, metadata.vendor_id);
+
+   {
+      QueryProbe probe(addr, "physical_address");
+      metadata.physical_address = cec->GetDevicePhysicalAddress(addr);
+   }
+   adapter->state.set_physical_address(addr, metadata.physical_address);
+   adapter->topology.set_physical_address(addr, metadata.physical_address);
+
+   {
+      QueryProbe probe(addr, "cec_version");
+      metadata.cec_version = cec->GetDeviceCecVersion(addr);
+   }
+   adapter->state.set_cec_version(addr, metadata.cec_version);
 
 #if CEC_LIB_VERSION_MAJOR >= 4
-   std::string name;
-   std::string lang;
+   {
+      QueryProbe probe(addr, "osd_name");
+      metadata.osd_name = cec->GetDeviceOSDName(addr);
+   }
+   adapter->state.set_osd_name(addr, metadata.osd_name);
+
+   {
+      QueryProbe probe(addr, "language");
+      metadata.language = cec->GetDeviceMenuLanguage(addr);
+   }
+   adapter->state.set_language(addr, metadata.language);
 #else
    cec_osd_name name;
+   {
+      QueryProbe probe(addr, "osd_name");
+      name = cec->GetDeviceOSDName(addr);
+   }
+   metadata.osd_name = name.name;
+
    cec_menu_language lang;
+   {
+      QueryProbe probe(addr, "language");
+      cec->GetDeviceMenuLanguage(addr, &lang);
+   }
+   metadata.language = lang.language;
 #endif
+   return true;
+}
+
+void device_metadata(Adapter * adapter, cec_logical_address addr,
+      DeviceMetadata & metadata) {
+   // a cached device costs no bus queries now, it is checked in the
+   // background instead
+   std::shared_ptr<MetadataCache> cache = std::atomic_load(&adapter->metadata);
+   if (cache && cache->lookup(addr, metadata)) {
+      adapter->topology.set_physical_address(addr, metadata.physical_address);
+      cache->refresh(addr);
+   } else {
+      query_device_metadata(adapter, addr, metadata);
+      if (cache && metadata.physical_address != PHYSICAL_ADDR_INVALID) {
+         cache->store(addr, metadata);
+      }
+   }
+}
+
+static PyObject * Device_new(PyTypeObject * type, PyObject * args, PyObject * kwds) {
+   Device * self;
+   Adapter * adapter;
+   unsigned char addr;
+   DeviceMetadata metadata;
 
    if( !PyArg_ParseTuple(args, "Ob:Device new", &adapter, &addr) ) {
       return NULL;
    }
-   if (!PyObject_IsInstance((PyObject *)adapter, (PyObject *)AdapterType())) {
+   ModuleState * module = type_state(type);
+   if (!module) {
+      return NULL;
+   }
+   if (!PyObject_IsInstance((PyObject *)adapter, (PyObject *)module->adapter_type)) {
       PyErr_SetString(PyExc_ValueError, "Adapter parameter is not an instance of cec.Adapter");
       return NULL;
    }
@@ -262,95 +393,47 @@ static PyObject * Device_new(PyTypeObject * type, PyObject * args, PyObject * kw
    Py_INCREF(adapter);
    self->adapter = adapter;
    self->addr = (cec_logical_address)addr;
-   uint64_t vendor;
+
    Py_BEGIN_ALLOW_THREADS
-   vendor = adapter->adapter->GetDeviceVendorId(self->addr);
+   device_metadata(adapter, self->addr, metadata);
    Py_END_ALLOW_THREADS
+
+   self->vendor = metadata.vendor_id;
    char vendor_str[7];
-   snprintf(vendor_str, 7, "%06" PRIX64, vendor);
+   snprintf(vendor_str, 7, "%06" PRIX32, metadata.vendor_id);
    vendor_str[6] = '\0';
    if (!(self->vendorId = Py_BuildValue("s", vendor_str))) {
       goto fail;
    }
 
    char strAddr[8];
-   Py_BEGIN_ALLOW_THREADS
-   uint16_t physicalAddress = adapter->adapter->GetDevicePhysicalAddress(self->addr);
-   snprintf(strAddr, 8, "%x.%x.%x.%x",
-         (physicalAddress >> 12) & 0xF,
-         (physicalAddress >> 8) & 0xF,
-         (physicalAddress >> 4) & 0xF,
-         physicalAddress & 0xF);
-   Py_END_ALLOW_THREADS
+   format_physical_addr(metadata.physical_address, strAddr);
    self->physicalAddress = Py_BuildValue("s", strAddr);
 
-   const char * ver_str;
-   Py_BEGIN_ALLOW_THREADS
-   cec_version ver = adapter->adapter->GetDeviceCecVersion(self->addr);
-   switch(ver) {
-      case CEC_VERSION_1_2:
-         ver_str = "1.2";
-         break;
-      case CEC_VERSION_1_2A:
-         ver_str = "1.2a";
-         break;
-      case CEC_VERSION_1_3:
-         ver_str = "1.3";
-         break;
-      case CEC_VERSION_1_3A:
-         ver_str = "1.3a";
-         break;
-      case CEC_VERSION_1_4:
-         ver_str = "1.4";
-         break;
-      case CEC_VERSION_UNKNOWN:
-      default:
-         ver_str = "Unknown";
-         break;
-   }
-   Py_END_ALLOW_THREADS
-
-   if (!(self->cecVersion = Py_BuildValue("s", ver_str))) {
+   if (!(self->cecVersion = Py_BuildValue("s", cec_version_str(metadata.cec_version)))) {
       goto fail;
    }
 
-#if CEC_LIB_VERSION_MAJOR >= 4
-   Py_BEGIN_ALLOW_THREADS
-   name = adapter->adapter->GetDeviceOSDName(self->addr);
-   Py_END_ALLOW_THREADS
-   if( !(self->osdName = Py_BuildValue("s#", name.c_str(), name.length())) ) {
+   if( !(self->osdName = Py_BuildValue("s#", metadata.osd_name.c_str(),
+               metadata.osd_name.length())) ) {
       goto fail;
    }
-#else
-   Py_BEGIN_ALLOW_THREADS
-   name = adapter->adapter->GetDeviceOSDName(self->addr);
-   Py_END_ALLOW_THREADS
-   if( !(self->osdName = Py_BuildValue("s", name.name)) ) {
-      goto fail;
-   }
-#endif
 
-#if CEC_LIB_VERSION_MAJOR >= 4
-   Py_BEGIN_ALLOW_THREADS
-   lang = adapter->adapter->GetDeviceMenuLanguage(self->addr);
-   Py_END_ALLOW_THREADS
-   if( !(self->lang = Py_BuildValue("s#", lang.c_str(), lang.length())) ) {
+   if( !(self->lang = Py_BuildValue("s#", metadata.language.c_str(),
+               metadata.language.length())) ) {
       goto fail;
    }
-#else
-   Py_BEGIN_ALLOW_THREADS
-   adapter->adapter->GetDeviceMenuLanguage(self->addr, &lang);
-   Py_END_ALLOW_THREADS
-   if( !(self->lang = Py_BuildValue("s", lang.language)) ) {
-      goto fail;
-   }
-#endif
 
    return (PyObject *)self;
 
 fail:
    Py_DECREF(adapter);
-   type->tp_free((PyObject *)self);
+   Py_XDECREF(self->vendorId);
+   Py_XDECREF(self->physicalAddress);
+   Py_XDECREF(self->cecVersion);
+   Py_XDECREF(self->osdName);
+   Py_XDECREF(self->lang);
+   free_instance((PyObject *)self);
    return NULL;
 
 }
@@ -362,7 +445,7 @@ static void Device_dealloc(Device * self) {
    Py_DECREF(self->cecVersion);
    Py_DECREF(self->osdName);
    Py_DECREF(self->lang);
-   Py_TYPE(self)->tp_free((PyObject*)self);
+   free_instance((PyObject *)self);
 }
 
 static PyObject * Device_str(Device * self) {
@@ -380,6 +463,9 @@ static PyObject * Device_repr(Device * self) {
 static PyMethodDef Device_methods[] = {
    {"is_on", (PyCFunction)Device_is_on, METH_NOARGS,
       "Get device power status"},
+   {"cached_power_status", (PyCFunction)Device_cached_power_status,
+      METH_VARARGS | METH_KEYWORDS,
+      "Get the last observed power status without querying the bus, or None"},
    {"power_on", (PyCFunction)Device_power_on, METH_NOARGS,
       "Power on this device"},
    {"standby", (PyCFunction)Device_standby, METH_NOARGS,
@@ -390,42 +476,30 @@ static PyMethodDef Device_methods[] = {
       "Select AV Input"},
    {"set_audio_input", (PyCFunction)Device_audio_input, METH_VARARGS,
       "Select Audio Input"},
-   {"transmit", (PyCFunction)Device_transmit, METH_VARARGS,
+   {"transmit", (PyCFunction)Device_transmit, METH_VARARGS | METH_KEYWORDS,
       "Transmit a raw CEC command to this device"},
    {NULL}
 };
 
-static PyTypeObject _DeviceType = {
-   PyVarObject_HEAD_INIT(NULL, 0)
-   "cec.Device",              /*tp_name*/
-   sizeof(Device),            /*tp_basicsize*/
-   0,                         /*tp_itemsize*/
-   (destructor)Device_dealloc, /*tp_dealloc*/
-   0,                         /*tp_print*/
-   0,                         /*tp_getattr*/
-   0,                         /*tp_setattr*/
-   0,                         /*tp_compare*/
-   (reprfunc)Device_repr,     /*tp_repr*/
-   0,                         /*tp_as_number*/
-   0,                         /*tp_as_sequence*/
-   0,                         /*tp_as_mapping*/
-   0,                         /*tp_hash */
-   0,                         /*tp_call*/
-   (reprfunc)Device_str,      /*tp_str*/
-   0,                         /*tp_getattro*/
-   0,                         /*tp_setattro*/
-   0,                         /*tp_as_buffer*/
-   Py_TPFLAGS_DEFAULT,        /*tp_flags*/
-   "CEC Device objects",      /* tp_doc */
+static PyType_Slot Device_slots[] = {
+   {Py_tp_dealloc, (void *)Device_dealloc},
+   {Py_tp_repr, (void *)Device_repr},
+   {Py_tp_str, (void *)Device_str},
+   {Py_tp_doc, (void *)"CEC Device objects"},
+   {Py_tp_methods, Device_methods},
+   {Py_tp_getset, Device_getset},
+   {Py_tp_new, (void *)Device_new},
+   {0, NULL}
 };
 
-PyTypeObject * DeviceTypeInit() {
-   _DeviceType.tp_new = Device_new;
-   _DeviceType.tp_methods = Device_methods;
-   _DeviceType.tp_getset = Device_getset;
-   return &_DeviceType;
-}
+static PyType_Spec Device_spec = {
+   "cec.Device",
+   sizeof(Device),
+   0,
+   CEC_TYPE_FLAGS,
+   Device_slots
+};
 
-PyTypeObject * DeviceType() {
-   return &_DeviceType;
+PyTypeObject * DeviceTypeInit(PyObject * module) {
+   return new_type(module, &Device_spec);
 }
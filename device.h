@@ -35,6 +35,7 @@ struct Device {
     Adapter * adapter;
 
     CEC::cec_logical_address   addr;
+    uint32_t vendor;
 
     PyObject * vendorId;
     PyObject * physicalAddress;
@@ -44,8 +45,21 @@ struct Device {
 };
 
 
-PyTypeObject * DeviceTypeInit();
-PyTypeObject * DeviceType();
+PyTypeObject * DeviceTypeInit(PyObject * module);
+
+struct DeviceMetadata;
+
+// Query the bus for the metadata Device objects are built from, recording it
+// in the adapter's state. Returns false, with the metadata of an absent
+// device, if the adapter is closed. Called without the GIL.
+bool query_device_metadata(Adapter * adapter, CEC::cec_logical_address addr,
+        DeviceMetadata & metadata);
+
+// The metadata for a Device object, from the adapter's metadata cache if it
+// has the device, which is then checked in the background, or else from the
+// bus. Called without the GIL.
+void device_metadata(Adapter * adapter, CEC::cec_logical_address addr,
+        DeviceMetadata & metadata);
 
 /*
  * Compat for libcec 3.x
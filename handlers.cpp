@@ -0,0 +1,197 @@
+/* handlers.cpp
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Implementation of native event handlers
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#include <string.h>
+
+#include <libcec/cec.h>
+
+#include "cec.h"
+#include "adapter.h"
+#include "handlers.h"
+
+using namespace CEC;
+
+static_assert(CEC_HANDLER_EVENT_LOG == EVENT_LOG &&
+        CEC_HANDLER_EVENT_KEYPRESS == EVENT_KEYPRESS &&
+        CEC_HANDLER_EVENT_COMMAND == EVENT_COMMAND &&
+        CEC_HANDLER_EVENT_ALERT == EVENT_ALERT &&
+        CEC_HANDLER_EVENT_MENU_CHANGED == EVENT_MENU_CHANGED &&
+        CEC_HANDLER_EVENT_ACTIVATED == EVENT_ACTIVATED &&
+        CEC_HANDLER_EVENT_POWER_CHANGE == EVENT_POWER_CHANGE &&
+        CEC_HANDLER_EVENT_DEVICE_ADDED == EVENT_DEVICE_ADDED &&
+        CEC_HANDLER_EVENT_DEVICE_REMOVED == EVENT_DEVICE_REMOVED,
+        "cec_handler.h event types must match EVENT_*");
+static_assert(CEC_HANDLER_MAX_PARAMETERS >= CEC_MAX_DATA_PACKET_SIZE,
+        "cec_handler_command must hold every parameter");
+
+#define HANDLER_EVENTS (EVENT_VALID & ~EVENT_CONFIG_CHANGE)
+
+static int handler_transmit(void * adapter, const cec_handler_command * command) {
+    if (command->size > CEC_MAX_DATA_PACKET_SIZE ||
+            command->initiator > 15 || command->destination > 15) {
+        return 0;
+    }
+    cec_command data;
+    data.Clear();
+    data.initiator = (cec_logical_address)command->initiator;
+    data.destination = (cec_logical_address)command->destination;
+    data.opcode = (cec_opcode)command->opcode;
+    data.opcode_set = command->opcode_set ? 1 : 0;
+    for (uint8_t i=0; i<command->size; i++) {
+        data.PushBack(command->parameters[i]);
+    }
+    // handlers run on the libcec thread, which mustn't wait out a backoff
+    RetryPolicy once;
+    return adapter_transmit((Adapter *)adapter, data, &once) ? 1 : 0;
+}
+
+static const cec_handler_api api = {
+    CEC_HANDLER_ABI_VERSION,
+    handler_transmit,
+};
+
+static void convert_event(const Event & event, cec_handler_event & out) {
+    memset(&out, 0, sizeof(out));
+    out.type = (uint32_t)event.type;
+    switch (event.type) {
+        case EVENT_LOG:
+            out.log_level = event.level;
+            out.log_time = event.time;
+            out.log_message = event.message.c_str();
+            break;
+        case EVENT_KEYPRESS:
+            out.keycode = event.keycode;
+            out.duration = event.duration;
+            break;
+        case EVENT_COMMAND:
+            out.command.initiator = event.command.initiator;
+            out.command.destination = event.command.destination;
+            out.command.opcode_set = event.command.opcode_set;
+            out.command.opcode = event.command.opcode;
+            out.command.size = event.command.parameters.size;
+            memcpy(out.command.parameters, event.command.parameters.data,
+                    event.command.parameters.size);
+            break;
+        case EVENT_ALERT:
+            out.alert = event.alert;
+            out.alert_param = event.has_param ? event.param.c_str() : NULL;
+            break;
+        case EVENT_MENU_CHANGED:
+            out.menu_state = event.menu;
+            break;
+        case EVENT_ACTIVATED:
+            out.logical_address = event.address;
+            out.activated = event.active;
+            break;
+        case EVENT_POWER_CHANGE:
+            out.logical_address = event.address;
+            out.old_power_status = event.old_status;
+            out.power_status = event.status;
+            break;
+        case EVENT_DEVICE_ADDED:
+        case EVENT_DEVICE_REMOVED:
+            out.logical_address = event.address;
+            break;
+    }
+}
+
+int HandlerList::add(PyObject * capsule) {
+    if (!PyCapsule_CheckExact(capsule)) {
+        PyErr_SetString(PyExc_TypeError, "handler must be a capsule");
+        return -1;
+    }
+    const cec_handler * handler = (const cec_handler *)PyCapsule_GetPointer(
+            capsule, CEC_HANDLER_CAPSULE);
+    if (!handler) {
+        return -1;
+    }
+    if (handler->abi_version != CEC_HANDLER_ABI_VERSION) {
+        PyErr_Format(PyExc_ValueError, "Unsupported handler ABI version %u, expected %d",
+                handler->abi_version, CEC_HANDLER_ABI_VERSION);
+        return -1;
+    }
+    if (!handler->handle || (handler->events & ~HANDLER_EVENTS)) {
+        PyErr_SetString(PyExc_ValueError, "Invalid handler function or events");
+        return -1;
+    }
+
+    Py_INCREF(capsule);
+    std::lock_guard<std::recursive_mutex> guard(lock);
+    handlers.push_back(Entry { capsule, handler });
+    events |= handler->events;
+    return 0;
+}
+
+void HandlerList::remove(PyObject * capsule) {
+    std::vector<PyObject *> removed;
+    {
+        std::lock_guard<std::recursive_mutex> guard(lock);
+        long mask = 0;
+        std::vector<Entry>::iterator itr = handlers.begin();
+        while (itr != handlers.end()) {
+            if (itr->capsule == capsule) {
+                removed.push_back(itr->capsule);
+                itr = handlers.erase(itr);
+            } else {
+                mask |= itr->handler->events;
+                ++itr;
+            }
+        }
+        events = mask;
+    }
+    for (size_t i=0; i<removed.size(); i++) {
+        Py_DECREF(removed[i]);
+    }
+}
+
+void HandlerList::clear() {
+    std::vector<Entry> removed;
+    {
+        std::lock_guard<std::recursive_mutex> guard(lock);
+        removed.swap(handlers);
+        events = 0;
+    }
+    for (size_t i=0; i<removed.size(); i++) {
+        Py_DECREF(removed[i].capsule);
+    }
+}
+
+bool HandlerList::dispatch(Adapter * adapter, const Event & event) {
+    if (!(events & event.type)) {
+        return false;
+    }
+    cec_handler_event converted;
+    convert_event(event, converted);
+
+    bool consumed = false;
+    std::lock_guard<std::recursive_mutex> guard(lock);
+    for (size_t i=0; i<handlers.size() && !consumed; i++) {
+        const cec_handler * handler = handlers[i].handler;
+        if (handler->events & event.type) {
+            consumed = handler->handle(handler->context, &api, adapter,
+                    &converted) == CEC_HANDLER_CONSUMED;
+        }
+    }
+    return consumed;
+}
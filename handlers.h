@@ -0,0 +1,70 @@
+/* handlers.h
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Native event handlers registered through cec_handler.h
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#ifndef CEC_HANDLERS_H
+#define CEC_HANDLERS_H
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "cec_handler.h"
+
+struct Adapter;
+struct Event;
+
+// Handlers are called with the lock held and never take the GIL, so add and
+// remove may wait for the lock with the GIL held. Once remove returns no
+// call to the handler is in progress. The lock is recursive in case libcec
+// delivers an event synchronously from a handler's transmit.
+class HandlerList {
+    public:
+        HandlerList() : events(0) {}
+
+        // takes a reference to capsule; -1 with an exception set if it isn't
+        // a valid handler. Requires the GIL.
+        int add(PyObject * capsule);
+        // Requires the GIL
+        void remove(PyObject * capsule);
+        void clear();
+
+        // run the handlers for event, true if one consumed it. Called
+        // without the GIL from the thread the event arrived on.
+        bool dispatch(Adapter * adapter, const Event & event);
+
+    private:
+        struct Entry {
+            PyObject * capsule;
+            const cec_handler * handler;
+        };
+
+        std::recursive_mutex lock;
+        std::vector<Entry> handlers;
+        std::atomic<long> events; // union of the handlers' event masks
+};
+
+#endif
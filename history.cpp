@@ -0,0 +1,287 @@
+/* history.cpp
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Implementation of the frame history and its buffer export
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "cec.h"
+#include "history.h"
+#include "module.h"
+#include "state.h"
+
+using namespace CEC;
+
+static_assert(sizeof(FrameRecord) == 80 && CEC_MAX_DATA_PACKET_SIZE == 64,
+        "FrameRecord must match FRAME_RECORD_FORMAT");
+
+void frame_record(const cec_command & cmd, int direction, FrameRecord & record) {
+    record.timestamp = monotonic_time();
+    record.initiator = cmd.initiator;
+    record.destination = cmd.destination;
+    record.opcode = cmd.opcode_set ? (int16_t)cmd.opcode : -1;
+    record.direction = (uint8_t)direction;
+    record.size = cmd.parameters.size;
+    record.padding[0] = record.padding[1] = 0;
+    memcpy(record.parameters, cmd.parameters.data, cmd.parameters.size);
+    memset(record.parameters + cmd.parameters.size, 0,
+            sizeof(record.parameters) - cmd.parameters.size);
+}
+
+HistoryStore::HistoryStore(size_t capacity) : records(capacity), next(0) {
+}
+
+void HistoryStore::add(const cec_command & cmd, int direction) {
+    std::lock_guard<std::mutex> guard(lock);
+    size_t capacity = records.size();
+    uint64_t seq = next++;
+    FrameRecord & record = records[seq % capacity];
+
+    if (seq >= capacity) {
+        // evict the frame in this slot from its opcode's index
+        int old = record.opcode < 0 ? 256 : record.opcode;
+        index[old].pop_front();
+    }
+    frame_record(cmd, direction, record);
+    index[record.opcode < 0 ? 256 : record.opcode].push_back(seq);
+}
+
+void HistoryStore::clear() {
+    std::lock_guard<std::mutex> guard(lock);
+    next = 0;
+    for (size_t i=0; i<257; i++) {
+        index[i].clear();
+    }
+    memset(records.data(), 0, records.size() * sizeof(FrameRecord));
+}
+
+size_t HistoryStore::filled() {
+    std::lock_guard<std::mutex> guard(lock);
+    return (std::min)((size_t)next, records.size());
+}
+
+size_t HistoryStore::oldest() {
+    std::lock_guard<std::mutex> guard(lock);
+    return next > records.size() ? next % records.size() : 0;
+}
+
+void HistoryStore::query(double start, double end, int opcode,
+        std::vector<size_t> & out) {
+    std::lock_guard<std::mutex> guard(lock);
+    size_t capacity = records.size();
+    uint64_t first = next > capacity ? next - capacity : 0;
+    // timestamps are taken under the lock, so they never decrease
+    auto before = [&](uint64_t seq, double t) {
+        return records[seq % capacity].timestamp < t;
+    };
+    auto after = [&](double t, uint64_t seq) {
+        return t < records[seq % capacity].timestamp;
+    };
+
+    if (opcode >= 0) {
+        const std::deque<uint64_t> & seqs = index[opcode];
+        std::deque<uint64_t>::const_iterator lo =
+            std::lower_bound(seqs.begin(), seqs.end(), start, before);
+        std::deque<uint64_t>::const_iterator hi =
+            std::upper_bound(lo, seqs.end(), end, after);
+        for (; lo != hi; ++lo) {
+            out.push_back(*lo % capacity);
+        }
+        return;
+    }
+
+    std::vector<uint64_t> seqs;
+    // binary search over the sequence numbers without materialising them
+    uint64_t lo = first, hi = next;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (before(mid, start)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    for (uint64_t seq = lo; seq < next && !after(end, seq); seq++) {
+        out.push_back(seq % capacity);
+    }
+}
+
+// Python History objects
+
+struct History {
+    PyObject_HEAD
+    std::shared_ptr<HistoryStore> store;
+
+    History() {}
+};
+
+PyObject * history_new(PyTypeObject * type, const std::shared_ptr<HistoryStore> & store) {
+    void * mem = type->tp_alloc(type, 0);
+    if (!mem) {
+        return NULL;
+    }
+    History * self = new (mem) History();
+    self->store = store;
+    return (PyObject *)self;
+}
+
+static void History_dealloc(History * self) {
+    self->~History();
+    free_instance((PyObject *)self);
+}
+
+static Py_ssize_t History_len(History * self) {
+    return self->store->filled();
+}
+
+static int History_getbuffer(History * self, Py_buffer * view, int flags) {
+    if (flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "History is read only");
+        view->obj = NULL;
+        return -1;
+    }
+    // the storage never moves, but each export covers the frames present
+    // when it was made, so it gets its own shape and strides
+    Py_ssize_t * layout = new Py_ssize_t[2];
+    layout[0] = self->store->filled();
+    layout[1] = sizeof(FrameRecord);
+    view->buf = (void *)self->store->data();
+    view->obj = (PyObject *)self;
+    Py_INCREF(self);
+    view->len = layout[0] * sizeof(FrameRecord);
+    view->readonly = 1;
+    view->itemsize = sizeof(FrameRecord);
+    view->format = (flags & PyBUF_FORMAT) ? (char *)FRAME_RECORD_FORMAT : NULL;
+    view->ndim = 1;
+    view->shape = (flags & PyBUF_ND) ? &layout[0] : NULL;
+    view->strides = (flags & PyBUF_STRIDES) ? &layout[1] : NULL;
+    view->suboffsets = NULL;
+    view->internal = layout;
+    return 0;
+}
+
+static void History_releasebuffer(History * self, Py_buffer * view) {
+    delete[] (Py_ssize_t *)view->internal;
+}
+
+static PyObject * History_query(History * self, PyObject * args, PyObject * kwargs) {
+    double start = -1e300;
+    double end = 1e300;
+    int opcode = -1;
+    static const char * keywords[] = { "start", "end", "opcode", NULL };
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|ddi:query",
+            (char **)keywords, &start, &end, &opcode)) {
+        return NULL;
+    }
+    if (opcode > 0xFF) {
+        PyErr_SetString(PyExc_ValueError, "opcode must be between 0 and 255");
+        return NULL;
+    }
+    std::vector<size_t> slots;
+    Py_BEGIN_ALLOW_THREADS
+    self->store->query(start, end, opcode, slots);
+    Py_END_ALLOW_THREADS
+
+    PyObject * result = PyList_New(slots.size());
+    if (!result) {
+        return NULL;
+    }
+    for (size_t i=0; i<slots.size(); i++) {
+        PyList_SET_ITEM(result, i, PyLong_FromSize_t(slots[i]));
+    }
+    return result;
+}
+
+static PyObject * History_clear(History * self, PyObject * args) {
+    Py_BEGIN_ALLOW_THREADS
+    self->store->clear();
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+static PyObject * History_getCapacity(History * self, void * closure) {
+    return PyLong_FromSize_t(self->store->capacity());
+}
+
+static PyObject * History_getOldest(History * self, void * closure) {
+    return PyLong_FromSize_t(self->store->oldest());
+}
+
+static PyMethodDef History_methods[] = {
+    {"query", (PyCFunction)History_query, METH_VARARGS | METH_KEYWORDS,
+        "Get the slots of frames in a time range and with an opcode, oldest first"},
+    {"clear", (PyCFunction)History_clear, METH_NOARGS, "Forget every frame"},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef History_getset[] = {
+   {"capacity", (getter)History_getCapacity, (setter)NULL, "Maximum number of frames"},
+   {"oldest", (getter)History_getOldest, (setter)NULL, "Slot of the oldest frame"},
+   {NULL}
+};
+
+static PyType_Slot History_slots[] = {
+   {Py_tp_dealloc, (void *)History_dealloc},
+   {Py_tp_doc, (void *)"Frame history, exporting FrameRecord structs through the buffer protocol"},
+   {Py_tp_methods, History_methods},
+   {Py_tp_getset, History_getset},
+   {Py_sq_length, (void *)History_len},
+#if PY_VERSION_HEX >= 0x03090000
+   {Py_bf_getbuffer, (void *)History_getbuffer},
+   {Py_bf_releasebuffer, (void *)History_releasebuffer},
+#endif
+   {0, NULL}
+};
+
+// only created by Adapter.history
+static PyType_Spec History_spec = {
+   "cec.History",
+   sizeof(History),
+   0,
+#if PY_VERSION_HEX >= 0x030A0000
+   CEC_TYPE_FLAGS | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+#else
+   CEC_TYPE_FLAGS,
+#endif
+   History_slots
+};
+
+PyTypeObject * HistoryTypeInit(PyObject * module) {
+   PyTypeObject * type = new_type(module, &History_spec);
+#if PY_VERSION_HEX < 0x030A0000
+   if (type) {
+      type->tp_new = NULL;
+   }
+#endif
+#if PY_VERSION_HEX < 0x03090000
+   // buffer slots can't be given in a type spec before 3.9
+   if (type) {
+      static PyBufferProcs buffer = { (getbufferproc)History_getbuffer,
+         (releasebufferproc)History_releasebuffer };
+      type->tp_as_buffer = &buffer;
+   }
+#endif
+   return type;
+}
@@ -0,0 +1,100 @@
+/* history.h
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Bounded history of received and transmitted frames
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#ifndef CEC_HISTORY_H
+#define CEC_HISTORY_H
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <libcec/cec.h>
+
+/*
+ * Compat for libcec 3.x
+ */
+#if CEC_LIB_VERSION_MAJOR < 4
+  #define CEC_MAX_DATA_PACKET_SIZE (16 * 4)
+#endif
+
+#define HISTORY_RECEIVED    0
+#define HISTORY_TRANSMITTED 1
+
+// One frame, exported as is through the buffer protocol
+struct FrameRecord {
+    double timestamp;      // monotonic_time()
+    uint8_t initiator;
+    uint8_t destination;
+    int16_t opcode;        // -1 for a poll without an opcode
+    uint8_t direction;     // HISTORY_RECEIVED or HISTORY_TRANSMITTED
+    uint8_t size;          // number of parameters
+    uint8_t padding[2];
+    uint8_t parameters[CEC_MAX_DATA_PACKET_SIZE];
+};
+
+// PEP 3118 format of FrameRecord
+#define FRAME_RECORD_FORMAT "T{d:timestamp:B:initiator:B:destination:h:opcode:" \
+    "B:direction:B:size:2x64s:parameters:}"
+
+// Fill record with cmd, timestamped now
+void frame_record(const CEC::cec_command & cmd, int direction, FrameRecord & record);
+
+// Frames in a ring of fixed capacity allocated up front. Slots fill from 0,
+// then the oldest frame is overwritten. Each opcode keeps the sequence
+// numbers of its frames, oldest first, for queries by opcode.
+class HistoryStore {
+    public:
+        HistoryStore(size_t capacity);
+
+        // safe from any thread, without the GIL
+        void add(const CEC::cec_command & cmd, int direction);
+        void clear();
+
+        size_t capacity() const { return records.size(); }
+        // number of slots holding a frame
+        size_t filled();
+        // slot of the oldest frame
+        size_t oldest();
+        const FrameRecord * data() const { return records.data(); }
+
+        // slots of the frames between start and end, inclusive, with opcode
+        // or any opcode if it is negative, oldest first
+        void query(double start, double end, int opcode, std::vector<size_t> & out);
+
+    private:
+        std::mutex lock;
+        std::vector<FrameRecord> records;
+        uint64_t next;  // sequence number of the next frame
+        std::deque<uint64_t> index[257]; // per opcode, the last for polls
+};
+
+// A Python view of a HistoryStore, which it keeps alive
+PyObject * history_new(PyTypeObject * type, const std::shared_ptr<HistoryStore> & store);
+PyTypeObject * HistoryTypeInit(PyObject * module);
+
+#endif
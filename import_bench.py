@@ -0,0 +1,33 @@
+#!/usr/bin/env python
+
+# Measure how long importing cec takes in a fresh interpreter, the cost paid
+# by every short lived process using the module. The interpreter start up
+# time is measured separately and subtracted.
+#
+# usage: import_bench.py [runs]
+
+import subprocess
+import sys
+import time
+
+runs = int(sys.argv[1]) if len(sys.argv) > 1 else 50
+
+def best(code):
+   times = []
+   for i in range(runs):
+      start = time.perf_counter()
+      subprocess.check_call([sys.executable, "-c", code])
+      times.append(time.perf_counter() - start)
+   times.sort()
+   return times[0], times[len(times)//2]
+
+base = best("pass")
+imp = best("import cec")
+use = best("import cec; cec.CEC_OPCODE_STANDBY")
+enum = best("import cec; cec.Opcode.STANDBY")
+
+print("runs: %d" % runs)
+for name, t in (("import", imp), ("import + flat constant", use),
+      ("import + enum namespace", enum)):
+   print("%-24s min %7.2f ms  median %7.2f ms" % (name,
+      (t[0] - base[0]) * 1000, (t[1] - base[1]) * 1000))
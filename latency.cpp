@@ -0,0 +1,143 @@
+/* latency.cpp
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Implementation of event delivery latency histograms
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#include <string.h>
+
+#include "cec.h"
+#include "latency.h"
+
+static const char * stage_names[STAGE_COUNT] = { "gil", "convert", "handlers", "total" };
+
+static_assert(EVENT_VALID < (1 << LATENCY_EVENT_TYPES),
+        "every event type needs a histogram set");
+
+static void add_sample(Histogram & h, double seconds) {
+    if (seconds < 0) {
+        seconds = 0;
+    }
+    double us = seconds * 1e6;
+    int bucket = 0;
+    while (bucket < LATENCY_BUCKETS - 1 && us >= (double)(1UL << bucket)) {
+        bucket++;
+    }
+    if (!h.count || seconds < h.min) {
+        h.min = seconds;
+    }
+    if (seconds > h.max) {
+        h.max = seconds;
+    }
+    h.count++;
+    h.sum += seconds;
+    h.buckets[bucket]++;
+}
+
+// upper bound of the bucket holding the given fraction of samples
+static double percentile(const Histogram & h, double fraction) {
+    unsigned long target = (unsigned long)(h.count * fraction);
+    unsigned long seen = 0;
+    for (int i=0; i<LATENCY_BUCKETS; i++) {
+        seen += h.buckets[i];
+        if (seen > target) {
+            return i < LATENCY_BUCKETS - 1 ? (1UL << i) * 1e-6 : h.max;
+        }
+    }
+    return h.max;
+}
+
+static PyObject * convert_histogram(const Histogram & h) {
+    PyObject * buckets = PyList_New(LATENCY_BUCKETS);
+    if (!buckets) {
+        return NULL;
+    }
+    for (int i=0; i<LATENCY_BUCKETS; i++) {
+        PyList_SET_ITEM(buckets, i, PyLong_FromUnsignedLong(h.buckets[i]));
+    }
+    return Py_BuildValue("{sksdsdsdsdsdsN}",
+            "count", h.count,
+            "mean", h.sum / h.count,
+            "min", h.min,
+            "max", h.max,
+            "p50", percentile(h, 0.5),
+            "p99", percentile(h, 0.99),
+            "buckets", buckets);
+}
+
+LatencyStats::LatencyStats() : tracing(false), attaching(false) {
+    memset(histograms, 0, sizeof(histograms));
+}
+
+void LatencyStats::enable(bool trace, bool attach) {
+    tracing = trace;
+    attaching = trace && attach;
+}
+
+void LatencyStats::record(long int event, double received, double acquired,
+        double dispatched, double returned) {
+    int type = 0;
+    while (type < LATENCY_EVENT_TYPES - 1 && !(event & (1 << type))) {
+        type++;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    Histogram * h = histograms[type];
+    add_sample(h[STAGE_GIL], acquired - received);
+    add_sample(h[STAGE_CONVERT], dispatched - acquired);
+    add_sample(h[STAGE_HANDLERS], returned - dispatched);
+    add_sample(h[STAGE_TOTAL], returned - received);
+}
+
+PyObject * LatencyStats::convert(bool reset) {
+    Histogram copy[LATENCY_EVENT_TYPES][STAGE_COUNT];
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        memcpy(copy, histograms, sizeof(copy));
+        if (reset) {
+            memset(histograms, 0, sizeof(histograms));
+        }
+    }
+
+    PyObject * result = PyDict_New();
+    if (!result) {
+        return NULL;
+    }
+    for (int type=0; type<LATENCY_EVENT_TYPES; type++) {
+        if (!copy[type][STAGE_TOTAL].count) {
+            continue;
+        }
+        PyObject * stages = PyDict_New();
+        PyObject * key = PyLong_FromLong(1 << type);
+        bool ok = stages && key && PyDict_SetItem(result, key, stages) == 0;
+        for (int stage=0; ok && stage<STAGE_COUNT; stage++) {
+            PyObject * h = convert_histogram(copy[type][stage]);
+            ok = h && PyDict_SetItemString(stages, stage_names[stage], h) == 0;
+            Py_XDECREF(h);
+        }
+        Py_XDECREF(stages);
+        Py_XDECREF(key);
+        if (!ok) {
+            Py_DECREF(result);
+            return NULL;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,79 @@
+/* latency.h
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Per-stage event delivery latency histograms
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#ifndef CEC_LATENCY_H
+#define CEC_LATENCY_H
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <atomic>
+#include <mutex>
+
+// Stages of delivering an event to Python callbacks
+enum LatencyStage {
+    STAGE_GIL,      // libcec callback entry until the GIL is held
+    STAGE_CONVERT,  // building the callback arguments
+    STAGE_HANDLERS, // running the callbacks
+    STAGE_TOTAL,    // libcec callback entry until the callbacks returned
+    STAGE_COUNT
+};
+
+// Bucket i counts latencies below 2**i microseconds, the last one the rest
+#define LATENCY_BUCKETS 28
+// One histogram set per bit of EVENT_VALID
+#define LATENCY_EVENT_TYPES 10
+
+struct Histogram {
+    unsigned long count;
+    double sum;
+    double min;
+    double max;
+    unsigned long buckets[LATENCY_BUCKETS];
+};
+
+class LatencyStats {
+    public:
+        LatencyStats();
+
+        bool enabled() const { return tracing; }
+        // append (received, acquired, dispatched) to callback arguments
+        bool attach() const { return attaching; }
+        void enable(bool trace, bool attach);
+
+        // times are monotonic_time() seconds
+        void record(long int event, double received, double acquired,
+                double dispatched, double returned);
+        // a dict of EVENT_* to a dict of stage name to histogram, optionally
+        // starting over
+        PyObject * convert(bool reset);
+
+    private:
+        std::atomic<bool> tracing;
+        std::atomic<bool> attaching;
+        std::mutex lock;
+        Histogram histograms[LATENCY_EVENT_TYPES][STAGE_COUNT];
+};
+
+#endif
@@ -0,0 +1,393 @@
+/* metadata.cpp
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Persistent device metadata cache
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#include "metadata.h"
+
+#if HAVE_METADATA_CACHE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "adapter.h"
+#include "device.h"
+
+using namespace CEC;
+
+static_assert(sizeof(MetadataHeader) == 64 && sizeof(MetadataEntry) == 64,
+        "the cache file layout must not depend on the compiler");
+
+// slots examined for an address before the oldest of them is reused
+#define METADATA_PROBES 32
+
+#define METADATA_SIZE (sizeof(MetadataHeader) + \
+        METADATA_CAPACITY * sizeof(MetadataEntry))
+
+namespace {
+
+// holds flock() on the cache file
+class FileLock {
+    public:
+        FileLock(int fd) : fd(fd) {
+            while (flock(fd, LOCK_EX) < 0 && errno == EINTR) {
+            }
+        }
+        ~FileLock() {
+            flock(fd, LOCK_UN);
+        }
+
+    private:
+        int fd;
+};
+
+// FNV-1a
+uint64_t hash_path(const char * path) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (; *path; path++) {
+        hash = (hash ^ (uint8_t)*path) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+double wall_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// copy entry, consistent with respect to writers in any process
+bool read_entry(const MetadataEntry * entry, MetadataEntry & copy) {
+    for (int tries = 0; tries < 1000; tries++) {
+        uint32_t sequence = __atomic_load_n(&entry->sequence, __ATOMIC_ACQUIRE);
+        if (sequence & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+        memcpy(&copy, entry, sizeof(copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&entry->sequence, __ATOMIC_RELAXED) == sequence) {
+            return true;
+        }
+    }
+    // a writer died mid update
+    return false;
+}
+
+void copy_string(char * dst, size_t size, const std::string & src) {
+    size_t n = std::min(src.size(), size - 1);
+    memcpy(dst, src.data(), n);
+    memset(dst + n, 0, size - n);
+}
+
+} // namespace
+
+MetadataCache * MetadataCache::open(Adapter * adapter, const char * path,
+        double max_age) {
+    int fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return NULL;
+    }
+    void * map = MAP_FAILED;
+    {
+        FileLock guard(fd);
+        struct stat st;
+        if (fstat(fd, &st) < 0) {
+            goto fail;
+        }
+        bool reset = (size_t)st.st_size != METADATA_SIZE;
+        if (reset && ftruncate(fd, METADATA_SIZE) < 0) {
+            goto fail;
+        }
+        map = mmap(NULL, METADATA_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+            goto fail;
+        }
+        MetadataHeader * header = (MetadataHeader *)map;
+        if (reset || memcmp(header->magic, METADATA_MAGIC, sizeof(header->magic)) ||
+                header->entry_size != sizeof(MetadataEntry) ||
+                header->capacity != METADATA_CAPACITY) {
+            memset(map, 0, METADATA_SIZE);
+            memcpy(header->magic, METADATA_MAGIC, sizeof(header->magic));
+            header->entry_size = sizeof(MetadataEntry);
+            header->capacity = METADATA_CAPACITY;
+        }
+    }
+    return new MetadataCache(adapter, fd, map, max_age);
+
+fail:
+    int err = errno;
+    if (map != MAP_FAILED) {
+        munmap(map, METADATA_SIZE);
+    }
+    close(fd);
+    errno = err;
+    return NULL;
+}
+
+MetadataCache::MetadataCache(Adapter * adapter, int fd, void * map,
+        double max_age) :
+    adapter(adapter),
+    key(hash_path(adapter->dev)),
+    fd(fd),
+    header((MetadataHeader *)map),
+    entries((MetadataEntry *)(header + 1)),
+    max_age(max_age),
+    running(true),
+    pending(0),
+    hits(0),
+    misses(0),
+    refreshes(0),
+    invalidations(0) {
+    thread = std::thread(&MetadataCache::run, this);
+}
+
+MetadataCache::~MetadataCache() {
+    stop();
+    munmap(header, METADATA_SIZE);
+    close(fd);
+}
+
+void MetadataCache::stop() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        running = false;
+        pending = 0;
+    }
+    cond.notify_one();
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+MetadataEntry * MetadataCache::find(cec_logical_address addr, bool create) {
+    uint64_t hash = (key ^ ((uint64_t)addr + 1)) * 0x9e3779b97f4a7c15ULL;
+    size_t start = (hash >> 32) % METADATA_CAPACITY;
+    MetadataEntry * oldest = NULL;
+    double oldest_time = 0;
+    for (size_t i = 0; i < METADATA_PROBES; i++) {
+        MetadataEntry * entry = &entries[(start + i) % METADATA_CAPACITY];
+        MetadataEntry copy;
+        if (!read_entry(entry, copy)) {
+            continue;
+        }
+        if (!(copy.flags & METADATA_USED)) {
+            // entries are never removed, so addr is not further along
+            return create ? entry : NULL;
+        }
+        if (copy.adapter == key && copy.logical_address == addr) {
+            return entry;
+        }
+        if (!oldest || copy.updated < oldest_time) {
+            oldest = entry;
+            oldest_time = copy.updated;
+        }
+    }
+    return create ? oldest : NULL;
+}
+
+void MetadataCache::begin_write(MetadataEntry * entry) {
+    // an odd count left by a writer that died is moved past
+    uint32_t sequence = (entry->sequence + 1) | 1;
+    __atomic_store_n(&entry->sequence, sequence, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void MetadataCache::end_write(MetadataEntry * entry) {
+    __atomic_store_n(&entry->sequence, entry->sequence + 1, __ATOMIC_RELEASE);
+}
+
+bool MetadataCache::lookup(cec_logical_address addr, DeviceMetadata & metadata) {
+    MetadataEntry * entry = find(addr, false);
+    MetadataEntry copy;
+    if (!entry || !read_entry(entry, copy) || !(copy.flags & METADATA_VALID) ||
+            copy.adapter != key || copy.logical_address != addr ||
+            (max_age >= 0 && wall_time() - copy.updated > max_age)) {
+        misses++;
+        return false;
+    }
+    metadata.vendor_id = copy.vendor_id;
+    metadata.physical_address = copy.physical_address;
+    metadata.cec_version = (cec_version)copy.cec_version;
+    metadata.osd_name.assign(copy.osd_name, strnlen(copy.osd_name, sizeof(copy.osd_name)));
+    metadata.language.assign(copy.language, strnlen(copy.language, sizeof(copy.language)));
+    hits++;
+    return true;
+}
+
+void MetadataCache::store(cec_logical_address addr, const DeviceMetadata & metadata) {
+    std::lock_guard<std::mutex> guard(write_lock);
+    FileLock file_guard(fd);
+    MetadataEntry * entry = find(addr, true);
+    if (!entry) {
+        return;
+    }
+    begin_write(entry);
+    entry->flags = METADATA_USED | METADATA_VALID;
+    entry->adapter = key;
+    entry->logical_address = addr;
+    entry->updated = wall_time();
+    entry->vendor_id = metadata.vendor_id;
+    entry->physical_address = metadata.physical_address;
+    entry->cec_version = metadata.cec_version;
+    copy_string(entry->osd_name, sizeof(entry->osd_name), metadata.osd_name);
+    copy_string(entry->language, sizeof(entry->language), metadata.language);
+    end_write(entry);
+}
+
+void MetadataCache::invalidate(cec_logical_address addr) {
+    std::lock_guard<std::mutex> guard(write_lock);
+    FileLock file_guard(fd);
+    MetadataEntry * entry = find(addr, false);
+    if (!entry || !(entry->flags & METADATA_VALID)) {
+        return;
+    }
+    begin_write(entry);
+    entry->flags &= ~METADATA_VALID;
+    end_write(entry);
+    invalidations++;
+}
+
+void MetadataCache::observe(const cec_command & cmd) {
+    if (!cmd.opcode_set || cmd.initiator >= CECDEVICE_BROADCAST) {
+        return;
+    }
+    const cec_datapacket & p = cmd.parameters;
+    switch (cmd.opcode) {
+        case CEC_OPCODE_REPORT_PHYSICAL_ADDRESS:
+        case CEC_OPCODE_DEVICE_VENDOR_ID:
+        case CEC_OPCODE_SET_OSD_NAME:
+        case CEC_OPCODE_CEC_VERSION:
+        case CEC_OPCODE_SET_MENU_LANGUAGE:
+            break;
+        default:
+            return;
+    }
+
+    std::lock_guard<std::mutex> guard(write_lock);
+    FileLock file_guard(fd);
+    MetadataEntry * entry = find(cmd.initiator, false);
+    if (!entry || !(entry->flags & METADATA_VALID)) {
+        return;
+    }
+    bool valid = true;
+    begin_write(entry);
+    switch (cmd.opcode) {
+        case CEC_OPCODE_REPORT_PHYSICAL_ADDRESS:
+            if (p.size >= 2) {
+                valid = entry->physical_address == ((p.data[0] << 8) | p.data[1]);
+            }
+            break;
+        case CEC_OPCODE_DEVICE_VENDOR_ID:
+            if (p.size >= 3) {
+                valid = entry->vendor_id ==
+                    (uint32_t)((p.data[0] << 16) | (p.data[1] << 8) | p.data[2]);
+            }
+            break;
+        case CEC_OPCODE_SET_OSD_NAME:
+            copy_string(entry->osd_name, sizeof(entry->osd_name),
+                    std::string((const char *)p.data, p.size));
+            break;
+        case CEC_OPCODE_CEC_VERSION:
+            if (p.size >= 1) {
+                entry->cec_version = p.data[0];
+            }
+            break;
+        case CEC_OPCODE_SET_MENU_LANGUAGE:
+            if (p.size >= 3) {
+                copy_string(entry->language, sizeof(entry->language),
+                        std::string((const char *)p.data, 3));
+            }
+            break;
+        default:
+            break;
+    }
+    if (valid) {
+        entry->updated = wall_time();
+    } else {
+        entry->flags &= ~METADATA_VALID;
+        invalidations++;
+    }
+    end_write(entry);
+}
+
+void MetadataCache::refresh(cec_logical_address addr) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!running) {
+            return;
+        }
+        pending |= 1 << addr;
+    }
+    cond.notify_one();
+}
+
+MetadataStats MetadataCache::stats() {
+    MetadataStats stats;
+    stats.hits = hits;
+    stats.misses = misses;
+    stats.refreshes = refreshes;
+    stats.invalidations = invalidations;
+    return stats;
+}
+
+void MetadataCache::run() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        cond.wait(guard, [this] { return !running || pending; });
+        if (!running) {
+            break;
+        }
+        for (int addr = 0; addr < 16; addr++) {
+            if (!running || !(pending & (1 << addr))) {
+                continue;
+            }
+            pending &= ~(1 << addr);
+            guard.unlock();
+            DeviceMetadata metadata;
+            if (!query_device_metadata(adapter, (cec_logical_address)addr,
+                        metadata)) {
+                // the adapter was closed, the entry can't be checked
+                guard.lock();
+                continue;
+            }
+            // an absent device reports no physical address
+            if (metadata.physical_address == PHYSICAL_ADDR_INVALID) {
+                invalidate((cec_logical_address)addr);
+            } else {
+                store((cec_logical_address)addr, metadata);
+            }
+            refreshes++;
+            guard.lock();
+        }
+    }
+}
+
+#endif
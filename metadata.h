@@ -0,0 +1,153 @@
+/* metadata.h
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Persistent device metadata cache
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#ifndef CEC_METADATA_H
+#define CEC_METADATA_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <libcec/cec.h>
+
+// the cache maps its file with POSIX mmap() and flock()
+#ifndef _WIN32
+#define HAVE_METADATA_CACHE 1
+#else
+#define HAVE_METADATA_CACHE 0
+#endif
+
+struct Adapter;
+
+// What Device objects are built from
+struct DeviceMetadata {
+    uint32_t vendor_id;
+    uint16_t physical_address;
+    CEC::cec_version cec_version;
+    std::string osd_name;
+    std::string language;
+};
+
+struct MetadataStats {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long refreshes;     // background queries completed
+    unsigned long invalidations; // entries contradicted by the bus
+};
+
+#define METADATA_MAGIC    "PYCECMD1"
+#define METADATA_CAPACITY 1024
+
+#define METADATA_USED  0x1  // the slot belongs to its adapter and address
+#define METADATA_VALID 0x2  // the fields may be used
+
+// The layout of the file, shared by every process mapping it
+struct MetadataHeader {
+    char magic[8];
+    uint32_t entry_size;
+    uint32_t capacity;
+    uint8_t reserved[48];
+};
+
+struct MetadataEntry {
+    uint32_t sequence;         // odd while the entry is being written
+    uint32_t flags;
+    uint64_t adapter;          // hash of the adapter path
+    double updated;            // wall clock time the device was last seen
+    uint32_t vendor_id;
+    uint16_t physical_address;
+    uint8_t logical_address;
+    uint8_t cec_version;
+    char osd_name[16];
+    char language[4];
+    uint8_t reserved[12];
+};
+
+// Device metadata of an adapter, kept in a memory mapped file so it survives
+// restarts and is shared by the processes on a host.
+//
+// Entries are keyed by adapter path and logical address, and hold the
+// physical address and vendor ID the device had. A Device built from a hit
+// costs no bus queries. Entries are checked lazily: a physical address or
+// vendor ID report on the bus that disagrees with an entry invalidates it,
+// other reports update it, and every hit is queried again in the background.
+//
+// Readers never block: each entry is guarded by a sequence count. Writers
+// are serialised with a mutex within the process and flock() across
+// processes.
+class MetadataCache {
+    public:
+        // map path, creating or resetting it if it is not a cache file;
+        // NULL with errno set on failure
+        static MetadataCache * open(Adapter * adapter, const char * path,
+                double max_age);
+        ~MetadataCache();
+
+        // entry of a device younger than max_age
+        bool lookup(CEC::cec_logical_address addr, DeviceMetadata & metadata);
+        void store(CEC::cec_logical_address addr, const DeviceMetadata & metadata);
+        // check and update entries from a frame seen on the bus
+        void observe(const CEC::cec_command & cmd);
+        // query the device again in the background
+        void refresh(CEC::cec_logical_address addr);
+        // stop the refresh thread; must not be called with the GIL held
+        void stop();
+
+        MetadataStats stats();
+
+    private:
+        MetadataCache(Adapter * adapter, int fd, void * map, double max_age);
+
+        void run();
+        // the slot of addr, or if create, a slot to hold it
+        MetadataEntry * find(CEC::cec_logical_address addr, bool create);
+        void begin_write(MetadataEntry * entry);
+        void end_write(MetadataEntry * entry);
+        void invalidate(CEC::cec_logical_address addr);
+
+        Adapter * adapter;
+        uint64_t key;        // hash of the adapter path
+        int fd;
+        MetadataHeader * header;
+        MetadataEntry * entries;
+        double max_age;
+
+        std::mutex write_lock;
+        std::mutex lock;     // guards the refresh state below
+        std::condition_variable cond;
+        std::thread thread;
+        bool running;
+        uint16_t pending;    // addresses waiting to be refreshed
+
+        std::atomic<unsigned long> hits;
+        std::atomic<unsigned long> misses;
+        std::atomic<unsigned long> refreshes;
+        std::atomic<unsigned long> invalidations;
+};
+
+#endif
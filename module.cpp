@@ -0,0 +1,95 @@
+/* module.cpp
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Implementation of the module state helpers
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#include "module.h"
+
+#if !CEC_MODULE_STATE
+// single-phase init, one module for the process
+static ModuleState state;
+#endif
+
+ModuleState * module_state(PyObject * module) {
+#if CEC_MODULE_STATE
+    return (ModuleState *)PyModule_GetState(module);
+#else
+    return &state;
+#endif
+}
+
+ModuleState * type_state(PyTypeObject * type) {
+#if CEC_MODULE_STATE
+    PyObject * module = PyType_GetModuleByDef(type, &cec_module);
+    if (!module) {
+        return NULL;
+    }
+    return module_state(module);
+#else
+    return &state;
+#endif
+}
+
+PyTypeObject * new_type(PyObject * module, PyType_Spec * spec) {
+#if PY_VERSION_HEX >= 0x03090000
+    return (PyTypeObject *)PyType_FromModuleAndSpec(module, spec, NULL);
+#else
+    return (PyTypeObject *)PyType_FromSpec(spec);
+#endif
+}
+
+void free_instance(PyObject * self) {
+    PyTypeObject * type = Py_TYPE(self);
+    type->tp_free(self);
+    // instances of heap types own a reference to their type since 3.8
+#if PY_VERSION_HEX >= 0x03080000
+    Py_DECREF(type);
+#endif
+}
+
+PyInterpreterState * current_interpreter() {
+#if PY_VERSION_HEX >= 0x03090000
+    return PyInterpreterState_Get();
+#else
+    return PyThreadState_Get()->interp;
+#endif
+}
+
+InterpreterLock::InterpreterLock(PyInterpreterState * interp) : tstate(NULL) {
+#if CEC_SUBINTERPRETERS
+    if (interp != PyInterpreterState_Main()) {
+        tstate = PyThreadState_New(interp);
+        PyEval_RestoreThread(tstate);
+        return;
+    }
+#endif
+    gstate = PyGILState_Ensure();
+}
+
+InterpreterLock::~InterpreterLock() {
+    if (tstate) {
+        PyThreadState_Clear(tstate);
+        PyThreadState_DeleteCurrent();
+    } else {
+        PyGILState_Release(gstate);
+    }
+}
@@ -0,0 +1,90 @@
+/* module.h
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Per-interpreter module state and interpreter aware GIL handling
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#ifndef CEC_MODULE_H
+#define CEC_MODULE_H
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+// Multi-phase init with the types kept in per-module state needs
+// PyType_GetModuleByDef to find the state from a type
+#if PY_VERSION_HEX >= 0x030B0000
+#define CEC_MODULE_STATE 1
+#else
+#define CEC_MODULE_STATE 0
+#endif
+
+// Interpreters with their own GIL were introduced in 3.12
+#if PY_VERSION_HEX >= 0x030C0000
+#define CEC_SUBINTERPRETERS 1
+#else
+#define CEC_SUBINTERPRETERS 0
+#endif
+
+#if PY_VERSION_HEX >= 0x030A0000
+#define CEC_TYPE_FLAGS (Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE)
+#else
+#define CEC_TYPE_FLAGS Py_TPFLAGS_DEFAULT
+#endif
+
+// Everything an interpreter's instance of the module owns
+struct ModuleState {
+    PyTypeObject * adapter_type;
+    PyTypeObject * device_type;
+    PyTypeObject * pool_type;
+    PyTypeObject * history_type;
+    PyTypeObject * config_type;
+    PyTypeObject * transmit_result_type;
+    PyTypeObject * broker_client_type; // NULL where the broker isn't supported
+};
+
+extern PyModuleDef cec_module;
+
+ModuleState * module_state(PyObject * module);
+// The state of the module that created type, or one of its bases. NULL with
+// an exception set if type doesn't come from this module.
+ModuleState * type_state(PyTypeObject * type);
+
+// Create a heap type from spec, owned by module
+PyTypeObject * new_type(PyObject * module, PyType_Spec * spec);
+// Free an instance of a heap type, releasing its reference to the type
+void free_instance(PyObject * self);
+
+PyInterpreterState * current_interpreter();
+
+// Holds the GIL of an interpreter on a native thread. PyGILState_Ensure only
+// attaches to the main interpreter, so events for objects created in a
+// subinterpreter get a thread state of that interpreter for the duration.
+class InterpreterLock {
+    public:
+        InterpreterLock(PyInterpreterState * interp);
+        ~InterpreterLock();
+
+    private:
+        PyThreadState * tstate;
+        PyGILState_STATE gstate;
+};
+
+#endif
@@ -0,0 +1,535 @@
+/* opcodes.cpp
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Table driven CEC frame decoder and formatter
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <algorithm>
+
+#include "cec.h"
+#include "opcodes.h"
+#include "state.h"
+
+using namespace CEC;
+
+#define OP(name) CEC_OPCODE_##name, #name
+#define F_ADDR(name) { FIELD_PHYSICAL_ADDRESS, #name, false }
+#define F_BYTE(name) { FIELD_BYTE, #name, false }
+#define F_BOOL(name) { FIELD_BOOL, #name, false }
+#define F_VENDOR(name) { FIELD_VENDOR_ID, #name, false }
+#define F_VERSION(name) { FIELD_CEC_VERSION, #name, false }
+#define F_LANGUAGE(name) { FIELD_LANGUAGE, #name, false }
+#define F_AUDIO(name) { FIELD_AUDIO_STATUS, #name, false }
+#define F_TEXT(name) { FIELD_TEXT, #name, false }
+#define F_DATA(name) { FIELD_DATA, #name, false }
+#define F_OPTIONAL_ADDR(name) { FIELD_PHYSICAL_ADDRESS, #name, true }
+
+constexpr OpcodeSpec opcode_table[] = {
+    { OP(ACTIVE_SOURCE), OPCODE_BROADCAST, { F_ADDR(physical_address) } },
+    { OP(IMAGE_VIEW_ON), OPCODE_DIRECT, {} },
+    { OP(TEXT_VIEW_ON), OPCODE_DIRECT, {} },
+    { OP(INACTIVE_SOURCE), OPCODE_DIRECT, { F_ADDR(physical_address) } },
+    { OP(REQUEST_ACTIVE_SOURCE), OPCODE_BROADCAST, {} },
+    { OP(ROUTING_CHANGE), OPCODE_BROADCAST, { F_ADDR(original_address), F_ADDR(new_address) } },
+    { OP(ROUTING_INFORMATION), OPCODE_BROADCAST, { F_ADDR(physical_address) } },
+    { OP(SET_STREAM_PATH), OPCODE_BROADCAST, { F_ADDR(physical_address) } },
+    { OP(STANDBY), OPCODE_BOTH, {} },
+    { OP(RECORD_OFF), OPCODE_DIRECT, {} },
+    { OP(RECORD_ON), OPCODE_DIRECT, { F_DATA(record_source) } },
+    { OP(RECORD_STATUS), OPCODE_DIRECT, { F_BYTE(record_status) } },
+    { OP(RECORD_TV_SCREEN), OPCODE_DIRECT, {} },
+    { OP(CLEAR_ANALOGUE_TIMER), OPCODE_DIRECT, { F_DATA(timer) } },
+    { OP(CLEAR_DIGITAL_TIMER), OPCODE_DIRECT, { F_DATA(timer) } },
+    { OP(CLEAR_EXTERNAL_TIMER), OPCODE_DIRECT, { F_DATA(timer) } },
+    { OP(SET_ANALOGUE_TIMER), OPCODE_DIRECT, { F_DATA(timer) } },
+    { OP(SET_DIGITAL_TIMER), OPCODE_DIRECT, { F_DATA(timer) } },
+    { OP(SET_EXTERNAL_TIMER), OPCODE_DIRECT, { F_DATA(timer) } },
+    { OP(SET_TIMER_PROGRAM_TITLE), OPCODE_DIRECT, { F_TEXT(program_title) } },
+    { OP(TIMER_CLEARED_STATUS), OPCODE_DIRECT, { F_BYTE(timer_cleared_status) } },
+    { OP(TIMER_STATUS), OPCODE_DIRECT, { F_DATA(timer_status) } },
+    { OP(CEC_VERSION), OPCODE_DIRECT, { F_VERSION(cec_version) } },
+    { OP(GET_CEC_VERSION), OPCODE_DIRECT, {} },
+    { OP(GIVE_PHYSICAL_ADDRESS), OPCODE_DIRECT, {} },
+    { OP(GET_MENU_LANGUAGE), OPCODE_DIRECT, {} },
+    { OP(REPORT_PHYSICAL_ADDRESS), OPCODE_BROADCAST, { F_ADDR(physical_address), F_BYTE(device_type) } },
+    { OP(SET_MENU_LANGUAGE), OPCODE_BROADCAST, { F_LANGUAGE(language) } },
+    { OP(DECK_CONTROL), OPCODE_DIRECT, { F_BYTE(deck_control_mode) } },
+    { OP(DECK_STATUS), OPCODE_DIRECT, { F_BYTE(deck_info) } },
+    { OP(GIVE_DECK_STATUS), OPCODE_DIRECT, { F_BYTE(status_request) } },
+    { OP(PLAY), OPCODE_DIRECT, { F_BYTE(play_mode) } },
+    { OP(GIVE_TUNER_DEVICE_STATUS), OPCODE_DIRECT, { F_BYTE(status_request) } },
+    { OP(SELECT_ANALOGUE_SERVICE), OPCODE_DIRECT, { F_DATA(service) } },
+    { OP(SELECT_DIGITAL_SERVICE), OPCODE_DIRECT, { F_DATA(service) } },
+    { OP(TUNER_DEVICE_STATUS), OPCODE_DIRECT, { F_DATA(tuner_device_info) } },
+    { OP(TUNER_STEP_DECREMENT), OPCODE_DIRECT, {} },
+    { OP(TUNER_STEP_INCREMENT), OPCODE_DIRECT, {} },
+    { OP(DEVICE_VENDOR_ID), OPCODE_BROADCAST, { F_VENDOR(vendor_id) } },
+    { OP(GIVE_DEVICE_VENDOR_ID), OPCODE_DIRECT, {} },
+    { OP(VENDOR_COMMAND), OPCODE_DIRECT, { F_DATA(vendor_data) } },
+    { OP(VENDOR_COMMAND_WITH_ID), OPCODE_BOTH, { F_VENDOR(vendor_id), F_DATA(vendor_data) } },
+    { OP(VENDOR_REMOTE_BUTTON_DOWN), OPCODE_BOTH, { F_DATA(rc_code) } },
+    { OP(VENDOR_REMOTE_BUTTON_UP), OPCODE_BOTH, {} },
+    { OP(SET_OSD_STRING), OPCODE_DIRECT, { F_BYTE(display_control), F_TEXT(osd_string) } },
+    { OP(GIVE_OSD_NAME), OPCODE_DIRECT, {} },
+    { OP(SET_OSD_NAME), OPCODE_DIRECT, { F_TEXT(osd_name) } },
+    { OP(MENU_REQUEST), OPCODE_DIRECT, { F_BYTE(menu_request_type) } },
+    { OP(MENU_STATUS), OPCODE_DIRECT, { F_BYTE(menu_state) } },
+    { OP(USER_CONTROL_PRESSED), OPCODE_DIRECT, { F_BYTE(ui_command), F_DATA(operands) } },
+    { OP(USER_CONTROL_RELEASE), OPCODE_DIRECT, {} },
+    { OP(GIVE_DEVICE_POWER_STATUS), OPCODE_DIRECT, {} },
+    { OP(REPORT_POWER_STATUS), OPCODE_BOTH, { F_BYTE(power_status) } },
+    { OP(FEATURE_ABORT), OPCODE_DIRECT, { F_BYTE(feature_opcode), F_BYTE(abort_reason) } },
+    { OP(ABORT), OPCODE_DIRECT, {} },
+    { OP(GIVE_AUDIO_STATUS), OPCODE_DIRECT, {} },
+    { OP(GIVE_SYSTEM_AUDIO_MODE_STATUS), OPCODE_DIRECT, {} },
+    { OP(REPORT_AUDIO_STATUS), OPCODE_DIRECT, { F_AUDIO(audio_status) } },
+    { OP(SET_SYSTEM_AUDIO_MODE), OPCODE_BOTH, { F_BOOL(system_audio_mode) } },
+    { OP(SYSTEM_AUDIO_MODE_REQUEST), OPCODE_DIRECT, { F_OPTIONAL_ADDR(physical_address) } },
+    { OP(SYSTEM_AUDIO_MODE_STATUS), OPCODE_DIRECT, { F_BOOL(system_audio_mode) } },
+    { OP(SET_AUDIO_RATE), OPCODE_DIRECT, { F_BYTE(audio_rate) } },
+    { OP(START_ARC), OPCODE_DIRECT, {} },
+    { OP(REPORT_ARC_STARTED), OPCODE_DIRECT, {} },
+    { OP(REPORT_ARC_ENDED), OPCODE_DIRECT, {} },
+    { OP(REQUEST_ARC_START), OPCODE_DIRECT, {} },
+    { OP(REQUEST_ARC_END), OPCODE_DIRECT, {} },
+    { OP(END_ARC), OPCODE_DIRECT, {} },
+    { OP(CDC), OPCODE_BROADCAST, { F_DATA(cdc_data) } },
+    { OP(NONE), OPCODE_BOTH, {} },
+};
+
+#undef OP
+#undef F_ADDR
+#undef F_BYTE
+#undef F_BOOL
+#undef F_VENDOR
+#undef F_VERSION
+#undef F_LANGUAGE
+#undef F_AUDIO
+#undef F_TEXT
+#undef F_DATA
+#undef F_OPTIONAL_ADDR
+
+constexpr int opcode_table_size = sizeof(opcode_table) / sizeof(opcode_table[0]);
+
+namespace {
+
+// Maps an opcode byte to its position in opcode_table
+struct OpcodeIndex {
+    uint8_t entry[256];
+};
+
+constexpr uint8_t NO_ENTRY = 0xFF;
+
+constexpr OpcodeIndex make_index() {
+    OpcodeIndex index = {};
+    for (int i=0; i<256; i++) {
+        index.entry[i] = NO_ENTRY;
+    }
+    for (int i=0; i<opcode_table_size; i++) {
+        index.entry[opcode_table[i].opcode & 0xFF] = (uint8_t)i;
+    }
+    return index;
+}
+
+constexpr OpcodeIndex opcode_index = make_index();
+
+constexpr bool unique() {
+    for (int i=0; i<opcode_table_size; i++) {
+        if (opcode_index.entry[opcode_table[i].opcode & 0xFF] != i) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(opcode_table_size < NO_ENTRY, "opcode table too large for the index");
+static_assert(unique(), "opcode listed twice in the opcode table");
+
+inline uint16_t param_physical_addr(const cec_datapacket & params, uint8_t pos) {
+    return (uint16_t)((params[pos] << 8) | params[pos + 1]);
+}
+
+inline uint32_t param_vendor_id(const cec_datapacket & params, uint8_t pos) {
+    return ((uint32_t)params[pos] << 16) | ((uint32_t)params[pos + 1] << 8) |
+        params[pos + 2];
+}
+
+// number of parameter bytes a field consumes, given what is left
+inline int field_size(FieldKind kind, int remaining) {
+    switch (kind) {
+        case FIELD_PHYSICAL_ADDRESS:
+            return 2;
+        case FIELD_VENDOR_ID:
+        case FIELD_LANGUAGE:
+            return 3;
+        case FIELD_BYTE:
+        case FIELD_BOOL:
+        case FIELD_CEC_VERSION:
+        case FIELD_AUDIO_STATUS:
+            return 1;
+        case FIELD_TEXT:
+        case FIELD_DATA:
+            return remaining;
+        case FIELD_NONE:
+        default:
+            return 0;
+    }
+}
+
+inline bool direction_valid(const OpcodeSpec * spec, const cec_command & cmd) {
+    int direction = cmd.destination == CECDEVICE_BROADCAST ?
+        OPCODE_BROADCAST : OPCODE_DIRECT;
+    return (spec->direction & direction) != 0;
+}
+
+}
+
+const OpcodeSpec * opcode_spec(uint8_t opcode) {
+    uint8_t entry = opcode_index.entry[opcode];
+    return entry == NO_ENTRY ? NULL : &opcode_table[entry];
+}
+
+// Formatting
+
+struct Writer {
+    char * buf;
+    size_t size;
+    size_t len;
+
+    void append(const char * fmt, ...);
+};
+
+void Writer::append(const char * fmt, ...) {
+    if (len >= size) {
+        return;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf + len, size - len, fmt, ap);
+    va_end(ap);
+    if (n > 0) {
+        len = (std::min)(len + n, size - 1);
+    }
+}
+
+static void format_data(Writer & w, const cec_datapacket & params, int pos, int count) {
+    for (int i=0; i<count; i++) {
+        w.append(i ? ":%02x" : "%02x", params[pos + i]);
+    }
+}
+
+static void format_text(Writer & w, const cec_datapacket & params, int pos, int count) {
+    w.append("'");
+    for (int i=0; i<count; i++) {
+        uint8_t c = params[pos + i];
+        w.append("%c", (c >= 0x20 && c < 0x7F && c != '\'') ? c : '.');
+    }
+    w.append("'");
+}
+
+size_t format_command(const cec_command & cmd, char * buf, size_t size) {
+    Writer w = { buf, size, 0 };
+    if (size == 0) {
+        return 0;
+    }
+    buf[0] = '\0';
+
+    w.append("%d -> %d: ", cmd.initiator, cmd.destination);
+    if (!cmd.opcode_set) {
+        w.append("POLL");
+        return w.len;
+    }
+
+    const cec_datapacket & params = cmd.parameters;
+    const OpcodeSpec * spec = opcode_spec((uint8_t)cmd.opcode);
+    int pos = 0;
+    if (spec) {
+        w.append("%s", spec->name);
+        for (int i=0; i<OPCODE_MAX_FIELDS && spec->fields[i].kind != FIELD_NONE; i++) {
+            const FieldSpec & field = spec->fields[i];
+            int remaining = params.size - pos;
+            int n = field_size(field.kind, remaining);
+            if (n > remaining || (n == 0 && field.kind != FIELD_TEXT && field.kind != FIELD_DATA)) {
+                if (!field.optional) {
+                    w.append(" <truncated>");
+                }
+                break;
+            }
+            if (n == 0) {
+                continue;
+            }
+            w.append(" %s=", field.name);
+            switch (field.kind) {
+                case FIELD_PHYSICAL_ADDRESS: {
+                    char str[8];
+                    format_physical_addr(param_physical_addr(params, pos), str);
+                    w.append("%s", str);
+                    break;
+                }
+                case FIELD_BYTE:
+                    w.append("%d", params[pos]);
+                    break;
+                case FIELD_BOOL:
+                    w.append("%s", params[pos] ? "True" : "False");
+                    break;
+                case FIELD_VENDOR_ID:
+                    w.append("%06X", param_vendor_id(params, pos));
+                    break;
+                case FIELD_CEC_VERSION:
+                    w.append("%s", cec_version_str((cec_version)params[pos]));
+                    break;
+                case FIELD_AUDIO_STATUS:
+                    w.append("%d%s", params[pos] & 0x7F, (params[pos] & 0x80) ? " (muted)" : "");
+                    break;
+                case FIELD_LANGUAGE:
+                case FIELD_TEXT:
+                    format_text(w, params, pos, n);
+                    break;
+                case FIELD_DATA:
+                case FIELD_NONE:
+                default:
+                    format_data(w, params, pos, n);
+                    break;
+            }
+            pos += n;
+        }
+        if (!direction_valid(spec, cmd)) {
+            w.append(cmd.destination == CECDEVICE_BROADCAST ?
+                " <not broadcast>" : " <broadcast only>");
+        }
+    } else {
+        w.append("UNKNOWN(0x%02x)", cmd.opcode);
+    }
+    if (pos < params.size) {
+        w.append(" ");
+        format_data(w, params, pos, params.size - pos);
+    }
+    return w.len;
+}
+
+// Decoding
+
+static int set_item(PyObject * dict, const char * key, PyObject * value) {
+    if (!value) {
+        return -1;
+    }
+    int res = PyDict_SetItemString(dict, key, value);
+    Py_DECREF(value);
+    return res;
+}
+
+static PyObject * decode_text(const cec_datapacket & params, int pos, int count) {
+    return PyUnicode_DecodeASCII((const char *)params.data + pos, count, "replace");
+}
+
+PyObject * decode_command(const cec_command & cmd) {
+    PyObject * result = PyDict_New();
+    PyObject * fields = PyDict_New();
+    bool valid = true;
+    const cec_datapacket & params = cmd.parameters;
+    const OpcodeSpec * spec = NULL;
+    int pos = 0;
+
+    if (!result || !fields) {
+        goto fail;
+    }
+    if (set_item(result, "initiator", PyLong_FromLong(cmd.initiator)) ||
+            set_item(result, "destination", PyLong_FromLong(cmd.destination)) ||
+            set_item(result, "broadcast",
+                PyBool_FromLong(cmd.destination == CECDEVICE_BROADCAST))) {
+        goto fail;
+    }
+
+    if (!cmd.opcode_set) {
+        Py_INCREF(Py_None);
+        if (set_item(result, "opcode", Py_None) ||
+                set_item(result, "name", PyUnicode_FromString("POLL"))) {
+            goto fail;
+        }
+    } else {
+        spec = opcode_spec((uint8_t)cmd.opcode);
+        if (set_item(result, "opcode", PyLong_FromLong(cmd.opcode)) ||
+                set_item(result, "name", PyUnicode_FromString(spec ? spec->name : "UNKNOWN"))) {
+            goto fail;
+        }
+    }
+
+    if (spec) {
+        valid = direction_valid(spec, cmd);
+        for (int i=0; i<OPCODE_MAX_FIELDS && spec->fields[i].kind != FIELD_NONE; i++) {
+            const FieldSpec & field = spec->fields[i];
+            int remaining = params.size - pos;
+            int n = field_size(field.kind, remaining);
+            if (n > remaining || (n == 0 && field.kind != FIELD_TEXT && field.kind != FIELD_DATA)) {
+                if (!field.optional) {
+                    valid = false;
+                }
+                break;
+            }
+            int err = 0;
+            switch (field.kind) {
+                case FIELD_PHYSICAL_ADDRESS: {
+                    char str[8];
+                    format_physical_addr(param_physical_addr(params, pos), str);
+                    err = set_item(fields, field.name, PyUnicode_FromString(str));
+                    break;
+                }
+                case FIELD_BYTE:
+                    err = set_item(fields, field.name, PyLong_FromLong(params[pos]));
+                    break;
+                case FIELD_BOOL:
+                    err = set_item(fields, field.name, PyBool_FromLong(params[pos]));
+                    break;
+                case FIELD_VENDOR_ID:
+                    err = set_item(fields, field.name,
+                        PyLong_FromUnsignedLong(param_vendor_id(params, pos)));
+                    break;
+                case FIELD_CEC_VERSION:
+                    err = set_item(fields, field.name,
+                        PyUnicode_FromString(cec_version_str((cec_version)params[pos])));
+                    break;
+                case FIELD_AUDIO_STATUS:
+                    err = set_item(fields, "volume", PyLong_FromLong(params[pos] & 0x7F)) ||
+                        set_item(fields, "mute", PyBool_FromLong(params[pos] & 0x80));
+                    break;
+                case FIELD_LANGUAGE:
+                case FIELD_TEXT:
+                    err = set_item(fields, field.name, decode_text(params, pos, n));
+                    break;
+                case FIELD_DATA:
+                case FIELD_NONE:
+                default:
+                    err = set_item(fields, field.name,
+                        PyBytes_FromStringAndSize((const char *)params.data + pos, n));
+                    break;
+            }
+            if (err) {
+                goto fail;
+            }
+            pos += n;
+        }
+    } else if (cmd.opcode_set) {
+        valid = false;
+    }
+
+    if (pos < params.size) {
+        if (set_item(fields, "extra", PyBytes_FromStringAndSize(
+                (const char *)params.data + pos, params.size - pos))) {
+            goto fail;
+        }
+    }
+
+    if (set_item(result, "valid", PyBool_FromLong(valid))) {
+        goto fail;
+    }
+    if (PyDict_SetItemString(result, "fields", fields)) {
+        goto fail;
+    }
+    Py_DECREF(fields);
+    return result;
+
+fail:
+    Py_XDECREF(fields);
+    Py_XDECREF(result);
+    return NULL;
+}
+
+// Argument conversion
+
+static int dict_byte(PyObject * dict, const char * key, int * value) {
+    PyObject * item = PyDict_GetItemString(dict, key);
+    if (!item) {
+        PyErr_Format(PyExc_KeyError, "command has no '%s'", key);
+        return -1;
+    }
+    long v = PyLong_AsLong(item);
+    if (v == -1 && PyErr_Occurred()) {
+        return -1;
+    }
+    *value = (int)v;
+    return 0;
+}
+
+int convert_command_arg(PyObject * obj, void * ptr) {
+    cec_command * cmd = (cec_command *)ptr;
+    cmd->Clear();
+
+    if (PyDict_Check(obj)) {
+        int initiator, destination, opcode;
+        if (dict_byte(obj, "initiator", &initiator) ||
+                dict_byte(obj, "destination", &destination) ||
+                dict_byte(obj, "opcode", &opcode)) {
+            return 0;
+        }
+        if (initiator < 0 || initiator > 15 || destination < 0 || destination > 15) {
+            PyErr_SetString(PyExc_ValueError, "Logical address must be between 0 and 15");
+            return 0;
+        }
+        cmd->initiator = (cec_logical_address)initiator;
+        cmd->destination = (cec_logical_address)destination;
+        cmd->opcode = (cec_opcode)(opcode & 0xFF);
+        PyObject * opcode_set = PyDict_GetItemString(obj, "opcode_set");
+        cmd->opcode_set = opcode_set ? PyObject_IsTrue(opcode_set) : 1;
+        PyObject * params = PyDict_GetItemString(obj, "parameters");
+        if (params && params != Py_None) {
+            Py_buffer view;
+            if (PyObject_GetBuffer(params, &view, PyBUF_SIMPLE)) {
+                return 0;
+            }
+            if (view.len > CEC_MAX_DATA_PACKET_SIZE) {
+                PyBuffer_Release(&view);
+                PyErr_SetString(PyExc_ValueError, "Too many parameters");
+                return 0;
+            }
+            for (Py_ssize_t i=0; i<view.len; i++) {
+                cmd->parameters.PushBack(((uint8_t *)view.buf)[i]);
+            }
+            PyBuffer_Release(&view);
+        }
+        return 1;
+    }
+
+    Py_buffer view;
+    if (PyObject_GetBuffer(obj, &view, PyBUF_SIMPLE)) {
+        PyErr_Clear();
+        PyErr_SetString(PyExc_TypeError, "command must be a dict or bytes");
+        return 0;
+    }
+    if (view.len < 1 || view.len > CEC_MAX_DATA_PACKET_SIZE + 2) {
+        PyBuffer_Release(&view);
+        PyErr_SetString(PyExc_ValueError, "Invalid frame length");
+        return 0;
+    }
+    const uint8_t * frame = (const uint8_t *)view.buf;
+    cmd->initiator = (cec_logical_address)(frame[0] >> 4);
+    cmd->destination = (cec_logical_address)(frame[0] & 0xF);
+    if (view.len > 1) {
+        cmd->opcode = (cec_opcode)frame[1];
+        cmd->opcode_set = 1;
+        for (Py_ssize_t i=2; i<view.len; i++) {
+            cmd->parameters.PushBack(frame[i]);
+        }
+    }
+    PyBuffer_Release(&view);
+    return 1;
+}
@@ -0,0 +1,84 @@
+/* opcodes.h
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * CEC opcode schema, frame decoder and formatter
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#ifndef CEC_OPCODES_H
+#define CEC_OPCODES_H
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <libcec/cec.h>
+
+enum FieldKind {
+    FIELD_NONE = 0,
+    FIELD_PHYSICAL_ADDRESS, // 2 bytes, "a.b.c.d"
+    FIELD_BYTE,             // 1 byte, int
+    FIELD_BOOL,             // 1 byte, bool
+    FIELD_VENDOR_ID,        // 3 bytes, int
+    FIELD_CEC_VERSION,      // 1 byte, "1.4"
+    FIELD_LANGUAGE,         // 3 bytes, str
+    FIELD_AUDIO_STATUS,     // 1 byte, volume and mute
+    FIELD_TEXT,             // remaining bytes, str
+    FIELD_DATA,             // remaining bytes, bytes
+};
+
+// Addressing allowed by the CEC specification
+#define OPCODE_DIRECT    0x1
+#define OPCODE_BROADCAST 0x2
+#define OPCODE_BOTH      (OPCODE_DIRECT | OPCODE_BROADCAST)
+
+#define OPCODE_MAX_FIELDS 3
+
+struct FieldSpec {
+    FieldKind kind;
+    const char * name;
+    bool optional;
+};
+
+struct OpcodeSpec {
+    CEC::cec_opcode opcode;
+    const char * name;
+    int direction;
+    FieldSpec fields[OPCODE_MAX_FIELDS];
+};
+
+// The schema of every opcode the module knows about, also used to register
+// the CEC_OPCODE_* module constants
+extern const OpcodeSpec opcode_table[];
+extern const int opcode_table_size;
+
+// NULL for opcodes missing from the schema
+const OpcodeSpec * opcode_spec(uint8_t opcode);
+
+// Write a one line description of cmd into buf, returns the length
+size_t format_command(const CEC::cec_command & cmd, char * buf, size_t size);
+
+// Decode cmd into a dict of header and typed parameter fields
+PyObject * decode_command(const CEC::cec_command & cmd);
+
+// PyArg_ParseTuple "O&" converter accepting a command dict, as delivered with
+// EVENT_COMMAND, or a raw frame as bytes
+int convert_command_arg(PyObject * obj, void * cmd);
+
+#endif
@@ -0,0 +1,206 @@
+/* poller.cpp
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Implementation of the background power status poller
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#include <algorithm>
+#include <chrono>
+
+#include "cec.h"
+#include "adapter.h"
+#include "poller.h"
+
+using namespace CEC;
+
+PowerPoller::PowerPoller(Adapter * adapter) :
+    adapter(adapter),
+    running(false),
+    woken(false),
+    watched(0),
+    fast_interval(1.0),
+    slow_interval(60.0) {
+    for (int i=0; i<16; i++) {
+        entries[i].reported = CEC_POWER_STATUS_UNKNOWN;
+        entries[i].checked = 0;
+        entries[i].interval = 0;
+        entries[i].next = 0;
+    }
+}
+
+PowerPoller::~PowerPoller() {
+    stop();
+}
+
+void PowerPoller::watch(uint16_t mask, double fast, double slow) {
+    mask &= 0x7FFF;
+    if (!mask) {
+        stop();
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    fast_interval = fast;
+    slow_interval = slow;
+    for (int i=CECDEVICE_TV; i<CECDEVICE_BROADCAST; i++) {
+        if ((mask & (1 << i)) && !(watched & (1 << i))) {
+            // poll right away, unless traffic already told us the status
+            entries[i].reported = CEC_POWER_STATUS_UNKNOWN;
+            entries[i].checked = 0;
+            entries[i].interval = fast;
+            entries[i].next = 0;
+        }
+    }
+    watched = mask;
+    woken = true;
+
+    if (!running) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+        running = true;
+        thread = std::thread(&PowerPoller::run, this);
+    } else {
+        cond.notify_one();
+    }
+}
+
+void PowerPoller::notify() {
+    std::lock_guard<std::mutex> guard(lock);
+    if (running && watched) {
+        woken = true;
+        cond.notify_one();
+    }
+}
+
+void PowerPoller::stop() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        watched = 0;
+        running = false;
+        cond.notify_one();
+    }
+    if (thread.joinable()) {
+        if (thread.get_id() == std::this_thread::get_id()) {
+            // stopped from a callback running on the poller thread
+            thread.detach();
+        } else {
+            thread.join();
+        }
+    }
+}
+
+bool PowerPoller::update(int addr, cec_power_status status, double now) {
+    Entry & entry = entries[addr];
+    bool changed = status != entry.reported;
+    entry.reported = status;
+    entry.checked = now;
+    if (changed ||
+            status == CEC_POWER_STATUS_IN_TRANSITION_STANDBY_TO_ON ||
+            status == CEC_POWER_STATUS_IN_TRANSITION_ON_TO_STANDBY) {
+        entry.interval = fast_interval;
+    } else {
+        entry.interval = (std::min)(entry.interval * 2, slow_interval);
+    }
+    entry.next = monotonic_time() + entry.interval;
+    return changed;
+}
+
+void PowerPoller::run() {
+    struct Change {
+        cec_logical_address addr;
+        cec_power_status old;
+        cec_power_status status;
+    } changes[16];
+
+    std::unique_lock<std::mutex> guard(lock);
+    while (running) {
+        int count = 0;
+
+        if (woken) {
+            // pick up status seen in traffic since the last check
+            woken = false;
+            for (int i=CECDEVICE_TV; i<CECDEVICE_BROADCAST; i++) {
+                if (!(watched & (1 << i))) {
+                    continue;
+                }
+                cec_power_status status;
+                double time;
+                if (adapter->state.power_status((cec_logical_address)i, -1, &status, &time) &&
+                        time > entries[i].checked) {
+                    cec_power_status old = entries[i].reported;
+                    if (update(i, status, time)) {
+                        changes[count].addr = (cec_logical_address)i;
+                        changes[count].old = old;
+                        changes[count].status = status;
+                        count++;
+                    }
+                }
+            }
+        }
+
+        // query the device that is most overdue
+        double now = monotonic_time();
+        double next = now + slow_interval;
+        int due = -1;
+        for (int i=CECDEVICE_TV; i<CECDEVICE_BROADCAST; i++) {
+            if (!(watched & (1 << i))) {
+                continue;
+            }
+            if (entries[i].next <= now && (due < 0 || entries[i].next < entries[due].next)) {
+                due = i;
+            }
+            next = (std::min)(next, entries[i].next);
+        }
+
+        if (due >= 0) {
+            guard.unlock();
+            cec_power_status status =
+                adapter->adapter->GetDevicePowerStatus((cec_logical_address)due);
+            adapter->state.set_power_status((cec_logical_address)due, status);
+            guard.lock();
+            if (!running) {
+                break;
+            }
+            cec_power_status old = entries[due].reported;
+            if ((watched & (1 << due)) && update(due, status, monotonic_time())) {
+                changes[count].addr = (cec_logical_address)due;
+                changes[count].old = old;
+                changes[count].status = status;
+                count++;
+            }
+        }
+
+        if (count) {
+            guard.unlock();
+            for (int i=0; i<count; i++) {
+                trigger_power_change(adapter, changes[i].addr, changes[i].old,
+                        changes[i].status);
+            }
+            guard.lock();
+            continue;
+        }
+
+        if (due < 0 && !woken && running) {
+            cond.wait_for(guard, std::chrono::duration<double>(next - now));
+        }
+    }
+}
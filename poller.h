@@ -0,0 +1,79 @@
+/* poller.h
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Background power status poller
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#ifndef CEC_POLLER_H
+#define CEC_POLLER_H
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <libcec/cec.h>
+
+struct Adapter;
+
+// Watches the power status of a set of devices from a single thread.
+//
+// A device is polled at the fast interval while it is changing or in
+// transition, and the interval doubles up to the slow interval while it is
+// stable. Power status seen in bus traffic counts as a poll, so a device that
+// reports on its own is never queried. Changes are delivered as
+// EVENT_POWER_CHANGE.
+class PowerPoller {
+    public:
+        PowerPoller(Adapter * adapter);
+        ~PowerPoller();
+
+        // replace the watched set, starting or stopping the thread as needed
+        void watch(uint16_t mask, double fast_interval, double slow_interval);
+        // power status was observed in traffic
+        void notify();
+        // stop the thread; must not be called with the GIL held
+        void stop();
+
+    private:
+        struct Entry {
+            CEC::cec_power_status reported;
+            double checked;
+            double interval;
+            double next;
+        };
+
+        void run();
+        // returns true if the status changed
+        bool update(int addr, CEC::cec_power_status status, double now);
+
+        Adapter * adapter;
+        std::mutex lock;
+        std::condition_variable cond;
+        std::thread thread;
+        bool running;
+        bool woken;
+        uint16_t watched;
+        double fast_interval;
+        double slow_interval;
+        Entry entries[16];
+};
+
+#endif
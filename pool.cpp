@@ -0,0 +1,476 @@
+/* pool.cpp
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Implementation of the AdapterPool class for Python
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+
+#include <string>
+#include <vector>
+
+#include <libcec/cec.h>
+
+#include "cec.h"
+#include "detect.h"
+#include "module.h"
+#include "pool.h"
+
+using namespace CEC;
+
+// EventQueue
+
+EventQueue::EventQueue(Dispatch dispatch, void * param,
+        PyInterpreterState * interp) :
+    dispatch(dispatch),
+    param(param),
+    interp(interp),
+    running(false) {
+}
+
+EventQueue::~EventQueue() {
+    stop();
+}
+
+void EventQueue::push(Adapter * adapter, Event & event) {
+    std::lock_guard<std::mutex> guard(lock);
+    pending.push_back(std::make_pair(adapter, std::move(event)));
+    cond.notify_one();
+}
+
+void EventQueue::start() {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!running) {
+        running = true;
+        thread = std::thread(&EventQueue::run, this);
+    }
+}
+
+void EventQueue::stop() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        running = false;
+        cond.notify_one();
+    }
+    if (thread.joinable()) {
+        if (thread.get_id() == std::this_thread::get_id()) {
+            // stopped from a callback running on the dispatcher
+            thread.detach();
+        } else {
+            thread.join();
+        }
+    }
+}
+
+void EventQueue::run() {
+    std::deque<std::pair<Adapter *, Event> > batch;
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;) {
+        while (running && pending.empty()) {
+            cond.wait(guard);
+        }
+        if (pending.empty()) {
+            break;
+        }
+        batch.swap(pending);
+        guard.unlock();
+
+        {
+            InterpreterLock gil(interp);
+            double acquired = monotonic_time();
+            for (size_t i=0; i<batch.size(); i++) {
+                batch[i].second.acquired = acquired;
+                dispatch(param, batch[i].first, batch[i].second);
+            }
+        }
+        batch.clear();
+
+        guard.lock();
+    }
+}
+
+// AdapterPool
+
+struct AdapterPool {
+    PyObject_HEAD
+    std::vector<Adapter *> adapters;
+    CallbackList callbacks;
+    EventQueue * queue;
+
+    AdapterPool() : queue(NULL) {}
+};
+
+static void pool_dispatch(void * param, Adapter * adapter, const Event & event) {
+    AdapterPool * self = (AdapterPool *)param;
+
+    // the adapter's own callbacks first, then the pool's tagged with the adapter
+    deliver_event(adapter, event);
+    if (PyErr_Occurred()) {
+        PyErr_Print();
+    }
+
+    if (!self->callbacks.wants(event.type)) {
+        return;
+    }
+
+    PyObject * args = event_args(event);
+    PyObject * tagged = NULL;
+    if (args) {
+        PyObject * head = Py_BuildValue("(O)", (PyObject *)adapter);
+        if (head) {
+            tagged = PySequence_Concat(head, args);
+            Py_DECREF(head);
+        }
+        Py_DECREF(args);
+    }
+    if (tagged) {
+        PyObject * result = trigger_callbacks(self->callbacks, event.type, tagged);
+        Py_XDECREF(result);
+        Py_DECREF(tagged);
+    }
+    if (PyErr_Occurred()) {
+        PyErr_Print();
+    }
+}
+
+static void close_adapters(AdapterPool * self) {
+    // stop libcec callbacks, then drain the queue
+    for (size_t i=0; i<self->adapters.size(); i++) {
+        PyObject * result = PyObject_CallMethod((PyObject *)self->adapters[i],
+                "close", NULL);
+        Py_XDECREF(result);
+    }
+    if (self->queue) {
+        Py_BEGIN_ALLOW_THREADS
+        self->queue->stop();
+        Py_END_ALLOW_THREADS
+    }
+}
+
+static void AdapterPool_dealloc(AdapterPool * self) {
+    close_adapters(self);
+    for (size_t i=0; i<self->adapters.size(); i++) {
+        self->adapters[i]->sink = NULL;
+        Py_DECREF(self->adapters[i]);
+    }
+    self->adapters.clear();
+    delete self->queue;
+    self->queue = NULL;
+    self->callbacks.clear();
+    self->~AdapterPool();
+    free_instance((PyObject *)self);
+}
+
+struct OpenResult {
+    PyObject * error;
+    char message[1024];
+};
+
+#pragma GCC diagnostic ignored "-Wwrite-strings"
+static PyObject * AdapterPool_new(PyTypeObject * type, PyObject * args, PyObject * kwargs) {
+    PyObject * devs = Py_None;
+    char * device_name = "python-cec";
+    cec_device_type device_type = CEC_DEVICE_TYPE_RECORDING_DEVICE;
+    char * keywords[] = { "devs", "name", "type", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|Osi:AdapterPool", keywords,
+            &devs, &device_name, &device_type)) {
+        return NULL;
+    }
+
+    if (device_type < CEC_DEVICE_TYPE_TV ||
+            device_type > CEC_DEVICE_TYPE_AUDIO_SYSTEM) {
+        PyErr_SetString(PyExc_Exception, "Invalid CEC device type");
+        return NULL;
+    }
+
+    std::vector<std::string> names;
+    if (devs == Py_None) {
+        std::vector<CEC_ADAPTER_TYPE> found;
+        bool ok;
+        Py_BEGIN_ALLOW_THREADS
+        ok = find_adapters(NULL, false, found);
+        Py_END_ALLOW_THREADS
+        if (!ok) {
+            PyErr_SetString(PyExc_IOError, "Failed to initialize adapter");
+            return NULL;
+        }
+        for (size_t i=0; i<found.size(); i++) {
+            names.push_back(CEC_ADAPTER_NAME(found[i]));
+        }
+    } else {
+        PyObject * iter = PyObject_GetIter(devs);
+        if (!iter) {
+            return NULL;
+        }
+        PyObject * item;
+        while ((item = PyIter_Next(iter))) {
+            const char * name = PyUnicode_AsUTF8(item);
+            if (name) {
+                names.push_back(name);
+            }
+            Py_DECREF(item);
+            if (!name) {
+                break;
+            }
+        }
+        Py_DECREF(iter);
+        if (PyErr_Occurred()) {
+            return NULL;
+        }
+    }
+    if (names.empty()) {
+        PyErr_SetString(PyExc_Exception, "No adapters found");
+        return NULL;
+    }
+
+    ModuleState * module = type_state(type);
+    if (!module) {
+        return NULL;
+    }
+    void * mem = type->tp_alloc(type, 0);
+    if (!mem) {
+        return NULL;
+    }
+    AdapterPool * self = new (mem) AdapterPool();
+    self->queue = new EventQueue(pool_dispatch, self, current_interpreter());
+
+    for (size_t i=0; i<names.size(); i++) {
+        Adapter * adapter = adapter_create(module->adapter_type, device_name,
+                device_type, false);
+        if (!adapter) {
+            Py_DECREF(self);
+            return NULL;
+        }
+        adapter->sink = self->queue;
+        self->adapters.push_back(adapter);
+    }
+    self->queue->start();
+
+    // open all adapters at once; each Open() takes a while to negotiate
+    std::vector<OpenResult> results(names.size());
+    Py_BEGIN_ALLOW_THREADS
+    std::vector<std::thread> threads;
+    for (size_t i=0; i<names.size(); i++) {
+        threads.push_back(std::thread([self, &names, &results, i]() {
+            results[i].error = adapter_open(self->adapters[i], names[i].c_str(),
+                    results[i].message, sizeof(results[i].message));
+        }));
+    }
+    for (size_t i=0; i<threads.size(); i++) {
+        threads[i].join();
+    }
+    Py_END_ALLOW_THREADS
+
+    for (size_t i=0; i<results.size(); i++) {
+        if (results[i].error) {
+            PyErr_SetString(results[i].error, results[i].message);
+            Py_DECREF(self);
+            return NULL;
+        }
+    }
+
+    return (PyObject *)self;
+}
+
+// Python methods
+
+static PyObject * add_callback(AdapterPool * self, PyObject * args) {
+    return add_callback_to(self->callbacks, args);
+}
+
+static PyObject * remove_callback(AdapterPool * self, PyObject * args) {
+    return remove_callback_from(self->callbacks, args);
+}
+
+static PyObject * pool_close(AdapterPool * self, PyObject * args) {
+    close_adapters(self);
+    Py_RETURN_NONE;
+}
+
+// the first adapter whose bus has a device at pa
+static Adapter * route(AdapterPool * self, uint16_t pa, cec_logical_address * addr) {
+    for (size_t i=0; i<self->adapters.size(); i++) {
+        cec_logical_address found = self->adapters[i]->topology.device_at(pa);
+        if (found != CECDEVICE_UNKNOWN) {
+            *addr = found;
+            return self->adapters[i];
+        }
+    }
+    return NULL;
+}
+
+static PyObject * adapter_for(AdapterPool * self, PyObject * args) {
+    PyObject * arg;
+    if (!PyArg_ParseTuple(args, "O:adapter_for", &arg)) {
+        return NULL;
+    }
+    int pa = physical_addr_arg(arg);
+    if (pa < 0) {
+        return NULL;
+    }
+    cec_logical_address addr;
+    Adapter * adapter = route(self, (uint16_t)pa, &addr);
+    if (!adapter) {
+        Py_RETURN_NONE;
+    }
+    Py_INCREF(adapter);
+    return (PyObject *)adapter;
+}
+
+static PyObject * transmit(AdapterPool * self, PyObject * args, PyObject * kwargs) {
+    PyObject * destination;
+    PyObject * opcode;
+    PyObject * params = NULL;
+    PyObject * initiator = NULL;
+    PyObject * which = Py_None;
+    PyObject * physical_address = Py_None;
+    static const char * keywords[] = { "destination", "opcode", "parameters",
+        "initiator", "adapter", "physical_address", NULL };
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|OOOO:transmit",
+            (char **)keywords, &destination, &opcode, &params, &initiator,
+            &which, &physical_address)) {
+        return NULL;
+    }
+
+    Adapter * adapter = NULL;
+    PyObject * dest = NULL;
+    if (which != Py_None) {
+        ModuleState * module = type_state(Py_TYPE(self));
+        if (!module) {
+            return NULL;
+        }
+        if (PyObject_TypeCheck(which, module->adapter_type)) {
+            for (size_t i=0; i<self->adapters.size(); i++) {
+                if ((PyObject *)self->adapters[i] == which) {
+                    adapter = self->adapters[i];
+                }
+            }
+        } else {
+            Py_ssize_t index = PyNumber_AsSsize_t(which, PyExc_IndexError);
+            if (index == -1 && PyErr_Occurred()) {
+                return NULL;
+            }
+            if (index >= 0 && (size_t)index < self->adapters.size()) {
+                adapter = self->adapters[index];
+            }
+        }
+        if (!adapter) {
+            PyErr_SetString(PyExc_ValueError, "Adapter is not in this pool");
+            return NULL;
+        }
+    } else if (physical_address != Py_None) {
+        int pa = physical_addr_arg(physical_address);
+        if (pa < 0) {
+            return NULL;
+        }
+        cec_logical_address addr;
+        adapter = route(self, (uint16_t)pa, &addr);
+        if (!adapter) {
+            PyErr_SetString(PyExc_ValueError, "No adapter knows a device at that physical address");
+            return NULL;
+        }
+        if (destination == Py_None) {
+            dest = PyLong_FromLong(addr);
+            if (!dest) {
+                return NULL;
+            }
+        }
+    } else if (self->adapters.size() == 1) {
+        adapter = self->adapters[0];
+    } else {
+        PyErr_SetString(PyExc_ValueError, "adapter or physical_address is required");
+        return NULL;
+    }
+
+    if (!dest) {
+        Py_INCREF(destination);
+        dest = destination;
+    }
+    PyObject * result;
+    if (initiator) {
+        if (params) {
+            result = PyObject_CallMethod((PyObject *)adapter, "transmit", "(OOOO)",
+                    dest, opcode, params, initiator);
+        } else {
+            result = PyObject_CallMethod((PyObject *)adapter, "transmit", "(OOy#O)",
+                    dest, opcode, "", (Py_ssize_t)0, initiator);
+        }
+    } else if (params) {
+        result = PyObject_CallMethod((PyObject *)adapter, "transmit", "(OOO)",
+                dest, opcode, params);
+    } else {
+        result = PyObject_CallMethod((PyObject *)adapter, "transmit", "(OO)",
+                dest, opcode);
+    }
+    Py_DECREF(dest);
+    return result;
+}
+
+static PyObject * AdapterPool_getAdapters(AdapterPool * self, void * closure) {
+    PyObject * result = PyList_New(self->adapters.size());
+    if (!result) {
+        return NULL;
+    }
+    for (size_t i=0; i<self->adapters.size(); i++) {
+        Py_INCREF(self->adapters[i]);
+        PyList_SET_ITEM(result, i, (PyObject *)self->adapters[i]);
+    }
+    return result;
+}
+
+static PyMethodDef AdapterPool_methods[] = {
+    {"close", (PyCFunction)pool_close, METH_NOARGS, "Close every adapter in the pool"},
+    {"add_callback", (PyCFunction)add_callback, METH_VARARGS,
+        "Add a callback for events from every adapter, called with the adapter first"},
+    {"remove_callback", (PyCFunction)remove_callback, METH_VARARGS, "Remove a callback"},
+    {"transmit", (PyCFunction)transmit, METH_VARARGS | METH_KEYWORDS,
+        "Transmit a raw CEC command through the adapter chosen by index, object or physical address"},
+    {"adapter_for", (PyCFunction)adapter_for, METH_VARARGS,
+        "Get the adapter whose bus has a device at a physical address, or None"},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef AdapterPool_getset[] = {
+   {"adapters", (getter)AdapterPool_getAdapters, (setter)NULL, "Adapters in the pool"},
+   {NULL}
+};
+
+static PyType_Slot AdapterPool_slots[] = {
+   {Py_tp_dealloc, (void *)AdapterPool_dealloc},
+   {Py_tp_doc, (void *)"Several CEC adapters sharing one event dispatcher"},
+   {Py_tp_methods, AdapterPool_methods},
+   {Py_tp_getset, AdapterPool_getset},
+   {Py_tp_new, (void *)AdapterPool_new},
+   {0, NULL}
+};
+
+static PyType_Spec AdapterPool_spec = {
+   "cec.AdapterPool",
+   sizeof(AdapterPool),
+   0,
+   CEC_TYPE_FLAGS,
+   AdapterPool_slots
+};
+
+PyTypeObject * AdapterPoolTypeInit(PyObject * module) {
+   return new_type(module, &AdapterPool_spec);
+}
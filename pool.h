@@ -0,0 +1,74 @@
+/* pool.h
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Pool of adapters sharing one event dispatcher
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+
+#ifndef CEC_POOL_H
+#define CEC_POOL_H
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "adapter.h"
+
+// Events from any number of adapters, delivered in arrival order from a single
+// thread. libcec threads only queue events and never wait for the GIL; the
+// dispatcher takes the GIL once per batch of queued events.
+class EventQueue {
+    public:
+        // called with the GIL held for each event
+        typedef void (*Dispatch)(void * param, Adapter * adapter,
+                const Event & event);
+
+        // dispatch runs in interp
+        EventQueue(Dispatch dispatch, void * param, PyInterpreterState * interp);
+        ~EventQueue();
+
+        // safe from any thread, without the GIL
+        void push(Adapter * adapter, Event & event);
+        void start();
+        // deliver what is queued and stop; must not be called with the GIL held
+        void stop();
+
+    private:
+        void run();
+
+        Dispatch dispatch;
+        void * param;
+        PyInterpreterState * interp;
+        std::mutex lock;
+        std::condition_variable cond;
+        std::thread thread;
+        bool running;
+        std::deque<std::pair<Adapter *, Event> > pending;
+};
+
+PyTypeObject * AdapterPoolTypeInit(PyObject * module);
+
+#endif
@@ -0,0 +1,250 @@
+/* presence.cpp
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Implementation of device presence tracking
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#include <algorithm>
+#include <chrono>
+
+#include "cec.h"
+#include "adapter.h"
+#include "presence.h"
+
+using namespace CEC;
+
+// failed polls in a row before a device is removed
+#define PRESENCE_MISSES 2
+
+static uint16_t address_mask(const cec_logical_addresses & addresses) {
+    uint16_t mask = 0;
+    for (int i=CECDEVICE_TV; i<CECDEVICE_BROADCAST; i++) {
+        if (addresses[i]) {
+            mask |= (uint16_t)(1 << i);
+        }
+    }
+    return mask;
+}
+
+PresenceTracker::PresenceTracker(Adapter * adapter) :
+    adapter(adapter),
+    running(false),
+    initialised(false),
+    devices(0),
+    reported(0),
+    suspects(0),
+    ours(0),
+    interval(5.0),
+    scan_interval(60.0),
+    next_scan(0),
+    scan_cursor(0) {
+    for (int i=0; i<16; i++) {
+        misses[i] = 0;
+        seen[i] = 0;
+    }
+}
+
+PresenceTracker::~PresenceTracker() {
+    stop();
+}
+
+void PresenceTracker::start(double new_interval, double new_scan_interval) {
+    std::lock_guard<std::mutex> guard(lock);
+    interval = new_interval;
+    scan_interval = new_scan_interval;
+    if (!running) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+        running = true;
+        initialised = false;
+        thread = std::thread(&PresenceTracker::run, this);
+    } else {
+        next_scan = (std::min)(next_scan, monotonic_time() + scan_interval);
+        cond.notify_one();
+    }
+}
+
+void PresenceTracker::heard(int addr) {
+    std::lock_guard<std::mutex> guard(lock);
+    uint16_t bit = (uint16_t)(1 << addr);
+    seen[addr] = monotonic_time();
+    misses[addr] = 0;
+    suspects &= ~bit;
+    if (!(devices & bit)) {
+        devices |= bit;
+        cond.notify_one();
+    }
+}
+
+void PresenceTracker::observe(const cec_command & cmd) {
+    if (cmd.initiator >= CECDEVICE_TV && cmd.initiator < CECDEVICE_BROADCAST) {
+        heard(cmd.initiator);
+    }
+}
+
+void PresenceTracker::transmitted(cec_logical_address addr, bool acked) {
+    if (addr < CECDEVICE_TV || addr >= CECDEVICE_BROADCAST) {
+        return;
+    }
+    if (acked) {
+        heard(addr);
+        return;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    if (devices & (1 << addr)) {
+        suspects |= (uint16_t)(1 << addr);
+        cond.notify_one();
+    }
+}
+
+void PresenceTracker::stop() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        running = false;
+        cond.notify_one();
+    }
+    if (thread.joinable()) {
+        if (thread.get_id() == std::this_thread::get_id()) {
+            // stopped from a callback running on the tracker thread
+            thread.detach();
+        } else {
+            thread.join();
+        }
+    }
+}
+
+bool PresenceTracker::tracking() {
+    std::lock_guard<std::mutex> guard(lock);
+    return running && initialised;
+}
+
+uint16_t PresenceTracker::present() {
+    std::lock_guard<std::mutex> guard(lock);
+    return devices;
+}
+
+void PresenceTracker::run() {
+    ICECAdapter * cec = adapter->adapter;
+    uint16_t active = 0;
+    uint16_t own = 0;
+    if (cec) {
+        active = address_mask(cec->GetActiveDevices());
+        own = address_mask(cec->GetLogicalAddresses());
+    }
+    // without a logical address of our own there is nothing to poll from
+    bool monitor = !own;
+
+    std::unique_lock<std::mutex> guard(lock);
+    double now = monotonic_time();
+    ours = own;
+    devices |= active & ~ours;
+    for (int i=CECDEVICE_TV; i<CECDEVICE_BROADCAST; i++) {
+        if (devices & (1 << i)) {
+            seen[i] = (std::max)(seen[i], now);
+        }
+    }
+    next_scan = now + scan_interval;
+    scan_cursor = CECDEVICE_TV;
+    initialised = true;
+
+    while (running) {
+        uint16_t changed = devices ^ reported;
+        if (changed) {
+            uint16_t current = devices;
+            reported = devices;
+            guard.unlock();
+            for (int i=CECDEVICE_TV; i<CECDEVICE_BROADCAST; i++) {
+                if (changed & (1 << i)) {
+                    trigger_presence_change(adapter, (cec_logical_address)i,
+                            (current & (1 << i)) != 0);
+                }
+            }
+            guard.lock();
+            continue;
+        }
+
+        now = monotonic_time();
+        double next = now + (monitor ? scan_interval : interval);
+        int due = -1;
+        if (!monitor) {
+            // confirm a suspect first, then the device silent for longest
+            for (int i=CECDEVICE_TV; i<CECDEVICE_BROADCAST && due < 0; i++) {
+                if (suspects & (1 << i)) {
+                    due = i;
+                }
+            }
+            for (int i=CECDEVICE_TV; i<CECDEVICE_BROADCAST; i++) {
+                if (!(devices & (1 << i))) {
+                    continue;
+                }
+                double deadline = seen[i] + interval;
+                if (deadline <= now && (due < 0 || (!(suspects & (1 << due)) &&
+                        seen[i] < seen[due]))) {
+                    due = i;
+                }
+                next = (std::min)(next, deadline);
+            }
+            // then the next absent address of a scan
+            if (due < 0 && now >= next_scan) {
+                while (scan_cursor < CECDEVICE_BROADCAST &&
+                        ((devices | ours) & (1 << scan_cursor))) {
+                    scan_cursor++;
+                }
+                if (scan_cursor < CECDEVICE_BROADCAST) {
+                    due = scan_cursor++;
+                } else {
+                    scan_cursor = CECDEVICE_TV;
+                    next_scan = now + scan_interval;
+                }
+            }
+            next = (std::min)(next, next_scan);
+        }
+
+        if (due >= 0) {
+            guard.unlock();
+            bool found = adapter->adapter &&
+                adapter->adapter->PollDevice((cec_logical_address)due);
+            guard.lock();
+            if (!running) {
+                break;
+            }
+            uint16_t bit = (uint16_t)(1 << due);
+            suspects &= ~bit;
+            seen[due] = monotonic_time();
+            if (found) {
+                misses[due] = 0;
+                devices |= bit;
+            } else if (devices & bit) {
+                if (++misses[due] >= PRESENCE_MISSES) {
+                    misses[due] = 0;
+                    devices &= ~bit;
+                } else {
+                    // ask again right away rather than after the interval
+                    suspects |= bit;
+                }
+            }
+            continue;
+        }
+
+        cond.wait_for(guard, std::chrono::duration<double>(next - now));
+    }
+}
@@ -0,0 +1,89 @@
+/* presence.h
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Incremental device presence tracking
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#ifndef CEC_PRESENCE_H
+#define CEC_PRESENCE_H
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <libcec/cec.h>
+
+struct Adapter;
+
+// Keeps the set of logical addresses with a device, from a single thread.
+//
+// The set starts from libcec's list of active devices. A frame from an
+// address, or one of ours it acknowledged, marks it present. A present
+// device silent for the interval is polled, and removed after failing two
+// polls in a row; a frame of ours it didn't acknowledge gets it polled right
+// away. The absent addresses are polled once per scan interval, one at a
+// time, to find devices that never speak on their own. Monitor only adapters
+// can't poll, so they only add devices. Changes are delivered as
+// EVENT_DEVICE_ADDED and EVENT_DEVICE_REMOVED, starting with an addition for
+// each device initially present.
+class PresenceTracker {
+    public:
+        PresenceTracker(Adapter * adapter);
+        ~PresenceTracker();
+
+        // start tracking, or update the intervals
+        void start(double interval, double scan_interval);
+        // a frame was received; safe from the libcec thread
+        void observe(const CEC::cec_command & cmd);
+        // a frame of ours to addr was acknowledged or not
+        void transmitted(CEC::cec_logical_address addr, bool acked);
+        // stop the thread; must not be called with the GIL held
+        void stop();
+
+        bool tracking();
+        // mask of the addresses with a device
+        uint16_t present();
+
+    private:
+        void run();
+        void heard(int addr);
+
+        Adapter * adapter;
+        std::mutex lock;
+        std::condition_variable cond;
+        std::thread thread;
+        bool running;
+        bool initialised;
+        uint16_t devices;     // present addresses
+        uint16_t reported;    // as last delivered
+        uint16_t suspects;    // present addresses to poll right away
+        uint16_t ours;        // our own logical addresses, never polled
+        uint8_t misses[16];   // failed polls in a row
+        double seen[16];      // last frame from, or poll of, each address
+        double interval;
+        double scan_interval;
+        double next_scan;
+        int scan_cursor;      // next absent address to poll in a scan
+};
+
+#endif
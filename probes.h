@@ -0,0 +1,104 @@
+/* probes.h
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * USDT probe points
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#ifndef CEC_PROBES_H
+#define CEC_PROBES_H
+
+#include <stdint.h>
+
+#include <chrono>
+
+// Static probes for perf, bpftrace and systemtap under the provider "cec".
+// They are compiled in when <sys/sdt.h> (systemtap-sdt-dev) is found, and
+// cost a nop each until a tracer attaches; build with -DCEC_NO_PROBES to
+// leave them out. Durations are in nanoseconds.
+//
+//   callback__entry(type)                   a libcec callback, EVENT_* type
+//   callback__return(type, ns)
+//   command__receive(initiator, destination, opcode)  in command callbacks
+//   gil__acquire(type, wait_ns)             GIL taken to deliver an event
+//   gil__release(type, held_ns)
+//   handler__entry(type, callback)          a Python callback, as PyObject *
+//   handler__return(type, callback, ns, failed)
+//   transmit__begin(initiator, destination, opcode, attempt)
+//   transmit__end(initiator, destination, opcode, status, ns)
+//                                           status is a TRANSMIT_* constant
+//   query__begin(address, query)            a blocking Device query, query
+//   query__end(address, query, ns)          is a string like "vendor_id"
+#if !defined(CEC_NO_PROBES) && defined(__has_include)
+#  if __has_include(<sys/sdt.h>)
+#    include <sys/sdt.h>
+#    define HAVE_CEC_PROBES 1
+#  endif
+#endif
+#ifndef HAVE_CEC_PROBES
+#  define HAVE_CEC_PROBES 0
+#endif
+
+#if HAVE_CEC_PROBES
+#define CEC_PROBE1(name, a) DTRACE_PROBE1(cec, name, a)
+#define CEC_PROBE2(name, a, b) DTRACE_PROBE2(cec, name, a, b)
+#define CEC_PROBE3(name, a, b, c) DTRACE_PROBE3(cec, name, a, b, c)
+#define CEC_PROBE4(name, a, b, c, d) DTRACE_PROBE4(cec, name, a, b, c, d)
+#define CEC_PROBE5(name, a, b, c, d, e) DTRACE_PROBE5(cec, name, a, b, c, d, e)
+#else
+// the arguments are not evaluated
+#define CEC_PROBE1(name, a) do { (void)sizeof(a); } while (0)
+#define CEC_PROBE2(name, a, b) do { (void)sizeof(a); (void)sizeof(b); } while (0)
+#define CEC_PROBE3(name, a, b, c) do { (void)sizeof(a); (void)sizeof(b); \
+    (void)sizeof(c); } while (0)
+#define CEC_PROBE4(name, a, b, c, d) do { (void)sizeof(a); (void)sizeof(b); \
+    (void)sizeof(c); (void)sizeof(d); } while (0)
+#define CEC_PROBE5(name, a, b, c, d, e) do { (void)sizeof(a); (void)sizeof(b); \
+    (void)sizeof(c); (void)sizeof(d); (void)sizeof(e); } while (0)
+#endif
+
+// nanoseconds on a monotonic clock, or 0 without probes
+static inline uint64_t probe_time() {
+#if HAVE_CEC_PROBES
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+    return 0;
+#endif
+}
+
+// fires query__begin, and query__end when it goes out of scope
+class QueryProbe {
+    public:
+        QueryProbe(int address, const char * query) :
+            address(address), query(query), start(probe_time()) {
+            CEC_PROBE2(query__begin, address, query);
+        }
+        ~QueryProbe() {
+            CEC_PROBE3(query__end, address, query, probe_time() - start);
+        }
+
+    private:
+        int address;
+        const char * query;
+        uint64_t start;
+};
+
+#endif
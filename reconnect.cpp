@@ -0,0 +1,171 @@
+/* reconnect.cpp
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Implementation of the adapter reconnect supervisor
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+
+#include <algorithm>
+#include <chrono>
+
+#include "cec.h"
+#include "adapter.h"
+#include "reconnect.h"
+
+using namespace CEC;
+
+Reconnector::Reconnector(Adapter * adapter) :
+    adapter(adapter),
+    running(false),
+    lost(false),
+    initial_delay(1.0),
+    max_delay(60.0) {
+    counters.connected = true;
+    counters.lost = 0;
+    counters.reconnects = 0;
+    counters.attempts = 0;
+    counters.downtime = 0;
+    counters.down_since = 0;
+}
+
+Reconnector::~Reconnector() {
+    stop();
+}
+
+void Reconnector::start(double initial, double max) {
+    std::lock_guard<std::mutex> guard(lock);
+    initial_delay = initial;
+    max_delay = max;
+    if (!running) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+        running = true;
+        thread = std::thread(&Reconnector::run, this);
+    }
+}
+
+void Reconnector::connection_lost() {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!running || lost) {
+        return;
+    }
+    lost = true;
+    counters.connected = false;
+    counters.lost++;
+    counters.down_since = monotonic_time();
+    cond.notify_one();
+}
+
+void Reconnector::stop() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        running = false;
+        cond.notify_one();
+    }
+    if (thread.joinable()) {
+        if (thread.get_id() == std::this_thread::get_id()) {
+            thread.detach();
+        } else {
+            thread.join();
+        }
+    }
+}
+
+ReconnectStats Reconnector::stats() {
+    std::lock_guard<std::mutex> guard(lock);
+    ReconnectStats result = counters;
+    if (!result.connected) {
+        result.downtime += monotonic_time() - result.down_since;
+    }
+    return result;
+}
+
+// Before the first attempt, libcec still holds the configuration of the lost
+// connection; after a failed attempt it is closed and has none to give
+void Reconnector::capture(ReconnectSnapshot & snapshot) {
+    ICECAdapter * cec = adapter->adapter;
+    snapshot.config.Clear();
+    snapshot.have_config = cec->GetCurrentConfiguration(&snapshot.config);
+    snapshot.primary = snapshot.have_config ?
+        snapshot.config.logicalAddresses.primary : CECDEVICE_UNKNOWN;
+    BusStateData state = adapter->state.snapshot();
+    snapshot.was_active = snapshot.have_config && state.active_source.valid() &&
+        snapshot.config.logicalAddresses.IsSet(state.active_source.value);
+}
+
+// Close and reopen the device, then put back what was set up before the loss
+bool Reconnector::reopen(const ReconnectSnapshot & snapshot) {
+    ICECAdapter * cec = adapter->adapter;
+
+    cec->Close();
+    // the bus may have been rewired while the adapter was away
+    adapter->topology.clear();
+    if (!cec->Open(adapter->dev)) {
+        return false;
+    }
+
+    if (snapshot.have_config) {
+        cec->SetConfiguration(&snapshot.config);
+    }
+    if (snapshot.primary != CECDEVICE_UNKNOWN &&
+            cec->GetLogicalAddresses().primary != snapshot.primary) {
+        cec->SetLogicalAddress(snapshot.primary);
+    }
+    if (snapshot.was_active) {
+        cec->SetActiveSource();
+    }
+    adapter->state.set_own_addresses(cec->GetLogicalAddresses());
+    return true;
+}
+
+void Reconnector::run() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (running) {
+        if (!lost) {
+            cond.wait(guard);
+            continue;
+        }
+
+        ReconnectSnapshot snapshot;
+        guard.unlock();
+        capture(snapshot);
+        guard.lock();
+
+        double delay = initial_delay;
+        while (running && lost) {
+            guard.unlock();
+            bool ok = reopen(snapshot);
+            guard.lock();
+            counters.attempts++;
+            if (ok) {
+                lost = false;
+                counters.connected = true;
+                counters.reconnects++;
+                counters.downtime += monotonic_time() - counters.down_since;
+                counters.down_since = 0;
+                break;
+            }
+            cond.wait_for(guard, std::chrono::duration<double>(delay));
+            delay = (std::min)(delay * 2, max_delay);
+        }
+    }
+}
@@ -0,0 +1,92 @@
+/* reconnect.h
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Adapter reconnect supervisor
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+
+#ifndef CEC_RECONNECT_H
+#define CEC_RECONNECT_H
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <libcec/cec.h>
+
+struct Adapter;
+
+struct ReconnectStats {
+    bool connected;
+    unsigned long lost;       // connection losses seen
+    unsigned long reconnects; // successful reopens
+    unsigned long attempts;   // reopen attempts, successful or not
+    double downtime;          // seconds spent disconnected, including now
+    double down_since;        // monotonic time of the current loss, or 0
+};
+
+// What a reopen restores, captured from libcec once per loss, while it still
+// holds the lost connection's state
+struct ReconnectSnapshot {
+    CEC::libcec_configuration config;
+    bool have_config;
+    CEC::cec_logical_address primary;
+    bool was_active;
+};
+
+// Reopens the adapter's device after libcec reports CEC_ALERT_CONNECTION_LOST.
+//
+// The same libcec instance is closed and reopened, so the Adapter, its
+// callbacks and its Device objects stay valid. Attempts back off
+// exponentially from the initial to the maximum delay. Once reopened, the
+// configuration, primary logical address and active source state captured
+// before the loss are restored.
+class Reconnector {
+    public:
+        Reconnector(Adapter * adapter);
+        ~Reconnector();
+
+        // start supervising, or update the delays
+        void start(double initial_delay, double max_delay);
+        // libcec reported the connection lost; safe from the libcec thread
+        void connection_lost();
+        // stop the thread; must not be called with the GIL held
+        void stop();
+
+        ReconnectStats stats();
+
+    private:
+        void run();
+        void capture(ReconnectSnapshot & snapshot);
+        bool reopen(const ReconnectSnapshot & snapshot);
+
+        Adapter * adapter;
+        std::mutex lock;
+        std::condition_variable cond;
+        std::thread thread;
+        bool running;
+        bool lost;
+        double initial_delay;
+        double max_delay;
+        ReconnectStats counters;
+};
+
+#endif
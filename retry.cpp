@@ -0,0 +1,351 @@
+/* retry.cpp
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Implementation of the transmit retry policy and results
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <random>
+
+#include "module.h"
+#include "retry.h"
+
+using namespace CEC;
+
+// a failure taking at least this fraction of the transmit timeout timed out
+#define TIMEOUT_FRACTION 0.9
+
+RetryState::RetryState() {
+    memset(&counters, 0, sizeof(counters));
+}
+
+RetryPolicy RetryState::policy() {
+    std::lock_guard<std::mutex> guard(lock);
+    return current;
+}
+
+void RetryState::set_policy(const RetryPolicy & policy) {
+    std::lock_guard<std::mutex> guard(lock);
+    current = policy;
+}
+
+void RetryState::record(const TransmitResult & result) {
+    std::lock_guard<std::mutex> guard(lock);
+    counters.transmits++;
+    counters.retries += result.attempts > 1 ? result.attempts - 1 : 0;
+    switch (result.status) {
+        case TRANSMIT_ACKED:
+            counters.acked++;
+            if (result.attempts > 1) {
+                counters.recovered++;
+            }
+            break;
+        case TRANSMIT_NACKED:
+            counters.nacked++;
+            break;
+        case TRANSMIT_TIMED_OUT:
+            counters.timed_out++;
+            break;
+        default:
+            counters.failed++;
+            break;
+    }
+}
+
+TransmitStats RetryState::stats(bool reset) {
+    std::lock_guard<std::mutex> guard(lock);
+    TransmitStats stats = counters;
+    if (reset) {
+        memset(&counters, 0, sizeof(counters));
+    }
+    return stats;
+}
+
+int classify_failure(const cec_command & cmd, double elapsed) {
+    if (cmd.transmit_timeout > 0 &&
+            elapsed * 1000 >= cmd.transmit_timeout * TIMEOUT_FRACTION) {
+        return TRANSMIT_TIMED_OUT;
+    }
+    return TRANSMIT_NACKED;
+}
+
+bool should_retry(const RetryPolicy & policy, int status, unsigned attempts) {
+    if (attempts >= policy.attempts) {
+        return false;
+    }
+    switch (status) {
+        case TRANSMIT_NACKED:
+            return policy.retry_on & RETRY_NACK;
+        case TRANSMIT_TIMED_OUT:
+            return policy.retry_on & RETRY_TIMEOUT;
+        default:
+            return false;
+    }
+}
+
+double retry_delay(const RetryPolicy & policy, unsigned attempts) {
+    // each thread draws from its own generator, no locking needed
+    static thread_local std::minstd_rand random(std::random_device{}());
+    double delay = policy.backoff;
+    for (unsigned i=1; i<attempts && delay < policy.max_backoff; i++) {
+        delay *= 2;
+    }
+    if (delay > policy.max_backoff) {
+        delay = policy.max_backoff;
+    }
+    std::uniform_real_distribution<double> spread(1 - policy.jitter, 1);
+    return delay * spread(random);
+}
+
+int retry_policy_args(RetryPolicy & policy, PyObject * attempts,
+        PyObject * backoff, PyObject * max_backoff, PyObject * jitter,
+        PyObject * retry_on) {
+    RetryPolicy updated = policy;
+    if (attempts && attempts != Py_None) {
+        long value = PyLong_AsLong(attempts);
+        if (value == -1 && PyErr_Occurred()) {
+            return -1;
+        }
+        if (value < 1 || value > 100) {
+            PyErr_SetString(PyExc_ValueError, "attempts must be between 1 and 100");
+            return -1;
+        }
+        updated.attempts = (unsigned)value;
+    }
+    if (backoff && backoff != Py_None) {
+        updated.backoff = PyFloat_AsDouble(backoff);
+        if (updated.backoff == -1 && PyErr_Occurred()) {
+            return -1;
+        }
+    }
+    if (max_backoff && max_backoff != Py_None) {
+        updated.max_backoff = PyFloat_AsDouble(max_backoff);
+        if (updated.max_backoff == -1 && PyErr_Occurred()) {
+            return -1;
+        }
+    }
+    if (updated.backoff < 0 || updated.max_backoff < updated.backoff) {
+        PyErr_SetString(PyExc_ValueError,
+                "backoff must be at least 0 and no more than max_backoff");
+        return -1;
+    }
+    if (jitter && jitter != Py_None) {
+        updated.jitter = PyFloat_AsDouble(jitter);
+        if (updated.jitter == -1 && PyErr_Occurred()) {
+            return -1;
+        }
+        if (updated.jitter < 0 || updated.jitter > 1) {
+            PyErr_SetString(PyExc_ValueError, "jitter must be between 0 and 1");
+            return -1;
+        }
+    }
+    if (retry_on && retry_on != Py_None) {
+        long value = PyLong_AsLong(retry_on);
+        if (value == -1 && PyErr_Occurred()) {
+            return -1;
+        }
+        if (value & ~RETRY_ALL) {
+            PyErr_SetString(PyExc_ValueError,
+                    "retry_on must be a combination of RETRY_NACK and RETRY_TIMEOUT");
+            return -1;
+        }
+        updated.retry_on = (int)value;
+    }
+    policy = updated;
+    return 0;
+}
+
+PyObject * convert_retry_policy(const RetryPolicy & policy) {
+    return Py_BuildValue("{sIsdsdsdsi}",
+            "attempts", policy.attempts,
+            "backoff", policy.backoff,
+            "max_backoff", policy.max_backoff,
+            "jitter", policy.jitter,
+            "retry_on", policy.retry_on);
+}
+
+PyObject * convert_transmit_stats(const TransmitStats & stats) {
+    return Py_BuildValue("{sksksksksksksk}",
+            "transmits", stats.transmits,
+            "acked", stats.acked,
+            "nacked", stats.nacked,
+            "timed_out", stats.timed_out,
+            "failed", stats.failed,
+            "retries", stats.retries,
+            "recovered", stats.recovered);
+}
+
+/*
+ * cec.TransmitResult
+ */
+
+struct TransmitResultObject {
+    PyObject_HEAD
+    TransmitResult result;
+};
+
+static const char * status_names[] = { "acked", "nacked", "timed out", "failed" };
+
+PyObject * transmit_result(PyObject * owner, std::atomic<PyObject *> & spare,
+        const TransmitResult & result) {
+    PyObject * obj = spare.exchange(NULL);
+    // reuse the last result if the caller let go of it
+    if (obj && Py_REFCNT(obj) != 1) {
+        Py_DECREF(obj);
+        obj = NULL;
+    }
+    if (!obj) {
+        ModuleState * module = type_state(Py_TYPE(owner));
+        if (!module) {
+            return NULL;
+        }
+        obj = (PyObject *)PyObject_New(TransmitResultObject,
+                module->transmit_result_type);
+        if (!obj) {
+            return NULL;
+        }
+    }
+    ((TransmitResultObject *)obj)->result = result;
+    Py_INCREF(obj);
+    Py_XDECREF(spare.exchange(obj));
+    return obj;
+}
+
+static void TransmitResult_dealloc(PyObject * self) {
+    free_instance(self);
+}
+
+static int TransmitResult_bool(TransmitResultObject * self) {
+    return self->result.status == TRANSMIT_ACKED;
+}
+
+// compare and hash like the bool transmit used to return
+static PyObject * TransmitResult_richcompare(TransmitResultObject * self,
+        PyObject * other, int op) {
+    long acked = self->result.status == TRANSMIT_ACKED;
+    long value;
+    if (Py_TYPE(other) == Py_TYPE(self)) {
+        value = ((TransmitResultObject *)other)->result.status == TRANSMIT_ACKED;
+    } else if (PyLong_Check(other)) {
+        int overflow;
+        value = PyLong_AsLongAndOverflow(other, &overflow);
+        if (value == -1 && PyErr_Occurred()) {
+            return NULL;
+        }
+        if (overflow) {
+            value = -1;
+        }
+    } else {
+        Py_RETURN_NOTIMPLEMENTED;
+    }
+    switch (op) {
+        case Py_EQ:
+            return PyBool_FromLong(acked == value);
+        case Py_NE:
+            return PyBool_FromLong(acked != value);
+    }
+    Py_RETURN_NOTIMPLEMENTED;
+}
+
+static Py_hash_t TransmitResult_hash(TransmitResultObject * self) {
+    return self->result.status == TRANSMIT_ACKED;
+}
+
+static PyObject * TransmitResult_repr(TransmitResultObject * self) {
+    char repr[128];
+    snprintf(repr, sizeof(repr), "<cec.TransmitResult %s attempts=%u elapsed=%.3f>",
+            status_names[self->result.status], self->result.attempts,
+            self->result.elapsed);
+    return PyUnicode_FromString(repr);
+}
+
+static PyObject * TransmitResult_getStatus(TransmitResultObject * self, void * closure) {
+    return PyLong_FromLong(self->result.status);
+}
+
+static PyObject * TransmitResult_getAcked(TransmitResultObject * self, void * closure) {
+    return PyBool_FromLong(self->result.status == TRANSMIT_ACKED);
+}
+
+static PyObject * TransmitResult_getNacked(TransmitResultObject * self, void * closure) {
+    return PyBool_FromLong(self->result.status == TRANSMIT_NACKED);
+}
+
+static PyObject * TransmitResult_getTimedOut(TransmitResultObject * self, void * closure) {
+    return PyBool_FromLong(self->result.status == TRANSMIT_TIMED_OUT);
+}
+
+static PyObject * TransmitResult_getAttempts(TransmitResultObject * self, void * closure) {
+    return PyLong_FromUnsignedLong(self->result.attempts);
+}
+
+static PyObject * TransmitResult_getElapsed(TransmitResultObject * self, void * closure) {
+    return PyFloat_FromDouble(self->result.elapsed);
+}
+
+static PyGetSetDef TransmitResult_getset[] = {
+   {"status", (getter)TransmitResult_getStatus, (setter)NULL, "TRANSMIT_* outcome"},
+   {"acked", (getter)TransmitResult_getAcked, (setter)NULL, "Acknowledged"},
+   {"nacked", (getter)TransmitResult_getNacked, (setter)NULL,
+      "Not acknowledged, refused or nothing at the destination"},
+   {"timed_out", (getter)TransmitResult_getTimedOut, (setter)NULL,
+      "The line stayed busy until the transmit timeout"},
+   {"attempts", (getter)TransmitResult_getAttempts, (setter)NULL, "Attempts made"},
+   {"elapsed", (getter)TransmitResult_getElapsed, (setter)NULL,
+      "Seconds taken, including the delays between attempts"},
+   {NULL}
+};
+
+static PyType_Slot TransmitResult_slots[] = {
+   {Py_tp_dealloc, (void *)TransmitResult_dealloc},
+   {Py_tp_repr, (void *)TransmitResult_repr},
+   {Py_nb_bool, (void *)TransmitResult_bool},
+   {Py_tp_richcompare, (void *)TransmitResult_richcompare},
+   {Py_tp_hash, (void *)TransmitResult_hash},
+   {Py_tp_doc, (void *)"Outcome of a transmission, true if acknowledged"},
+   {Py_tp_getset, TransmitResult_getset},
+   {0, NULL}
+};
+
+// only created by transmit
+static PyType_Spec TransmitResult_spec = {
+   "cec.TransmitResult",
+   sizeof(TransmitResultObject),
+   0,
+#if PY_VERSION_HEX >= 0x030A0000
+   CEC_TYPE_FLAGS | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+#else
+   CEC_TYPE_FLAGS,
+#endif
+   TransmitResult_slots
+};
+
+PyTypeObject * TransmitResultTypeInit(PyObject * module) {
+   PyTypeObject * type = new_type(module, &TransmitResult_spec);
+#if PY_VERSION_HEX < 0x030A0000
+   if (type) {
+      type->tp_new = NULL;
+   }
+#endif
+   return type;
+}
@@ -0,0 +1,119 @@
+/* retry.h
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Transmit retry policy and results
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#ifndef CEC_RETRY_H
+#define CEC_RETRY_H
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <atomic>
+#include <mutex>
+
+#include <libcec/cec.h>
+
+// Outcome of a transmission. libcec only reports whether a frame was
+// acknowledged, so a failure is classified by how long it took: a frame
+// that isn't acknowledged fails as soon as its header is sent, while a busy
+// line keeps the adapter waiting until the command's transmit timeout.
+#define TRANSMIT_ACKED     0
+#define TRANSMIT_NACKED    1 // refused, or nothing at the destination
+#define TRANSMIT_TIMED_OUT 2 // the line stayed busy, or the adapter didn't answer
+#define TRANSMIT_FAILED    3 // not sent, the adapter is closed or a monitor
+
+// failures worth another attempt, for RetryPolicy::retry_on
+#define RETRY_NACK    0x1
+#define RETRY_TIMEOUT 0x2
+#define RETRY_ALL     0x3
+
+struct RetryPolicy {
+    unsigned attempts;  // including the first
+    double backoff;     // seconds before the second attempt, doubling after
+    double max_backoff;
+    double jitter;      // fraction of each delay that is random, 0-1
+    int retry_on;       // RETRY_* mask
+
+    // a single attempt
+    RetryPolicy() : attempts(1), backoff(0.05), max_backoff(1.0), jitter(0.5),
+        retry_on(RETRY_ALL) {}
+};
+
+struct TransmitResult {
+    int status;         // TRANSMIT_*
+    unsigned attempts;
+    double elapsed;     // seconds, including the delays between attempts
+};
+
+struct TransmitStats {
+    unsigned long transmits;
+    unsigned long acked;
+    unsigned long nacked;
+    unsigned long timed_out;
+    unsigned long failed;
+    unsigned long retries;   // attempts after the first
+    unsigned long recovered; // acknowledged after a retry
+};
+
+// An adapter's default policy and the outcomes of its transmissions
+class RetryState {
+    public:
+        RetryState();
+
+        RetryPolicy policy();
+        void set_policy(const RetryPolicy & policy);
+        void record(const TransmitResult & result);
+        TransmitStats stats(bool reset);
+
+    private:
+        std::mutex lock;
+        RetryPolicy current;
+        TransmitStats counters;
+};
+
+// TRANSMIT_* of an attempt to send cmd that libcec rejected after elapsed
+// seconds
+int classify_failure(const CEC::cec_command & cmd, double elapsed);
+// whether a transmission that ended with status after attempts is retried
+bool should_retry(const RetryPolicy & policy, int status, unsigned attempts);
+// seconds to wait before the attempt after attempts, with jitter
+double retry_delay(const RetryPolicy & policy, unsigned attempts);
+
+// Update policy from Python arguments, each NULL or None to keep the
+// policy's value. Returns -1 with an exception set if one is invalid.
+int retry_policy_args(RetryPolicy & policy, PyObject * attempts,
+        PyObject * backoff, PyObject * max_backoff, PyObject * jitter,
+        PyObject * retry_on);
+// dicts of a policy and of transmit statistics
+PyObject * convert_retry_policy(const RetryPolicy & policy);
+PyObject * convert_transmit_stats(const TransmitStats & stats);
+
+// A cec.TransmitResult for result. The owner, an adapter or broker client,
+// keeps its last result object in spare and refills it when nothing else
+// refers to it any more, so checking each result and dropping it, the common
+// case, allocates nothing. Requires the GIL.
+PyObject * transmit_result(PyObject * owner, std::atomic<PyObject *> & spare,
+        const TransmitResult & result);
+PyTypeObject * TransmitResultTypeInit(PyObject * module);
+
+#endif
@@ -0,0 +1,206 @@
+/* rules.cpp
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Implementation of native auto-responder rules
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#include <string.h>
+
+#include "cec.h"
+#include "opcodes.h"
+#include "rules.h"
+#include "state.h"
+
+using namespace CEC;
+
+static bool matches(const Rule & rule, const cec_command & cmd) {
+    if (rule.opcode >= 0 && (!cmd.opcode_set || cmd.opcode != rule.opcode)) {
+        return false;
+    }
+    if (rule.initiator >= 0 && cmd.initiator != rule.initiator) {
+        return false;
+    }
+    if (rule.destination >= 0 && cmd.destination != rule.destination) {
+        return false;
+    }
+    if (rule.prefix_size > cmd.parameters.size) {
+        return false;
+    }
+    return memcmp(rule.prefix, cmd.parameters.data, rule.prefix_size) == 0;
+}
+
+long RuleSet::add(Rule & rule) {
+    std::lock_guard<std::mutex> guard(lock);
+    rule.id = next_id++;
+    rule.last_reply = 0;
+    rule.matches = rule.replies = rule.limited = 0;
+    rules.push_back(rule);
+    count = rules.size();
+    return rule.id;
+}
+
+bool RuleSet::remove(long id) {
+    std::lock_guard<std::mutex> guard(lock);
+    for (std::vector<Rule>::iterator itr = rules.begin(); itr != rules.end(); ++itr) {
+        if (itr->id == id) {
+            rules.erase(itr);
+            count = rules.size();
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<Rule> RuleSet::snapshot() {
+    std::lock_guard<std::mutex> guard(lock);
+    return rules;
+}
+
+bool RuleSet::process(const cec_command & cmd, cec_command & reply, bool & send) {
+    if (!count) {
+        return false;
+    }
+    bool mirror = true;
+    std::lock_guard<std::mutex> guard(lock);
+    for (size_t i=0; i<rules.size(); i++) {
+        Rule & rule = rules[i];
+        if (!matches(rule, cmd)) {
+            continue;
+        }
+        rule.matches++;
+        double now = monotonic_time();
+        if (rule.last_reply && now - rule.last_reply < rule.rate_limit) {
+            rule.limited++;
+            break;
+        }
+        // a rate limited match wasn't answered, so it's still delivered
+        mirror = rule.mirror;
+        rule.last_reply = now;
+        rule.replies++;
+        reply = rule.reply;
+        if (rule.reply_to_sender) {
+            reply.destination = cmd.initiator;
+        }
+        send = true;
+        break;
+    }
+    return !mirror;
+}
+
+static int match_int(PyObject * match, const char * key, int max, int * value) {
+    PyObject * item = PyDict_GetItemString(match, key);
+    if (!item || item == Py_None) {
+        *value = -1;
+        return 0;
+    }
+    long v = PyLong_AsLong(item);
+    if (v == -1 && PyErr_Occurred()) {
+        return -1;
+    }
+    if (v < 0 || v > max) {
+        PyErr_Format(PyExc_ValueError, "'%s' must be between 0 and %d", key, max);
+        return -1;
+    }
+    *value = (int)v;
+    return 0;
+}
+
+int convert_rule_match(PyObject * match, Rule & rule) {
+    static const char * keys[] = { "opcode", "initiator", "destination", "param_prefix" };
+
+    if (!PyDict_Check(match)) {
+        PyErr_SetString(PyExc_TypeError, "match must be a dict");
+        return -1;
+    }
+    PyObject * key;
+    PyObject * value;
+    Py_ssize_t pos = 0;
+    while (PyDict_Next(match, &pos, &key, &value)) {
+        bool known = false;
+        for (const char * name : keys) {
+            known |= PyUnicode_Check(key) && PyUnicode_CompareWithASCIIString(key, name) == 0;
+        }
+        if (!known) {
+            PyErr_Format(PyExc_ValueError, "Unknown match key %R", key);
+            return -1;
+        }
+    }
+
+    if (match_int(match, "opcode", 0xFF, &rule.opcode) ||
+            match_int(match, "initiator", 15, &rule.initiator) ||
+            match_int(match, "destination", 15, &rule.destination)) {
+        return -1;
+    }
+    rule.prefix_size = 0;
+    PyObject * prefix = PyDict_GetItemString(match, "param_prefix");
+    if (prefix && prefix != Py_None) {
+        Py_buffer view;
+        if (PyObject_GetBuffer(prefix, &view, PyBUF_SIMPLE)) {
+            return -1;
+        }
+        if (view.len > CEC_MAX_DATA_PACKET_SIZE) {
+            PyBuffer_Release(&view);
+            PyErr_SetString(PyExc_ValueError, "param_prefix is too long");
+            return -1;
+        }
+        memcpy(rule.prefix, view.buf, view.len);
+        rule.prefix_size = (uint8_t)view.len;
+        PyBuffer_Release(&view);
+    }
+    return 0;
+}
+
+static PyObject * match_value(int value) {
+    if (value < 0) {
+        Py_RETURN_NONE;
+    }
+    return PyLong_FromLong(value);
+}
+
+PyObject * convert_rules(const std::vector<Rule> & rules) {
+    PyObject * result = PyList_New(rules.size());
+    if (!result) {
+        return NULL;
+    }
+    for (size_t i=0; i<rules.size(); i++) {
+        const Rule & rule = rules[i];
+        PyObject * item = Py_BuildValue("{sls{sNsNsNsy#}sNsdsOsOsksksk}",
+                "id", rule.id,
+                "match",
+                    "opcode", match_value(rule.opcode),
+                    "initiator", match_value(rule.initiator),
+                    "destination", match_value(rule.destination),
+                    "param_prefix", (const char *)rule.prefix, (Py_ssize_t)rule.prefix_size,
+                "reply", decode_command(rule.reply),
+                "rate_limit", rule.rate_limit,
+                "mirror", rule.mirror ? Py_True : Py_False,
+                "reply_to_sender", rule.reply_to_sender ? Py_True : Py_False,
+                "matches", rule.matches,
+                "replies", rule.replies,
+                "limited", rule.limited);
+        if (!item) {
+            Py_DECREF(result);
+            return NULL;
+        }
+        PyList_SET_ITEM(result, i, item);
+    }
+    return result;
+}
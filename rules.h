@@ -0,0 +1,96 @@
+/* rules.h
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Native auto-responder rules, answering commands on the libcec thread
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#ifndef CEC_RULES_H
+#define CEC_RULES_H
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include <libcec/cec.h>
+
+/*
+ * Compat for libcec 3.x
+ */
+#if CEC_LIB_VERSION_MAJOR < 4
+  #define CEC_MAX_DATA_PACKET_SIZE (16 * 4)
+#endif
+
+struct Rule {
+    long id;
+    // match, -1 for any
+    int opcode;
+    int initiator;
+    int destination;
+    uint8_t prefix[CEC_MAX_DATA_PACKET_SIZE];
+    uint8_t prefix_size;
+    // reply
+    CEC::cec_command reply;
+    bool reply_to_sender;  // send the reply to the initiator of the match
+    bool mirror;           // still deliver the matched command as an event
+    double rate_limit;     // minimum seconds between replies
+    // counters
+    double last_reply;
+    unsigned long matches;
+    unsigned long replies;
+    unsigned long limited;
+};
+
+// Rules are only evaluated with the lock held, which never waits for the
+// GIL, and replies are transmitted after releasing it.
+class RuleSet {
+    public:
+        RuleSet() : next_id(1), count(0) {}
+
+        // returns the id of the rule
+        long add(Rule & rule);
+        bool remove(long id);
+        std::vector<Rule> snapshot();
+
+        // Find the first rule cmd matches, setting reply and send if it
+        // should be answered now. Returns true if a reply was sent and the
+        // command shouldn't be delivered as an event. Called from the libcec
+        // thread without the GIL.
+        bool process(const CEC::cec_command & cmd, CEC::cec_command & reply,
+                bool & send);
+
+    private:
+        std::mutex lock;
+        std::vector<Rule> rules;
+        long next_id;
+        std::atomic<int> count;
+};
+
+// Fill in the match fields of rule from a dict of opcode, initiator,
+// destination and param_prefix, all optional. -1 with an exception set.
+int convert_rule_match(PyObject * match, Rule & rule);
+
+// a list of dicts describing each rule and its counters
+PyObject * convert_rules(const std::vector<Rule> & rules);
+
+#endif
@@ -10,7 +10,15 @@ if "CFLAGS" in cfg_vars:
 if "OPT" in cfg_vars:
     cfg_vars["OPT"] = cfg_vars["OPT"].replace("-Wstrict-prototypes", "")
 
-python_cec = Extension('cec', sources = [ 'cec.cpp', 'device.cpp', 'adapter.cpp' ],
+python_cec = Extension('cec', sources = [ 'cec.cpp', 'device.cpp', 'adapter.cpp',
+                                          'state.cpp', 'topology.cpp', 'poller.cpp',
+                                          'vendor.cpp', 'opcodes.cpp',
+                                          'constants.cpp', 'detect.cpp', 'reconnect.cpp',
+                                          'pool.cpp', 'module.cpp', 'handlers.cpp',
+                                          'rules.cpp', 'latency.cpp',
+                                          'history.cpp', 'capture.cpp', 'metadata.cpp',
+                                          'config.cpp', 'volume.cpp', 'retry.cpp',
+                                          'broker.cpp', 'presence.cpp' ],
                         include_dirs=['include'],
                         libraries = [ 'cec' ])
 
@@ -25,4 +33,5 @@ setup(name='cec', version='0.3.0',
       },
       author="retsyx",
       data_files=['COPYING'],
+      headers=['cec_handler.h'],
       ext_modules=[python_cec])
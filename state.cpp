@@ -0,0 +1,432 @@
+/* state.cpp
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Implementation of the passive CEC bus state model
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#define __STDC_FORMAT_MACROS
+
+#include <inttypes.h>
+#include <chrono>
+
+#include "cec.h"
+#include "state.h"
+
+using namespace CEC;
+
+double monotonic_time() {
+    std::chrono::steady_clock::duration d =
+        std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration<double>(d).count();
+}
+
+const char * cec_version_str(cec_version ver) {
+    switch(ver) {
+        case CEC_VERSION_1_2:
+            return "1.2";
+        case CEC_VERSION_1_2A:
+            return "1.2a";
+        case CEC_VERSION_1_3:
+            return "1.3";
+        case CEC_VERSION_1_3A:
+            return "1.3a";
+        case CEC_VERSION_1_4:
+            return "1.4";
+        case CEC_VERSION_UNKNOWN:
+        default:
+            return "Unknown";
+    }
+}
+
+static inline bool valid_addr(cec_logical_address addr) {
+    return addr >= CECDEVICE_TV && addr < CECDEVICE_BROADCAST;
+}
+
+static inline uint16_t param_physical_addr(const cec_command & cmd, uint8_t pos) {
+    return (uint16_t)((cmd.parameters[pos] << 8) | cmd.parameters[pos + 1]);
+}
+
+bool BusState::observe(const cec_command & cmd) {
+    if (!cmd.opcode_set) {
+        // a poll, carries no state
+        return false;
+    }
+
+    const cec_datapacket & params = cmd.parameters;
+    double now = monotonic_time();
+    cec_logical_address src = cmd.initiator;
+    cec_logical_address dst = cmd.destination;
+
+    bool power = false;
+
+    std::lock_guard<std::mutex> guard(lock);
+
+    switch (cmd.opcode) {
+        case CEC_OPCODE_REPORT_POWER_STATUS:
+            if (valid_addr(src) && params.size >= 1) {
+                data.devices[src].power_status.set((cec_power_status)params[0], now);
+                power = true;
+            }
+            break;
+        case CEC_OPCODE_STANDBY:
+            if (dst == CECDEVICE_BROADCAST) {
+                // only devices already seen, not empty or our own addresses
+                for (int i=CECDEVICE_TV; i<CECDEVICE_BROADCAST; i++) {
+                    if (i != src && !(own & (1 << i)) && data.devices[i].known()) {
+                        data.devices[i].power_status.set(CEC_POWER_STATUS_STANDBY, now);
+                    }
+                }
+                data.active_source.set(CECDEVICE_UNKNOWN, now);
+                power = true;
+            } else if (valid_addr(dst)) {
+                data.devices[dst].power_status.set(CEC_POWER_STATUS_STANDBY, now);
+                if (data.active_source.value == dst) {
+                    data.active_source.set(CECDEVICE_UNKNOWN, now);
+                }
+                power = true;
+            }
+            break;
+        case CEC_OPCODE_IMAGE_VIEW_ON:
+        case CEC_OPCODE_TEXT_VIEW_ON:
+            if (valid_addr(dst)) {
+                cec_power_status & status = data.devices[dst].power_status.value;
+                if (!data.devices[dst].power_status.valid() || status != CEC_POWER_STATUS_ON) {
+                    data.devices[dst].power_status.set(
+                            CEC_POWER_STATUS_IN_TRANSITION_STANDBY_TO_ON, now);
+                    power = true;
+                }
+            }
+            break;
+        case CEC_OPCODE_ACTIVE_SOURCE:
+            if (valid_addr(src) && params.size >= 2) {
+                uint16_t pa = param_physical_addr(cmd, 0);
+                data.active_source.set(src, now);
+                data.stream_path.set(pa, now);
+                data.devices[src].physical_address.set(pa, now);
+                data.devices[src].power_status.set(CEC_POWER_STATUS_ON, now);
+                power = true;
+            }
+            break;
+        case CEC_OPCODE_INACTIVE_SOURCE:
+            if (valid_addr(src) && data.active_source.value == src) {
+                data.active_source.set(CECDEVICE_UNKNOWN, now);
+            }
+            break;
+        case CEC_OPCODE_ROUTING_CHANGE:
+            if (params.size >= 4) {
+                data.stream_path.set(param_physical_addr(cmd, 2), now);
+            }
+            break;
+        case CEC_OPCODE_ROUTING_INFORMATION:
+        case CEC_OPCODE_SET_STREAM_PATH:
+            if (params.size >= 2) {
+                data.stream_path.set(param_physical_addr(cmd, 0), now);
+            }
+            break;
+        case CEC_OPCODE_REPORT_PHYSICAL_ADDRESS:
+            if (valid_addr(src) && params.size >= 2) {
+                data.devices[src].physical_address.set(param_physical_addr(cmd, 0), now);
+                if (params.size >= 3) {
+                    data.devices[src].device_type.set((cec_device_type)params[2], now);
+                }
+            }
+            break;
+        case CEC_OPCODE_DEVICE_VENDOR_ID:
+            if (valid_addr(src) && params.size >= 3) {
+                uint32_t vendor = ((uint32_t)params[0] << 16) |
+                    ((uint32_t)params[1] << 8) | params[2];
+                data.devices[src].vendor_id.set(vendor, now);
+            }
+            break;
+        case CEC_OPCODE_CEC_VERSION:
+            if (valid_addr(src) && params.size >= 1) {
+                data.devices[src].cec_version.set((cec_version)params[0], now);
+            }
+            break;
+        case CEC_OPCODE_SET_OSD_NAME:
+            if (valid_addr(src)) {
+                data.devices[src].osd_name.set(
+                        std::string((const char *)params.data, params.size), now);
+            }
+            break;
+        case CEC_OPCODE_SET_MENU_LANGUAGE:
+            if (valid_addr(src) && params.size >= 3) {
+                data.devices[src].language.set(
+                        std::string((const char *)params.data, 3), now);
+            }
+            break;
+        case CEC_OPCODE_SET_SYSTEM_AUDIO_MODE:
+        case CEC_OPCODE_SYSTEM_AUDIO_MODE_STATUS:
+            if (params.size >= 1) {
+                data.system_audio_mode.set(params[0] != 0, now);
+                if (params[0] && src == CECDEVICE_AUDIOSYSTEM) {
+                    data.devices[src].power_status.set(CEC_POWER_STATUS_ON, now);
+                    power = true;
+                }
+            }
+            break;
+        case CEC_OPCODE_REPORT_AUDIO_STATUS:
+            if (params.size >= 1) {
+                data.volume.set(params[0] & 0x7F, now);
+                data.mute.set((params[0] & 0x80) != 0, now);
+            }
+            break;
+        default:
+            break;
+    }
+    return power;
+}
+
+void BusState::observe_activated(cec_logical_address addr, bool active) {
+    set_active_source(addr, active);
+}
+
+void BusState::set_power_status(cec_logical_address addr, cec_power_status status) {
+    if (!valid_addr(addr) || status == CEC_POWER_STATUS_UNKNOWN) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    data.devices[addr].power_status.set(status, monotonic_time());
+}
+
+void BusState::set_physical_address(cec_logical_address addr, uint16_t physical_address) {
+    if (!valid_addr(addr) || physical_address == 0xFFFF) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    data.devices[addr].physical_address.set(physical_address, monotonic_time());
+}
+
+void BusState::set_vendor_id(cec_logical_address addr, uint32_t vendor_id) {
+    if (!valid_addr(addr) || vendor_id == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    data.devices[addr].vendor_id.set(vendor_id, monotonic_time());
+}
+
+void BusState::set_cec_version(cec_logical_address addr, cec_version version) {
+    if (!valid_addr(addr) || version == CEC_VERSION_UNKNOWN) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    data.devices[addr].cec_version.set(version, monotonic_time());
+}
+
+void BusState::set_osd_name(cec_logical_address addr, const std::string & name) {
+    if (!valid_addr(addr) || name.empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    data.devices[addr].osd_name.set(name, monotonic_time());
+}
+
+void BusState::set_language(cec_logical_address addr, const std::string & lang) {
+    if (!valid_addr(addr) || lang.empty() || lang == "???") {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    data.devices[addr].language.set(lang, monotonic_time());
+}
+
+void BusState::set_active_source(cec_logical_address addr, bool active) {
+    if (!valid_addr(addr)) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    double now = monotonic_time();
+    if (active) {
+        data.active_source.set(addr, now);
+        data.devices[addr].power_status.set(CEC_POWER_STATUS_ON, now);
+    } else if (data.active_source.value == addr) {
+        data.active_source.set(CECDEVICE_UNKNOWN, now);
+    }
+}
+
+void BusState::set_own_addresses(const cec_logical_addresses & addresses) {
+    uint16_t mask = 0;
+    for (int i=CECDEVICE_TV; i<CECDEVICE_BROADCAST; i++) {
+        if (addresses[i]) {
+            mask |= (uint16_t)(1 << i);
+        }
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    own = mask;
+}
+
+bool BusState::power_status(cec_logical_address addr, double max_age,
+        cec_power_status * status, double * time) {
+    if (!valid_addr(addr)) {
+        return false;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    const Observed<cec_power_status> & observed = data.devices[addr].power_status;
+    if (!observed.fresh(monotonic_time(), max_age)) {
+        return false;
+    }
+    *status = observed.value;
+    if (time) {
+        *time = observed.time;
+    }
+    return true;
+}
+
+BusStateData BusState::snapshot() {
+    std::lock_guard<std::mutex> guard(lock);
+    return data;
+}
+
+// Python conversion
+
+static int set_field(PyObject * dict, const char * key, PyObject * value, double time) {
+    if (!value) {
+        return -1;
+    }
+    PyObject * item = Py_BuildValue("(Nd)", value, time);
+    if (!item) {
+        return -1;
+    }
+    int res = PyDict_SetItemString(dict, key, item);
+    Py_DECREF(item);
+    return res;
+}
+
+static PyObject * physical_addr_str(uint16_t addr) {
+    char str[8];
+    format_physical_addr(addr, str);
+    return Py_BuildValue("s", str);
+}
+
+static PyObject * vendor_str(uint32_t vendor) {
+    char str[7];
+    snprintf(str, 7, "%06" PRIX32, vendor & 0xFFFFFF);
+    return Py_BuildValue("s", str);
+}
+
+static PyObject * convert_device(const DeviceState & dev) {
+    PyObject * result = PyDict_New();
+    if (!result) {
+        return NULL;
+    }
+    int err = 0;
+    if (dev.power_status.valid()) {
+        err |= set_field(result, "power_status",
+                PyLong_FromLong(dev.power_status.value), dev.power_status.time);
+    }
+    if (dev.physical_address.valid()) {
+        err |= set_field(result, "physical_address",
+                physical_addr_str(dev.physical_address.value), dev.physical_address.time);
+    }
+    if (dev.device_type.valid()) {
+        err |= set_field(result, "device_type",
+                PyLong_FromLong(dev.device_type.value), dev.device_type.time);
+    }
+    if (dev.vendor_id.valid()) {
+        err |= set_field(result, "vendor",
+                vendor_str(dev.vendor_id.value), dev.vendor_id.time);
+    }
+    if (dev.cec_version.valid()) {
+        err |= set_field(result, "cec_version",
+                Py_BuildValue("s", cec_version_str(dev.cec_version.value)),
+                dev.cec_version.time);
+    }
+    if (dev.osd_name.valid()) {
+        err |= set_field(result, "osd_string",
+                PyUnicode_DecodeASCII(dev.osd_name.value.c_str(),
+                    dev.osd_name.value.length(), "ignore"),
+                dev.osd_name.time);
+    }
+    if (dev.language.valid()) {
+        err |= set_field(result, "language",
+                PyUnicode_DecodeASCII(dev.language.value.c_str(),
+                    dev.language.value.length(), "ignore"),
+                dev.language.time);
+    }
+    if (err) {
+        Py_DECREF(result);
+        return NULL;
+    }
+    return result;
+}
+
+PyObject * convert_state(const BusStateData & state) {
+    PyObject * result = PyDict_New();
+    PyObject * devices = PyDict_New();
+    if (!result || !devices) {
+        goto fail;
+    }
+
+    if (state.active_source.valid()) {
+        if (set_field(result, "active_source",
+                PyLong_FromLong(state.active_source.value), state.active_source.time)) {
+            goto fail;
+        }
+    }
+    if (state.stream_path.valid()) {
+        if (set_field(result, "stream_path",
+                physical_addr_str(state.stream_path.value), state.stream_path.time)) {
+            goto fail;
+        }
+    }
+    if (state.system_audio_mode.valid()) {
+        if (set_field(result, "system_audio_mode",
+                PyBool_FromLong(state.system_audio_mode.value),
+                state.system_audio_mode.time)) {
+            goto fail;
+        }
+    }
+    if (state.volume.valid()) {
+        if (set_field(result, "volume",
+                PyLong_FromLong(state.volume.value), state.volume.time) ||
+            set_field(result, "mute",
+                PyBool_FromLong(state.mute.value), state.mute.time)) {
+            goto fail;
+        }
+    }
+
+    for (int i=CECDEVICE_TV; i<CECDEVICE_BROADCAST; i++) {
+        PyObject * dev = convert_device(state.devices[i]);
+        if (!dev) {
+            goto fail;
+        }
+        if (PyDict_Size(dev) > 0) {
+            PyObject * key = PyLong_FromLong(i);
+            int err = key ? PyDict_SetItem(devices, key, dev) : -1;
+            Py_XDECREF(key);
+            if (err) {
+                Py_DECREF(dev);
+                goto fail;
+            }
+        }
+        Py_DECREF(dev);
+    }
+
+    if (PyDict_SetItemString(result, "devices", devices)) {
+        goto fail;
+    }
+    Py_DECREF(devices);
+    return result;
+
+fail:
+    Py_XDECREF(devices);
+    Py_XDECREF(result);
+    return NULL;
+}
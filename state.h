@@ -0,0 +1,132 @@
+/* state.h
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Passive model of the CEC bus state, built from observed traffic
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#ifndef CEC_STATE_H
+#define CEC_STATE_H
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <mutex>
+#include <string>
+
+#include <libcec/cec.h>
+
+// Seconds on the monotonic clock. Comparable with Python's time.monotonic().
+double monotonic_time();
+
+const char * cec_version_str(CEC::cec_version ver);
+
+// A value together with the time it was last observed. A time of 0 means the
+// value was never observed.
+template <typename T>
+struct Observed {
+    T value;
+    double time;
+
+    Observed() : value(), time(0) {}
+
+    void set(const T & v, double t) {
+        value = v;
+        time = t;
+    }
+
+    bool valid() const {
+        return time > 0;
+    }
+
+    // max_age < 0 means any age is acceptable
+    bool fresh(double now, double max_age) const {
+        return valid() && (max_age < 0 || now - time <= max_age);
+    }
+};
+
+struct DeviceState {
+    Observed<CEC::cec_power_status> power_status;
+    Observed<uint16_t> physical_address;
+    Observed<CEC::cec_device_type> device_type;
+    Observed<uint32_t> vendor_id;
+    Observed<CEC::cec_version> cec_version;
+    Observed<std::string> osd_name;
+    Observed<std::string> language;
+
+    // whether anything was observed about the device
+    bool known() const {
+        return power_status.valid() || physical_address.valid() ||
+            device_type.valid() || vendor_id.valid() || cec_version.valid() ||
+            osd_name.valid() || language.valid();
+    }
+};
+
+struct BusStateData {
+    DeviceState devices[16];
+    Observed<CEC::cec_logical_address> active_source;
+    Observed<uint16_t> stream_path;
+    Observed<bool> system_audio_mode;
+    Observed<uint8_t> volume;
+    Observed<bool> mute;
+};
+
+// Updated from the libcec callback thread without holding the GIL, and read
+// from Python threads. All access goes through the lock.
+class BusState {
+    public:
+        BusState() : own(0) {}
+
+        // update from a frame seen on the bus, returns true if the frame
+        // carried power status
+        bool observe(const CEC::cec_command & cmd);
+        // update from a libcec source activation callback
+        void observe_activated(CEC::cec_logical_address addr, bool active);
+
+        // record the results of explicit bus queries
+        void set_power_status(CEC::cec_logical_address addr,
+                CEC::cec_power_status status);
+        void set_physical_address(CEC::cec_logical_address addr,
+                uint16_t physical_address);
+        void set_vendor_id(CEC::cec_logical_address addr, uint32_t vendor_id);
+        void set_cec_version(CEC::cec_logical_address addr,
+                CEC::cec_version version);
+        void set_osd_name(CEC::cec_logical_address addr, const std::string & name);
+        void set_language(CEC::cec_logical_address addr, const std::string & lang);
+        void set_active_source(CEC::cec_logical_address addr, bool active);
+        // the adapter's own logical addresses, which broadcasts don't update
+        void set_own_addresses(const CEC::cec_logical_addresses & addresses);
+
+        // returns false if there is no observation younger than max_age
+        bool power_status(CEC::cec_logical_address addr, double max_age,
+                CEC::cec_power_status * status, double * time = NULL);
+
+        BusStateData snapshot();
+
+    private:
+        std::mutex lock;
+        BusStateData data;
+        uint16_t own; // mask of our logical addresses
+};
+
+// convert a snapshot to a Python dict
+PyObject * convert_state(const BusStateData & state);
+
+#endif
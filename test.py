@@ -1,14 +1,141 @@
 #!/usr/bin/env python
 
+import os
+import shutil
+import struct
+import tempfile
+import threading
 import time
 import cec
 
+# The checks that need an adapter use the first one libcec finds. They don't
+# depend on what is on the bus, so a stand-in libcec found first on the
+# library path runs them without hardware.
+
+def wait_for(event, what):
+   assert event.wait(2), "timed out waiting for " + what
+
+# star imports still export the constants resolved on first use
+names = {}
+exec("from cec import *", names)
+assert names["CEC_OPCODE_STANDBY"] == 54
+assert names["EVENT_ALL"] == cec.EVENT_ALL
+
+def test_hotplug():
+   # a temporary directory stands in for /dev
+   path = tempfile.mkdtemp()
+   seen = []
+   changed = threading.Event()
+   def on_hotplug(node, present):
+      seen.append((os.path.basename(node), present))
+      changed.set()
+   try:
+      cec.watch_adapters(on_hotplug, path=path)
+      # only nodes named like adapters are reported
+      open(os.path.join(path, "unrelated"), "w").close()
+      node = os.path.join(path, "ttyACM0")
+      open(node, "w").close()
+      wait_for(changed, "the adapter to be plugged in")
+      changed.clear()
+      os.unlink(node)
+      wait_for(changed, "the adapter to be removed")
+      assert seen == [("ttyACM0", True), ("ttyACM0", False)], seen
+   finally:
+      cec.watch_adapters(None)
+      shutil.rmtree(path)
+
+def test_transmit_result(adapter):
+   r = adapter.transmit(cec.CECDEVICE_TV, cec.CEC_OPCODE_GIVE_DEVICE_POWER_STATUS)
+   assert r.attempts == 1
+   # compares and hashes as the bool transmit() used to return
+   assert bool(r) == r.acked
+   assert (r == True) == r.acked and (r == False) == (not r.acked)
+   assert r == bool(r) and hash(r) == hash(bool(r))
+   assert r.status in (cec.TRANSMIT_ACKED, cec.TRANSMIT_NACKED,
+                       cec.TRANSMIT_TIMED_OUT, cec.TRANSMIT_FAILED)
+   # failures are retried up to attempts, successes aren't
+   r = adapter.transmit(cec.CECDEVICE_TV, cec.CEC_OPCODE_GIVE_DEVICE_POWER_STATUS,
+                        attempts=3, backoff=0.01, retry_on=cec.RETRY_ALL)
+   assert r.attempts == (1 if r.acked else 3), r
+
+def test_history(adapter):
+   adapter.record_history(capacity=4)
+   history = adapter.history
+   try:
+      for i in range(6):
+         adapter.transmit(cec.CECDEVICE_TV, cec.CEC_OPCODE_GIVE_DEVICE_POWER_STATUS)
+      # the ring has wrapped, keeping the newest frames
+      assert len(history) == 4 and history.capacity == 4
+      slots = history.query()
+      assert slots == [(history.oldest + i) % 4 for i in range(4)], slots
+      record = struct.Struct("<dBBhBB2x64s")
+      frames = memoryview(history).tobytes()
+      times = [record.unpack_from(frames, slot * record.size)[0] for slot in slots]
+      assert times == sorted(times), times
+   finally:
+      adapter.record_history(0)
+
+def test_config_changes(adapter):
+   changes = []
+   changed = threading.Event()
+   def on_change(event, fields):
+      changes.append(fields)
+      changed.set()
+   config = adapter.config
+   timeout = config.double_tap_timeout
+   adapter.add_callback(on_change, cec.EVENT_CONFIG_CHANGE)
+   try:
+      # only the fields that changed are reported
+      config.update(double_tap_timeout=timeout + 50, combo_key=config.combo_key)
+      wait_for(changed, "the configuration change")
+      assert changes == [{"double_tap_timeout": timeout + 50}], changes
+      changes.clear()
+      config.update(double_tap_timeout=timeout + 50)
+      time.sleep(0.2)
+      assert changes == [], changes
+   finally:
+      config.double_tap_timeout = timeout
+      adapter.remove_callback(on_change, cec.EVENT_CONFIG_CHANGE)
+
+def test_broker(adapter):
+   path = tempfile.mkdtemp()
+   sock = os.path.join(path, "cec.sock")
+   adapter.serve_broker(sock)
+   config = adapter.config
+   timeout = config.double_tap_timeout
+   try:
+      client = cec.connect_broker(sock)
+      received = threading.Event()
+      client.add_callback(lambda event, fields: received.set(), cec.EVENT_CONFIG_CHANGE)
+      # published right after connecting, likely before the client's
+      # thread has started
+      config.double_tap_timeout = timeout + 10
+      wait_for(received, "the event through the broker")
+      assert client.address == adapter.address
+      assert sorted(client.state()) == sorted(adapter.state())
+      client.close()
+      assert not client.connected
+   finally:
+      config.double_tap_timeout = timeout
+      adapter.serve_broker(None)
+      shutil.rmtree(path)
+
 adapters = cec.list_adapters()
 
 test_power = False
 
 print(adapters)
 
+test_hotplug()
+
+if len(adapters) > 0:
+   adapter = cec.Adapter(dev=adapters[0])
+   test_transmit_result(adapter)
+   test_history(adapter)
+   test_config_changes(adapter)
+   test_broker(adapter)
+   adapter.close()
+
 if len(adapters) > 0:
    adapter = adapters[0]
    print("Using Adapter %s"%(adapter))
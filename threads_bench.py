@@ -0,0 +1,73 @@
+#!/usr/bin/env python
+
+# Measure how module calls scale across threads. On a free-threaded build the
+# total throughput should grow with the thread count, with the GIL it stays
+# flat. With --adapter, adapter calls and callback churn are included, which
+# also exercises the adapter's locking.
+#
+# usage: threads_bench.py [--adapter [dev]] [--seconds s] [max threads]
+
+import argparse
+import sys
+import threading
+import time
+
+import cec
+
+parser = argparse.ArgumentParser()
+parser.add_argument("--adapter", nargs="?", const="", default=None)
+parser.add_argument("--seconds", type=float, default=2.0)
+parser.add_argument("threads", type=int, nargs="?", default=8)
+args = parser.parse_args()
+
+adapter = None
+if args.adapter is not None:
+   if args.adapter:
+      adapter = cec.Adapter(dev=args.adapter)
+   else:
+      adapter = cec.Adapter()
+
+frame = b"\x4f\x82\x10\x00"
+
+def noop(*args):
+   pass
+
+def work():
+   cec.format(cec.decode(frame))
+   if adapter:
+      adapter.state()
+      adapter.add_callback(noop, cec.EVENT_COMMAND)
+      adapter.remove_callback(noop, cec.EVENT_COMMAND)
+
+def run(threads):
+   counts = [0] * threads
+   stop = threading.Event()
+   def loop(i):
+      n = 0
+      while not stop.is_set():
+         for j in range(100):
+            work()
+         n += 100
+      counts[i] = n
+   workers = [threading.Thread(target=loop, args=(i,)) for i in range(threads)]
+   for w in workers:
+      w.start()
+   time.sleep(args.seconds)
+   stop.set()
+   for w in workers:
+      w.join()
+   return sum(counts) / args.seconds
+
+if hasattr(sys, "_is_gil_enabled"):
+   print("GIL enabled: %s" % sys._is_gil_enabled())
+base = None
+threads = 1
+while threads <= args.threads:
+   rate = run(threads)
+   if base is None:
+      base = rate
+   print("%3d threads  %10.0f calls/s  %5.2fx" % (threads, rate, rate / base))
+   threads *= 2
+
+if adapter:
+   adapter.close()
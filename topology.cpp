@@ -0,0 +1,239 @@
+/* topology.cpp
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Implementation of the HDMI topology index
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#include <algorithm>
+
+#include "topology.h"
+
+using namespace CEC;
+
+static inline bool valid_addr(cec_logical_address addr) {
+    return addr >= CECDEVICE_TV && addr < CECDEVICE_BROADCAST;
+}
+
+static inline uint16_t param_physical_addr(const cec_command & cmd, uint8_t pos) {
+    return (uint16_t)((cmd.parameters[pos] << 8) | cmd.parameters[pos + 1]);
+}
+
+Topology::Topology() : subtree(0x10000, 0), seen(0x10000, false) {
+    for (int i=0; i<16; i++) {
+        phys[i] = PHYSICAL_ADDR_INVALID;
+    }
+}
+
+bool Topology::valid(uint16_t pa) {
+    if (pa == PHYSICAL_ADDR_INVALID) {
+        return false;
+    }
+    bool zero = false;
+    for (int shift=12; shift>=0; shift-=4) {
+        if ((pa >> shift) & 0xF) {
+            if (zero) {
+                return false;
+            }
+        } else {
+            zero = true;
+        }
+    }
+    return true;
+}
+
+int Topology::depth(uint16_t pa) {
+    int d = 0;
+    for (int shift=12; shift>=0 && ((pa >> shift) & 0xF); shift-=4) {
+        d++;
+    }
+    return d;
+}
+
+bool Topology::parent(uint16_t pa, uint16_t * out) {
+    int d = depth(pa);
+    if (d == 0) {
+        return false;
+    }
+    *out = pa & ~(0xF << (4 * (4 - d)));
+    return true;
+}
+
+int Topology::port_path(uint16_t pa, uint8_t ports[4]) {
+    int d = depth(pa);
+    for (int i=0; i<d; i++) {
+        ports[i] = (pa >> (12 - 4 * i)) & 0xF;
+    }
+    return d;
+}
+
+// Set or clear addr in the masks of pa and all of its ancestors
+void Topology::mark(uint16_t pa, cec_logical_address addr, bool set) {
+    uint16_t bit = (uint16_t)(1 << addr);
+    uint16_t node = pa;
+    do {
+        if (set) {
+            subtree[node] |= bit;
+        } else {
+            subtree[node] &= ~bit;
+        }
+    } while (parent(node, &node));
+}
+
+void Topology::mark_seen(uint16_t pa) {
+    uint16_t node = pa;
+    do {
+        seen[node] = true;
+    } while (parent(node, &node));
+}
+
+void Topology::observe(const cec_command & cmd) {
+    if (!cmd.opcode_set) {
+        return;
+    }
+
+    const cec_datapacket & params = cmd.parameters;
+    cec_logical_address src = cmd.initiator;
+
+    switch (cmd.opcode) {
+        case CEC_OPCODE_REPORT_PHYSICAL_ADDRESS:
+        case CEC_OPCODE_ACTIVE_SOURCE:
+            if (params.size >= 2) {
+                set_physical_address(src, param_physical_addr(cmd, 0));
+            }
+            break;
+        case CEC_OPCODE_ROUTING_CHANGE:
+            if (params.size >= 4) {
+                std::lock_guard<std::mutex> guard(lock);
+                uint16_t orig = param_physical_addr(cmd, 0);
+                uint16_t next = param_physical_addr(cmd, 2);
+                if (valid(orig)) {
+                    mark_seen(orig);
+                }
+                if (valid(next)) {
+                    mark_seen(next);
+                }
+            }
+            break;
+        case CEC_OPCODE_ROUTING_INFORMATION:
+        case CEC_OPCODE_SET_STREAM_PATH:
+            if (params.size >= 2) {
+                std::lock_guard<std::mutex> guard(lock);
+                uint16_t pa = param_physical_addr(cmd, 0);
+                if (valid(pa)) {
+                    mark_seen(pa);
+                }
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void Topology::set_physical_address(cec_logical_address addr, uint16_t pa) {
+    if (!valid_addr(addr) || !valid(pa)) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    if (phys[addr] == pa) {
+        return;
+    }
+    if (phys[addr] != PHYSICAL_ADDR_INVALID) {
+        mark(phys[addr], addr, false);
+    }
+    phys[addr] = pa;
+    mark(pa, addr, true);
+    mark_seen(pa);
+}
+
+void Topology::remove(cec_logical_address addr) {
+    if (!valid_addr(addr)) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    if (phys[addr] != PHYSICAL_ADDR_INVALID) {
+        mark(phys[addr], addr, false);
+        phys[addr] = PHYSICAL_ADDR_INVALID;
+    }
+}
+
+void Topology::clear() {
+    std::lock_guard<std::mutex> guard(lock);
+    for (int i=0; i<16; i++) {
+        phys[i] = PHYSICAL_ADDR_INVALID;
+    }
+    std::fill(subtree.begin(), subtree.end(), 0);
+    std::fill(seen.begin(), seen.end(), false);
+}
+
+bool Topology::physical_address(cec_logical_address addr, uint16_t * pa) {
+    if (!valid_addr(addr)) {
+        return false;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    *pa = phys[addr];
+    return *pa != PHYSICAL_ADDR_INVALID;
+}
+
+cec_logical_address Topology::device_at(uint16_t pa) {
+    if (!valid(pa)) {
+        return CECDEVICE_UNKNOWN;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    uint16_t mask = subtree[pa];
+    for (int i=CECDEVICE_TV; i<CECDEVICE_BROADCAST; i++) {
+        if ((mask & (1 << i)) && phys[i] == pa) {
+            return (cec_logical_address)i;
+        }
+    }
+    return CECDEVICE_UNKNOWN;
+}
+
+uint16_t Topology::devices_behind(uint16_t pa) {
+    if (!valid(pa)) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    return subtree[pa];
+}
+
+int Topology::children(uint16_t pa, uint16_t out[15]) {
+    int d = depth(pa);
+    if (!valid(pa) || d == 4) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    int count = 0;
+    int shift = 12 - 4 * d;
+    for (int port=1; port<16; port++) {
+        uint16_t child = pa | (uint16_t)(port << shift);
+        if (subtree[child] || seen[child]) {
+            out[count++] = child;
+        }
+    }
+    return count;
+}
+
+void Topology::snapshot(uint16_t out[16]) {
+    std::lock_guard<std::mutex> guard(lock);
+    for (int i=0; i<16; i++) {
+        out[i] = phys[i];
+    }
+}
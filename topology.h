@@ -0,0 +1,85 @@
+/* topology.h
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * HDMI topology index keyed by physical address
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#ifndef CEC_TOPOLOGY_H
+#define CEC_TOPOLOGY_H
+
+#include <mutex>
+#include <vector>
+
+#include <libcec/cec.h>
+
+#define PHYSICAL_ADDR_INVALID 0xFFFF
+
+// A physical address a.b.c.d names a node in a 4 level, 16 way tree. The
+// root 0.0.0.0 is the TV, and each non-zero nibble is the input port taken
+// at that level. Every node keeps a mask of the logical addresses at or
+// below it, so all lookups are a fixed number of array accesses.
+class Topology {
+    public:
+        Topology();
+
+        // update from a frame seen on the bus
+        void observe(const CEC::cec_command & cmd);
+        // record a logical address at a physical address, moving it if needed
+        void set_physical_address(CEC::cec_logical_address addr, uint16_t pa);
+        // forget a device that left the bus
+        void remove(CEC::cec_logical_address addr);
+        // forget everything, when the adapter is closed or reopened
+        void clear();
+
+        // returns false if the physical address of addr is unknown
+        bool physical_address(CEC::cec_logical_address addr, uint16_t * pa);
+        // lowest logical address at exactly pa, or CECDEVICE_UNKNOWN
+        CEC::cec_logical_address device_at(uint16_t pa);
+        // mask of logical addresses at or below pa
+        uint16_t devices_behind(uint16_t pa);
+        // occupied child nodes of pa, returns the number written to out
+        int children(uint16_t pa, uint16_t out[15]);
+        // physical address of each known logical address, PHYSICAL_ADDR_INVALID
+        // if unknown
+        void snapshot(uint16_t out[16]);
+
+        // well formed: no non-zero nibble follows a zero nibble
+        static bool valid(uint16_t pa);
+        // number of non-zero nibbles
+        static int depth(uint16_t pa);
+        // returns false for the root
+        static bool parent(uint16_t pa, uint16_t * out);
+        // input ports from the root down, returns the number written to ports
+        static int port_path(uint16_t pa, uint8_t ports[4]);
+
+    private:
+        void mark(uint16_t pa, CEC::cec_logical_address addr, bool set);
+        void mark_seen(uint16_t pa);
+
+        std::mutex lock;
+        uint16_t phys[16];
+        // logical address masks of each subtree, indexed by physical address
+        std::vector<uint16_t> subtree;
+        // nodes named in routing frames, which may have no logical address
+        std::vector<bool> seen;
+};
+
+#endif
@@ -0,0 +1,118 @@
+/* vendor.cpp
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Compile time table of known CEC vendor IDs
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#include <stddef.h>
+
+#include "vendor.h"
+
+namespace {
+
+struct Vendor {
+    uint32_t id;
+    const char * name;
+};
+
+// Same set as libcec's cec_vendor_id
+constexpr Vendor vendors[] = {
+    { 0x000039, "Toshiba" },
+    { 0x0000F0, "Samsung" },
+    { 0x0005CD, "Denon" },
+    { 0x000678, "Marantz" },
+    { 0x000982, "Loewe" },
+    { 0x0009B0, "Onkyo" },
+    { 0x000CB8, "Medion" },
+    { 0x000CE7, "Toshiba" },
+    { 0x0010FA, "Apple" },
+    { 0x001582, "Pulse Eight" },
+    { 0x001950, "Harman/Kardon" },
+    { 0x001A11, "Google" },
+    { 0x0020C7, "Akai" },
+    { 0x002467, "AOC" },
+    { 0x008045, "Panasonic" },
+    { 0x00903E, "Philips" },
+    { 0x009053, "Daewoo" },
+    { 0x00A0DE, "Yamaha" },
+    { 0x00D0D5, "Grundig" },
+    { 0x00E036, "Pioneer" },
+    { 0x00E091, "LG" },
+    { 0x08001F, "Sharp" },
+    { 0x080046, "Sony" },
+    { 0x18C086, "Broadcom" },
+    { 0x534850, "Sharp" },
+    { 0x6B746D, "Vizio" },
+    { 0x8065E9, "BenQ" },
+    { 0x9C645E, "Harman/Kardon" },
+};
+
+constexpr int vendor_count = sizeof(vendors) / sizeof(vendors[0]);
+
+// Multiplicative hash into 64 slots. The multiplier was found by search so
+// that every ID above lands in its own slot; the static_assert below fails
+// the build if an edit to the table introduces a collision.
+constexpr int slot_bits = 6;
+constexpr int slot_count = 1 << slot_bits;
+constexpr uint32_t multiplier = 0x8B4BD;
+
+constexpr int slot(uint32_t id) {
+    return (int)((uint32_t)(id * multiplier) >> (32 - slot_bits));
+}
+
+struct Index {
+    int8_t entry[slot_count];
+};
+
+constexpr Index make_index() {
+    Index index = {};
+    for (int i=0; i<slot_count; i++) {
+        index.entry[i] = -1;
+    }
+    for (int i=0; i<vendor_count; i++) {
+        index.entry[slot(vendors[i].id)] = (int8_t)i;
+    }
+    return index;
+}
+
+constexpr Index vendor_index = make_index();
+
+constexpr bool perfect() {
+    for (int i=0; i<vendor_count; i++) {
+        if (vendor_index.entry[slot(vendors[i].id)] != i) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(vendor_count < 128, "vendor table too large for the index");
+static_assert(perfect(), "vendor hash has collisions, choose a new multiplier");
+
+}
+
+const char * vendor_name(uint32_t id) {
+    int entry = vendor_index.entry[slot(id)];
+    if (entry < 0 || vendors[entry].id != id) {
+        return NULL;
+    }
+    return vendors[entry].name;
+}
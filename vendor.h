@@ -0,0 +1,33 @@
+/* vendor.h
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * CEC vendor ID lookup
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#ifndef CEC_VENDOR_H
+#define CEC_VENDOR_H
+
+#include <stdint.h>
+
+// Manufacturer name of a 24 bit IEEE OUI vendor ID, or NULL if unknown
+const char * vendor_name(uint32_t id);
+
+#endif
@@ -0,0 +1,132 @@
+/* volume.cpp
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Closed loop volume control
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#include <stdlib.h>
+
+#include "adapter.h"
+#include "state.h"
+#include "volume.h"
+
+using namespace CEC;
+
+#if CEC_LIB_VERSION_MAJOR > 1
+
+// distance from the target, in steps, beyond which the key is held
+#define VOLUME_HOLD_THRESHOLD 4
+// seconds between repeats of a held key, within the 200-500ms CEC allows
+#define VOLUME_REPEAT_INTERVAL 0.2
+// steps in a row without the volume moving before giving up
+#define VOLUME_STALL_STEPS 3
+
+static bool known(uint8_t status) {
+    return (status & AUDIO_VOLUME_MASK) <= 100;
+}
+
+// Hold key until the volume is predicted to reach level by the time the
+// release takes effect. Returns the status after the release.
+static uint8_t hold_volume_key(ICECAdapter * cec, cec_user_control_code key,
+        int volume, int level, double deadline, unsigned & steps) {
+    int direction = key == CEC_USER_CONTROL_CODE_VOLUME_UP ? 1 : -1;
+    double pressed = monotonic_time();
+    double repeated = pressed;
+    cec->SendKeypress(CECDEVICE_AUDIOSYSTEM, key, false);
+    steps++;
+    while (true) {
+        double asked = monotonic_time();
+        uint8_t status = cec->AudioStatus();
+        double now = monotonic_time();
+        if (!known(status)) {
+            break;
+        }
+        int current = status & AUDIO_VOLUME_MASK;
+        int remaining = (level - current) * direction;
+        // the volume keeps moving for about as long as a status query takes
+        double rate = (current - volume) * direction / (now - pressed);
+        if (remaining <= rate * (now - asked) + 1 || now >= deadline) {
+            break;
+        }
+        if (now - repeated >= VOLUME_REPEAT_INTERVAL) {
+            cec->SendKeypress(CECDEVICE_AUDIOSYSTEM, key, false);
+            repeated = now;
+            steps++;
+        }
+    }
+    cec->SendKeyRelease(CECDEVICE_AUDIOSYSTEM, false);
+    return cec->AudioStatus();
+}
+
+bool drive_volume(Adapter * adapter, int level, bool unmute, double timeout,
+        VolumeResult & result) {
+    ICECAdapter * cec = adapter->adapter;
+    double start = monotonic_time();
+    double deadline = start + timeout;
+    result.reached = false;
+    result.steps = 0;
+
+    uint8_t status = cec->AudioStatus();
+    if (unmute && known(status) && (status & AUDIO_MUTE_MASK)) {
+        status = cec->AudioToggleMute();
+        if (!known(status)) {
+            status = cec->AudioStatus();
+        }
+    }
+
+    unsigned stalled = 0;
+    while (known(status)) {
+        int volume = status & AUDIO_VOLUME_MASK;
+        int diff = level - volume;
+        if (diff == 0) {
+            result.reached = true;
+            break;
+        }
+        if (monotonic_time() >= deadline || stalled >= VOLUME_STALL_STEPS) {
+            break;
+        }
+        cec_user_control_code key = diff > 0 ? CEC_USER_CONTROL_CODE_VOLUME_UP :
+            CEC_USER_CONTROL_CODE_VOLUME_DOWN;
+        uint8_t next;
+        if (abs(diff) > VOLUME_HOLD_THRESHOLD) {
+            next = hold_volume_key(cec, key, volume, level, deadline, result.steps);
+        } else {
+            // libcec returns the status reported after the key
+            next = diff > 0 ? cec->VolumeUp(true) : cec->VolumeDown(true);
+            result.steps++;
+            if (!known(next)) {
+                next = cec->AudioStatus();
+            }
+        }
+        if (known(next) && (next & AUDIO_VOLUME_MASK) == volume) {
+            stalled++;
+        } else {
+            stalled = 0;
+        }
+        status = next;
+    }
+
+    result.status = status;
+    result.elapsed = monotonic_time() - start;
+    return known(status);
+}
+
+#endif
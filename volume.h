@@ -0,0 +1,56 @@
+/* volume.h
+ *
+ * Copyright (C) 2024 retsyx <retsyx@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Closed loop volume control
+ *
+ * Author: retsyx <retsyx@gmail.com>
+ */
+
+#ifndef CEC_VOLUME_H
+#define CEC_VOLUME_H
+
+#include <stdint.h>
+
+#include <libcec/cec.h>
+
+struct Adapter;
+
+// an audio status byte: volume in the low 7 bits, mute in the top bit
+#define AUDIO_VOLUME_MASK    0x7F
+#define AUDIO_MUTE_MASK      0x80
+#define AUDIO_VOLUME_UNKNOWN 0x7F
+
+struct VolumeResult {
+    uint8_t status;  // the last audio status reported
+    bool reached;
+    unsigned steps;  // volume keys sent
+    double elapsed;
+};
+
+// Drive the audio system's volume to level, 0-100, using its reported audio
+// status as feedback. Far from the target the volume key is held, with
+// repeats, and released ahead of the target as predicted from the rate the
+// volume moved at; the remainder is stepped one key at a time. If unmute is
+// set a muted system is unmuted first. Gives up after timeout seconds, or
+// when the volume stops responding. Returns false if the audio system
+// doesn't report its status. Called without the GIL.
+bool drive_volume(Adapter * adapter, int level, bool unmute, double timeout,
+        VolumeResult & result);
+
+#endif